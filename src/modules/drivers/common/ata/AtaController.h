@@ -26,10 +26,14 @@
 #include <utilities/RequestQueue.h>
 #include <machine/IrqHandler.h>
 #include <Log.h>
+#include "AtaDisk.h"
 
 #define ATA_CMD_READ  0
 #define ATA_CMD_WRITE 1
 
+/// Adjacent asynchronous reads are merged into transfers of up to this many bytes.
+#define ATA_MAX_MERGED_READ 262144
+
 /** Base class for an ATA controller. */
 class AtaController : public Controller, public RequestQueue, public IrqHandler
 {
@@ -68,6 +72,52 @@ private:
     void operator =(const AtaController&);
 
 protected:
+    /** Sorts requests into one-way elevator order: ascending location from
+        where the last request left their disk's head, then wrapping around. */
+    virtual bool compareRequests(Request *pA, Request *pB)
+    {
+        bool bAWrapped = pA->p3 < reinterpret_cast<AtaDisk*>(pA->p2)->getHeadPosition();
+        bool bBWrapped = pB->p3 < reinterpret_cast<AtaDisk*>(pB->p2)->getHeadPosition();
+        if (bAWrapped != bBWrapped)
+            return bBWrapped;
+        return pA->p3 < pB->p3;
+    }
+
+    /** Merges asynchronous reads (p3 = location, p4 = length) of the same
+        disk that overlap or are adjacent. */
+    virtual bool mergeRequests(Request *pQueued, Request *pNew)
+    {
+        if (pQueued->p1 != ATA_CMD_READ || pNew->p1 != ATA_CMD_READ)
+            return false;
+        if (pQueued->p2 != pNew->p2 || !pQueued->p4 || !pNew->p4)
+            return false;
+
+        uint64_t queuedEnd = pQueued->p3 + pQueued->p4;
+        uint64_t newEnd = pNew->p3 + pNew->p4;
+
+        // Already covered?
+        if (pNew->p3 >= pQueued->p3 && newEnd <= queuedEnd)
+            return true;
+
+        if (pNew->p3 != queuedEnd && newEnd != pQueued->p3)
+            return false;
+        if (pQueued->p4 + pNew->p4 > ATA_MAX_MERGED_READ)
+            return false;
+
+        if (pNew->p3 < pQueued->p3)
+            pQueued->p3 = pNew->p3;
+        pQueued->p4 += pNew->p4;
+        return true;
+    }
+
+    /** Records where a request leaves the disk's head, for the elevator. */
+    void setHeadPosition(AtaDisk *pDisk, uint64_t location)
+    {
+        m_RequestQueueMutex.acquire();
+        pDisk->setHeadPosition(location);
+        m_RequestQueueMutex.release();
+    }
+
     int m_nController;
 };
 
@@ -30,11 +30,16 @@
 // Note the IrqReceived mutex is deliberately started in the locked state.
 AtaDisk::AtaDisk(AtaController *pDev, bool isMaster, IoBase *commandRegs, IoBase *controlRegs, BusMasterIde *busMaster) :
         Disk(), m_IsMaster(isMaster), m_SupportsLBA28(true), m_SupportsLBA48(false),
+        m_nSectors(0), m_StreamClock(0), m_StreamLock(), m_HeadPosition(0), m_Stats(), m_StatsLock(),
         m_IrqReceived(true), m_Cache(), m_nAlignPoints(0), m_CommandRegs(commandRegs),
         m_ControlRegs(controlRegs), m_BusMaster(busMaster), m_PrdTableLock(false), m_PrdTable(0),
         m_LastPrdTableOffset(0), m_PrdTablePhys(0), m_PrdTableMemRegion("ata-prdtable"), m_bDma(true)
 {
     m_pParent = pDev;
+    m_Cache.setCallback(cacheCallback, reinterpret_cast<void*>(this));
+
+    memset(m_Streams, 0, sizeof(m_Streams));
+    memset(&m_Stats, 0, sizeof(m_Stats));
 }
 
 AtaDisk::~AtaDisk()
@@ -192,6 +197,20 @@ bool AtaDisk::initialise()
         m_SupportsLBA48 = true;
     }
 
+    // How big is the disk? Readahead mustn't run off the end.
+    if (m_SupportsLBA48)
+    {
+        m_nSectors = static_cast<uint64_t>(LITTLE_TO_HOST16(m_pIdent[100])) |
+                     (static_cast<uint64_t>(LITTLE_TO_HOST16(m_pIdent[101])) << 16) |
+                     (static_cast<uint64_t>(LITTLE_TO_HOST16(m_pIdent[102])) << 32) |
+                     (static_cast<uint64_t>(LITTLE_TO_HOST16(m_pIdent[103])) << 48);
+    }
+    else
+    {
+        m_nSectors = static_cast<uint64_t>(LITTLE_TO_HOST16(m_pIdent[60])) |
+                     (static_cast<uint64_t>(LITTLE_TO_HOST16(m_pIdent[61])) << 16);
+    }
+
 
     // Any form of DMA support?
     if(!(m_pIdent[49] & (1 << 8)))
@@ -209,6 +228,18 @@ bool AtaDisk::initialise()
     return true;
 }
 
+ssize_t AtaDisk::pageOffset(uint64_t location)
+{
+    // Look through the align points.
+    uint64_t alignPoint = 0;
+    for (size_t i = 0; i < m_nAlignPoints; i++)
+        if (m_AlignPoints[i] <= location && m_AlignPoints[i] > alignPoint)
+            alignPoint = m_AlignPoints[i];
+
+    // Calculate the offset to get location on a page boundary.
+    return -((location - alignPoint) % 4096);
+}
+
 uintptr_t AtaDisk::read(uint64_t location)
 {
     if (location % 512)
@@ -219,38 +250,43 @@ uintptr_t AtaDisk::read(uint64_t location)
     // Grab our parent.
     AtaController *pParent = static_cast<AtaController*> (m_pParent);
 
-    // Look through the align points.
-    uint64_t alignPoint = 0;
-    for (size_t i = 0; i < m_nAlignPoints; i++)
-        if (m_AlignPoints[i] <= location && m_AlignPoints[i] > alignPoint)
-            alignPoint = m_AlignPoints[i];
+    ssize_t offs = pageOffset(location);
 
-    // Calculate the offset to get location on a page boundary.
-    ssize_t offs =  -((location - alignPoint) % 4096);
+    // Keep any sequential stream this is part of ahead of the reader.
+    readahead(location+offs);
 
     // Create room in the cache.
     uintptr_t buffer;
     if ( (buffer=m_Cache.lookup(location+offs)) )
     {
+        LockGuard<Spinlock> guard(m_StatsLock);
+        m_Stats.nCacheHits++;
         return buffer-offs;
     }
 
-#if 0
     Timer &timer = *Machine::instance().getTimer();
-    uint64_t now = timer.getTickCount();
-    NOTICE("Started read request at " << Dec << now << Hex);
-#endif
+    uint64_t start = timer.getTickCount();
+    size_t queueDepth = pParent->getQueueDepth();
 
     pParent->addRequest(0, ATA_CMD_READ, reinterpret_cast<uint64_t> (this), location+offs);
 
-#if 0
-    uint64_t end = timer.getTickCount();
-    NOTICE("Ended read request at " << Dec << end << " [" << (end - now) << " seconds]");
-#endif
+    recordRequest(false, start, queueDepth);
 
-    /// \todo Add speculative loading here.
+    // doRead leaves the pages it reads unpinned, so under memory pressure
+    // the page may already be gone again.
+    if ( !(buffer=m_Cache.lookup(location+offs)) )
+    {
+        pParent->addRequest(0, ATA_CMD_READ, reinterpret_cast<uint64_t> (this), location+offs);
+        if ( !(buffer=m_Cache.lookup(location+offs)) )
+            return 0;
+    }
+
+    return buffer - offs;
+}
 
-    return m_Cache.lookup(location+offs) - offs;
+void AtaDisk::unpin(uint64_t location)
+{
+    m_Cache.release(location + pageOffset(location));
 }
 
 void AtaDisk::write(uint64_t location)
@@ -258,24 +294,11 @@ void AtaDisk::write(uint64_t location)
     if (location % 512)
         FATAL("AtaDisk: write request not on a sector boundary!");
 
-    // Grab our parent.
-    AtaController *pParent = static_cast<AtaController*> (m_pParent);
-
-    // Look through the align points.
-    uint64_t alignPoint = 0;
-    for (size_t i = 0; i < m_nAlignPoints; i++)
-        if (m_AlignPoints[i] < location && m_AlignPoints[i] > alignPoint)
-            alignPoint = m_AlignPoints[i];
+    ssize_t offs = pageOffset(location);
 
-    // Calculate the offset to get location on a page boundary.
-    ssize_t offs =  -((location - alignPoint) % 4096);
-
-    // Find the cache page.
-    uintptr_t buffer;
-    if ( !(buffer=m_Cache.lookup(location+offs)) )
-        return;
-
-    pParent->addRequest(1, ATA_CMD_WRITE, reinterpret_cast<uint64_t> (this), location+offs);
+    // The cache writes the page back through cacheCallback: periodically,
+    // when memory runs short, or on flush(). It won't be evicted before.
+    m_Cache.markDirty(location+offs);
 }
 
 void AtaDisk::align(uint64_t location)
@@ -294,27 +317,192 @@ void AtaDisk::flush(uint64_t location)
         return;
 
     doWrite(location);
+
+    m_Cache.release(location);
 }
 
-uint64_t AtaDisk::doRead(uint64_t location)
+void AtaDisk::cacheCallback(uintptr_t key, uintptr_t location, void *meta)
 {
+    AtaDisk *pDisk = reinterpret_cast<AtaDisk*>(meta);
+    AtaController *pParent = static_cast<AtaController*> (pDisk->m_pParent);
+
+    uint64_t start = Machine::instance().getTimer()->getTickCount();
+    size_t queueDepth = pParent->getQueueDepth();
+
+    // The cache has the page pinned until we return.
+    pParent->addRequest(1, ATA_CMD_WRITE, reinterpret_cast<uint64_t> (pDisk), key);
+
+    pDisk->recordRequest(true, start, queueDepth);
+}
+
+void AtaDisk::readahead(uint64_t location)
+{
+    uint64_t window = location & ~static_cast<uint64_t>(ATA_READ_WINDOW - 1);
+    uint64_t issueFrom, issueTo;
+
+    {
+        LockGuard<Spinlock> guard(m_StreamLock);
+        m_StreamClock++;
+
+        // Does this carry on from (or stay within) the last window of a stream?
+        ReadStream *pStream = 0, *pVictim = &m_Streams[0];
+        for (size_t i = 0; i < ATA_READAHEAD_STREAMS; i++)
+        {
+            ReadStream &stream = m_Streams[i];
+            if (stream.bValid &&
+                (window == stream.lastWindow || window == stream.lastWindow + ATA_READ_WINDOW))
+            {
+                pStream = &stream;
+                break;
+            }
+
+            if (!stream.bValid || (pVictim->bValid && stream.lastUsed < pVictim->lastUsed))
+                pVictim = &stream;
+        }
+
+        if (!pStream)
+        {
+            // Could be the start of a new stream - nothing to read ahead yet.
+            pVictim->bValid = true;
+            pVictim->lastWindow = window;
+            pVictim->issuedTo = window + ATA_READ_WINDOW;
+            pVictim->nWindows = 1;
+            pVictim->lastUsed = m_StreamClock;
+            return;
+        }
+
+        pStream->lastUsed = m_StreamClock;
+        if (window == pStream->lastWindow)
+            return;
+
+        // Sequential - read further ahead the longer the stream goes on.
+        pStream->lastWindow = window;
+        if (pStream->nWindows < ATA_READAHEAD_MAX)
+            pStream->nWindows *= 2;
+
+        issueFrom = pStream->issuedTo;
+        if (issueFrom < window + ATA_READ_WINDOW)
+            issueFrom = window + ATA_READ_WINDOW;
+        issueTo = window + (pStream->nWindows + 1) * ATA_READ_WINDOW;
+        if (m_nSectors && issueTo > m_nSectors * 512)
+            issueTo = m_nSectors * 512 & ~static_cast<uint64_t>(ATA_READ_WINDOW - 1);
+        if (issueTo <= issueFrom)
+            return;
+        pStream->issuedTo = issueTo;
+    }
+
+    // Queue the reads. They're merged into larger transfers by the controller,
+    // and never make us wait: if the queue is busy, don't bother.
+    AtaController *pParent = static_cast<AtaController*> (m_pParent);
+    for (uint64_t w = issueFrom; w < issueTo; w += ATA_READ_WINDOW)
+    {
+        if (pParent->getQueueDepth() >= REQUEST_QUEUE_MAX_QUEUE_SZ / 2)
+            break;
+        if (m_Cache.exists(w, ATA_READ_WINDOW))
+            continue;
+
+        pParent->addAsyncRequest(2, ATA_CMD_READ, reinterpret_cast<uint64_t> (this), w, ATA_READ_WINDOW);
+
+        LockGuard<Spinlock> guard(m_StatsLock);
+        m_Stats.nReadahead++;
+    }
+}
+
+void AtaDisk::recordRequest(bool bWrite, uint64_t startTime, size_t queueDepth)
+{
+    uint64_t latency = Machine::instance().getTimer()->getTickCount() - startTime;
+
+    LockGuard<Spinlock> guard(m_StatsLock);
+    if (bWrite)
+    {
+        m_Stats.nWrites++;
+        m_Stats.writeLatency += latency;
+        if (latency > m_Stats.maxWriteLatency)
+            m_Stats.maxWriteLatency = latency;
+    }
+    else
+    {
+        m_Stats.nReads++;
+        m_Stats.readLatency += latency;
+        if (latency > m_Stats.maxReadLatency)
+            m_Stats.maxReadLatency = latency;
+    }
+
+    m_Stats.nQueueSamples++;
+    m_Stats.totalQueueDepth += queueDepth;
+    if (queueDepth > m_Stats.maxQueueDepth)
+        m_Stats.maxQueueDepth = queueDepth;
+}
+
+AtaDisk::Statistics AtaDisk::getStatistics()
+{
+    LockGuard<Spinlock> guard(m_StatsLock);
+    return m_Stats;
+}
+
+uint64_t AtaDisk::doRead(uint64_t location, uint64_t nBytes)
+{
+    if (nBytes)
+    {
+        // Readahead: read each run of windows that isn't cached yet. Some may
+        // have been read on demand while this request was waiting.
+        uint64_t end = location + nBytes;
+        while (location < end)
+        {
+            while (location < end && m_Cache.exists(location, ATA_READ_WINDOW))
+                location += ATA_READ_WINDOW;
+
+            uint64_t runEnd = location;
+            while (runEnd < end && !m_Cache.exists(runEnd, ATA_READ_WINDOW))
+                runEnd += ATA_READ_WINDOW;
+
+            if (runEnd > location)
+                internalRead(location, runEnd - location);
+            location = runEnd;
+        }
+        return 0;
+    }
+
     // Handle the case where a read took place while we were waiting in the
     // RequestQueue - don't double up the cache.
-    size_t nBytes = 65536;
+    nBytes = ATA_READ_WINDOW;
     uint64_t oldLocation = location;
     location &= ~(nBytes - 1);
-    uintptr_t buffer = m_Cache.lookup(location);
-    if(buffer)
+    if(m_Cache.exists(location, nBytes))
     {
-        WARNING("AtaDisk::doRead(" << oldLocation << ") - buffer was already in cache");
-        return 0;
+        // Part of the window is still cached while the rest was evicted,
+        // so fall back to reading just the requested page.
+        if(m_Cache.exists(oldLocation))
+            return 0;
+        location = oldLocation;
+        nBytes = 4096;
     }
-    buffer = m_Cache.insert(location, nBytes);
+
+    return internalRead(location, nBytes);
+}
+
+uint64_t AtaDisk::internalRead(uint64_t location, size_t nBytes)
+{
+    uintptr_t buffer = m_Cache.insert(location, nBytes);
     if(!buffer)
     {
         FATAL("AtaDisk::doRead - no buffer");
     }
 
+    // The pages stay pinned while the disk writes into them, or they could
+    // be evicted and their frames handed to someone else mid-transfer.
+    uint64_t ret = readSectors(location, buffer, nBytes);
+
+    // Nobody holds these pages now: read() pins the one it was asked for,
+    // the rest are evictable until someone looks them up.
+    for(size_t page = 0; page < nBytes; page += 4096)
+        m_Cache.release(location + page);
+
+    return ret;
+}
+
+uint64_t AtaDisk::readSectors(uint64_t location, uintptr_t buffer, size_t nBytes)
+{
     // Grab our parent.
     AtaController *pParent = static_cast<AtaController*> (m_pParent);
 
@@ -494,6 +682,10 @@ uint64_t AtaDisk::doRead(uint64_t location)
                     *pTarget++ = commandRegs->read16(0);
             }
         }
+
+        // Move on to the next chunk.
+        location += nSectorsToRead * 512;
+        buffer += nSectorsToRead * 512;
     }
     return 0;
 }
@@ -508,7 +700,10 @@ uint64_t AtaDisk::doWrite(uint64_t location)
     return 0;
 #endif
 
+    // Whoever queued the write holds a reference to the page until it is
+    // complete, so there's no need to hold another.
     uintptr_t buffer = m_Cache.lookup(location);
+    m_Cache.release(location);
 
     uintptr_t nBytes = 4096;
 
@@ -26,6 +26,15 @@
 #include <processor/PhysicalMemoryManager.h>
 #include "BusMasterIde.h"
 
+/// Size of the block read from the disk on a cache miss.
+#define ATA_READ_WINDOW 65536
+
+/// Number of sequential read streams tracked per disk for readahead.
+#define ATA_READAHEAD_STREAMS 4
+
+/// Maximum number of windows read ahead of a sequential stream.
+#define ATA_READAHEAD_MAX 8
+
 /** An ATA disk device. Most read/write commands get channeled upstream
  * to the controller, as it has to multiplex between multiple disks. */
 class AtaDisk : public Disk
@@ -50,8 +59,13 @@ public:
 
     virtual void flush(uint64_t location);
 
+    virtual void unpin(uint64_t location);
+
     // These are the internal functions that the controller calls when it is ready to process our request.
-    virtual uint64_t doRead(uint64_t location);
+    /** Reads into the cache. If nBytes is zero, reads the window containing
+        location; otherwise reads whatever isn't already cached of the given
+        window-aligned range (readahead). */
+    virtual uint64_t doRead(uint64_t location, uint64_t nBytes = 0);
     virtual uint64_t doWrite(uint64_t location);
 
     // Internal write function, actually writes to the disk
@@ -67,7 +81,73 @@ public:
       return false;
     }
 
+    /** I/O statistics. Latencies are in Timer::getTickCount units, and
+        queue depths are sampled whenever a request is made. */
+    struct Statistics
+    {
+        size_t nReads;            ///< Reads that had to wait for the disk
+        size_t nCacheHits;        ///< Reads satisfied from the cache
+        size_t nWrites;
+        size_t nReadahead;        ///< Readahead windows requested
+        uint64_t readLatency;     ///< Total time spent waiting for reads
+        uint64_t maxReadLatency;
+        uint64_t writeLatency;    ///< Total time spent waiting for writes
+        uint64_t maxWriteLatency;
+        size_t nQueueSamples;
+        size_t totalQueueDepth;
+        size_t maxQueueDepth;
+    };
+
+    Statistics getStatistics();
+
+    /** Where the last request passed to this disk left its head, for the
+        controller's elevator.
+        \note The controller's request queue must be locked. */
+    uint64_t getHeadPosition()
+    {
+        return m_HeadPosition;
+    }
+    void setHeadPosition(uint64_t location)
+    {
+        m_HeadPosition = location;
+    }
+
 private:
+    /** Returns the (non-positive) offset from \p location to the start of
+        its cache page, taking align points into account. */
+    ssize_t pageOffset(uint64_t location);
+
+    /** Cache writeback callback: writes a dirty page to the disk. */
+    static void cacheCallback(uintptr_t key, uintptr_t location, void *meta);
+
+    /** Reads nBytes at location into a new cache block. */
+    uint64_t internalRead(uint64_t location, size_t nBytes);
+
+    /** Transfers nBytes at location from the disk into buffer, which the
+        caller keeps pinned until this returns. */
+    uint64_t readSectors(uint64_t location, uintptr_t buffer, size_t nBytes);
+
+    /** Notes a read of the given location, and if it continues a sequential
+        stream, queues reads of the windows ahead of it. */
+    void readahead(uint64_t location);
+
+    /** Records a request's latency and the queue depth it saw. */
+    void recordRequest(bool bWrite, uint64_t startTime, size_t queueDepth);
+
+    /** A run of sequential reads. */
+    struct ReadStream
+    {
+        bool bValid;
+        /** The window last read. */
+        uint64_t lastWindow;
+        /** Readahead has been requested up to here. */
+        uint64_t issuedTo;
+        /** How many windows to keep ahead - doubles as the stream continues. */
+        size_t nWindows;
+        /** For replacing the least recently used stream. */
+        size_t lastUsed;
+    };
+
     /** Sets the drive up for reading from address 'n' in LBA28 mode. */
     void setupLBA28(uint64_t n, uint32_t nSectors);
     /** Sets the drive up for reading from address 'n' in LBA48 mode. */
@@ -88,6 +168,18 @@ private:
     bool m_SupportsLBA28;
     /** Does the device support LBA48? */
     bool m_SupportsLBA48;
+    /** Number of sectors on the device. */
+    uint64_t m_nSectors;
+
+    ReadStream m_Streams[ATA_READAHEAD_STREAMS];
+    size_t m_StreamClock;
+    Spinlock m_StreamLock;
+
+    /** Location of the last request passed to this disk. */
+    uint64_t m_HeadPosition;
+
+    Statistics m_Stats;
+    Spinlock m_StatsLock;
 
     /** This mutex is released by the IRQ handler when an IRQ is received, to wake the working thread.
      * \todo A condvar would really be better here. */
@@ -313,7 +313,7 @@ bool AtapiDisk::initialise()
   return true;
 }
 
-uint64_t AtapiDisk::doRead(uint64_t location)
+uint64_t AtapiDisk::doRead(uint64_t location, uint64_t nBytes)
 {
     size_t off = location & 0xFFF;
     location &= ~0xFFF;
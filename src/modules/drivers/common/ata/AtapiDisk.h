@@ -99,7 +99,7 @@ public:
   bool initialise();
 
   // These are the internal functions that the controller calls when it is ready to process our request.
-  virtual uint64_t doRead(uint64_t location);
+  virtual uint64_t doRead(uint64_t location, uint64_t nBytes = 0);
   virtual uint64_t doRead2(uint64_t location, uintptr_t buffer, size_t buffSize);
   virtual uint64_t doWrite(uint64_t location);
 
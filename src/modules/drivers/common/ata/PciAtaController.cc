@@ -247,8 +247,9 @@ uint64_t PciAtaController::executeRequest(uint64_t p1, uint64_t p2, uint64_t p3,
                                           uint64_t p5, uint64_t p6, uint64_t p7, uint64_t p8)
 {
   AtaDisk *pDisk = reinterpret_cast<AtaDisk*> (p2);
+  setHeadPosition(pDisk, p3);
   if(p1 == ATA_CMD_READ)
-    return pDisk->doRead(p3);
+    return pDisk->doRead(p3, p4);
   else if(p1 == ATA_CMD_WRITE)
     return pDisk->doWrite(p3);
   else
@@ -29,8 +29,7 @@
 
 Dm9601::Dm9601(UsbDevice *pDev) :
             UsbDevice(pDev), ::Network(), m_pInEndpoint(0), m_pOutEndpoint(0),
-            m_TxLock(false), m_IncomingPackets(false), m_RxPacketQueue(),
-            m_RxPacketQueueLock(), m_TxPacket(0)
+            m_TxLock(false), m_TxPacket(0)
 {
 }
 
@@ -119,7 +118,6 @@ void Dm9601::initialiseDriver()
         delay(100);
     }
 
-    new Thread(Processor::information().getCurrentThread()->getParent(), trampoline, this);
     new Thread(Processor::information().getCurrentThread()->getParent(), recvTrampoline, this);
 
     NetworkStack::instance().registerDevice(this);
@@ -134,31 +132,6 @@ int Dm9601::recvTrampoline(void *p)
     return 0;
 }
 
-int Dm9601::trampoline(void *p)
-{
-    Dm9601 *pDm9601 = reinterpret_cast<Dm9601*>(p);
-    pDm9601->receiveThread();
-    return 0;
-}
-
-void Dm9601::receiveThread()
-{
-    while(true)
-    {
-        m_IncomingPackets.acquire();
-
-        m_RxPacketQueueLock.acquire();
-        Packet *pPacket = m_RxPacketQueue.popFront();
-        m_RxPacketQueueLock.release();
-
-        NetworkStack::instance().receive(pPacket->len, pPacket->buffer + pPacket->offset, this, 0);
-
-        delete pPacket;
-
-        NetworkStack::instance().getMemPool().free(pPacket->buffer);
-    }
-}
-
 void Dm9601::receiveLoop()
 {
     while(true)
@@ -238,16 +211,15 @@ void Dm9601::doReceive()
         return;
     }
 
-    Packet *pPacket = new Packet;
-    pPacket->buffer = buff;
-    pPacket->len = len;
-    pPacket->offset = 3;
-
-    m_RxPacketQueueLock.acquire();
-    m_RxPacketQueue.pushBack(pPacket);
-    m_RxPacketQueueLock.release();
+    // Strip the status header so the stack sees a plain ethernet frame, and
+    // hand the buffer straight over (the stack frees it when done).
+    memmove(pBuffer, &pBuffer[3], len);
 
-    m_IncomingPackets.release();
+    NetworkStack::Frame frame;
+    frame.buffer = buff;
+    frame.nBytes = len;
+    frame.offset = 0;
+    NetworkStack::instance().receive(this, &frame, 1, true);
 }
 
 bool Dm9601::setStationInfo(StationInfo info)
@@ -53,10 +53,6 @@ class Dm9601 : public UsbDevice, public Network
 
         static int recvTrampoline(void *p);
 
-        static int trampoline(void *p);
-
-        void receiveThread();
-
         void receiveLoop();
 
         void doReceive();
@@ -163,19 +159,6 @@ class Dm9601 : public UsbDevice, public Network
         /** Mutex to only allow one TX in progress at a time. */
         Mutex m_TxLock;
 
-        /** Number of packets in the queue */
-        Semaphore m_IncomingPackets;
-
-        /** Packet queue */
-        struct Packet
-        {
-            uintptr_t buffer;
-            size_t len;
-            uint32_t offset;
-        };
-        List<Packet*> m_RxPacketQueue;
-        Spinlock m_RxPacketQueueLock;
-
         /** Internal state: which TX packet are we on at the moment */
         size_t m_TxPacket;
 
@@ -27,7 +27,7 @@ Loopback Loopback::m_Instance;
 
 static uint8_t g_LocalIpv6[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
 
-Loopback::Loopback() : Network()
+Loopback::Loopback() : Network(), m_nLoss(0), m_nLossSeed(1)
 {
     setSpecificType(String("Loopback-card"));
     NetworkStack::instance().registerDevice(this);
@@ -41,7 +41,7 @@ Loopback::Loopback() : Network()
     m_StationInfo.nIpv6Addresses = 1;
 }
 
-Loopback::Loopback(Network* pDev) : Network(pDev)
+Loopback::Loopback(Network* pDev) : Network(pDev), m_nLoss(0), m_nLossSeed(1)
 {
     setSpecificType(String("Loopback-card"));
     NetworkStack::instance().registerDevice(this);
@@ -66,10 +66,33 @@ bool Loopback::send(size_t nBytes, uintptr_t buffer)
         ERROR("Loopback: Attempt to send a packet with size > 64 KB");
         return false;
     }
+
+    if(m_nLoss)
+    {
+        // A linear congruential generator is random enough to pick the
+        // packets to lose, and the same seed loses the same packets each run.
+        m_nLossSeed = m_nLossSeed * 1103515245 + 12345;
+        if(((m_nLossSeed >> 16) % 1000) < m_nLoss)
+        {
+            m_StationInfo.nDropped++;
+            return true;
+        }
+    }
+
     NetworkStack::instance().receive(nBytes, buffer, this, 0);
     return true;
 }
 
+bool Loopback::setPacketLoss(size_t nPerThousand)
+{
+    if(nPerThousand > 1000)
+        nPerThousand = 1000;
+
+    m_nLoss = nPerThousand;
+    m_nLossSeed = 1;
+    return true;
+}
+
 bool Loopback::setStationInfo(StationInfo info)
 {
     // Nothing here is modifiable
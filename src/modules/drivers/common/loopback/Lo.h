@@ -46,6 +46,8 @@ public:
 
   virtual bool send(size_t nBytes, uintptr_t buffer);
 
+  virtual bool setPacketLoss(size_t nPerThousand);
+
   virtual bool setStationInfo(StationInfo info);
 
   virtual StationInfo getStationInfo();
@@ -54,6 +56,12 @@ private:
 
   static Loopback m_Instance;
 
+  /** Packets in every thousand that send() drops */
+  size_t m_nLoss;
+
+  /** State for picking the packets to drop */
+  uint32_t m_nLossSeed;
+
   Loopback(const Loopback&);
   void operator =(const Loopback&);
 };
@@ -89,6 +89,16 @@ public:
     pParent->write(location+m_Start);
   }
 
+  virtual void unpin(uint64_t location)
+  {
+    if(location > m_Length)
+        return;
+    else if((location + 0x1000) > m_Length)
+        return;
+    Disk *pParent = static_cast<Disk*> (getParent());
+    pParent->unpin(location+m_Start);
+  }
+
   /** Returns the first byte of the parent disk that is in this partition. */
   uint64_t getStart();
 
@@ -24,7 +24,8 @@
 
 
 Rtl8139::Rtl8139(Network* pDev) :
-    Network(pDev), m_pBase(0), m_StationInfo(), m_RxCurr(0), m_TxCurr(0), m_RxLock(false), m_TxLock(), m_pRxBuffVirt(0), m_pTxBuffVirt(0),
+    Network(pDev), m_pBase(0), m_StationInfo(), m_RxCurr(0), m_TxCurr(0), m_RxLock(), m_TxLock(), m_pRxBuffVirt(0), m_pTxBuffVirt(0),
+    m_pRxScratch(new uint8_t[RTL_PACK_MAX]), m_bRxInterrupts(true),
     m_pRxBuffPhys(0), m_pTxBuffPhys(0), m_RxBuffMR("rtl8139-rxbuffer"), m_TxBuffMR("rtl8139-txbuffer")
 {
     setSpecificType(String("rtl8139-card"));
@@ -71,6 +72,7 @@ Rtl8139::Rtl8139(Network* pDev) :
 
 Rtl8139::~Rtl8139()
 {
+    delete [] m_pRxScratch;
 }
 
 void Rtl8139::reset()
@@ -123,9 +125,8 @@ void Rtl8139::reset()
     m_pBase->write8(RTL_CMD_RXEN | RTL_CMD_TXEN, RTL_CMD);
 
     // enable all good irqs
-    m_pBase->write16(RTL_IMR_RXOK | RTL_IMR_RXERR, RTL_IMR);
+    m_pBase->write16((m_bRxInterrupts ? RTL_IMR_RXOK : 0) | RTL_IMR_RXERR, RTL_IMR);
     m_pBase->write16(0xffff, RTL_ISR);
-    m_RxLock = false;
     NOTICE("RTL8139: Reset");
 }
 
@@ -154,53 +155,94 @@ bool Rtl8139::send(size_t nBytes, uintptr_t buffer)
     return true;
 }
 
-void Rtl8139::recv()
+size_t Rtl8139::recv(size_t nBudget)
 {
-    while(m_RxLock);
-    m_RxLock = true;
+    LockGuard<Spinlock> guard(m_RxLock);
 
-    // get the address of the start of the packet;
-    uintptr_t rxPacket = reinterpret_cast<uintptr_t>(m_pRxBuffVirt + m_RxCurr);
-    uint16_t status = *(reinterpret_cast<uint16_t *>(rxPacket));
-    // get the status and the lenght, both at the beginning of the packet
-    uint16_t length = *(reinterpret_cast<uint16_t *>(rxPacket+2));
+    NetworkStack::Frame frames[RTL8139_RX_BATCH];
+    size_t nFrames = 0;
+    size_t nReceived = 0;
 
-    // if bad packet, reset
-    if(!(status & RTL_RXSTS_RXOK) || (status & (RTL_RXSTS_ISE | RTL_RXSTS_CRC | RTL_RXSTS_FAE)) || (length >= RTL_PACK_MAX) || (length < RTL_PACK_MIN))
+    while(nReceived < nBudget && !(m_pBase->read8(RTL_CMD) & RTL_CMD_BUFE))
     {
-        WARNING("RTL8139: Bad packet: len: " << length << ", status: " << status << "!");
-        reset();
-        return;
-    }
-    // create packet buffer, needed later
-    uint8_t *packBuff = new uint8_t[length - 4];
+        // get the address of the start of the packet;
+        uintptr_t rxPacket = reinterpret_cast<uintptr_t>(m_pRxBuffVirt + m_RxCurr);
+        uint16_t status = *(reinterpret_cast<uint16_t *>(rxPacket));
+        // get the status and the lenght, both at the beginning of the packet
+        uint16_t length = *(reinterpret_cast<uint16_t *>(rxPacket+2));
+
+        // if bad packet, reset
+        if(!(status & RTL_RXSTS_RXOK) || (status & (RTL_RXSTS_ISE | RTL_RXSTS_CRC | RTL_RXSTS_FAE)) || (length >= RTL_PACK_MAX) || (length < RTL_PACK_MIN))
+        {
+            WARNING("RTL8139: Bad packet: len: " << length << ", status: " << status << "!");
+            flushRxBatch(frames, nFrames);
+            reset();
+            return nReceived;
+        }
 
-    // check if passing over the end of the buffer
-    if(m_RxCurr + length > RTL_BUFF_SIZE)
-    {
-        // copy first the part of the packet until the end of the buffer and then the rest of it, at the beginning of the buffer
-        uint32_t left = RTL_BUFF_SIZE - (m_RxCurr + 4);
-        memcpy(packBuff, reinterpret_cast<void *>(rxPacket + 4), left);
-        memcpy(&packBuff[left], m_pRxBuffVirt, length - 4 - left);
+        // check if passing over the end of the buffer
+        bool bWrapped = m_RxCurr + length + 4 > RTL_BUFF_SIZE;
+        if(bWrapped)
+        {
+            // everything before this packet has to go first
+            flushRxBatch(frames, nFrames);
+
+            // copy first the part of the packet until the end of the buffer and then the rest of it, at the beginning of the buffer
+            uint32_t left = RTL_BUFF_SIZE - (m_RxCurr + 4);
+            memcpy(m_pRxScratch, reinterpret_cast<void *>(rxPacket + 4), left);
+            memcpy(&m_pRxScratch[left], m_pRxBuffVirt, length - 4 - left);
+
+            frames[0].buffer = reinterpret_cast<uintptr_t>(m_pRxScratch);
+            frames[0].nBytes = length - 4;
+            frames[0].offset = 0;
+            nFrames = 1;
+        }
+        else
+        {
+            // the stack copies it out of the ring before we hand the space back
+            frames[nFrames].buffer = rxPacket + 4;
+            frames[nFrames].nBytes = length - 4;
+            frames[nFrames].offset = 0;
+            nFrames++;
+        }
 
-        // adjust current offset
-        m_RxCurr = (length - left + 3) & ~3;
-    }
-    else
-    {
-        // copy the packet
-        memcpy(packBuff, reinterpret_cast<void *>(rxPacket + 4), length-4);
+        // adjust current offset (it never should be over the buffer's size)
+        m_RxCurr = ((m_RxCurr + length + 4 + 3) & ~3) % RTL_BUFF_SIZE;
+        nReceived++;
 
-        // adjust current offset
-        m_RxCurr = (m_RxCurr + length + 4 + 3) & ~3;
+        // the scratch buffer is reused by the next wrapped packet
+        if(nFrames == RTL8139_RX_BATCH || bWrapped)
+            flushRxBatch(frames, nFrames);
     }
-    // adjust current offset (it never should be over the buffer's size)
-    m_RxCurr %= RTL_BUFF_SIZE;
 
-    // send the packet to the stack
-    NetworkStack::instance().receive(length-4, reinterpret_cast<uintptr_t>(packBuff), this, 0);
+    flushRxBatch(frames, nFrames);
+    return nReceived;
+}
+
+void Rtl8139::flushRxBatch(NetworkStack::Frame *pFrames, size_t &nFrames)
+{
+    if(!nFrames)
+        return;
+
+    // send the packets to the stack
+    NetworkStack::instance().receive(this, pFrames, nFrames);
+    nFrames = 0;
+
+    // the card can now reuse the space (CAPR lags the real offset by 16)
+    m_pBase->write16(static_cast<uint16_t>(m_RxCurr - 16), RTL_RXCURR);
+}
+
+size_t Rtl8139::poll(size_t nBudget)
+{
+    return recv(nBudget);
+}
+
+void Rtl8139::setReceiveInterrupts(bool bEnabled)
+{
+    LockGuard<Spinlock> guard(m_RxLock);
 
-    m_RxLock = false;
+    m_bRxInterrupts = bEnabled;
+    m_pBase->write16((bEnabled ? RTL_IMR_RXOK : 0) | RTL_IMR_RXERR, RTL_IMR);
 }
 
 bool Rtl8139::setStationInfo(StationInfo info)
@@ -249,9 +291,10 @@ bool Rtl8139::irq(irq_id_t number, InterruptState &state)
         if((irqStatus & (RTL_ISR_RXOK|RTL_ISR_TXOK|RTL_ISR_RXERR|RTL_ISR_TXERR)) == 0)
             break;
 
-        // RxOK, receive the packet
-        if(irqStatus & RTL_ISR_RXOK)
-            recv();
+        // RxOK, receive everything in the ring - unless the stack is
+        // polling us, in which case it'll pick the packets up itself
+        if((irqStatus & RTL_ISR_RXOK) && m_bRxInterrupts)
+            recv(~0UL);
 
         // if rx error, reset
         if(irqStatus & RTL_ISR_RXERR)
@@ -26,10 +26,14 @@
 #include <machine/IrqHandler.h>
 #include <process/Thread.h>
 #include <process/Semaphore.h>
+#include <network-stack/NetworkStack.h>
 
 #define RTL8139_VENDOR_ID 0x10ec
 #define RTL8139_DEVICE_ID 0x8139
 
+/** Maximum number of packets handed to the stack at once */
+#define RTL8139_RX_BATCH 16
+
 /** Device driver for the RTL8139 class of network device */
 class Rtl8139 : public Network, public IrqHandler
 {
@@ -50,6 +54,15 @@ class Rtl8139 : public Network, public IrqHandler
 
         virtual bool isConnected();
 
+        virtual bool canPoll()
+        {
+            return true;
+        }
+
+        virtual size_t poll(size_t nBudget);
+
+        virtual void setReceiveInterrupts(bool bEnabled);
+
         // IRQ handler callback.
         virtual bool irq(irq_id_t number, InterruptState &state);
 
@@ -57,7 +70,13 @@ class Rtl8139 : public Network, public IrqHandler
 
     private:
 
-        void recv();
+        /** Passes up to nBudget packets from the Rx ring to the stack.
+         *  \return The number of packets received. */
+        size_t recv(size_t nBudget);
+
+        /** Hands a batch of frames in the Rx ring to the stack, and then
+         *  returns their space in the ring to the card. */
+        void flushRxBatch(NetworkStack::Frame *pFrames, size_t &nFrames);
 
         void reset();
 
@@ -72,12 +91,19 @@ class Rtl8139 : public Network, public IrqHandler
         uint32_t m_RxCurr;
         uint8_t m_TxCurr;
 
-        volatile bool m_RxLock;
+        Spinlock m_RxLock;
         Spinlock m_TxLock;
 
         uint8_t *m_pRxBuffVirt;
         uint8_t *m_pTxBuffVirt;
 
+        /** Packets which wrap around the end of the Rx ring are made
+         *  contiguous here before being passed on. */
+        uint8_t *m_pRxScratch;
+
+        /** Whether the RxOK interrupt is currently unmasked. */
+        bool m_bRxInterrupts;
+
         uintptr_t m_pRxBuffPhys;
         uintptr_t m_pTxBuffPhys;
 
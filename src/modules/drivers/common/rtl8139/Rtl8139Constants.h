@@ -37,6 +37,7 @@ enum Rtl8139Constants {
     RTL_CMD_RES = 0x10,         // Reset command
     RTL_CMD_RXEN = 0x08,        // Rx Enable command
     RTL_CMD_TXEN = 0x04,        // Tx Enable command
+    RTL_CMD_BUFE = 0x01,        // Rx Buffer Empty status bit
 
     RTL_ISR_TXERR = 0x08,       // Tx Error irq status bit
     RTL_ISR_TXOK = 0x04,        // Tx OK irq status bit
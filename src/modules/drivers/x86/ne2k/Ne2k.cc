@@ -23,11 +23,8 @@
 #include <machine/IrqManager.h>
 #include <process/Scheduler.h>
 
-// #define NE2K_NO_THREADS
-
 Ne2k::Ne2k(Network* pDev) :
-  Network(pDev), m_pBase(0), m_NextPacket(0),
-  m_PacketQueueSize(0),m_PacketQueue(), m_PacketQueueLock()
+  Network(pDev), m_pBase(0), m_NextPacket(0)
 {
   setSpecificType(String("ne2k-card"));
 
@@ -108,13 +105,6 @@ Ne2k::Ne2k(Network* pDev) :
     m_pBase->write8(0xFF, NE_MAR + i);
   m_pBase->write8(tmp, NE_CMD);
 
-  // register the packet queue handler before we install the IRQ
-#ifdef THREADS
-  new Thread(Processor::information().getCurrentThread()->getParent(),
-             reinterpret_cast<Thread::ThreadStartFunc> (&trampoline),
-             reinterpret_cast<void*> (this));
-#endif
-
   // install the IRQ
   NOTICE("NE2K: IRQ is " << getInterruptNumber());
   Machine::instance().getIrqManager()->registerIsaIrqHandler(getInterruptNumber(), static_cast<IrqHandler*>(this));
@@ -196,6 +186,9 @@ void Ne2k::recv()
   uint8_t current = m_pBase->read8(NE_CURR);
   m_pBase->write8(0x21, NE_CMD);
 
+  NetworkStack::Frame frames[NE2K_RX_BATCH];
+  size_t nFrames = 0;
+
   // Read packets until the current packet
   while(m_NextPacket != current)
   {
@@ -219,15 +212,24 @@ void Ne2k::recv()
     // Remove the status and length bytes
     length -= 3;
 
-    // packet buffer
-    uint8_t* tmp = reinterpret_cast<uint8_t*>(NetworkStack::instance().getMemPool().allocate());
-    uint16_t* packBuffer = reinterpret_cast<uint16_t*>(tmp);
-    memset(tmp, 0, length);
-
-    // check status, new read for the rest of the packet
+    // header read is complete
     while(!(m_pBase->read8(NE_ISR) & 0x40));
     m_pBase->write8(0x40, NE_ISR);
 
+    // packet buffer - this is handed over to the stack, which frees it
+    uint8_t* tmp = reinterpret_cast<uint8_t*>(NetworkStack::instance().getMemPool().allocateNow());
+    if(!tmp)
+    {
+      // No buffer to put it in, skip over the packet in the ring
+      droppedPacket();
+      m_NextPacket = status >> 8;
+      m_pBase->write8((m_NextPacket == PAGE_RX) ? (PAGE_STOP - 1) : (m_NextPacket - 1), NE_BNDRY);
+      continue;
+    }
+    uint16_t* packBuffer = reinterpret_cast<uint16_t*>(tmp);
+    memset(tmp, 0, length);
+
+    // new read for the rest of the packet
     m_pBase->write8(4, NE_RSAR0);
     m_pBase->write8(m_NextPacket, NE_RSAR1);
     m_pBase->write8((length) & 0xff, NE_RBCR0);
@@ -252,63 +254,24 @@ void Ne2k::recv()
     m_NextPacket = status >> 8;
     m_pBase->write8((m_NextPacket == PAGE_RX) ? (PAGE_STOP - 1) : (m_NextPacket - 1), NE_BNDRY);
 
-    // push onto the queue
-    packet* p = new packet;
-    p->ptr = reinterpret_cast<uintptr_t>(packBuffer);
-    p->len = length;
-
-#ifdef NE2K_NO_THREADS
-
-    NetworkStack::instance().receive(p->len, p->ptr, this, 0);
-
-    NetworkStack::instance().getMemPool().free(p->ptr);
-    delete p;
-
-#else
-
-    {
-        LockGuard<Spinlock> guard(m_PacketQueueLock);
-        m_PacketQueue.pushBack(p);
-        m_PacketQueueSize.release();
-    }
-
-#endif
+    frames[nFrames].buffer = reinterpret_cast<uintptr_t>(packBuffer);
+    frames[nFrames].nBytes = length;
+    frames[nFrames].offset = 0;
+    if(++nFrames == NE2K_RX_BATCH)
+      flushRxBatch(frames, nFrames);
   }
-}
 
-int Ne2k::trampoline(void *p)
-{
-  Ne2k *pNe = reinterpret_cast<Ne2k*> (p);
-  pNe->receiveThread();
-  return 0;
+  flushRxBatch(frames, nFrames);
 }
 
-void Ne2k::receiveThread()
+void Ne2k::flushRxBatch(NetworkStack::Frame *pFrames, size_t &nFrames)
 {
-  while(true)
-  {
-    // handle the incoming packet
-    m_PacketQueueSize.acquire();
-
-    // grab from the front
-    packet* p = 0;
-    {
-        LockGuard<Spinlock> guard(m_PacketQueueLock);
-        p = m_PacketQueue.popFront();
-    }
+  if(!nFrames)
+    return;
 
-    if(!p)
-        continue;
-    else if(!p->ptr || !p->len)
-        continue;
-
-    // pass to the network stack
-    NetworkStack::instance().receive(p->len, p->ptr, this, 0);
-
-    // destroy the buffer now that it's handled
-    NetworkStack::instance().getMemPool().free(p->ptr);
-    delete p;
-  }
+  // The stack takes ownership of the buffers
+  NetworkStack::instance().receive(this, pFrames, nFrames, true);
+  nFrames = 0;
 }
 
 bool Ne2k::setStationInfo(StationInfo info)
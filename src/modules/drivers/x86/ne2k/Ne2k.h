@@ -26,10 +26,14 @@
 #include <process/Thread.h>
 #include <process/Semaphore.h>
 #include <utilities/RequestQueue.h>
+#include <network-stack/NetworkStack.h>
 
 #define NE2K_VENDOR_ID 0x10ec
 #define NE2K_DEVICE_ID 0x8029
 
+/** Maximum number of packets handed to the stack at once */
+#define NE2K_RX_BATCH 16
+
 /** Device driver for the NE2K class of network device */
 class Ne2k : public Network, public IrqHandler
 {
@@ -59,22 +63,11 @@ private:
 
   void recv();
 
-  static int trampoline(void* p);
-
-  void receiveThread();
+  /** Hands a batch of received packets over to the stack. */
+  void flushRxBatch(NetworkStack::Frame *pFrames, size_t &nFrames);
 
-  struct packet
-  {
-    uintptr_t ptr;
-    size_t len;
-  };
   uint8_t m_NextPacket;
 
-  Semaphore m_PacketQueueSize;
-  List<packet*> m_PacketQueue;
-
-  Spinlock m_PacketQueueLock;
-  
   Ne2k(const Ne2k&);
   void operator =(const Ne2k&);
 };
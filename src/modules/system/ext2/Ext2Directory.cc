@@ -103,7 +103,7 @@ bool Ext2Directory::addEntry(String filename, File *pFile, size_t type)
     if (!bFound)
     {
         // Need to make a new block.
-        uint32_t block = m_pExt2Fs->findFreeBlock(m_InodeNumber);
+        uint32_t block = allocateBlock();
         if (block == 0)
         {
             // We had a problem.
@@ -143,7 +143,7 @@ bool Ext2Directory::addEntry(String filename, File *pFile, size_t type)
     memcpy(pDir->d_name, filename, filename.length());
 
     // We're all good - add the directory to our cache.
-    m_Cache.insert(filename, pFile);
+    addToCache(filename, pFile);
 
     m_Size = m_nSize;
 
@@ -193,7 +193,7 @@ void Ext2Directory::cacheDirectoryContents()
             }
 
             // Add to cache.
-            m_Cache.insert(sFilename, pFile);
+            populateCache(sFilename, pFile);
 
             // Next.
             pDir = reinterpret_cast<Dir*> (reinterpret_cast<uintptr_t>(pDir)+LITTLE_TO_HOST16(pDir->d_reclen));
@@ -56,6 +56,11 @@ uintptr_t Ext2File::readBlock(uint64_t location)
     return static_cast<Ext2Node*>(this)->readBlock(location);
 }
 
+uint64_t Ext2File::getDiskBlock(uint64_t nBlock)
+{
+    return static_cast<Ext2Node*>(this)->getDiskBlock(nBlock);
+}
+
 void Ext2File::truncate()
 {
     static_cast<Ext2Node*>(this)->truncate();
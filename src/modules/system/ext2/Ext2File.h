@@ -41,6 +41,8 @@ public:
     /** Updates inode attributes. */
     void fileAttributeChanged();
 
+    uint64_t getDiskBlock(uint64_t nBlock);
+
 protected:
     /** Performs a read-to-cache. */
     uintptr_t readBlock(uint64_t location);
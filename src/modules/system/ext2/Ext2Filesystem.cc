@@ -18,6 +18,7 @@
 #include "Ext2File.h"
 #include "Ext2Filesystem.h"
 #include "Ext2Symlink.h"
+#include <LockGuard.h>
 #include <Log.h>
 #include <Module.h>
 #include <machine/Machine.h>
@@ -40,7 +41,7 @@ uint8_t g_pSparseBlock[4096] ALIGN(4096) __attribute__((__section__(".bss")));
 
 
 Ext2Filesystem::Ext2Filesystem() :
-    m_pSuperblock(0), m_pGroupDescriptors(), m_BlockSize(0), m_InodeSize(0),
+    m_pSuperblock(0), m_pGroupDescriptors(), m_pGroupSummaries(0), m_BlockSize(0), m_InodeSize(0),
     m_nGroupDescriptors(0), m_WriteLock(false), m_pRoot(0)
 {
 }
@@ -95,6 +96,16 @@ bool Ext2Filesystem::initialise(Disk *pDisk)
         m_pGroupDescriptors[i] = reinterpret_cast<GroupDesc*>(block+off);
     }
 
+    // Seed the free space summaries from the group descriptors.
+    m_pGroupSummaries = new GroupSummary[m_nGroupDescriptors];
+    for (size_t i = 0; i < m_nGroupDescriptors; i++)
+    {
+        m_pGroupSummaries[i].nFreeBlocks = LITTLE_TO_HOST16(m_pGroupDescriptors[i]->bg_free_blocks_count);
+        m_pGroupSummaries[i].nFreeInodes = LITTLE_TO_HOST16(m_pGroupDescriptors[i]->bg_free_inodes_count);
+        m_pGroupSummaries[i].nBlockHint = 0;
+        m_pGroupSummaries[i].nInodeHint = 0;
+    }
+
     // Create our bitmap arrays and tables.
     m_pInodeTables  = new Vector<size_t>[m_nGroupDescriptors];
     m_pInodeBitmaps = new Vector<size_t>[m_nGroupDescriptors];
@@ -160,7 +171,7 @@ bool Ext2Filesystem::createNode(File* parent, String filename, uint32_t mask, St
     }
 
     // Find a free inode.
-    uint32_t inode_num = findFreeInode();
+    uint32_t inode_num = findFreeInode(parent->getInode(), type == EXT2_S_IFDIR);
     if (inode_num == 0)
     {
         SYSCALL_ERROR(NoSpaceLeftOnDevice);
@@ -185,6 +196,7 @@ bool Ext2Filesystem::createNode(File* parent, String filename, uint32_t mask, St
         memcpy(reinterpret_cast<void*>(newInode->i_block), value, value.length());
         newInode->i_size = value.length();
     }
+    writeInode(inode_num);
     // Else case comes later, after pFile is created.
 
     Ext2Directory *pE2Parent = reinterpret_cast<Ext2Directory*>(parent);
@@ -264,109 +276,304 @@ uintptr_t Ext2Filesystem::readBlock(uint32_t block)
     return m_pDisk->read(static_cast<uint64_t>(m_BlockSize)*static_cast<uint64_t>(block));
 }
 
+void Ext2Filesystem::unpinBlock(uint32_t block)
+{
+    if (block == 0)
+        return;
+
+    m_pDisk->unpin(static_cast<uint64_t>(m_BlockSize)*static_cast<uint64_t>(block));
+}
+
+void Ext2Filesystem::writeBlock(uint32_t block)
+{
+    if (block == 0)
+        return;
+
+    m_pDisk->write(static_cast<uint64_t>(m_BlockSize)*static_cast<uint64_t>(block));
+}
+
 uint32_t Ext2Filesystem::findFreeBlock(uint32_t inode)
 {
-    inode--; // Inode zero is undefined, so it's not used.
+    size_t nClaimed;
+    return findFreeBlocks(inode, 0, 1, nClaimed);
+}
 
-    uint32_t group = inode / LITTLE_TO_HOST32(m_pSuperblock->s_inodes_per_group);
-    group = 0;
+uint32_t Ext2Filesystem::findFreeBlocks(uint32_t inode, uint32_t goal, size_t nWanted, size_t &nClaimed)
+{
+    LockGuard<Mutex> guard(m_WriteLock);
+
+    uint32_t blocksPerGroup = LITTLE_TO_HOST32(m_pSuperblock->s_blocks_per_group);
+    uint32_t firstBlock = LITTLE_TO_HOST32(m_pSuperblock->s_first_data_block);
+    uint32_t nBlocks = LITTLE_TO_HOST32(m_pSuperblock->s_blocks_count);
+
+    nClaimed = 0;
 
-    for (; group < m_nGroupDescriptors; group++)
+    // Start in the inode's own group, unless we were given somewhere better.
+    size_t startGroup = inode ? (inode - 1) / LITTLE_TO_HOST32(m_pSuperblock->s_inodes_per_group) : 0;
+    if (goal >= firstBlock && goal < nBlocks)
     {
-        ///\todo Check group descriptor hint.
+        size_t group = (goal - firstBlock) / blocksPerGroup;
+        startGroup = group;
+
+        // Carry straight on from the goal if we can.
+        if (m_pGroupSummaries[group].nFreeBlocks)
+        {
+            ensureFreeBlockBitmapLoaded(group);
+            if ((nClaimed = claimBlocks(group, (goal - firstBlock) % blocksPerGroup, nWanted)))
+                return goal;
+        }
+    }
+    if (startGroup >= m_nGroupDescriptors)
+        startGroup = 0;
+
+    for (size_t n = 0; n < m_nGroupDescriptors; n++)
+    {
+        size_t group = (startGroup + n) % m_nGroupDescriptors;
+        GroupSummary &summary = m_pGroupSummaries[group];
+        if (!summary.nFreeBlocks)
+            continue;
+
         ensureFreeBlockBitmapLoaded(group);
+        Vector<size_t> &bitmap = m_pBlockBitmaps[group];
+        size_t nBits = getBlocksInGroup(group);
 
-        Vector<size_t> &list = m_pBlockBitmaps[group];
-        for (size_t i = 0;
-             i < LITTLE_TO_HOST32(m_pSuperblock->s_blocks_per_group)/8;
-             i += sizeof(uint32_t))
+        size_t bit = findClearBits(bitmap, summary.nBlockHint, nBits, 1);
+        if (bit >= nBits)
         {
-            // Calculate block index.
-            size_t idx = i / (m_BlockSize*8);
-            size_t off = i % (m_BlockSize*8);
-
-            // Grab the specific block.
-            /// \todo Endianness - to ensure correct operation, must ptr be
-            /// little endian?
-            uintptr_t block = list[idx];
-            uint32_t *ptr = reinterpret_cast<uint32_t*> (block+off);
-            uint32_t tmp = *ptr;
-
-            if (tmp == ~0U)
-                continue;
+            // The descriptor's count was stale.
+            summary.nFreeBlocks = 0;
+            continue;
+        }
+        summary.nBlockHint = bit;
+
+        // Rather than splitting a run, look for one that fits if we want several.
+        if (nWanted > 1)
+        {
+            size_t run = findClearBits(bitmap, bit, nBits, nWanted);
+            if (run < nBits)
+                bit = run;
+        }
+
+        nClaimed = claimBlocks(group, bit, nWanted);
+        return firstBlock + group * blocksPerGroup + bit;
+    }
+
+    return 0;
+}
+
+size_t Ext2Filesystem::claimBlocks(size_t group, size_t bit, size_t nWanted)
+{
+    Vector<size_t> &bitmap = m_pBlockBitmaps[group];
+    size_t nBits = getBlocksInGroup(group);
+
+    size_t n = 0;
+    for (; n < nWanted && bit + n < nBits && !testBit(bitmap, bit + n); n++)
+        setBit(bitmap, bit + n, true);
+
+    if (n)
+    {
+        m_pGroupSummaries[group].nFreeBlocks -= n;
+        m_pGroupDescriptors[group]->bg_free_blocks_count =
+            HOST_TO_LITTLE16(LITTLE_TO_HOST16(m_pGroupDescriptors[group]->bg_free_blocks_count) - n);
+        m_pSuperblock->s_free_blocks_count =
+            HOST_TO_LITTLE32(LITTLE_TO_HOST32(m_pSuperblock->s_free_blocks_count) - n);
+
+        writeBlockBitmap(group, bit);
+        writeBlockBitmap(group, bit + n - 1);
+        writeGroupDescriptor(group);
+    }
+
+    return n;
+}
+
+uint32_t Ext2Filesystem::findFreeInode(uint32_t parent, bool bDirectory)
+{
+    LockGuard<Mutex> guard(m_WriteLock);
+
+    uint32_t inodesPerGroup = LITTLE_TO_HOST32(m_pSuperblock->s_inodes_per_group);
 
-            for (size_t j = 0; j < 32; j++,tmp >>= 1)
+    // Files go next to their directory. Directories are spread out, into a
+    // group with at least the average number of free inodes and the most free
+    // blocks, so that their files have room to grow.
+    size_t startGroup = parent ? (parent - 1) / inodesPerGroup : 0;
+    if (bDirectory)
+    {
+        uint32_t avgFreeInodes = LITTLE_TO_HOST32(m_pSuperblock->s_free_inodes_count) / m_nGroupDescriptors;
+        uint32_t bestFreeBlocks = 0;
+        for (size_t group = 0; group < m_nGroupDescriptors; group++)
+        {
+            GroupSummary &summary = m_pGroupSummaries[group];
+            if (summary.nFreeInodes && summary.nFreeInodes >= avgFreeInodes &&
+                summary.nFreeBlocks > bestFreeBlocks)
             {
-                if ( (tmp&1) == 0 )
-                {
-                    // Unused, we can use this block!
-                    // Set it as used.
-                    *ptr = *ptr | (1<<j);
-                    ///\todo Update the group descriptor's free_blocks_count.
-                    return (group * LITTLE_TO_HOST32(m_pSuperblock->s_blocks_per_group)) +
-                        i*8 + j;
-                }
+                startGroup = group;
+                bestFreeBlocks = summary.nFreeBlocks;
             }
+        }
+    }
+    if (startGroup >= m_nGroupDescriptors)
+        startGroup = 0;
+
+    for (size_t n = 0; n < m_nGroupDescriptors; n++)
+    {
+        size_t group = (startGroup + n) % m_nGroupDescriptors;
+        GroupSummary &summary = m_pGroupSummaries[group];
+        if (!summary.nFreeInodes)
+            continue;
+
+        ensureFreeInodeBitmapLoaded(group);
+        Vector<size_t> &bitmap = m_pInodeBitmaps[group];
 
-            // Shouldn't get here - if there were no available blocks here it should
-            // have hit the "continue" above!
-            assert(false);
+        size_t bit = findClearBits(bitmap, summary.nInodeHint, inodesPerGroup, 1);
+        if (bit >= inodesPerGroup)
+        {
+            // The descriptor's count was stale.
+            summary.nFreeInodes = 0;
+            continue;
         }
+
+        setBit(bitmap, bit, true);
+        summary.nInodeHint = bit + 1;
+        summary.nFreeInodes--;
+
+        GroupDesc *pDesc = m_pGroupDescriptors[group];
+        pDesc->bg_free_inodes_count = HOST_TO_LITTLE16(LITTLE_TO_HOST16(pDesc->bg_free_inodes_count) - 1);
+        if (bDirectory)
+            pDesc->bg_used_dirs_count = HOST_TO_LITTLE16(LITTLE_TO_HOST16(pDesc->bg_used_dirs_count) + 1);
+        m_pSuperblock->s_free_inodes_count =
+            HOST_TO_LITTLE32(LITTLE_TO_HOST32(m_pSuperblock->s_free_inodes_count) - 1);
+
+        writeInodeBitmap(group, bit);
+        writeGroupDescriptor(group);
+
+        // Inode numbers start at one.
+        return group * inodesPerGroup + bit + 1;
     }
 
     return 0;
 }
 
-uint32_t Ext2Filesystem::findFreeInode()
+void Ext2Filesystem::releaseBlock(uint32_t block)
 {
-    for (uint32_t group = 0; group < m_nGroupDescriptors; group++)
+    // Block zero is a hole, not a real block.
+    uint32_t firstBlock = LITTLE_TO_HOST32(m_pSuperblock->s_first_data_block);
+    if (!block || block < firstBlock || block >= LITTLE_TO_HOST32(m_pSuperblock->s_blocks_count))
+        return;
+
+    LockGuard<Mutex> guard(m_WriteLock);
+
+    uint32_t blocksPerGroup = LITTLE_TO_HOST32(m_pSuperblock->s_blocks_per_group);
+    size_t group = (block - firstBlock) / blocksPerGroup;
+    size_t bit = (block - firstBlock) % blocksPerGroup;
+
+    ensureFreeBlockBitmapLoaded(group);
+    Vector<size_t> &bitmap = m_pBlockBitmaps[group];
+    if (!testBit(bitmap, bit))
     {
-        ///\todo Check group descriptor hint.
-        ensureFreeInodeBitmapLoaded(group);
+        WARNING("EXT2: releasing block " << Dec << block << Hex << " which isn't in use");
+        return;
+    }
+    setBit(bitmap, bit, false);
+
+    GroupSummary &summary = m_pGroupSummaries[group];
+    summary.nFreeBlocks++;
+    if (bit < summary.nBlockHint)
+        summary.nBlockHint = bit;
 
-        Vector<size_t> &list = m_pInodeBitmaps[group];
-        for (size_t i = 0;
-             i < LITTLE_TO_HOST32(m_pSuperblock->s_inodes_per_group)/8;
-             i += sizeof(uint32_t))
+    m_pGroupDescriptors[group]->bg_free_blocks_count =
+        HOST_TO_LITTLE16(LITTLE_TO_HOST16(m_pGroupDescriptors[group]->bg_free_blocks_count) + 1);
+    m_pSuperblock->s_free_blocks_count =
+        HOST_TO_LITTLE32(LITTLE_TO_HOST32(m_pSuperblock->s_free_blocks_count) + 1);
+
+    writeBlockBitmap(group, bit);
+    writeGroupDescriptor(group);
+}
+
+size_t Ext2Filesystem::findClearBits(Vector<size_t> &bitmap, size_t bit, size_t nBits, size_t nRun)
+{
+    size_t nBitsPerBlock = m_BlockSize * 8;
+    size_t runStart = bit, runLength = 0;
+
+    while (bit < nBits)
+    {
+        // Skip whole words that are in use.
+        if ((bit % 32) == 0 && bit + 32 <= nBits)
         {
-            // Calculate block index.
-            size_t idx = i / (m_BlockSize*8);
-            size_t off = i % (m_BlockSize*8);
-
-            // Grab the specific block.
-            /// \todo Endianness - to ensure correct operation, must ptr be
-            /// little endian?
-            uintptr_t block = list[idx];
-            uint32_t *ptr = reinterpret_cast<uint32_t*> (block+off);
-            uint32_t tmp = *ptr;
-
-            if (tmp == ~0U)
+            uint32_t word = *reinterpret_cast<uint32_t*>(bitmap[bit / nBitsPerBlock] + (bit % nBitsPerBlock) / 8);
+            if (word == ~0U)
+            {
+                bit += 32;
+                runLength = 0;
                 continue;
-
-            for (size_t j = 0; j < 32; j++,tmp >>= 1)
+            }
+            if (word == 0 && runLength + 32 < nRun)
             {
-                if ( (tmp&1) == 0 )
-                {
-                    // Unused, we can use this block!
-                    // Set it as used.
-                    *ptr = *ptr | (1<<j);
-                    ///\todo Update the group descriptor's free_inodes_count.
-                    return (group * LITTLE_TO_HOST32(m_pSuperblock->s_blocks_per_group)) +
-                        i*8 + j;
-                }
+                if (!runLength)
+                    runStart = bit;
+                runLength += 32;
+                bit += 32;
+                continue;
             }
+        }
 
-            // Shouldn't get here - if there were no available blocks here it should
-            // have hit the "continue" above!
-            assert(false);
+        if (testBit(bitmap, bit))
+            runLength = 0;
+        else
+        {
+            if (!runLength)
+                runStart = bit;
+            if (++runLength >= nRun)
+                return runStart;
         }
+        bit++;
     }
 
-    return 0;
+    return nBits;
 }
 
-void Ext2Filesystem::releaseBlock(uint32_t block)
+bool Ext2Filesystem::testBit(Vector<size_t> &bitmap, size_t bit)
 {
+    size_t nBitsPerBlock = m_BlockSize * 8;
+    uint8_t *p = reinterpret_cast<uint8_t*>(bitmap[bit / nBitsPerBlock] + (bit % nBitsPerBlock) / 8);
+    return (*p & (1 << (bit % 8))) != 0;
+}
+
+void Ext2Filesystem::setBit(Vector<size_t> &bitmap, size_t bit, bool bSet)
+{
+    size_t nBitsPerBlock = m_BlockSize * 8;
+    uint8_t *p = reinterpret_cast<uint8_t*>(bitmap[bit / nBitsPerBlock] + (bit % nBitsPerBlock) / 8);
+    if (bSet)
+        *p |= (1 << (bit % 8));
+    else
+        *p &= ~(1 << (bit % 8));
+}
+
+size_t Ext2Filesystem::getBlocksInGroup(size_t group)
+{
+    uint32_t blocksPerGroup = LITTLE_TO_HOST32(m_pSuperblock->s_blocks_per_group);
+    uint32_t nBlocks = LITTLE_TO_HOST32(m_pSuperblock->s_blocks_count) -
+                       LITTLE_TO_HOST32(m_pSuperblock->s_first_data_block);
+
+    size_t nLeft = nBlocks - group * blocksPerGroup;
+    return (nLeft < blocksPerGroup) ? nLeft : blocksPerGroup;
+}
+
+void Ext2Filesystem::writeBlockBitmap(size_t group, size_t bit)
+{
+    writeBlock(LITTLE_TO_HOST32(m_pGroupDescriptors[group]->bg_block_bitmap) + bit / (m_BlockSize*8));
+}
+
+void Ext2Filesystem::writeInodeBitmap(size_t group, size_t bit)
+{
+    writeBlock(LITTLE_TO_HOST32(m_pGroupDescriptors[group]->bg_inode_bitmap) + bit / (m_BlockSize*8));
+}
+
+void Ext2Filesystem::writeGroupDescriptor(size_t group)
+{
+    uint32_t gdBlock = LITTLE_TO_HOST32(m_pSuperblock->s_first_data_block)+1;
+    writeBlock(gdBlock + (group * sizeof(GroupDesc)) / m_BlockSize);
+
+    m_pDisk->write(1024ULL);
 }
 
 Inode *Ext2Filesystem::getInode(uint32_t inode)
@@ -387,6 +594,18 @@ Inode *Ext2Filesystem::getInode(uint32_t inode)
     return reinterpret_cast<Inode*> (block+blockOff);
 }
 
+void Ext2Filesystem::writeInode(uint32_t inode)
+{
+    inode--;
+
+    uint32_t group = inode / LITTLE_TO_HOST32(m_pSuperblock->s_inodes_per_group);
+    uint32_t index = inode % LITTLE_TO_HOST32(m_pSuperblock->s_inodes_per_group);
+
+    size_t blockNum = (index*sizeof(Inode)) / m_BlockSize;
+
+    writeBlock(LITTLE_TO_HOST32(m_pGroupDescriptors[group]->bg_inode_table) + blockNum);
+}
+
 void Ext2Filesystem::ensureFreeBlockBitmapLoaded(size_t group)
 {
     assert(group < m_nGroupDescriptors);
@@ -60,13 +60,49 @@ private:
 
     /** Reads a block of data from the disk. */
     uintptr_t readBlock(uint32_t block);
-
+    /** Drops the reference readBlock took on \p block 's cache page, for
+        callers that don't keep the pointer. */
+    void unpinBlock(uint32_t block);
+    /** Has \p block 's cache page written back, after it's been changed
+        through the pointer readBlock returned. */
+    void writeBlock(uint32_t block);
+
+    /** Claims a single free block for \p inode. */
     uint32_t findFreeBlock(uint32_t inode);
-    uint32_t findFreeInode();
+    /** Claims up to \p nWanted contiguous free blocks for \p inode, starting
+        at \p goal if it's free and in the inode's block group otherwise.
+        \return The first block claimed, or zero if the disk is full. The
+                number of blocks claimed is stored in \p nClaimed. */
+    uint32_t findFreeBlocks(uint32_t inode, uint32_t goal, size_t nWanted, size_t &nClaimed);
+    /** Claims a free inode, near \p parent for files and in a lightly used
+        group for directories. */
+    uint32_t findFreeInode(uint32_t parent, bool bDirectory);
 
     void releaseBlock(uint32_t block);
 
+    /** Claims up to \p nWanted clear bits from \p bit on in the block bitmap
+        of \p group, stopping at the first set bit. \return The number claimed. */
+    size_t claimBlocks(size_t group, size_t bit, size_t nWanted);
+    /** Finds the first run of \p nRun clear bits at or after \p bit in a
+        bitmap of \p nBits bits. \return The start of the run, or \p nBits. */
+    size_t findClearBits(Vector<size_t> &bitmap, size_t bit, size_t nBits, size_t nRun);
+    bool testBit(Vector<size_t> &bitmap, size_t bit);
+    void setBit(Vector<size_t> &bitmap, size_t bit, bool bSet);
+    /** Number of blocks in \p group - the last group may be short. */
+    size_t getBlocksInGroup(size_t group);
+
+    /** Have the block bitmap block holding \p bit of \p group written back. */
+    void writeBlockBitmap(size_t group, size_t bit);
+    /** Have the inode bitmap block holding \p bit of \p group written back. */
+    void writeInodeBitmap(size_t group, size_t bit);
+    /** Have \p group 's descriptor and the superblock written back, after
+        their free counts change. */
+    void writeGroupDescriptor(size_t group);
+
     Inode *getInode(uint32_t num);
+    /** Has the inode table block holding inode \p num written back, after
+        the inode's been changed through the pointer getInode returned. */
+    void writeInode(uint32_t num);
 
     void ensureFreeBlockBitmapLoaded(size_t group);
     void ensureFreeInodeBitmapLoaded(size_t group);
@@ -85,6 +121,18 @@ private:
     /** Free block bitmaps, indexed by group descriptor. */
     Vector<size_t> *m_pBlockBitmaps;
 
+    /** In-memory free space summary for a block group, so full groups can
+        be skipped without touching their bitmaps. */
+    struct GroupSummary
+    {
+        uint32_t nFreeBlocks;
+        uint32_t nFreeInodes;
+        /** No free block/inode below these bits. */
+        uint32_t nBlockHint;
+        uint32_t nInodeHint;
+    };
+    GroupSummary *m_pGroupSummaries;
+
     /** Size of a block. */
     uint32_t m_BlockSize;
 
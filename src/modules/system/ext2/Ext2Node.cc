@@ -21,8 +21,15 @@
 
 Ext2Node::Ext2Node(uintptr_t inode_num, Inode *pInode, Ext2Filesystem *pFs) :
     m_pInode(pInode), m_InodeNumber(inode_num), m_pExt2Fs(pFs), m_pBlocks(0),
-    m_nBlocks(LITTLE_TO_HOST32(pInode->i_blocks)), m_nSize(LITTLE_TO_HOST32(pInode->i_size))
+    m_nBlocks(0), m_pExtents(0), m_nExtents(0),
+    m_nExtentsSize(0), m_PreallocStart(0), m_nPrealloc(0), m_nSize(LITTLE_TO_HOST32(pInode->i_size))
 {
+    // i_blocks counts 512-byte sectors, indirect tables included, so the
+    // number of blocks in the file comes from its size. A symlink short
+    // enough to be kept in i_block itself has none.
+    if (pInode->i_blocks)
+        m_nBlocks = (m_nSize + pFs->m_BlockSize - 1) / pFs->m_BlockSize;
+
     m_pBlocks = new uint32_t[m_nBlocks];
     memset(m_pBlocks, ~0, sizeof(uint32_t)*m_nBlocks);
 
@@ -32,6 +39,9 @@ Ext2Node::Ext2Node(uintptr_t inode_num, Inode *pInode, Ext2Filesystem *pFs) :
 
 Ext2Node::~Ext2Node()
 {
+    discardPreallocation();
+    delete [] m_pExtents;
+    delete [] m_pBlocks;
 }
 
 uint64_t Ext2Node::read(uint64_t location, uint64_t size, uintptr_t buffer)
@@ -53,42 +63,54 @@ uint64_t Ext2Node::read(uint64_t location, uint64_t size, uintptr_t buffer)
     }
 
     size_t nBs = m_pExt2Fs->m_BlockSize;
+    Disk *pDisk = m_pExt2Fs->getDisk();
 
     size_t nBytes = size;
-    uint32_t nBlock = location / nBs;
     while (nBytes)
     {
-        // If the current location is block-aligned and we have to read at least a
-        // block in, we can read directly to the buffer.
-        if ( (location % nBs) == 0 && nBytes >= nBs )
+        uint32_t nBlock = location / nBs;
+        Extent extent;
+        if (!getExtent(nBlock, extent))
+            return size - nBytes;
+
+        // Everything up to the end of the extent is contiguous on disk.
+        size_t nExtentBytes = (extent.logical + extent.length) * nBs - location;
+        if (nExtentBytes > nBytes)
+            nExtentBytes = nBytes;
+
+        if (extent.physical == 0)
         {
-            ensureBlockLoaded(nBlock);
-            uintptr_t buf = m_pExt2Fs->readBlock(m_pBlocks[nBlock]);
-            memcpy(reinterpret_cast<uint8_t*>(buffer),
-                   reinterpret_cast<uint8_t*>(buf),
-                   nBs);
-            buffer += nBs;
-            location += nBs;
-            nBytes -= nBs;
-            nBlock++;
+            // Sparse - reads back as zeroes.
+            memset(reinterpret_cast<uint8_t*>(buffer), 0, nExtentBytes);
         }
-        // Else we have to read in a partial block.
         else
         {
-            // Create a buffer for the block.
-            ensureBlockLoaded(nBlock);
-            uintptr_t buf = m_pExt2Fs->readBlock(m_pBlocks[nBlock]);
-            // memcpy the relevant block area.
-            uintptr_t start = location % nBs;
-            uintptr_t size = (start+nBytes >= nBs) ? nBs-start : nBytes;
-            memcpy(reinterpret_cast<uint8_t*>(buffer),
-                   reinterpret_cast<uint8_t*>(buf+start),
-                   size);
-            buffer += size;
-            location += size;
-            nBytes -= size;
-            nBlock++;
+            // Copy a whole disk cache page at a time rather than a block.
+            uint64_t diskLocation = static_cast<uint64_t>(extent.physical + (nBlock - extent.logical)) * nBs +
+                                    location % nBs;
+            uintptr_t target = buffer;
+            for (size_t nLeft = nExtentBytes; nLeft;)
+            {
+                uint64_t sector = diskLocation & ~511ULL;
+                size_t nChunk = 4096 - (diskLocation % 4096);
+                if (nChunk > nLeft)
+                    nChunk = nLeft;
+
+                uintptr_t buf = pDisk->read(sector);
+                memcpy(reinterpret_cast<uint8_t*>(target),
+                       reinterpret_cast<uint8_t*>(buf + (diskLocation - sector)),
+                       nChunk);
+                pDisk->unpin(sector);
+
+                target += nChunk;
+                diskLocation += nChunk;
+                nLeft -= nChunk;
+            }
         }
+
+        buffer += nExtentBytes;
+        location += nExtentBytes;
+        nBytes -= nExtentBytes;
     }
 
     return size;
@@ -99,41 +121,55 @@ uint64_t Ext2Node::write(uint64_t location, uint64_t size, uintptr_t buffer)
     ensureLargeEnough(location+size);
 
     size_t nBs = m_pExt2Fs->m_BlockSize;
+    Disk *pDisk = m_pExt2Fs->getDisk();
 
     size_t nBytes = size;
-    uint32_t nBlock = location / nBs;
     while (nBytes)
     {
-        // If the current location is block-aligned and we have to write at least a
-        // block out, we can write directly to the buffer.
-        if ( (location % nBs) == 0 && nBytes >= nBs )
+        uint32_t nBlock = location / nBs;
+        Extent extent;
+        if (!getExtent(nBlock, extent))
+            return size - nBytes;
+
+        size_t nExtentBytes = (extent.logical + extent.length) * nBs - location;
+        if (nExtentBytes > nBytes)
+            nExtentBytes = nBytes;
+
+        if (extent.physical == 0)
         {
-            ensureBlockLoaded(nBlock);
-            uintptr_t buf = m_pExt2Fs->readBlock(m_pBlocks[nBlock]);
-            memcpy(reinterpret_cast<uint8_t*>(buf),
-                   reinterpret_cast<uint8_t*>(buffer),
-                   nBs);
-            buffer += nBs;
-            location += nBs;
-            nBytes -= nBs;
-            nBlock++;
+            // Give the hole a block, then go round again to write into it.
+            if (!fillHole(nBlock))
+                return size - nBytes;
+            continue;
         }
-        // Else we have to read in a block, partially edit it and write back.
         else
         {
-            // Create a buffer for the block.
-            ensureBlockLoaded(nBlock);
-            uintptr_t buf = m_pExt2Fs->readBlock(m_pBlocks[nBlock]);
-            // memcpy the relevant block area.
-            uintptr_t start = location % nBs;
-            uintptr_t size = (start+nBytes >= nBs) ? nBs-start : nBytes;
-            memcpy(reinterpret_cast<uint8_t*>(buf+start),
-                   reinterpret_cast<uint8_t*>(buffer), size);
-            buffer += size;
-            location += size;
-            nBytes -= size;
-            nBlock++;
+            uint64_t diskLocation = static_cast<uint64_t>(extent.physical + (nBlock - extent.logical)) * nBs +
+                                    location % nBs;
+            uintptr_t source = buffer;
+            for (size_t nLeft = nExtentBytes; nLeft;)
+            {
+                uint64_t sector = diskLocation & ~511ULL;
+                size_t nChunk = 4096 - (diskLocation % 4096);
+                if (nChunk > nLeft)
+                    nChunk = nLeft;
+
+                uintptr_t buf = pDisk->read(sector);
+                memcpy(reinterpret_cast<uint8_t*>(buf + (diskLocation - sector)),
+                       reinterpret_cast<uint8_t*>(source),
+                       nChunk);
+                pDisk->write(sector);
+                pDisk->unpin(sector);
+
+                source += nChunk;
+                diskLocation += nChunk;
+                nLeft -= nChunk;
+            }
         }
+
+        buffer += nExtentBytes;
+        location += nExtentBytes;
+        nBytes -= nExtentBytes;
     }
 
     return size;
@@ -147,23 +183,85 @@ uintptr_t Ext2Node::readBlock(uint64_t location)
 
     uint32_t nBlock = location / nBs;
 
-    ensureBlockLoaded(nBlock);
-    return m_pExt2Fs->readBlock(m_pBlocks[nBlock]);
+    Extent extent;
+    if (!getExtent(nBlock, extent))
+        return 0;
+    if (extent.physical == 0)
+        return m_pExt2Fs->readBlock(0);
+    return m_pExt2Fs->readBlock(extent.physical + (nBlock - extent.logical));
+}
+
+uint32_t Ext2Node::getDiskBlock(size_t nBlock)
+{
+    Extent extent;
+    if (!getExtent(nBlock, extent) || extent.physical == 0)
+        return 0;
+    return extent.physical + (nBlock - extent.logical);
 }
 
 void Ext2Node::truncate()
 {
+    size_t nPerBlock = m_pExt2Fs->m_BlockSize/4;
+
     for (size_t i = 0; i < m_nBlocks; i++)
     {
         ensureBlockLoaded(i);
         m_pExt2Fs->releaseBlock(m_pBlocks[i]);
     }
 
+    // Then the indirect, bi-indirect and tri-indirect tables that mapped them.
+    size_t nLeft = (m_nBlocks > 12) ? m_nBlocks - 12 : 0;
+    size_t nSpan = nPerBlock;
+    for (size_t i = 12; i < 15 && nLeft; i++)
+    {
+        size_t n = (nLeft < nSpan) ? nLeft : nSpan;
+        releaseTable(LITTLE_TO_HOST32(m_pInode->i_block[i]), i - 11, n);
+        nLeft -= n;
+        nSpan *= nPerBlock;
+    }
+
+    discardPreallocation();
+
     m_nSize = 0;
     m_nBlocks = 0;
+    delete [] m_pBlocks;
+    m_pBlocks = 0;
+    clearExtents();
 
+    memset(reinterpret_cast<void*>(m_pInode->i_block), 0, sizeof(m_pInode->i_block));
     m_pInode->i_size = 0;
     m_pInode->i_blocks = 0;
+    m_pExt2Fs->writeInode(m_InodeNumber);
+}
+
+void Ext2Node::releaseTable(uint32_t table, size_t depth, size_t nBlocks)
+{
+    if (table == 0)
+        return;
+
+    if (depth > 1)
+    {
+        size_t nPerBlock = m_pExt2Fs->m_BlockSize/4;
+        size_t nSpan = 1;
+        for (size_t i = 1; i < depth; i++)
+            nSpan *= nPerBlock;
+
+        // Take a copy, so the table isn't left pinned while we recurse.
+        uint32_t *pEntries = new uint32_t[nPerBlock];
+        memcpy(pEntries, reinterpret_cast<void*>(m_pExt2Fs->readBlock(table)), m_pExt2Fs->m_BlockSize);
+        m_pExt2Fs->unpinBlock(table);
+
+        for (size_t i = 0; i < nPerBlock && nBlocks; i++)
+        {
+            size_t n = (nBlocks < nSpan) ? nBlocks : nSpan;
+            releaseTable(LITTLE_TO_HOST32(pEntries[i]), depth - 1, n);
+            nBlocks -= n;
+        }
+
+        delete [] pEntries;
+    }
+
+    m_pExt2Fs->releaseBlock(table);
 }
 
 bool Ext2Node::ensureLargeEnough(size_t size)
@@ -178,7 +276,7 @@ bool Ext2Node::ensureLargeEnough(size_t size)
 
     while (size > m_nBlocks*m_pExt2Fs->m_BlockSize)
     {
-        uint32_t block = m_pExt2Fs->findFreeBlock(m_InodeNumber);
+        uint32_t block = allocateBlock();
         if (block == 0)
         {
             // We had a problem.
@@ -189,6 +287,8 @@ bool Ext2Node::ensureLargeEnough(size_t size)
         // Load the block and zero it.
         uint8_t *pBuffer = reinterpret_cast<uint8_t*>(m_pExt2Fs->readBlock(block));
         memset(pBuffer, 0, m_pExt2Fs->m_BlockSize);
+        m_pExt2Fs->writeBlock(block);
+        m_pExt2Fs->unpinBlock(block);
     }
     return true;
 }
@@ -205,6 +305,90 @@ bool Ext2Node::ensureBlockLoaded(size_t nBlock)
     return true;
 }
 
+bool Ext2Node::getExtent(size_t nBlock, Extent &extent)
+{
+    if (nBlock >= m_nBlocks)
+        return false;
+
+    // Find the first extent starting after nBlock.
+    size_t lo = 0, hi = m_nExtents;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (m_pExtents[mid].logical <= nBlock)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    // Does the one before it contain nBlock?
+    if (lo && nBlock < m_pExtents[lo-1].logical + m_pExtents[lo-1].length)
+    {
+        extent = m_pExtents[lo-1];
+        return true;
+    }
+
+    // No - build an extent from the block map. Stop at the next cached
+    // extent, and after an indirect block's worth of entries so that a big
+    // contiguous file doesn't pull its whole block map in at once.
+    ensureBlockLoaded(nBlock);
+    extent.logical = nBlock;
+    extent.physical = m_pBlocks[nBlock];
+    extent.length = 1;
+
+    size_t nMax = m_pExt2Fs->m_BlockSize / 4;
+    size_t nLimit = (lo < m_nExtents) ? m_pExtents[lo].logical : m_nBlocks;
+    while (extent.length < nMax && nBlock + extent.length < nLimit)
+    {
+        size_t nNext = nBlock + extent.length;
+        ensureBlockLoaded(nNext);
+
+        uint32_t expected = extent.physical ? extent.physical + extent.length : 0;
+        if (m_pBlocks[nNext] != expected)
+            break;
+        extent.length++;
+    }
+
+    insertExtent(lo, extent);
+    return true;
+}
+
+void Ext2Node::insertExtent(size_t idx, const Extent &extent)
+{
+    // Extend the previous extent if this carries straight on from it.
+    if (idx)
+    {
+        Extent &prev = m_pExtents[idx-1];
+        uint32_t expected = prev.physical ? prev.physical + prev.length : 0;
+        if (prev.logical + prev.length == extent.logical && extent.physical == expected)
+        {
+            prev.length += extent.length;
+            return;
+        }
+    }
+
+    if (m_nExtents == m_nExtentsSize)
+    {
+        m_nExtentsSize = m_nExtentsSize ? m_nExtentsSize * 2 : 8;
+        Extent *pTmp = new Extent[m_nExtentsSize];
+        memcpy(pTmp, m_pExtents, m_nExtents * sizeof(Extent));
+        delete [] m_pExtents;
+        m_pExtents = pTmp;
+    }
+
+    memmove(&m_pExtents[idx+1], &m_pExtents[idx], (m_nExtents - idx) * sizeof(Extent));
+    m_pExtents[idx] = extent;
+    m_nExtents++;
+}
+
+void Ext2Node::clearExtents()
+{
+    delete [] m_pExtents;
+    m_pExtents = 0;
+    m_nExtents = 0;
+    m_nExtentsSize = 0;
+}
+
 bool Ext2Node::getBlockNumber(size_t nBlock)
 {
     size_t nPerBlock = m_pExt2Fs->m_BlockSize/4;
@@ -238,6 +422,8 @@ bool Ext2Node::getBlockNumberIndirect(uint32_t inode_block, size_t nBlocks, size
         m_pBlocks[nBlocks++] = LITTLE_TO_HOST32(buffer[i]);
     }
 
+    m_pExt2Fs->unpinBlock(inode_block);
+
     return true;
 }
 
@@ -249,9 +435,10 @@ bool Ext2Node::getBlockNumberBiindirect(uint32_t inode_block, size_t nBlocks, si
 
     // What indirect block does nBlock exist on?
     size_t nIndirectBlock = (nBlock-nBlocks) / nPerBlock;
+    uint32_t indirectBlock = LITTLE_TO_HOST32(buffer[nIndirectBlock]);
+    m_pExt2Fs->unpinBlock(inode_block);
 
-    getBlockNumberIndirect(LITTLE_TO_HOST32(buffer[nIndirectBlock]),
-                           nBlocks+nIndirectBlock*nPerBlock, nBlock);
+    getBlockNumberIndirect(indirectBlock, nBlocks+nIndirectBlock*nPerBlock, nBlock);
 
     return true;
 }
@@ -264,123 +451,218 @@ bool Ext2Node::getBlockNumberTriindirect(uint32_t inode_block, size_t nBlocks, s
 
     // What biindirect block does nBlock exist on?
     size_t nBiBlock = (nBlock-nBlocks) / (nPerBlock*nPerBlock);
+    uint32_t biBlock = LITTLE_TO_HOST32(buffer[nBiBlock]);
+    m_pExt2Fs->unpinBlock(inode_block);
 
-    getBlockNumberBiindirect(LITTLE_TO_HOST32(buffer[nBiBlock]),
-                             nBlocks+nBiBlock*nPerBlock*nPerBlock, nBlock);
-
-    delete [] buffer;
+    getBlockNumberBiindirect(biBlock, nBlocks+nBiBlock*nPerBlock*nPerBlock, nBlock);
 
     return true;
 }
 
-bool Ext2Node::addBlock(uint32_t blockValue)
+bool Ext2Node::fillHole(size_t nBlock)
 {
-    size_t nEntriesPerBlock = m_pExt2Fs->m_BlockSize/4;
-
-    // Calculate whether direct, indirect or tri-indirect addressing is needed.
-    if (m_nBlocks < 12)
+    uint32_t block = allocateBlock();
+    if (block == 0)
     {
-        // Direct addressing is possible.
-        m_pInode->i_block[m_nBlocks] = HOST_TO_LITTLE32(blockValue);
+        SYSCALL_ERROR(NoSpaceLeftOnDevice);
+        return false;
     }
-    else if (m_nBlocks < 12 + nEntriesPerBlock)
+
+    // Zero it, as the write may not cover all of it.
+    uint8_t *pBuffer = reinterpret_cast<uint8_t*>(m_pExt2Fs->readBlock(block));
+    memset(pBuffer, 0, m_pExt2Fs->m_BlockSize);
+    m_pExt2Fs->writeBlock(block);
+    m_pExt2Fs->unpinBlock(block);
+
+    if (!setBlockNumber(nBlock, block))
     {
-        // Indirect addressing needed.
+        m_pExt2Fs->releaseBlock(block);
+        return false;
+    }
+    addToBlockCount(1);
 
-        // If this is the first indirect block, we need to reserve a new table block.
-        if (m_nBlocks == 12)
-        {
-            m_pInode->i_block[12] = HOST_TO_LITTLE32(m_pExt2Fs->findFreeBlock(m_InodeNumber));
-            if (m_pInode->i_block[12] == 0)
-            {
-                // We had a problem.
-                SYSCALL_ERROR(NoSpaceLeftOnDevice);
-                return false;
-            }
-        }
+    // The cached extent the hole was in is stale now.
+    clearExtents();
+    return true;
+}
 
-        // Now we can set the block.
-        uint32_t *buffer = reinterpret_cast<uint32_t*>(m_pExt2Fs->readBlock(LITTLE_TO_HOST32(m_pInode->i_block[12])));
+bool Ext2Node::setBlockNumber(size_t blockNum, uint32_t blockValue)
+{
+    size_t nPerBlock = m_pExt2Fs->m_BlockSize/4;
+
+    ensureBlockLoaded(blockNum);
 
-        buffer[m_nBlocks-12] = HOST_TO_LITTLE32(blockValue);
+    if (blockNum < 12)
+    {
+        m_pInode->i_block[blockNum] = HOST_TO_LITTLE32(blockValue);
+        m_pExt2Fs->writeInode(m_InodeNumber);
+        m_pBlocks[blockNum] = blockValue;
+        return true;
     }
-    else if (m_nBlocks < 12 + nEntriesPerBlock + nEntriesPerBlock*nEntriesPerBlock)
+
+    // Find the indirect block the entry lives in, filling in any tables
+    // that are missing because the hole spans them too.
+    uint32_t table;
+    size_t idx;
+    if (blockNum < nPerBlock+12)
+    {
+        table = getTableBlock(0, 12);
+        idx = blockNum - 12;
+    }
+    else if (blockNum < (nPerBlock*nPerBlock)+nPerBlock+12)
+    {
+        idx = blockNum - nPerBlock - 12;
+        table = getTableBlock(0, 13);
+        if (table)
+            table = getTableBlock(table, idx / nPerBlock);
+        idx %= nPerBlock;
+    }
+    else if (blockNum < (nPerBlock*nPerBlock*nPerBlock)+(nPerBlock*nPerBlock)+nPerBlock+12)
     {
-        // Bi-indirect addressing required.
+        idx = blockNum - (nPerBlock*nPerBlock) - nPerBlock - 12;
+        table = getTableBlock(0, 14);
+        if (table)
+            table = getTableBlock(table, idx / (nPerBlock*nPerBlock));
+        if (table)
+            table = getTableBlock(table, (idx / nPerBlock) % nPerBlock);
+        idx %= nPerBlock;
+    }
+    else
+    {
+        SYSCALL_ERROR(FileTooLarge);
+        return false;
+    }
+
+    if (table == 0)
+        return false;
 
-        // Index from the start of the bi-indirect block (i.e. ignore the 12 direct entries and one indirect block).
-        size_t biIdx = m_nBlocks - 12 - nEntriesPerBlock;
-        // Block number inside the bi-indirect table of where to find the indirect block table.
-        size_t indirectBlock = biIdx / nEntriesPerBlock;
-        // Index inside the indirect block table.
-        size_t indirectIdx = biIdx % nEntriesPerBlock;
+    uint32_t *pTable = reinterpret_cast<uint32_t*>(m_pExt2Fs->readBlock(table));
+    pTable[idx] = HOST_TO_LITTLE32(blockValue);
+    m_pExt2Fs->writeBlock(table);
+    m_pExt2Fs->unpinBlock(table);
 
-        // If this is the first bi-indirect block, we need to reserve a bi-indirect table block.
-        if (biIdx == 0)
+    m_pBlocks[blockNum] = blockValue;
+    return true;
+}
+
+uint32_t Ext2Node::getTableBlock(uint32_t table, size_t idx)
+{
+    uint32_t *pTable = 0;
+    uint32_t block;
+    if (table == 0)
+        block = LITTLE_TO_HOST32(m_pInode->i_block[idx]);
+    else
+    {
+        pTable = reinterpret_cast<uint32_t*>(m_pExt2Fs->readBlock(table));
+        block = LITTLE_TO_HOST32(pTable[idx]);
+    }
+
+    if (block == 0)
+    {
+        block = allocateBlock();
+        if (block == 0)
+            SYSCALL_ERROR(NoSpaceLeftOnDevice);
+        else
         {
-            m_pInode->i_block[13] = HOST_TO_LITTLE32(m_pExt2Fs->findFreeBlock(m_InodeNumber));
-            if (m_pInode->i_block[13] == 0)
+            // An empty table is all holes.
+            uint8_t *pBuffer = reinterpret_cast<uint8_t*>(m_pExt2Fs->readBlock(block));
+            memset(pBuffer, 0, m_pExt2Fs->m_BlockSize);
+            m_pExt2Fs->writeBlock(block);
+            m_pExt2Fs->unpinBlock(block);
+            addToBlockCount(1);
+
+            if (table == 0)
+            {
+                m_pInode->i_block[idx] = HOST_TO_LITTLE32(block);
+                m_pExt2Fs->writeInode(m_InodeNumber);
+            }
+            else
             {
-                // We had a problem.
-                SYSCALL_ERROR(NoSpaceLeftOnDevice);
-                return false;
+                pTable[idx] = HOST_TO_LITTLE32(block);
+                m_pExt2Fs->writeBlock(table);
             }
         }
+    }
 
-        // Now we can safely read the bi-indirect block.
-        uint32_t *pBlock = reinterpret_cast<uint32_t*>(m_pExt2Fs->readBlock(LITTLE_TO_HOST32(m_pInode->i_block[13])));
+    if (table)
+        m_pExt2Fs->unpinBlock(table);
+    return block;
+}
 
-        // Do we need to start a new indirect block?
-        if (indirectIdx == 0)
+uint32_t Ext2Node::allocateBlock()
+{
+    if (!m_nPrealloc)
+    {
+        // Aim to carry on straight after the current last block.
+        uint32_t goal = 0;
+        if (m_nBlocks)
         {
-            pBlock[indirectBlock] = HOST_TO_LITTLE32(m_pExt2Fs->findFreeBlock(m_InodeNumber));
-            if (pBlock[indirectBlock] == 0)
-            {
-                // We had a problem.
-                SYSCALL_ERROR(NoSpaceLeftOnDevice);
-                return false;
-            }
+            ensureBlockLoaded(m_nBlocks - 1);
+            if (m_pBlocks[m_nBlocks - 1])
+                goal = m_pBlocks[m_nBlocks - 1] + 1;
         }
 
-        // Cache this as it gets clobbered by the readBlock call (using the same buffer).
-        uint32_t nIndirectBlockNum = LITTLE_TO_HOST32(pBlock[indirectBlock]);
-
-        // Grab the indirect block.
-        pBlock = reinterpret_cast<uint32_t*>(m_pExt2Fs->readBlock(nIndirectBlockNum));
+        size_t nClaimed = 0;
+        m_PreallocStart = m_pExt2Fs->findFreeBlocks(m_InodeNumber, goal, EXT2_PREALLOC_BLOCKS, nClaimed);
+        if (!m_PreallocStart)
+            return 0;
+        m_nPrealloc = nClaimed;
+    }
 
-        // Set the correct entry.
-        pBlock[indirectIdx] = HOST_TO_LITTLE32(blockValue);
+    m_nPrealloc--;
+    return m_PreallocStart++;
+}
 
-        /// This causes a assertion failed in SlamAllocator when copying some file on a ext2 volume
-        /// (eddyb)
-        // Done.
-        //delete [] pBlock;
-    }
-    else
-    {
-        // Tri-indirect addressing required.
-        FATAL("EXT2: Tri-indirect addressing required, but not implemented.");
-        return false;
-    }
+void Ext2Node::discardPreallocation()
+{
+    for (; m_nPrealloc; m_nPrealloc--)
+        m_pExt2Fs->releaseBlock(m_PreallocStart++);
+}
 
+bool Ext2Node::addBlock(uint32_t blockValue)
+{
+    // Grow the map by a hole, then point the hole at the block: that fills
+    // in (and writes back) whatever indirect tables the new entry needs.
     uint32_t *pTmp = new uint32_t[m_nBlocks+1];
     memcpy(pTmp, m_pBlocks, m_nBlocks*4);
     delete [] m_pBlocks;
     m_pBlocks = pTmp;
-    m_pBlocks[m_nBlocks] = blockValue;
+    m_pBlocks[m_nBlocks] = 0;
 
     m_nBlocks++;
-    m_pInode->i_blocks = HOST_TO_LITTLE32(m_nBlocks);
+    if (!setBlockNumber(m_nBlocks-1, blockValue))
+    {
+        m_nBlocks--;
+        return false;
+    }
+
+    // Keep the last cached extent growing with the file, if it reaches the end.
+    if (m_nExtents)
+    {
+        Extent &last = m_pExtents[m_nExtents-1];
+        if (last.physical && last.logical + last.length == m_nBlocks-1 &&
+            last.physical + last.length == blockValue)
+            last.length++;
+    }
+
+    addToBlockCount(1);
 
     return true;
 }
 
+void Ext2Node::addToBlockCount(size_t nBlocks)
+{
+    size_t nSectors = nBlocks * (m_pExt2Fs->m_BlockSize / 512);
+    m_pInode->i_blocks = HOST_TO_LITTLE32(LITTLE_TO_HOST32(m_pInode->i_blocks) + nSectors);
+    m_pExt2Fs->writeInode(m_InodeNumber);
+}
+
 void Ext2Node::fileAttributeChanged(size_t size, size_t atime, size_t mtime, size_t ctime)
 {
     // Reconstruct the inode from the cached fields.
-    m_pInode->i_blocks = HOST_TO_LITTLE32(m_nBlocks);
     m_pInode->i_size = HOST_TO_LITTLE32(size); /// \todo 4GB files.
     m_pInode->i_atime = HOST_TO_LITTLE32(atime);
     m_pInode->i_mtime = HOST_TO_LITTLE32(mtime);
     m_pInode->i_ctime = HOST_TO_LITTLE32(ctime);
+    m_pExt2Fs->writeInode(m_InodeNumber);
 }
@@ -20,6 +20,9 @@
 #include <utilities/Vector.h>
 #include "Ext2Filesystem.h"
 
+/// Number of blocks to claim at once for a growing file, to keep it contiguous.
+#define EXT2_PREALLOC_BLOCKS 8
+
 /** A node in an ext2 filesystem. */
 class Ext2Node
 {
@@ -49,19 +52,66 @@ public:
 
     uintptr_t readBlock(uint64_t location);
 
+    /** Returns the filesystem block logical block \p nBlock is stored in,
+        or zero if it's a hole or past the end of the file. */
+    uint32_t getDiskBlock(size_t nBlock);
+
 protected:
     /** Ensures the inode is at least 'size' big. */
     bool ensureLargeEnough(size_t size);
 
     bool addBlock(uint32_t blockValue);
 
+    /** Adds \p nBlocks newly used blocks, data or indirect tables, to
+        i_blocks - which counts them in 512-byte sectors. */
+    void addToBlockCount(size_t nBlocks);
+
+    /** Frees indirect table \p table and, for a bi- or tri-indirect table
+        (\p depth 2 or 3), the tables under it that map the first \p nBlocks
+        blocks. The data blocks themselves aren't freed. */
+    void releaseTable(uint32_t table, size_t depth, size_t nBlocks);
+
+    /** Claims a block for this node, carrying on from its last block and
+        taking from (or refilling) the preallocated run. */
+    uint32_t allocateBlock();
+    /** Gives any unused preallocated blocks back to the filesystem. */
+    void discardPreallocation();
+
     bool ensureBlockLoaded(size_t nBlock);
     bool getBlockNumber(size_t nBlock);
     bool getBlockNumberIndirect(uint32_t inode_block, size_t nBlocks, size_t nBlock);
     bool getBlockNumberBiindirect(uint32_t inode_block, size_t nBlocks, size_t nBlock);
     bool getBlockNumberTriindirect(uint32_t inode_block, size_t nBlocks, size_t nBlock);
 
+    /** Points logical block \p blockNum, which must be within the file,
+        at \p blockValue in the inode or indirect blocks. */
     bool setBlockNumber(size_t blockNum, uint32_t blockValue);
+    /** Returns entry \p idx of indirect block \p table (or of the inode's
+        block array, if \p table is zero), first pointing it at a new,
+        zeroed block if it's a hole.
+        \return The block, or zero if the disk is full. */
+    uint32_t getTableBlock(uint32_t table, size_t idx);
+    /** Allocates and zeroes a block for the hole at logical block \p nBlock. */
+    bool fillHole(size_t nBlock);
+
+    /** A run of blocks that are contiguous on disk: logical blocks
+        [logical, logical+length) live at [physical, physical+length).
+        A physical block of zero means the run is a hole. */
+    struct Extent
+    {
+        uint32_t logical;
+        uint32_t physical;
+        uint32_t length;
+    };
+
+    /** Finds the extent containing logical block \p nBlock, building it
+        from the block map and caching it if it isn't cached already. */
+    bool getExtent(size_t nBlock, Extent &extent);
+    /** Adds \p extent to the cache at index \p idx, merging it with the
+        extent before it where possible. */
+    void insertExtent(size_t idx, const Extent &extent);
+    /** Throws away all cached extents. */
+    void clearExtents();
 
     Inode *m_pInode;
     uint32_t m_InodeNumber;
@@ -70,6 +120,15 @@ protected:
     uint32_t *m_pBlocks;
     uint32_t m_nBlocks;
 
+    /** Cached extents, sorted by logical block. */
+    Extent *m_pExtents;
+    size_t m_nExtents;
+    size_t m_nExtentsSize;
+
+    /** Blocks claimed ahead of time for this node but not used yet. */
+    uint32_t m_PreallocStart;
+    uint32_t m_nPrealloc;
+
     size_t m_nSize;
 };
 
@@ -263,7 +263,7 @@ bool FatDirectory::addEntry(String filename, File *pFile, size_t type)
       // cacheDirectoryContents to build the cache properly.
       // NOTICE("Adding " << filename << "...");
       if(m_bCachePopulated)
-        m_Cache.insert(filename, pFile);
+        addToCache(filename, pFile);
 
       return true;
     }
@@ -342,7 +342,7 @@ bool FatDirectory::removeEntry(File *pFile)
 
   pFs->writeDirectoryEntry(dir, dirClus, dirOffset);
   if(m_bCachePopulated)
-    m_Cache.remove(filename);
+    removeFromCache(filename);
   return true;
 }
 
@@ -360,7 +360,7 @@ void FatDirectory::cacheDirectoryContents()
       NOTICE("Adding root directory");
     FatFileInfo info;
     info.creationTime = info.modifiedTime = info.accessedTime = 0;
-    m_Cache.insert(String("."), new FatDirectory(String("."), m_Inode, pFs, 0, info));
+    populateCache(String("."), new FatDirectory(String("."), m_Inode, pFs, 0, info));
     if(!m_bCachePopulated)
       m_bCachePopulated = true;
   }
@@ -479,7 +479,7 @@ void FatDirectory::cacheDirectoryContents()
         }
 
         // NOTICE("Inserting '" << filename << "'.");
-        m_Cache.insert(filename, pF);
+        populateCache(filename, pF);
         if(!m_bCachePopulated)
           m_bCachePopulated = true;
       }
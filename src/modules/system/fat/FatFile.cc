@@ -17,20 +17,25 @@
 #include "FatFile.h"
 #include "FatFilesystem.h"
 
+#include <Log.h>
 #include <process/Mutex.h>
 #include <utilities/MemoryPool.h>
+#include <utilities/utility.h>
 #include <LockGuard.h>
 
 FatFile::FatFile(String name, Time accessedTime, Time modifiedTime, Time creationTime,
                  uintptr_t inode, class Filesystem *pFs, size_t size, uint32_t dirClus,
                  uint32_t dirOffset, File *pParent) :
     File(name,accessedTime,modifiedTime,creationTime,inode,pFs,size,pParent),
-    m_DirClus(dirClus), m_DirOffset(dirOffset), m_FileBlockCache()
+    m_DirClus(dirClus), m_DirOffset(dirOffset), m_FileBlockCache(), m_pRuns(0),
+    m_nRuns(0), m_nRunsSize(0), m_nMappedClusters(0), m_bChainMapped(false),
+    m_ClusterMapLock(false)
 {
 }
 
 FatFile::~FatFile()
 {
+    delete [] m_pRuns;
 }
 
 uintptr_t FatFile::readBlock(uint64_t location)
@@ -57,3 +62,126 @@ void FatFile::extend(size_t newSize)
         m_Size = newSize;
     }
 }
+
+bool FatFile::getClusterRun(uint32_t nCluster, ClusterRun &run)
+{
+    LockGuard<Mutex> guard(m_ClusterMapLock);
+
+    if (!mapClusters(nCluster))
+        return false;
+
+    // Find the first run starting after nCluster - the one before it holds it.
+    size_t lo = 0, hi = m_nRuns;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (m_pRuns[mid].logical <= nCluster)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    run = m_pRuns[lo-1];
+    return true;
+}
+
+uint32_t FatFile::getLastCluster()
+{
+    LockGuard<Mutex> guard(m_ClusterMapLock);
+
+    mapClusters(~0U);
+    if (!m_nRuns)
+        return 0;
+
+    ClusterRun &last = m_pRuns[m_nRuns-1];
+    return last.physical + last.length - 1;
+}
+
+void FatFile::appendCluster(uint32_t cluster)
+{
+    LockGuard<Mutex> guard(m_ClusterMapLock);
+
+    // A partial map picks the new cluster up from the FAT when it gets there.
+    if (m_bChainMapped && m_nRuns)
+        addCluster(cluster);
+}
+
+void FatFile::clearClusterMap()
+{
+    LockGuard<Mutex> guard(m_ClusterMapLock);
+
+    delete [] m_pRuns;
+    m_pRuns = 0;
+    m_nRuns = 0;
+    m_nRunsSize = 0;
+    m_nMappedClusters = 0;
+    m_bChainMapped = false;
+}
+
+bool FatFile::mapClusters(uint32_t nCluster)
+{
+    FatFilesystem *pFs = reinterpret_cast<FatFilesystem*>(m_pFilesystem);
+
+    if (!m_nRuns && !m_bChainMapped)
+    {
+        // The inode of the file is the first cluster.
+        if (getInode())
+            addCluster(getInode());
+        else
+            m_bChainMapped = true;
+    }
+
+    while (nCluster >= m_nMappedClusters && !m_bChainMapped)
+    {
+        ClusterRun &last = m_pRuns[m_nRuns-1];
+        uint32_t clus = pFs->getClusterEntry(last.physical + last.length - 1);
+        if (clus == 0 || pFs->isEof(clus))
+        {
+            if (clus == 0)
+                WARNING("FAT: cluster chain of " << getFullPath() << " ends in a free cluster");
+            m_bChainMapped = true;
+            break;
+        }
+
+        // A chain can't be longer than the volume - it must loop back on itself.
+        if (m_nMappedClusters >= pFs->m_nClusters)
+        {
+            WARNING("FAT: cluster chain of " << getFullPath() << " loops");
+            m_bChainMapped = true;
+            break;
+        }
+
+        addCluster(clus);
+    }
+
+    return nCluster < m_nMappedClusters;
+}
+
+void FatFile::addCluster(uint32_t cluster)
+{
+    if (m_nRuns)
+    {
+        ClusterRun &last = m_pRuns[m_nRuns-1];
+        if (last.physical + last.length == cluster)
+        {
+            last.length++;
+            m_nMappedClusters++;
+            return;
+        }
+    }
+
+    if (m_nRuns == m_nRunsSize)
+    {
+        m_nRunsSize = m_nRunsSize ? m_nRunsSize * 2 : 8;
+        ClusterRun *pTmp = new ClusterRun[m_nRunsSize];
+        memcpy(pTmp, m_pRuns, m_nRuns * sizeof(ClusterRun));
+        delete [] m_pRuns;
+        m_pRuns = pTmp;
+    }
+
+    m_pRuns[m_nRuns].logical = m_nMappedClusters;
+    m_pRuns[m_nRuns].physical = cluster;
+    m_pRuns[m_nRuns].length = 1;
+    m_nRuns++;
+    m_nMappedClusters++;
+}
@@ -22,6 +22,7 @@
 #include <utilities/String.h>
 #include <utilities/RadixTree.h>
 #include <utilities/Cache.h>
+#include <process/Mutex.h>
 
 /** A File is a file, a directory or a symlink. */
 class FatFile : public File
@@ -58,11 +59,54 @@ public:
 
   void extend(size_t newSize);
 
+  /** A run of clusters that are contiguous on disk: logical clusters
+      [logical, logical+length) of the file live at [physical, physical+length). */
+  struct ClusterRun
+  {
+    uint32_t logical;
+    uint32_t physical;
+    uint32_t length;
+  };
+
+  /** Finds the run containing logical cluster \p nCluster, following the
+      chain further into the FAT if it hasn't been mapped that far yet.
+      \return False if the chain ends before \p nCluster. */
+  bool getClusterRun(uint32_t nCluster, ClusterRun &run);
+
+  /** Returns the last cluster in the file's chain, or zero if it has none. */
+  uint32_t getLastCluster();
+
+  /** Records that \p cluster has just been linked onto the end of the chain. */
+  void appendCluster(uint32_t cluster);
+
+  /** Throws away the cluster map, for when the chain is cut short or the
+      first cluster changes. It is rebuilt from the FAT on demand. */
+  void clearClusterMap();
+
 private:
+  /** Follows the chain until logical cluster \p nCluster is mapped, or the
+      chain ends. \note m_ClusterMapLock must be held. */
+  bool mapClusters(uint32_t nCluster);
+
+  /** Adds \p cluster as the next logical cluster in the map, growing the
+      last run where it is contiguous. \note m_ClusterMapLock must be held. */
+  void addCluster(uint32_t cluster);
+
   uint32_t m_DirClus;
   uint32_t m_DirOffset;
 
   Cache m_FileBlockCache;
+
+  /** Runs of the cluster chain mapped so far, sorted by logical cluster. */
+  ClusterRun *m_pRuns;
+  size_t m_nRuns;
+  size_t m_nRunsSize;
+  /** Number of logical clusters covered by m_pRuns. */
+  uint32_t m_nMappedClusters;
+  /** Set once the map reaches the end of the chain. */
+  bool m_bChainMapped;
+  /** Protects the cluster map. */
+  Mutex m_ClusterMapLock;
 };
 
 #endif
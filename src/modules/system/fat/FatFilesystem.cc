@@ -50,7 +50,7 @@ bool isPowerOf2(uint32_t n)
 FatFilesystem::FatFilesystem() :
         m_Superblock(), m_Superblock16(), m_Superblock32(), m_FsInfo(), m_Type(FAT12), m_DataAreaStart(0),
         m_RootDirCount(0), m_FatSector(0), m_RootDir(), m_BlockSize(0), m_pFatCache(0), m_FatLock(), m_pRoot(0),
-        m_FatCache(), m_FreeClusterHint()
+        m_FatCache(), m_FreeClusterHint(), m_pClusterBitmap(0), m_nClusters(0), m_ClusterBitmapLock()
 {
 }
 
@@ -60,6 +60,7 @@ FatFilesystem::~FatFilesystem()
         delete m_pRoot;
     if(m_pFatCache)
         delete [] m_pFatCache;
+    delete [] m_pClusterBitmap;
 }
 
 bool FatFilesystem::initialise(Disk *pDisk)
@@ -168,6 +169,7 @@ bool FatFilesystem::initialise(Disk *pDisk)
     m_DataAreaStart = firstDataSector;
     m_RootDirCount = rootDirSectors;
     m_BlockSize = m_Superblock.BPB_SecPerClus * m_Superblock.BPB_BytsPerSec;
+    m_nClusters = clusterCount + 2; // clusters 0 and 1 are reserved
 
     // read in the FAT32 FSInfo structure
     if (m_Type == FAT32)
@@ -186,8 +188,17 @@ bool FatFilesystem::initialise(Disk *pDisk)
     //m_pFatCache = new uint8_t[fatSz];
     //readSectorBlock(fatSector, fatSz, reinterpret_cast<uintptr_t>(m_pFatCache));
 
-    // Setup the free cluster hint for non-FAT32 volumes
+    // Find out which clusters are in use, and start allocating from where
+    // the last user of a FAT32 volume left off.
+    if (!buildClusterBitmap())
+    {
+        ERROR("FAT: Couldn't read the FAT on device " << devName);
+        return false;
+    }
+
     m_FreeClusterHint = 2;
+    if (m_Type == FAT32 && m_FsInfo.FSI_NxtFree >= 2 && m_FsInfo.FSI_NxtFree < m_nClusters)
+        m_FreeClusterHint = m_FsInfo.FSI_NxtFree;
 
     // Define the root directory early
     getRoot();
@@ -302,8 +313,7 @@ uint64_t FatFilesystem::read(File *pFile, uint64_t location, uint64_t size, uint
         return 0;
 
     // the inode of the file is the first cluster
-    uint32_t clus = pFile->getInode();
-    if (clus == 0)
+    if (pFile->getInode() == 0)
         return 0; // can't do it
 
     // validity checking
@@ -327,110 +337,89 @@ uint64_t FatFilesystem::read(File *pFile, uint64_t location, uint64_t size, uint
         }
     }
 
-    // finalSize holds the total amount of data to read, now find the cluster and sector offsets
-    uint32_t clusOffset = location / (m_Superblock.BPB_SecPerClus * m_Superblock.BPB_BytsPerSec);
-    uint32_t firstOffset = location % (m_Superblock.BPB_SecPerClus * m_Superblock.BPB_BytsPerSec); // the offset within the cluster specified above to start reading from
-
-    // tracking info
+    FatFile *pFatFile = static_cast<FatFile*>(pFile);
+    uint8_t* destBuffer = reinterpret_cast<uint8_t*>(buffer);
 
+    // main read loop - one pass per run of contiguous clusters
     uint64_t bytesRead = 0;
-    uint64_t currOffset = firstOffset;
-    while (clusOffset)
+    while (bytesRead < finalSize)
     {
-        clus = getClusterEntry(clus);
-        if (clus == 0 || isEof(clus))
+        uint32_t nCluster = location / m_BlockSize;
+        FatFile::ClusterRun run;
+        if (!pFatFile->getClusterRun(nCluster, run))
         {
-            WARNING("FAT: CLUSTER FAIL - " << clus << ", cluster offset = " << clusOffset << "."); // <-- This is where the installer + lodisk is failing.
+            WARNING("FAT: CLUSTER FAIL - cluster offset = " << nCluster << ".");
             WARNING("    -> file: " << pFile->getFullPath());
             WARNING("    -> size: " << pFile->getSize());
-            return 0; // can't do it
-        }
-        clusOffset--;
-    }
-
-    // buffers
-    uint8_t* tmpBuffer = new uint8_t[m_BlockSize];
-    uint8_t* destBuffer = reinterpret_cast<uint8_t*>(buffer);
-
-    // main read loop
-    while (true)
-    {
-        // read in the entire cluster
-        readCluster(clus, reinterpret_cast<uintptr_t> (tmpBuffer));
-
-        // How many bytes should we copy?
-        size_t bytesToCopy = finalSize - bytesRead;
-        if(bytesToCopy > m_BlockSize)
-        {
-            bytesToCopy = m_BlockSize;
+            return bytesRead;
         }
 
-        // Perform the copy.
-        memcpy(&destBuffer[bytesRead], &tmpBuffer[currOffset], bytesToCopy);
-        currOffset += bytesToCopy;
-        bytesRead += bytesToCopy;
+        // Everything up to the end of the run is contiguous on disk.
+        uint64_t runBytes = static_cast<uint64_t>(run.logical + run.length) * m_BlockSize - location;
+        if (runBytes > finalSize - bytesRead)
+            runBytes = finalSize - bytesRead;
 
-        // Done?
-        if(bytesRead == finalSize)
+        uint64_t diskLocation = getClusterLocation(run.physical + (nCluster - run.logical), location % m_BlockSize);
+        if (!readDiskBytes(diskLocation, runBytes, reinterpret_cast<uintptr_t>(&destBuffer[bytesRead])))
         {
-            delete [] tmpBuffer;
+            ERROR("FAT: read of " << pFile->getFullPath() << " failed");
             return bytesRead;
         }
 
-        // end of cluster, set the offset back to zero
-        currOffset = 0;
-
-        // grab the next cluster, check for EOF
-        clus = getClusterEntry(clus);
-        if (clus == 0)
-            break; // something broke!
-
-        if (isEof(clus))
-            break;
+        bytesRead += runBytes;
+        location += runBytes;
     }
 
-    delete [] tmpBuffer;
-
-    // if we reach here, something's gone wrong
-    WARNING("FAT: read returning zero... Something's not right.");
-    return 0;
+    return bytesRead;
 }
 
 /////////////////////////////////////////////////////////////////////////////
 
 uint32_t FatFilesystem::findFreeCluster(bool bLock)
 {
-    size_t j;
-    uint32_t clus;
-    uint32_t totalSectors = m_Superblock.BPB_TotSec32;
-    if (totalSectors == 0)
+    uint32_t clus = 0;
+    size_t nWords = (m_nClusters + 31) / 32;
+
+    m_ClusterBitmapLock.acquire();
+
+    // Search from the hint to the end of the volume, then wrap round to the
+    // start, skipping 32 allocated clusters at a time.
+    for (size_t pass = 0; pass < 2 && !clus; pass++)
     {
-        if (m_Type != FAT32)
-            totalSectors = m_Superblock.BPB_TotSec16;
-        else
+        size_t start = pass ? 2 : m_FreeClusterHint;
+        for (size_t w = start / 32; w < nWords; w++)
         {
-            return 0;
+            uint32_t bits = m_pClusterBitmap[w];
+            if (w == start / 32)
+                bits |= (1U << (start % 32)) - 1;
+            if (bits == ~0U)
+                continue;
+
+            uint32_t candidate = w * 32 + __builtin_ctz(~bits);
+            if (candidate < m_nClusters)
+                clus = candidate;
+            break;
         }
     }
 
-    uint32_t mask = m_Type == FAT32 ? 0x0FFFFFFF : 0xFFFF;
-
-    for (j = (m_Type == FAT32 ? m_FsInfo.FSI_NxtFree : m_FreeClusterHint); j < (totalSectors / m_Superblock.BPB_SecPerClus); j++)
+    if (clus)
     {
-        clus = getClusterEntry(j, false);
-        if ((clus & mask) == 0)
-        {
-            /// \todo For FAT32, update the FSInfo structure
-            setClusterEntry(j, eofValue(), false); // default to it being EOF - ie, pin the cluster
+        m_pClusterBitmap[clus / 32] |= 1U << (clus % 32);
+        m_FreeClusterHint = clus + 1;
+    }
 
-            // All done!
-            m_FreeClusterHint = j + 1;
-            return j;
-        }
+    m_ClusterBitmapLock.release();
+
+    if (!clus)
+    {
+        ERROR("FAT: no free clusters left");
+        return 0;
     }
 
-    FATAL("findFreeCluster returning zero!");
-    return 0;
+    /// \todo For FAT32, update the FSInfo structure
+    setClusterEntry(clus, eofValue(), false); // default to it being EOF - ie, pin the cluster
+
+    return clus;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -472,12 +461,13 @@ uint64_t FatFilesystem::write(File *pFile, uint64_t location, uint64_t size, uin
         // write into the directory entry, and into the File itself
         pFile->setInode(freeClus);
         setCluster(pFile, freeClus);
+        static_cast<FatFile*>(pFile)->clearClusterMap();
     }
 
+    FatFile *pFatFile = static_cast<FatFile*>(pFile);
+
     uint32_t clusSize = m_Superblock.BPB_SecPerClus * m_Superblock.BPB_BytsPerSec;
     uint32_t finalOffset = location + size;
-    uint32_t offsetSector = location / m_Superblock.BPB_BytsPerSec;
-    uint32_t clus = 0;
 
     // does the file currently have enough clusters to allow us to write without stopping?
     int i = clusSize;
@@ -499,14 +489,7 @@ uint64_t FatFilesystem::write(File *pFile, uint64_t location, uint64_t size, uin
         if (numExtraBytes % i)
             j++;
 
-        clus = firstClus;
-
-        uint32_t lastClus = clus;
-        while (!isEof(clus))
-        {
-            lastClus = clus;
-            clus = getClusterEntry(clus, false);
-        }
+        uint32_t lastClus = pFatFile->getLastCluster();
 
         uint32_t prev = 0;
         for (i = 0; i < j; i++)
@@ -520,79 +503,42 @@ uint64_t FatFilesystem::write(File *pFile, uint64_t location, uint64_t size, uin
             }
 
             setClusterEntry(prev, lastClus, false);
+            pFatFile->appendCluster(lastClus);
         }
 
         setClusterEntry(lastClus, eofValue(), false);
     }
 
-    uint64_t finalSize = size;
-
-    // finalSize holds the total amount of data to read, now find the cluster and sector offsets
-    uint32_t clusOffset = offsetSector / m_Superblock.BPB_SecPerClus; //location / (m_Superblock.BPB_SecPerClus * m_Superblock.BPB_BytsPerSec);
-    uint32_t firstOffset = location % (m_Superblock.BPB_SecPerClus * m_Superblock.BPB_BytsPerSec); // the offset within the cluster specified above to start reading from
-
-    // tracking info
-
-    uint64_t bytesWritten = 0;
-    uint64_t currOffset = firstOffset;
-    clus = firstClus;
-    for (uint32_t z = 0; z < clusOffset; z++)
-    {
-        clus = getClusterEntry(clus, false);
-        if (clus == 0 || isEof(clus))
-            return 0;
-    }
-
-    // buffers
-    uint8_t* tmpBuffer = new uint8_t[m_BlockSize];
     uint8_t* srcBuffer = reinterpret_cast<uint8_t*>(buffer);
 
-    // main write loop
-    while (true)
+    // main write loop - one pass per run of contiguous clusters
+    uint64_t bytesWritten = 0;
+    uint64_t currLocation = location;
+    while (bytesWritten < size)
     {
-        // read in the entire cluster
-        readCluster(clus, reinterpret_cast<uintptr_t> (tmpBuffer));
-
-        // read...
-        while (currOffset < m_BlockSize)
-        {
-            tmpBuffer[currOffset] = srcBuffer[bytesWritten];
-
-            currOffset++;
-            bytesWritten++;
-
-            if (bytesWritten == finalSize)
-            {
-                // update the size on disk, if needed
-                if (fileSizeChange != 0)
-                {
-                    updateFileSize(pFile, fileSizeChange);
-                    pFile->setSize(pFile->getSize() + fileSizeChange);
-                }
-
-                // and now actually write the updated file contents
-                writeCluster(clus, reinterpret_cast<uintptr_t> (tmpBuffer));
-
-                delete [] tmpBuffer;
-                return bytesWritten;
-            }
-        }
-
-        writeCluster(clus, reinterpret_cast<uintptr_t> (tmpBuffer));
+        uint32_t nCluster = currLocation / clusSize;
+        FatFile::ClusterRun run;
+        if (!pFatFile->getClusterRun(nCluster, run))
+            break;
 
-        // end of cluster, set the offset back to zero
-        currOffset = 0;
+        uint64_t runBytes = static_cast<uint64_t>(run.logical + run.length) * clusSize - currLocation;
+        if (runBytes > size - bytesWritten)
+            runBytes = size - bytesWritten;
 
-        // grab the next cluster, check for EOF
-        clus = getClusterEntry(clus, false);
-        if (clus == 0)
-            break; // something broke!
-
-        if (isEof(clus))
+        uint64_t diskLocation = getClusterLocation(run.physical + (nCluster - run.logical), currLocation % clusSize);
+        if (!writeDiskBytes(diskLocation, runBytes, reinterpret_cast<uintptr_t>(&srcBuffer[bytesWritten])))
             break;
+
+        bytesWritten += runBytes;
+        currLocation += runBytes;
     }
 
-    delete [] tmpBuffer;
+    // update the size on disk, if needed
+    if (bytesWritten == size && fileSizeChange != 0)
+    {
+        updateFileSize(pFile, fileSizeChange);
+        pFile->setSize(pFile->getSize() + fileSizeChange);
+    }
 
     return bytesWritten;
 }
@@ -742,19 +688,29 @@ bool FatFilesystem::readCluster(uint32_t block, uintptr_t buffer)
 bool FatFilesystem::readSectorBlock(uint32_t sec, size_t size, uintptr_t buffer)
 {
     assert(buffer);
-    size_t off = 0;
+    return readDiskBytes(static_cast<uint64_t>(m_Superblock.BPB_BytsPerSec) * static_cast<uint64_t>(sec), size, buffer);
+}
+
+bool FatFilesystem::readDiskBytes(uint64_t location, size_t size, uintptr_t buffer)
+{
     while (size)
     {
-        size_t sz = (size > 512) ? 512 : size;
-        uintptr_t buff = m_pDisk->read(
-            (static_cast<uint64_t>(m_Superblock.BPB_BytsPerSec) * static_cast<uint64_t>(sec)) + off);
+        // Copy up to the end of the disk cache page.
+        uint64_t sector = location & ~511ULL;
+        size_t sz = 4096 - (location % 4096);
+        if (sz > size)
+            sz = size;
+
+        uintptr_t buff = m_pDisk->read(sector);
         if(!buff)
             return false;
-        memcpy(reinterpret_cast<void*>(buffer), reinterpret_cast<void*>(buff),
+        memcpy(reinterpret_cast<void*>(buffer), reinterpret_cast<void*>(buff + (location - sector)),
                sz);
+        m_pDisk->unpin(sector);
+
         buffer += sz;
         size -= sz;
-        off += sz;
+        location += sz;
     }
     return true;
 }
@@ -769,17 +725,116 @@ bool FatFilesystem::writeCluster(uint32_t block, uintptr_t buffer)
 bool FatFilesystem::writeSectorBlock(uint32_t sec, size_t size, uintptr_t buffer)
 {
     assert(buffer);
-    size_t off = 0;
+    return writeDiskBytes(static_cast<uint64_t>(m_Superblock.BPB_BytsPerSec) * static_cast<uint64_t>(sec), size, buffer);
+}
+
+bool FatFilesystem::writeDiskBytes(uint64_t location, size_t size, uintptr_t buffer)
+{
     while (size)
     {
-        size_t sz = (size > 4096) ? 4096 : size;
-        uintptr_t buff = m_pDisk->read(static_cast<uint64_t>(m_Superblock.BPB_BytsPerSec)*static_cast<uint64_t>(sec)+off);
-        memcpy(reinterpret_cast<void*>(buff), reinterpret_cast<void*>(buffer),
+        uint64_t sector = location & ~511ULL;
+        size_t sz = 4096 - (location % 4096);
+        if (sz > size)
+            sz = size;
+
+        uintptr_t buff = m_pDisk->read(sector);
+        if(!buff)
+            return false;
+        memcpy(reinterpret_cast<void*>(buff + (location - sector)), reinterpret_cast<void*>(buffer),
                sz);
+        m_pDisk->write(sector);
+        m_pDisk->unpin(sector);
+
         buffer += sz;
         size -= sz;
-        off += sz;
+        location += sz;
+    }
+    return true;
+}
+
+bool FatFilesystem::buildClusterBitmap()
+{
+    size_t nWords = (m_nClusters + 31) / 32;
+    m_pClusterBitmap = new uint32_t[nWords];
+    memset(m_pClusterBitmap, 0, nWords * sizeof(uint32_t));
+
+    // Clusters 0 and 1 are reserved.
+    m_pClusterBitmap[0] |= 3;
+
+    size_t fatBytes = 0;
+    switch (m_Type)
+    {
+        case FAT12:
+            fatBytes = (m_nClusters * 3 + 1) / 2;
+            break;
+        case FAT16:
+            fatBytes = m_nClusters * 2;
+            break;
+        case FAT32:
+            fatBytes = m_nClusters * 4;
+            break;
     }
+
+    // FAT12 entries straddle sector boundaries, but the whole FAT is only a
+    // few KB, so read it in one go. The others are read a page at a time.
+    size_t chunkSize = (m_Type == FAT12) ? fatBytes : 4096;
+    uint8_t *pChunk = new uint8_t[chunkSize];
+    uint64_t fatLocation = static_cast<uint64_t>(m_FatSector) * m_Superblock.BPB_BytsPerSec;
+
+    for (size_t off = 0; off < fatBytes; off += chunkSize)
+    {
+        size_t sz = (fatBytes - off > chunkSize) ? chunkSize : fatBytes - off;
+        if (!readDiskBytes(fatLocation + off, sz, reinterpret_cast<uintptr_t>(pChunk)))
+        {
+            delete [] pChunk;
+            delete [] m_pClusterBitmap;
+            m_pClusterBitmap = 0;
+            return false;
+        }
+
+        uint32_t first = 0, count = 0;
+        switch (m_Type)
+        {
+            case FAT12:
+                count = m_nClusters;
+                break;
+            case FAT16:
+                first = off / 2;
+                count = sz / 2;
+                break;
+            case FAT32:
+                first = off / 4;
+                count = sz / 4;
+                break;
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t clus = first + i;
+            uint32_t ent = 0;
+            switch (m_Type)
+            {
+                case FAT12:
+                {
+                    uint32_t b = clus + (clus / 2);
+                    ent = pChunk[b] | (pChunk[b + 1] << 8);
+                    ent = (clus & 0x1) ? (ent >> 4) : (ent & 0x0FFF);
+                    break;
+                }
+                case FAT16:
+                    ent = reinterpret_cast<uint16_t*>(pChunk)[i];
+                    break;
+                case FAT32:
+                    ent = reinterpret_cast<uint32_t*>(pChunk)[i] & 0x0FFFFFFF;
+                    break;
+            }
+
+            if (ent && clus < m_nClusters)
+                m_pClusterBitmap[clus / 32] |= 1U << (clus % 32);
+        }
+    }
+
+    delete [] pChunk;
     return true;
 }
 
@@ -888,6 +943,21 @@ uint32_t FatFilesystem::setClusterEntry(uint32_t cluster, uint32_t value, bool b
         return 0;
     }
 
+    // Keep the free cluster bitmap in step with the FAT.
+    if (m_pClusterBitmap && cluster < m_nClusters)
+    {
+        m_ClusterBitmapLock.acquire();
+        if (value)
+            m_pClusterBitmap[cluster / 32] |= 1U << (cluster % 32);
+        else
+        {
+            m_pClusterBitmap[cluster / 32] &= ~(1U << (cluster % 32));
+            if (cluster < m_FreeClusterHint)
+                m_FreeClusterHint = cluster;
+        }
+        m_ClusterBitmapLock.release();
+    }
+
     uint32_t fatOffset = 0;
     switch (m_Type)
     {
@@ -1120,6 +1190,9 @@ void FatFilesystem::truncate(File *pFile)
             setClusterEntry(prev, 0, true);
         }
     }
+
+    // Only the first cluster is left.
+    static_cast<FatFile*>(pFile)->clearClusterMap();
 }
 
 void FatFilesystem::extend(File *pFile, size_t size)
@@ -1154,6 +1227,7 @@ void FatFilesystem::extend(File *pFile, size_t size)
         // Update the cluster and file object.
         pFile->setInode(freeClus);
         setCluster(pFile, freeClus);
+        static_cast<FatFile*>(pFile)->clearClusterMap();
 
         // Do we need to do anything more?
         if(clusSize >= size)
@@ -1163,8 +1237,6 @@ void FatFilesystem::extend(File *pFile, size_t size)
     }
 
     uint32_t finalOffset = size;
-    uint32_t offsetSector = pFile->getSize() / m_Superblock.BPB_BytsPerSec;
-    uint32_t clus = 0;
 
     // Figure out how many (if any) additional clusters we need to link in now.
     int i = clusSize;
@@ -1186,14 +1258,8 @@ void FatFilesystem::extend(File *pFile, size_t size)
         if (numExtraBytes % i)
             j++;
 
-        clus = firstClus;
-
-        uint32_t lastClus = clus;
-        while (!isEof(clus))
-        {
-            lastClus = clus;
-            clus = getClusterEntry(clus, false);
-        }
+        FatFile *pFatFile = static_cast<FatFile*>(pFile);
+        uint32_t lastClus = pFatFile->getLastCluster();
 
         uint32_t prev = 0;
         for (i = 0; i < j; i++)
@@ -1207,6 +1273,7 @@ void FatFilesystem::extend(File *pFile, size_t size)
             }
 
             setClusterEntry(prev, lastClus, false);
+            pFatFile->appendCluster(lastClus);
         }
 
         // Final cluster must always point to EOF.
@@ -1349,6 +1416,9 @@ bool FatFilesystem::remove(File* parent, File* file)
             if (isEof(clus))
                 break;
         }
+
+        if (!file->isDirectory())
+            static_cast<FatFile*>(file)->clearClusterMap();
     }
 
     return true;
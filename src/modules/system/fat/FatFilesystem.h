@@ -24,6 +24,7 @@
 #include <process/Mutex.h>
 #include <utilities/UnlikelyLock.h>
 #include <LockGuard.h>
+#include <Spinlock.h>
 #include "FatFile.h"
 
 #include "fat.h"
@@ -72,12 +73,29 @@ protected:
   /** Writes a cluster to the disk. */
   bool writeCluster(uint32_t block, uintptr_t buffer);
 
-  /** Reads a block starting from a specific sector from the disk. */
+  /** Writes a block starting from a specific sector to the disk. */
   bool writeSectorBlock(uint32_t sec, size_t size, uintptr_t buffer);
 
-  /** Writes a block starting from a specific sector to the disk. */
+  /** Reads a block starting from a specific sector from the disk. */
   bool readSectorBlock(uint32_t sec, size_t size, uintptr_t buffer);
 
+  /** Copies \p size bytes from byte \p location of the disk, a whole disk
+    * cache page at a time. */
+  bool readDiskBytes(uint64_t location, size_t size, uintptr_t buffer);
+
+  /** Copies \p size bytes into the disk cache at byte \p location. The
+    * pages are left dirty for the disk to write back. */
+  bool writeDiskBytes(uint64_t location, size_t size, uintptr_t buffer);
+
+  /** Returns the byte location on disk of \p offset bytes into \p cluster. */
+  inline uint64_t getClusterLocation(uint32_t cluster, uint32_t offset = 0)
+  {
+    return static_cast<uint64_t>(getSectorNumber(cluster)) * m_Superblock.BPB_BytsPerSec + offset;
+  }
+
+  /** Reads the whole FAT once and builds m_pClusterBitmap from it. */
+  bool buildClusterBitmap();
+
   /** Obtains the first sector given a cluster number */
   uint32_t getSectorNumber(uint32_t cluster);
 
@@ -232,10 +250,21 @@ protected:
   Tree<uintptr_t, uintptr_t> m_FatCache;
 
   /**
-   * Hint for the free cluster code, to avoid searching the ENTIRE FAT each
-   * time someone wants a free cluster (on non-FAT32 volumes).
+   * Hint for the free cluster code: no cluster below this is free, unless
+   * one has been freed since (which moves the hint back).
    */
   uint32_t m_FreeClusterHint;
+
+  /** One bit per cluster, set if the cluster is in use. Built from the FAT
+    * at mount and kept in step by setClusterEntry, so that findFreeCluster
+    * never has to read the FAT. */
+  uint32_t *m_pClusterBitmap;
+
+  /** Number of cluster numbers on the volume (the last valid cluster + 1). */
+  uint32_t m_nClusters;
+
+  /** Protects m_pClusterBitmap and m_FreeClusterHint. */
+  Spinlock m_ClusterBitmapLock;
 };
 
 #endif
@@ -60,14 +60,14 @@ public:
       // Root directory, . and .. should redirect to this directory
       Iso9660Directory *dot = new Iso9660Directory(String("."), m_Inode, m_pFs, m_pParent, m_Dir, m_AccessedTime, m_ModifiedTime, m_CreationTime);
       Iso9660Directory *dotdot = new Iso9660Directory(String(".."), m_Inode, m_pFs, m_pParent, m_Dir, m_AccessedTime, m_ModifiedTime, m_CreationTime);
-      m_Cache.insert(String("."), dot);
-      m_Cache.insert(String(".."), dotdot);
+      populateCache(String("."), dot);
+      populateCache(String(".."), dotdot);
     }
     else
     {
       // Non-root, . and .. should point to the correct locations
       Iso9660Directory *dot = new Iso9660Directory(String("."), m_Inode, m_pFs, m_pParent, m_Dir, m_AccessedTime, m_ModifiedTime, m_CreationTime);
-      m_Cache.insert(String("."), dot);
+      populateCache(String("."), dot);
 
       Iso9660Directory *dotdot = new Iso9660Directory(String(".."),
                                                     pParentDir->getInode(),
@@ -78,7 +78,7 @@ public:
                                                     pParentDir->getModifiedTime(),
                                                     pParentDir->getCreationTime()
                                                     );
-      m_Cache.insert(String(".."), dotdot);
+      populateCache(String(".."), dotdot);
     }
 
     // How big is the directory?
@@ -121,12 +121,12 @@ public:
         if(record->FileFlags & (1 << 1))
         {
           Iso9660Directory *dir = new Iso9660Directory(fileName, 0, m_pFs, this, *record, unixTime, unixTime, unixTime);
-          m_Cache.insert(fileName, dir);
+          populateCache(fileName, dir);
         }
         else
         {
           Iso9660File *file = new Iso9660File(fileName, unixTime, unixTime, unixTime, 0, m_pFs, LITTLE_TO_HOST32(record->DataLen_LE), *record, this);
-          m_Cache.insert(fileName, file);
+          populateCache(fileName, file);
         }
       }
 
@@ -93,12 +93,12 @@ String qnameLabelHelper(char *buff, size_t *len, uintptr_t buffLoc)
 }
 
 Dns::Dns() :
-  m_DnsCache(), m_DnsRequests(), m_Endpoint(0)
+  m_Cache(), m_DnsRequests(), m_RequestLock(false), m_Endpoint(0)
 {
 }
 
 Dns::Dns(const Dns& ent) :
-  m_DnsCache(ent.m_DnsCache), m_DnsRequests(ent.m_DnsRequests), m_Endpoint(ent.m_Endpoint)
+  m_Cache(), m_DnsRequests(ent.m_DnsRequests), m_RequestLock(false), m_Endpoint(ent.m_Endpoint)
 {
   new Thread(Processor::information().getCurrentThread()->getParent(),
              reinterpret_cast<Thread::ThreadStartFunc>(&trampoline),
@@ -150,35 +150,36 @@ void Dns::mainThread()
       DnsHeader* head = reinterpret_cast<DnsHeader*>(buffLoc);
 
       // look for the ID in our request list
-      bool bFound = false;
       DnsRequest* req = 0;
+      m_RequestLock.acquire();
       for(Vector<DnsRequest*>::Iterator it = m_DnsRequests.begin(); it != m_DnsRequests.end(); it++)
       {
         if((*it)->id == head->id)
         {
           req = (*it);
-          bFound = true;
 
+          // The list's reference to the request is now ours
           m_DnsRequests.erase(it);
           break;
         }
       }
+      m_RequestLock.release();
 
-      if(!bFound)
+      if(!req)
         continue;
 
+      uint16_t rcode = BIG_TO_HOST16(head->opAndParam) & DNS_RESPONSE;
       uint16_t qCount = BIG_TO_HOST16(head->qCount);
       uint16_t ansCount = BIG_TO_HOST16(head->aCount);
       uint16_t nameCount = BIG_TO_HOST16(head->nCount);
       uint16_t addCount = BIG_TO_HOST16(head->dCount);
 
-      // If there were no answers, this is a "name not found" error.
-      if(!ansCount)
-      {
-          req->success = false;
-          req->waitSem.release();
-          continue;
-      }
+      // The answer can be cached for as long as its shortest-lived record
+      uint32_t ttl = ~0U;
+
+      // How long to remember a name doesn't exist for, from the SOA record
+      // that comes with the answer
+      uint32_t negativeTtl = DNS_CACHE_DEFAULT_NEGATIVE_TTL;
 
       // Read in each question section
       size_t ansOffset = sizeof(DnsHeader);
@@ -201,6 +202,9 @@ void Dns::mainThread()
       bool hostnameFilled = false;
       for(uint16_t answer = 0; answer < (ansCount + nameCount + addCount); answer++)
       {
+        // Records past the answer section are about the name servers
+        bool bAnswer = answer < ansCount;
+
         DnsAnswer* ans = reinterpret_cast<DnsAnswer*>(ansStart);
         String *qname = new String;
         if(BIG_TO_HOST16(ans->name) & 0xC000)
@@ -223,15 +227,22 @@ void Dns::mainThread()
           ans = reinterpret_cast<DnsAnswer*>((ansStart + len) - sizeof(ans->name));
         }
 
+        uintptr_t rdata = reinterpret_cast<uintptr_t>(ans) + sizeof(DnsAnswer);
+        uint16_t rdLength = BIG_TO_HOST16(ans->length);
+        uint32_t recordTtl = BIG_TO_HOST32(ans->ttl);
+
         switch(BIG_TO_HOST16(ans->type))
         {
           /** A Record */
           case 0x0001:
             {
+              if(!bAnswer)
+                break;
+
               // Add the IP address for this entry to the list
-              if(BIG_TO_HOST16(ans->length) == 4)
+              if(rdLength == 4)
               {
-                uint32_t newIp = *reinterpret_cast<uint32_t*>(ansStart + sizeof(DnsAnswer));
+                uint32_t newIp = *reinterpret_cast<uint32_t*>(rdata);
                 IpAddress *ip = new IpAddress(newIp);
                 req->addresses.pushBack(ip);
               }
@@ -239,6 +250,9 @@ void Dns::mainThread()
               // Add the name to the aliases list
               req->aliases.pushBack(qname);
               qname = 0;
+
+              if(recordTtl < ttl)
+                ttl = recordTtl;
             }
             break;
             /** NS */
@@ -250,18 +264,31 @@ void Dns::mainThread()
             /** CNAME */
             case 0x0005:
             {
+                if(!bAnswer)
+                    break;
+
                 // Set the CNAME
                 if(!hostnameFilled)
                 {
                     req->hostname = *qname;
                     hostnameFilled = true;
                 }
+
+                if(recordTtl < ttl)
+                    ttl = recordTtl;
             }
             break;
             /** SOA */
             case 0x0006:
             {
-                WARNING("TODO: SOA Records");
+                // An SOA alongside a negative answer says how long to
+                // remember it for: the lesser of its own TTL and its MINIMUM
+                // field, which ends its data (RFC 2308).
+                if(bAnswer || rdLength < 20)
+                    break;
+
+                uint32_t minimum = BIG_TO_HOST32(*reinterpret_cast<uint32_t*>(rdata + rdLength - 4));
+                negativeTtl = (recordTtl < minimum) ? recordTtl : minimum;
             }
             break;
             /* WKS */
@@ -305,7 +332,7 @@ void Dns::mainThread()
         if(qname)
             delete qname;
 
-        ansStart += sizeof(DnsAnswer) + BIG_TO_HOST16(ans->length);
+        ansStart = rdata + rdLength;
       }
 
       // If no hostname was filled, take one from the aliases (if possible)
@@ -315,41 +342,74 @@ void Dns::mainThread()
               req->hostname = *(*(req->aliases.begin()));
       }
 
-      if(req->callerLeft)
-          delete req;
-      else
+      if(rcode == DNS_NAME_ERROR || (!rcode && !req->addresses.count()))
       {
-          /// \todo Rewrite the DNS cache mechanism. For now, we'll just avoid
-          ///       caching. A proper DNS cache mechanism needs to handle the
-          ///       CNAMEs as well as the aliases
-          // m_DnsCache.pushBack(req->entry);
+          // The name doesn't exist, or has no addresses
+          m_Cache.insertNegative(req->name, negativeTtl);
+          req->success = false;
+      }
+      else if(!rcode)
+      {
+          m_Cache.insert(req->name, req->hostname, req->aliases, req->addresses, ttl);
           req->success = true;
-          req->waitSem.release();
       }
+      else
+      {
+          // Server failure or the like - another try may do better
+          req->success = false;
+      }
+
+      completeRequest(req);
     }
   }
 }
 
 int Dns::hostToIp(String hostname, HostInfo& ret, Network* pCard)
 {
-    if(!pCard || !pCard->isConnected())
+    // A cached answer doesn't need the network
+    DnsCache::Result cached = m_Cache.lookup(hostname, ret.hostname, ret.aliases, ret.addresses);
+    if(cached == DnsCache::Found)
+        return 0;
+    else if(cached == DnsCache::NotFound)
         return -1;
 
-    /// \todo Rewrite DNS cache mechanism
-    /*for(List<DnsEntry*>::Iterator it = m_DnsCache.begin(); it!= m_DnsCache.end(); it++)
-    {
-        if(!strcmp(static_cast<const char*>((*it)->hostname), static_cast<const char*>(hostname)))
-        {
-            nIps = (*it)->numIps;
-            return (*it)->ip;
-        }
-    }*/
+    if(!pCard || !pCard->isConnected())
+        return -1;
 
     // Grab the DNS server to use
     StationInfo info = pCard->getStationInfo();
     if(info.nDnsServers == 0)
         return -1;
 
+    // If someone is already asking about this name, wait for their answer
+    // rather than asking again
+    DnsRequest* req = 0;
+    m_RequestLock.acquire();
+    for(Vector<DnsRequest*>::Iterator it = m_DnsRequests.begin(); it != m_DnsRequests.end(); it++)
+    {
+        if((*it)->name == hostname)
+        {
+            req = *it;
+            req->refCount++;
+            break;
+        }
+    }
+
+    if(req)
+    {
+        m_RequestLock.release();
+        return waitForRequest(req, ret);
+    }
+
+    // Shove all this into a DnsRequest ready for replies
+    req = new DnsRequest;
+    req->name = hostname;
+    req->id = m_NextId++;
+    req->refCount = 2; // ours, and the list's
+
+    m_DnsRequests.pushBack(req);
+    m_RequestLock.release();
+
     // Setup for our request
     ConnectionlessEndpoint* e = m_Endpoint;
 
@@ -359,7 +419,7 @@ int Dns::hostToIp(String hostname, HostInfo& ret, Network* pCard)
 
     // Setup the DNS message header
     DnsHeader* head = reinterpret_cast<DnsHeader*>(buffLoc);
-    head->id = m_NextId++;
+    head->id = req->id;
     head->opAndParam = HOST_TO_BIG16(DNS_RECURSION);
     head->qCount = HOST_TO_BIG16(1);
 
@@ -394,45 +454,114 @@ int Dns::hostToIp(String hostname, HostInfo& ret, Network* pCard)
     q->type = HOST_TO_BIG16(1);
     q->cls = HOST_TO_BIG16(1);
 
-    // Shove all this into a DnsRequest ready for replies
-    DnsRequest* req = new DnsRequest;
-    req->id = head->id;
-
-    m_DnsRequests.pushBack(req);
-
     // Try each DNS server until we actually get a successful query on one
+    bool bComplete = false;
     for(size_t dnsServer = 0; dnsServer < info.nDnsServers; dnsServer++)
     {
         Endpoint::RemoteEndpoint remoteHost;
         remoteHost.remotePort = 53;
         remoteHost.ip = info.dnsServers[dnsServer];
 
-        req->success = false;
         if(e->send(sizeof(DnsHeader) + sizeof(QuestionSecNameSuffix) + len + 1, buffLoc, remoteHost, false) < 0)
             continue;
 
         req->waitSem.acquire(1, 15);
         if(Processor::information().getCurrentThread()->wasInterrupted())
-        {
-            req->callerLeft = true;
-            return -1;
-        }
+            break;
+
+        m_RequestLock.acquire();
+        bComplete = req->bComplete;
+        m_RequestLock.release();
+
+        if(bComplete)
+            break;
+    }
+
+    delete [] buff;
+
+    if(!bComplete)
+        abandonRequest(req);
+
+    return finishRequest(req, ret);
+}
+
+int Dns::ipToHost(IpAddress ip, HostInfo& ret)
+{
+    if(!m_Cache.lookup(ip, ret.hostname))
+        return -1;
+
+    ret.addresses.pushBack(new IpAddress(ip));
+    return 0;
+}
+
+int Dns::waitForRequest(DnsRequest* req, HostInfo& ret)
+{
+    // The request is only woken when it's completed, and the thread that
+    // sent it completes it one way or another when it gives up.
+    req->waitSem.acquire(1);
+    return finishRequest(req, ret);
+}
 
-        if(!req->success)
+void Dns::completeRequest(DnsRequest* req)
+{
+    m_RequestLock.acquire();
+    req->bComplete = true;
+    size_t nWaiting = req->refCount - 1;
+    m_RequestLock.release();
+
+    // Our reference keeps the request around until this is done
+    if(nWaiting)
+        req->waitSem.release(nWaiting);
+
+    releaseRequest(req);
+}
+
+void Dns::abandonRequest(DnsRequest* req)
+{
+    m_RequestLock.acquire();
+    for(Vector<DnsRequest*>::Iterator it = m_DnsRequests.begin(); it != m_DnsRequests.end(); it++)
+    {
+        if(*it == req)
         {
-            delete req;
+            // Take the list's reference, and complete it as a failure
+            m_DnsRequests.erase(it);
+            m_RequestLock.release();
+
+            req->success = false;
+            completeRequest(req);
+            return;
         }
-        else
-        {
+    }
 
-            ret.addresses = req->addresses;
-            ret.aliases = req->aliases;
-            ret.hostname = req->hostname;
+    // The reply has just come in, and is being dealt with
+    m_RequestLock.release();
+}
 
-            delete req;
-            return 0;
-        }
+int Dns::finishRequest(DnsRequest* req, HostInfo& ret)
+{
+    m_RequestLock.acquire();
+    bool bSuccess = req->bComplete && req->success;
+    m_RequestLock.release();
+
+    if(bSuccess)
+    {
+        ret.hostname = req->hostname;
+        for(List<String*>::Iterator it = req->aliases.begin(); it != req->aliases.end(); it++)
+            ret.aliases.pushBack(new String(**it));
+        for(List<IpAddress*>::Iterator it = req->addresses.begin(); it != req->addresses.end(); it++)
+            ret.addresses.pushBack(new IpAddress(**it));
     }
 
-    return -1;
+    releaseRequest(req);
+    return bSuccess ? 0 : -1;
+}
+
+void Dns::releaseRequest(DnsRequest* req)
+{
+    m_RequestLock.acquire();
+    bool bLast = (--req->refCount == 0);
+    m_RequestLock.release();
+
+    if(bLast)
+        delete req;
 }
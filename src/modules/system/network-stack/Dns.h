@@ -22,12 +22,14 @@
 #include <processor/state.h>
 #include <processor/types.h>
 #include <process/Semaphore.h>
+#include <process/Mutex.h>
 #include <machine/Network.h>
 #include <machine/Machine.h>
 
 #include "NetworkStack.h"
 #include "Ethernet.h"
 #include "UdpManager.h"
+#include "DnsCache.h"
 
 /** These are bit masks for the opAndParam field of the header */
 #define DNS_QUESREQ    0x8000 // query = 0, request = 1
@@ -39,6 +41,9 @@
 #define DNS_RSVD       0x70
 #define DNS_RESPONSE   0xF // response code - 0 means no errors
 
+/** Response codes */
+#define DNS_NAME_ERROR 3 // the name doesn't exist
+
 /** Query types */
 #define DNSQUERY_HOSTADDR     1
 
@@ -80,8 +85,15 @@ public:
   /** Initialises the Endpoint and begins running the worker thread */
   void initialise();
   
-  /** Requests a lookup for a hostname */
+  /** Requests a lookup for a hostname. Answers (and names that don't
+   *  exist) are cached for as long as the server allows, and a lookup for a
+   *  name that's already being asked about waits for that answer rather
+   *  than asking again. */
   int hostToIp(String hostname, HostInfo& ret, Network* pCard = 0);
+
+  /** Finds the name for an address, from the answers in the cache only -
+   *  PTR queries aren't implemented yet. */
+  int ipToHost(IpAddress ip, HostInfo& ret);
   
   /** Operator = is invalid */
   Dns& operator = (const Dns& ent)
@@ -120,44 +132,25 @@ private:
     uint16_t  length;
   } __attribute__ ((packed));
   
-  /** An entry in the DNS cache */
-  class DnsEntry
-  {
-    public:
-      DnsEntry() : ip(0), numIps(0), hostname()
-      {};
-      DnsEntry(const DnsEntry& ent) : ip(ent.ip), numIps(ent.numIps), hostname(ent.hostname)
-      {};
-      
-      /// Multiple IP addresses are possible
-      IpAddress* ip;
-      size_t numIps;
-      
-      /// Hostname
-      String hostname;
-      
-      DnsEntry& operator = (const DnsEntry& ent)
-      {
-        ip = ent.ip;
-        numIps = ent.numIps;
-        hostname = ent.hostname;
-        return *this;
-      }
-  };
-  
   /// a DNS request we've sent
   class DnsRequest
   {
     public:
       DnsRequest() :
-        hostname(), aliases(), addresses(), id(0), waitSem(0),
-        success(false), callerLeft(false)
-      {};
-      DnsRequest(const DnsRequest& ent) :
-        hostname(ent.hostname), aliases(ent.aliases), addresses(ent.addresses), id(ent.id),
-        waitSem(0), success(ent.success), callerLeft(ent.callerLeft)
+        name(), hostname(), aliases(), addresses(), id(0), waitSem(0),
+        success(false), bComplete(false), refCount(0)
       {};
-      
+      ~DnsRequest()
+      {
+        for(List<String*>::Iterator it = aliases.begin(); it != aliases.end(); it++)
+          delete *it;
+        for(List<IpAddress*>::Iterator it = addresses.begin(); it != addresses.end(); it++)
+          delete *it;
+      }
+
+      /// The name we asked for
+      String name;
+
       /// Hostname for this host, based on our request (probably a CNAME)
       String hostname;
 
@@ -169,36 +162,54 @@ private:
 
       /// DNS request ID
       uint16_t id;
-      
-      /// Semaphore used to wake up the caller thread when this request completes
+
+      /// Semaphore used to wake up the threads waiting for this request
+      /// once it completes
       Semaphore waitSem;
-      
-      /// Whether or not the request succeeded (possibly redundant now)
+
+      /// Whether or not the request succeeded
       bool success;
 
-      // Whether or not the caller left. If true, the request handler needs to
-      // free the request rather than waking up the calling thread.
-      bool callerLeft;
-      
-      DnsRequest& operator = (const DnsRequest& ent)
-      {
-        hostname = ent.hostname;
-        aliases = ent.aliases;
-        addresses = ent.addresses;
-        id = ent.id;
-        success = ent.success;
-        callerLeft = ent.callerLeft;
-        return *this;
-      }
-      
+      /// Whether or not the request has finished, one way or another. Once
+      /// it has, the rest of it doesn't change.
+      bool bComplete;
+
+      /// Number of threads waiting on the request, plus one while it's in
+      /// the request list. The last to let go of it frees it.
+      /// \note Guarded by m_RequestLock.
+      size_t refCount;
+
     private:
+      DnsRequest(const DnsRequest&);
+      DnsRequest& operator = (const DnsRequest&);
   };
-  
-  /// DNS cache (not a Tree because we can't look up an IpAddress object)
-  List<DnsEntry*> m_DnsCache;
-  
+
+  /** Waits for a request someone else has sent, then copies its answer. */
+  int waitForRequest(DnsRequest* req, HostInfo& ret);
+
+  /** Marks a request complete and wakes everyone waiting on it. Takes over
+   *  the caller's reference to it. */
+  void completeRequest(DnsRequest* req);
+
+  /** Gives up on a request nobody answered, if it's still outstanding. */
+  void abandonRequest(DnsRequest* req);
+
+  /** Copies a completed request's answer out, and drops the caller's
+   *  reference to it.
+   *  \return 0 if it succeeded, -1 otherwise. */
+  int finishRequest(DnsRequest* req, HostInfo& ret);
+
+  /** Drops a reference to a request, freeing it with the last. */
+  void releaseRequest(DnsRequest* req);
+
+  /// DNS cache
+  DnsCache m_Cache;
+
   /// DNS request list
   Vector<DnsRequest*> m_DnsRequests;
+
+  /// Lock for the request list, and each request's reference count
+  Mutex m_RequestLock;
   
   /// DNS communication endpoint
   ConnectionlessEndpoint* m_Endpoint;
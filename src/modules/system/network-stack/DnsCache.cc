@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "DnsCache.h"
+#include <machine/Machine.h>
+#include <machine/Timer.h>
+#include <utilities/utility.h>
+#include <LockGuard.h>
+
+DnsCache::DnsCache() :
+  m_pLruHead(0), m_pLruTail(0), m_nEntries(0), m_Lock(false)
+{
+  for(size_t i = 0; i < DNS_CACHE_BUCKETS; i++)
+  {
+    m_Names[i] = 0;
+    m_Addresses[i] = 0;
+  }
+}
+
+DnsCache::~DnsCache()
+{
+  flush();
+}
+
+size_t DnsCache::hash(const char *name)
+{
+  // FNV-1a
+  uint32_t h = 2166136261U;
+  while(*name)
+  {
+    h ^= static_cast<uint8_t>(*name++);
+    h *= 16777619U;
+  }
+  return h & (DNS_CACHE_BUCKETS - 1);
+}
+
+size_t DnsCache::hash(IpAddress ip)
+{
+  uint32_t h = 0;
+  if(ip.getType() == IpAddress::IPv4)
+    h = ip.getIp();
+  else
+  {
+    uint8_t v6[16];
+    ip.getIp(v6);
+    for(size_t i = 0; i < 16; i += 4)
+      h ^= (v6[i] << 24) | (v6[i + 1] << 16) | (v6[i + 2] << 8) | v6[i + 3];
+  }
+
+  h *= 2654435761U;
+  return (h >> 16) & (DNS_CACHE_BUCKETS - 1);
+}
+
+String DnsCache::lowercase(const String &name)
+{
+  size_t len = name.length();
+  char *buff = new char[len + 1];
+
+  const char *s = static_cast<const char*>(name);
+  for(size_t i = 0; i < len; i++)
+  {
+    char c = s[i];
+    if(c >= 'A' && c <= 'Z')
+      c += 'a' - 'A';
+    buff[i] = c;
+  }
+  buff[len] = 0;
+
+  String ret(buff);
+  delete [] buff;
+  return ret;
+}
+
+uint32_t DnsCache::now()
+{
+  Timer *pTimer = Machine::instance().getTimer();
+  return pTimer ? pTimer->getUnixTimestamp() : 0;
+}
+
+DnsCache::Entry *DnsCache::find(const String &name, size_t h)
+{
+  for(Entry *pEntry = m_Names[h]; pEntry; pEntry = pEntry->hashNext)
+  {
+    if(!strcmp(static_cast<const char*>(pEntry->name), static_cast<const char*>(name)))
+      return pEntry;
+  }
+  return 0;
+}
+
+void DnsCache::touch(Entry *pEntry)
+{
+  if(m_pLruHead == pEntry)
+    return;
+
+  // Unlink...
+  if(pEntry->lruPrev)
+    pEntry->lruPrev->lruNext = pEntry->lruNext;
+  if(pEntry->lruNext)
+    pEntry->lruNext->lruPrev = pEntry->lruPrev;
+  if(m_pLruTail == pEntry)
+    m_pLruTail = pEntry->lruPrev;
+
+  // ... and put at the front
+  pEntry->lruPrev = 0;
+  pEntry->lruNext = m_pLruHead;
+  if(m_pLruHead)
+    m_pLruHead->lruPrev = pEntry;
+  m_pLruHead = pEntry;
+  if(!m_pLruTail)
+    m_pLruTail = pEntry;
+}
+
+void DnsCache::add(Entry *pEntry)
+{
+  while(m_nEntries >= DNS_CACHE_MAX_ENTRIES && m_pLruTail)
+    remove(m_pLruTail);
+
+  pEntry->hashNext = m_Names[pEntry->hash];
+  m_Names[pEntry->hash] = pEntry;
+
+  for(AddressLink *pLink = pEntry->links; pLink; pLink = pLink->entryNext)
+  {
+    size_t h = hash(pLink->ip);
+    pLink->hashNext = m_Addresses[h];
+    m_Addresses[h] = pLink;
+  }
+
+  pEntry->lruPrev = 0;
+  pEntry->lruNext = m_pLruHead;
+  if(m_pLruHead)
+    m_pLruHead->lruPrev = pEntry;
+  m_pLruHead = pEntry;
+  if(!m_pLruTail)
+    m_pLruTail = pEntry;
+
+  m_nEntries++;
+}
+
+void DnsCache::remove(Entry *pEntry)
+{
+  for(Entry **ppEntry = &m_Names[pEntry->hash]; *ppEntry; ppEntry = &(*ppEntry)->hashNext)
+  {
+    if(*ppEntry == pEntry)
+    {
+      *ppEntry = pEntry->hashNext;
+      break;
+    }
+  }
+
+  AddressLink *pLink = pEntry->links;
+  while(pLink)
+  {
+    for(AddressLink **ppLink = &m_Addresses[hash(pLink->ip)]; *ppLink; ppLink = &(*ppLink)->hashNext)
+    {
+      if(*ppLink == pLink)
+      {
+        *ppLink = pLink->hashNext;
+        break;
+      }
+    }
+
+    AddressLink *pNext = pLink->entryNext;
+    delete pLink;
+    pLink = pNext;
+  }
+
+  if(pEntry->lruPrev)
+    pEntry->lruPrev->lruNext = pEntry->lruNext;
+  else
+    m_pLruHead = pEntry->lruNext;
+  if(pEntry->lruNext)
+    pEntry->lruNext->lruPrev = pEntry->lruPrev;
+  else
+    m_pLruTail = pEntry->lruPrev;
+
+  for(List<String*>::Iterator it = pEntry->aliases.begin(); it != pEntry->aliases.end(); it++)
+    delete *it;
+  for(List<IpAddress*>::Iterator it = pEntry->addresses.begin(); it != pEntry->addresses.end(); it++)
+    delete *it;
+
+  delete pEntry;
+  m_nEntries--;
+}
+
+DnsCache::Result DnsCache::lookup(const String &name, String &hostname, List<String*> &aliases, List<IpAddress*> &addresses)
+{
+  String key = lowercase(name);
+  size_t h = hash(static_cast<const char*>(key));
+
+  LockGuard<Mutex> guard(m_Lock);
+
+  Entry *pEntry = find(key, h);
+  if(!pEntry)
+    return Miss;
+
+  if(pEntry->expiry <= now())
+  {
+    remove(pEntry);
+    return Miss;
+  }
+
+  touch(pEntry);
+
+  if(pEntry->bNegative)
+    return NotFound;
+
+  hostname = pEntry->hostname;
+  for(List<String*>::Iterator it = pEntry->aliases.begin(); it != pEntry->aliases.end(); it++)
+    aliases.pushBack(new String(**it));
+  for(List<IpAddress*>::Iterator it = pEntry->addresses.begin(); it != pEntry->addresses.end(); it++)
+    addresses.pushBack(new IpAddress(**it));
+
+  return Found;
+}
+
+bool DnsCache::lookup(IpAddress ip, String &hostname)
+{
+  LockGuard<Mutex> guard(m_Lock);
+
+  for(AddressLink *pLink = m_Addresses[hash(ip)]; pLink; pLink = pLink->hashNext)
+  {
+    if(!(pLink->ip == ip))
+      continue;
+
+    Entry *pEntry = pLink->entry;
+    if(pEntry->expiry <= now())
+    {
+      remove(pEntry);
+      return false;
+    }
+
+    touch(pEntry);
+    hostname = pEntry->hostname;
+    return true;
+  }
+
+  return false;
+}
+
+void DnsCache::insert(const String &name, const String &hostname, List<String*> &aliases, List<IpAddress*> &addresses, uint32_t ttl)
+{
+  if(!ttl)
+    return;
+  if(ttl > DNS_CACHE_MAX_TTL)
+    ttl = DNS_CACHE_MAX_TTL;
+
+  // Build it all before taking the lock
+  Entry *pEntry = new Entry;
+  pEntry->name = lowercase(name);
+  pEntry->hash = hash(static_cast<const char*>(pEntry->name));
+  pEntry->expiry = now() + ttl;
+  pEntry->bNegative = false;
+  pEntry->hostname = hostname;
+  pEntry->links = 0;
+
+  for(List<String*>::Iterator it = aliases.begin(); it != aliases.end(); it++)
+    pEntry->aliases.pushBack(new String(**it));
+  for(List<IpAddress*>::Iterator it = addresses.begin(); it != addresses.end(); it++)
+  {
+    pEntry->addresses.pushBack(new IpAddress(**it));
+
+    AddressLink *pLink = new AddressLink;
+    pLink->ip = **it;
+    pLink->entry = pEntry;
+    pLink->hashNext = 0;
+    pLink->entryNext = pEntry->links;
+    pEntry->links = pLink;
+  }
+
+  LockGuard<Mutex> guard(m_Lock);
+
+  Entry *pOld = find(pEntry->name, pEntry->hash);
+  if(pOld)
+    remove(pOld);
+
+  add(pEntry);
+}
+
+void DnsCache::insertNegative(const String &name, uint32_t ttl)
+{
+  if(!ttl)
+    return;
+  if(ttl > DNS_CACHE_MAX_NEGATIVE_TTL)
+    ttl = DNS_CACHE_MAX_NEGATIVE_TTL;
+
+  Entry *pEntry = new Entry;
+  pEntry->name = lowercase(name);
+  pEntry->hash = hash(static_cast<const char*>(pEntry->name));
+  pEntry->expiry = now() + ttl;
+  pEntry->bNegative = true;
+  pEntry->links = 0;
+
+  LockGuard<Mutex> guard(m_Lock);
+
+  Entry *pOld = find(pEntry->name, pEntry->hash);
+  if(pOld)
+    remove(pOld);
+
+  add(pEntry);
+}
+
+void DnsCache::flush()
+{
+  LockGuard<Mutex> guard(m_Lock);
+
+  while(m_pLruHead)
+    remove(m_pLruHead);
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef MACHINE_DNSCACHE_H
+#define MACHINE_DNSCACHE_H
+
+#include <processor/types.h>
+#include <network/IpAddress.h>
+#include <utilities/String.h>
+#include <utilities/List.h>
+#include <process/Mutex.h>
+
+/// Number of hash chains for names, and for addresses. A power of two.
+#define DNS_CACHE_BUCKETS       256
+/// Most names the cache holds. Past this the least recently used goes.
+#define DNS_CACHE_MAX_ENTRIES   512
+/// Longest we keep any answer for, in seconds, whatever its TTL says.
+#define DNS_CACHE_MAX_TTL       86400
+/// Longest we remember a name doesn't exist for, in seconds (RFC 2308
+/// suggests one to three hours).
+#define DNS_CACHE_MAX_NEGATIVE_TTL  10800
+/// How long a name is remembered not to exist when the server didn't send
+/// an SOA record to say, in seconds.
+#define DNS_CACHE_DEFAULT_NEGATIVE_TTL  60
+
+/** Answers from DNS servers, kept for as long as their TTL allows.
+ *
+ *  Entries are hashed on the name that was asked for (ignoring case), and
+ *  each of an entry's addresses is hashed as well, so an address can be
+ *  mapped back to its name. A name the server said doesn't exist is cached
+ *  too, as a negative entry, so that repeated lookups for it don't each go
+ *  to the network.
+ *
+ *  Expired entries are dropped when they're next looked at, and once the
+ *  cache is full the least recently used entry makes way for a new one.
+ *
+ *  Everything handed out is a copy, which the caller owns. */
+class DnsCache
+{
+  public:
+    DnsCache();
+    ~DnsCache();
+
+    enum Result
+    {
+      /// Nothing cached for the name: ask a server.
+      Miss = 0,
+      /// The name's answer was cached, and has been copied out.
+      Found,
+      /// The name is cached as not existing.
+      NotFound
+    };
+
+    /** Looks up a name.
+     *  \param name The name that would be asked for.
+     *  \param hostname Set to the canonical name, if Found.
+     *  \param aliases Copies of the aliases are added, if Found.
+     *  \param addresses Copies of the addresses are added, if Found. */
+    Result lookup(const String &name, String &hostname, List<String*> &aliases, List<IpAddress*> &addresses);
+
+    /** Finds the name an address was the answer for.
+     *  \return False if no cached answer has the address. */
+    bool lookup(IpAddress ip, String &hostname);
+
+    /** Caches an answer for a name, replacing anything that was cached for
+     *  it. The lists are copied. Nothing is cached with a TTL of zero.
+     *  \param ttl Seconds the answer may be kept for. */
+    void insert(const String &name, const String &hostname, List<String*> &aliases, List<IpAddress*> &addresses, uint32_t ttl);
+
+    /** Caches that a name doesn't exist.
+     *  \param ttl Seconds to remember that for. */
+    void insertNegative(const String &name, uint32_t ttl);
+
+    /** Forgets everything. */
+    void flush();
+
+  private:
+    DnsCache(const DnsCache &);
+    DnsCache &operator = (const DnsCache &);
+
+    struct Entry;
+
+    /** One of an entry's addresses, in the address table */
+    struct AddressLink
+    {
+      IpAddress ip;
+      Entry *entry;
+      /// Next in the address table chain
+      AddressLink *hashNext;
+      /// Next of the same entry's addresses
+      AddressLink *entryNext;
+    };
+
+    struct Entry
+    {
+      /// The name asked for, in lower case
+      String name;
+      size_t hash;
+
+      /// Seconds since the epoch at which this goes stale
+      uint32_t expiry;
+
+      /// True if the name doesn't exist, in which case the rest is empty
+      bool bNegative;
+
+      String hostname;
+      List<String*> aliases;
+      List<IpAddress*> addresses;
+
+      AddressLink *links;
+
+      Entry *hashNext;
+      Entry *lruPrev;
+      Entry *lruNext;
+    };
+
+    static size_t hash(const char *name);
+    static size_t hash(IpAddress ip);
+
+    /** The name in lower case, as the cache stores it */
+    static String lowercase(const String &name);
+
+    /** Current time, in seconds */
+    static uint32_t now();
+
+    /** Finds the entry for a (lower case) name.
+     *  \note m_Lock must be held. */
+    Entry *find(const String &name, size_t h);
+
+    /** Adds a new entry, evicting the least recently used to make room.
+     *  \note m_Lock must be held. */
+    void add(Entry *pEntry);
+
+    /** Takes an entry out of all the tables and frees it.
+     *  \note m_Lock must be held. */
+    void remove(Entry *pEntry);
+
+    /** Moves an entry to the front of the LRU list.
+     *  \note m_Lock must be held. */
+    void touch(Entry *pEntry);
+
+    Entry *m_Names[DNS_CACHE_BUCKETS];
+    AddressLink *m_Addresses[DNS_CACHE_BUCKETS];
+
+    /// Most recently used at the head, next to be evicted at the tail
+    Entry *m_pLruHead;
+    Entry *m_pLruTail;
+    size_t m_nEntries;
+
+    Mutex m_Lock;
+};
+
+#endif
@@ -128,14 +128,7 @@ void Ethernet::send(size_t nBytes, uintptr_t packet, Network* pCard, MacAddress
   // Move the payload for the ethernet header to go in
   memmove(reinterpret_cast<void*>(packet + sizeof(ethernetHeader)), reinterpret_cast<void*>(packet), nBytes);
 
-  // get the ethernet header pointer
-  ethernetHeader* ethHeader = reinterpret_cast<ethernetHeader*>(packet);
-
-  // copy in the data
-  StationInfo me = pCard->getStationInfo();
-  memcpy(ethHeader->destMac, dest.getMac(), 6);
-  memcpy(ethHeader->sourceMac, me.mac, 6);
-  ethHeader->type = HOST_TO_BIG16(type);
+  writeHeader(packet, pCard, dest, type);
 
   // send it over the network
   pCard->send(nBytes + sizeof(ethernetHeader), packet);
@@ -143,3 +136,34 @@ void Ethernet::send(size_t nBytes, uintptr_t packet, Network* pCard, MacAddress
   // and dump it into any raw sockets (note the -1 for protocol - this means WIRE level endpoints)
   // RawManager::instance().receive(packAddr, newSize, 0, -1, pCard);
 }
+
+bool Ethernet::send(NetBuffer *pBuffer, Network* pCard, MacAddress dest, uint16_t type)
+{
+  if(!pCard || !pCard->isConnected())
+    return false; // NIC isn't active
+
+  // The device wants the frame in one piece
+  if(!pBuffer->linearize())
+    return false;
+
+  uintptr_t packet = pBuffer->push(sizeof(ethernetHeader));
+  if(!packet)
+  {
+    ERROR("Ethernet: no headroom for the header");
+    return false;
+  }
+
+  writeHeader(packet, pCard, dest, type);
+
+  return pCard->send(pBuffer->length(), packet);
+}
+
+void Ethernet::writeHeader(uintptr_t packet, Network* pCard, MacAddress dest, uint16_t type)
+{
+  ethernetHeader* ethHeader = reinterpret_cast<ethernetHeader*>(packet);
+
+  StationInfo me = pCard->getStationInfo();
+  memcpy(ethHeader->destMac, dest.getMac(), 6);
+  memcpy(ethHeader->sourceMac, me.mac, 6);
+  ethHeader->type = HOST_TO_BIG16(type);
+}
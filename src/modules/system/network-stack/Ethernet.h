@@ -21,6 +21,7 @@
 #include <processor/types.h>
 #include <machine/Network.h>
 #include "NetworkStack.h"
+#include "NetBuffer.h"
 
 #define ETH_ARP   0x0806
 #define ETH_RARP  0x8035
@@ -48,6 +49,10 @@ public:
   /** Sends an ethernet packet */
   static void send(size_t nBytes, uintptr_t packet, Network* pCard, MacAddress dest, uint16_t type);
 
+  /** Sends an ethernet packet, pushing the header into the buffer's
+    * headroom rather than moving the packet along to make room for it. */
+  static bool send(NetBuffer *pBuffer, Network* pCard, MacAddress dest, uint16_t type);
+
   /** Injects an Ethernet header into a given buffer and returns the size
     * of the header. */ 
   size_t injectHeader(uintptr_t packet, MacAddress destMac, MacAddress sourceMac, uint16_t type);
@@ -64,6 +69,9 @@ private:
 
   static Ethernet ethernetInstance;
 
+  /** Fills in the header at the front of an outgoing packet */
+  static void writeHeader(uintptr_t packet, Network* pCard, MacAddress dest, uint16_t type);
+
   struct ethernetHeader
   {
     uint8_t   destMac[6];
@@ -20,6 +20,7 @@
 
 class IpAddress;
 class Network;
+class NetBuffer;
 
 // This file contains definitions common to IPv4 and IPv6
 
@@ -44,6 +45,10 @@ class IpBase
 
         virtual bool send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uintptr_t packet, Network *pCard = 0) = 0;
 
+        /** Sends the packet in a NetBuffer, pushing the IP (and link) headers
+         *  into its headroom. The buffer stays the caller's. */
+        virtual bool send(IpAddress dest, IpAddress from, uint8_t type, NetBuffer *pBuffer, Network *pCard = 0) = 0;
+
         virtual uint16_t ipChecksum(IpAddress &from, IpAddress &to, uint8_t proto, uintptr_t data, uint16_t length) = 0;
 };
 
@@ -95,33 +95,37 @@ void Ipv4::injectChecksumAndDataFields(uintptr_t ipv4HeaderStart, size_t payload
 
 uint16_t Ipv4::ipChecksum(IpAddress &from, IpAddress &to, uint8_t proto, uintptr_t data, uint16_t length)
 {
-  // Allocate space for the psuedo-header + packet data
-  size_t tmpSize = length + sizeof(PsuedoHeader);
-  uint8_t* tmpPack = new uint8_t[tmpSize];
-  uintptr_t tmpPackAddr = reinterpret_cast<uintptr_t>(tmpPack);
-
   // Set up the psuedo-header
-  PsuedoHeader *pHeader = reinterpret_cast<PsuedoHeader*>(tmpPackAddr);
-  pHeader->src_addr = from.getIp();
-  pHeader->dest_addr = to.getIp();
-  pHeader->proto = proto;
-  pHeader->datalen = HOST_TO_BIG16(length);
-  pHeader->zero = 0;
-
-  // Throw in the packet data
-  memcpy(reinterpret_cast<void*>(tmpPackAddr + sizeof(PsuedoHeader)),
-         reinterpret_cast<void*>(data),
-         length);
-
-  // Perform the checksum
-  uint16_t checksum = Network::calculateChecksum(tmpPackAddr, tmpSize);
-
-  // Done.
-  delete [] tmpPack;
-  return checksum;
+  PsuedoHeader header;
+  header.src_addr = from.getIp();
+  header.dest_addr = to.getIp();
+  header.proto = proto;
+  header.datalen = HOST_TO_BIG16(length);
+  header.zero = 0;
+
+  // Sum the psuedo-header and then the packet data, in place
+  uint32_t sum = Network::checksumPartial(reinterpret_cast<uintptr_t>(&header), sizeof(PsuedoHeader));
+  sum = Network::checksumPartial(data, length, sum);
+  return Network::checksumFinish(sum);
 }
 
 bool Ipv4::send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uintptr_t packet, Network *pCard)
+{
+  // Move the payload past both the headers at once, rather than a layer at
+  // a time, and send it from where it lands
+  size_t headroom = sizeof(ipHeader) + Ethernet::instance().ethHeaderSize();
+  memmove(reinterpret_cast<void*>(packet + headroom), reinterpret_cast<void*>(packet), nBytes);
+
+  NetBuffer *pBuffer = NetBuffer::wrap(packet, headroom + nBytes, headroom, nBytes);
+  if(!pBuffer)
+    return false;
+
+  bool ret = send(dest, from, type, pBuffer, pCard);
+  pBuffer->unref();
+  return ret;
+}
+
+bool Ipv4::send(IpAddress dest, IpAddress from, uint8_t type, NetBuffer *pBuffer, Network *pCard)
 {
   IpAddress realDest = dest;
 
@@ -145,8 +149,15 @@ bool Ipv4::send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uin
   if(from == Network::convertToIpv4(0, 0, 0, 0))
     from = me.ipv4;
 
-  // Move the payload past the IP header we will now inject
-  memmove(reinterpret_cast<void*>(packet + sizeof(ipHeader)), reinterpret_cast<void*>(packet), nBytes);
+  size_t nBytes = pBuffer->chainLength();
+
+  // Prepend the header
+  uintptr_t packet = pBuffer->push(sizeof(ipHeader));
+  if(!packet)
+  {
+    ERROR("IPv4: no headroom for the header");
+    return false;
+  }
 
   // Grab a pointer for the ip header
   ipHeader* header = reinterpret_cast<ipHeader*>(packet);
@@ -168,7 +179,8 @@ bool Ipv4::send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uin
   header->header_len = 5;
 
   header->checksum = 0;
-  header->checksum = Network::calculateChecksum(packet, sizeof(ipHeader));
+  if(!(pCard->getChecksumOffload() & Network::TxIpv4Checksum))
+    header->checksum = Network::calculateChecksum(packet, sizeof(ipHeader));
 
   // Get the address to send to
   /// \todo Perhaps flag this so if we don't want to automatically resolve the MAC
@@ -181,7 +193,7 @@ bool Ipv4::send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uin
     macValid = Arp::instance().getFromCache(realDest, true, &destMac, pCard);
 
   if(macValid)
-    Ethernet::send(nBytes + sizeof(ipHeader), packet, pCard, destMac, dest.getType());
+    Ethernet::send(pBuffer, pCard, destMac, dest.getType());
 
   return macValid;
 }
@@ -209,12 +221,12 @@ void Ipv4::receive(size_t nBytes, uintptr_t packet, Network* pCard, uint32_t off
   size_t packetSize = nBytes - offset;
   bool wasFragment = false;
 
-  // Verify the checksum
-  uint16_t checksum = header->checksum;
-  header->checksum = 0;
-  uint16_t calcChecksum = Network::calculateChecksum(reinterpret_cast<uintptr_t>(header), sizeof(ipHeader));
-  header->checksum = checksum;
-  if(checksum == calcChecksum)
+  // Verify the checksum, unless the card already has. Summing the header
+  // with its checksum in place gives zero if it's intact.
+  bool bChecksumValid = true;
+  if(!(pCard->getChecksumOffload() & Network::RxIpv4Checksum))
+    bChecksumValid = Network::calculateChecksum(reinterpret_cast<uintptr_t>(header), sizeof(ipHeader)) == 0;
+  if(bChecksumValid)
   {
     IpAddress from(header->ipSrc);
     IpAddress to(header->ipDest);
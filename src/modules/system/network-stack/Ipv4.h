@@ -63,6 +63,7 @@ public:
 
   /** Sends an IP packet */
   virtual bool send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uintptr_t packet, Network *pCard = 0);
+  virtual bool send(IpAddress dest, IpAddress from, uint8_t type, NetBuffer *pBuffer, Network *pCard = 0);
 
   /** Injects an IPv4 header into a given buffer and returns the size
     * of the header. */
@@ -134,33 +134,37 @@ Ipv6::~Ipv6()
 
 uint16_t Ipv6::ipChecksum(IpAddress &from, IpAddress &to, uint8_t proto, uintptr_t data, uint16_t length)
 {
-  // Allocate space for the psuedo-header + packet data
-  size_t tmpSize = length + sizeof(PsuedoHeader);
-  uint8_t* tmpPack = new uint8_t[tmpSize];
-  uintptr_t tmpPackAddr = reinterpret_cast<uintptr_t>(tmpPack);
-
   // Set up the psuedo-header
-  PsuedoHeader *pHeader = reinterpret_cast<PsuedoHeader*>(tmpPackAddr);
-  from.getIp(pHeader->src_addr);
-  to.getIp(pHeader->dest_addr);
-  pHeader->nextHeader = proto;
-  pHeader->length = HOST_TO_BIG16(length);
-  pHeader->zero1 = pHeader->zero2 = 0;
-
-  // Throw in the packet data
-  memcpy(reinterpret_cast<void*>(tmpPackAddr + sizeof(PsuedoHeader)),
-         reinterpret_cast<void*>(data),
-         length);
-
-  // Perform the checksum
-  uint16_t checksum = Network::calculateChecksum(tmpPackAddr, tmpSize);
-
-  // Done.
-  delete [] tmpPack;
-  return checksum;
+  PsuedoHeader header;
+  from.getIp(header.src_addr);
+  to.getIp(header.dest_addr);
+  header.nextHeader = proto;
+  header.length = HOST_TO_BIG16(length);
+  header.zero1 = header.zero2 = 0;
+
+  // Sum the psuedo-header and then the packet data, in place
+  uint32_t sum = Network::checksumPartial(reinterpret_cast<uintptr_t>(&header), sizeof(PsuedoHeader));
+  sum = Network::checksumPartial(data, length, sum);
+  return Network::checksumFinish(sum);
 }
 
 bool Ipv6::send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uintptr_t packet, Network *pCard)
+{
+    // Move the payload past both the headers at once, rather than a layer
+    // at a time, and send it from where it lands
+    size_t headroom = sizeof(ip6Header) + Ethernet::instance().ethHeaderSize();
+    memmove(reinterpret_cast<void*>(packet + headroom), reinterpret_cast<void*>(packet), nBytes);
+
+    NetBuffer *pBuffer = NetBuffer::wrap(packet, headroom + nBytes, headroom, nBytes);
+    if(!pBuffer)
+        return false;
+
+    bool ret = send(dest, from, type, pBuffer, pCard);
+    pBuffer->unref();
+    return ret;
+}
+
+bool Ipv6::send(IpAddress dest, IpAddress from, uint8_t type, NetBuffer *pBuffer, Network *pCard)
 {
     IpAddress realDest = dest;
 
@@ -190,10 +194,16 @@ bool Ipv6::send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uin
 
     /// \todo Assumption: given "from" address is accurate.
 
-    // Load the payload.
-    memmove(reinterpret_cast<void*>(packet + sizeof(ip6Header)), reinterpret_cast<void*>(packet), nBytes);
+    size_t nBytes = pBuffer->chainLength();
+
+    // Prepend the IPv6 header.
+    uintptr_t packet = pBuffer->push(sizeof(ip6Header));
+    if(!packet)
+    {
+        ERROR("IPv6: no headroom for the header");
+        return false;
+    }
 
-    // Fill in the IPv6 header.
     ip6Header *pHeader = reinterpret_cast<ip6Header*>(packet);
     memset(pHeader, 0, sizeof(ip6Header));
 
@@ -224,7 +234,7 @@ bool Ipv6::send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uin
         macValid = Ndp::instance().neighbourSolicit(realDest, &destMac, pCard);
 
     if(macValid)
-        Ethernet::send(nBytes + sizeof(ip6Header), packet, pCard, destMac, dest.getType());
+        Ethernet::send(pBuffer, pCard, destMac, dest.getType());
 
     return macValid;
 }
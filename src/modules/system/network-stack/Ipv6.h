@@ -66,6 +66,7 @@ public:
 
     /** Sends an IP packet */
     virtual bool send(IpAddress dest, IpAddress from, uint8_t type, size_t nBytes, uintptr_t packet, Network *pCard = 0);
+    virtual bool send(IpAddress dest, IpAddress from, uint8_t type, NetBuffer *pBuffer, Network *pCard = 0);
 
     virtual uint16_t ipChecksum(IpAddress &from, IpAddress &to, uint8_t proto, uintptr_t data, uint16_t length);
 
@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "NetBuffer.h"
+#include <utilities/utility.h>
+
+NetBuffer::NetBuffer(Memory *pMemory, size_t offset, size_t nBytes) :
+    m_pData(pMemory), m_Offset(offset), m_Length(nBytes), m_pNext(0), m_RefCount(1)
+{
+}
+
+NetBuffer::~NetBuffer()
+{
+}
+
+NetBuffer *NetBuffer::allocate(size_t nBytes, size_t headroom)
+{
+    Memory *pMemory = new Memory;
+    if(!pMemory)
+        return 0;
+
+    pMemory->base = reinterpret_cast<uintptr_t>(new uint8_t[headroom + nBytes]);
+    if(!pMemory->base)
+    {
+        delete pMemory;
+        return 0;
+    }
+    pMemory->refCount = 1;
+    pMemory->size = headroom + nBytes;
+    pMemory->bOwned = true;
+
+    NetBuffer *pBuffer = new NetBuffer(pMemory, headroom, 0);
+    if(!pBuffer)
+        release(pMemory);
+    return pBuffer;
+}
+
+NetBuffer *NetBuffer::wrap(uintptr_t base, size_t size, size_t offset, size_t nBytes)
+{
+    Memory *pMemory = new Memory;
+    if(!pMemory)
+        return 0;
+
+    pMemory->refCount = 1;
+    pMemory->base = base;
+    pMemory->size = size;
+    pMemory->bOwned = false;
+
+    NetBuffer *pBuffer = new NetBuffer(pMemory, offset, nBytes);
+    if(!pBuffer)
+        release(pMemory);
+    return pBuffer;
+}
+
+void NetBuffer::release(Memory *pMemory)
+{
+    if((pMemory->refCount -= 1) == 0)
+    {
+        if(pMemory->bOwned)
+            delete [] reinterpret_cast<uint8_t*>(pMemory->base);
+        delete pMemory;
+    }
+}
+
+void NetBuffer::unref()
+{
+    NetBuffer *pBuffer = this;
+    while(pBuffer && (pBuffer->m_RefCount -= 1) == 0)
+    {
+        NetBuffer *pNext = pBuffer->m_pNext;
+        release(pBuffer->m_pData);
+        delete pBuffer;
+        pBuffer = pNext;
+    }
+}
+
+NetBuffer *NetBuffer::clone()
+{
+    // The caller's memory may be gone by the time the clone is
+    if(!m_pData->bOwned || m_pNext)
+        return copy(headroom());
+
+    m_pData->refCount += 1;
+
+    NetBuffer *pBuffer = new NetBuffer(m_pData, m_Offset, m_Length);
+    if(!pBuffer)
+        release(m_pData);
+    return pBuffer;
+}
+
+NetBuffer *NetBuffer::copy(size_t headroom)
+{
+    size_t nBytes = chainLength();
+
+    NetBuffer *pBuffer = allocate(nBytes, headroom);
+    if(!pBuffer)
+        return 0;
+
+    read(pBuffer->put(nBytes), nBytes);
+    return pBuffer;
+}
+
+uintptr_t NetBuffer::push(size_t nBytes)
+{
+    if(nBytes > m_Offset)
+        return 0;
+
+    m_Offset -= nBytes;
+    m_Length += nBytes;
+    return data();
+}
+
+uintptr_t NetBuffer::pull(size_t nBytes)
+{
+    if(nBytes > m_Length)
+        return 0;
+
+    m_Offset += nBytes;
+    m_Length -= nBytes;
+    return data();
+}
+
+uintptr_t NetBuffer::put(size_t nBytes)
+{
+    if(nBytes > tailroom())
+        return 0;
+
+    uintptr_t ret = data() + m_Length;
+    m_Length += nBytes;
+    return ret;
+}
+
+bool NetBuffer::append(uintptr_t buffer, size_t nBytes)
+{
+    uintptr_t p = put(nBytes);
+    if(!p && nBytes)
+        return false;
+
+    memcpy(reinterpret_cast<void*>(p), reinterpret_cast<void*>(buffer), nBytes);
+    return true;
+}
+
+void NetBuffer::chain(NetBuffer *pBuffer)
+{
+    NetBuffer *pTail = this;
+    while(pTail->m_pNext)
+        pTail = pTail->m_pNext;
+    pTail->m_pNext = pBuffer;
+}
+
+size_t NetBuffer::chainLength()
+{
+    size_t nBytes = 0;
+    for(NetBuffer *pBuffer = this; pBuffer; pBuffer = pBuffer->m_pNext)
+        nBytes += pBuffer->m_Length;
+    return nBytes;
+}
+
+bool NetBuffer::linearize()
+{
+    if(!m_pNext)
+        return true;
+
+    size_t nBytes = chainLength();
+
+    // Keep our headroom, so headers can still be pushed
+    uintptr_t base = reinterpret_cast<uintptr_t>(new uint8_t[m_Offset + nBytes]);
+    if(!base)
+        return false;
+
+    Memory *pMemory = new Memory;
+    if(!pMemory)
+    {
+        delete [] reinterpret_cast<uint8_t*>(base);
+        return false;
+    }
+    pMemory->refCount = 1;
+    pMemory->base = base;
+    pMemory->size = m_Offset + nBytes;
+    pMemory->bOwned = true;
+
+    read(base + m_Offset, nBytes);
+
+    // Drop the rest of the chain and our old memory
+    m_pNext->unref();
+    m_pNext = 0;
+    release(m_pData);
+
+    m_pData = pMemory;
+    m_Length = nBytes;
+    return true;
+}
+
+size_t NetBuffer::read(uintptr_t buffer, size_t nBytes, size_t offset)
+{
+    size_t nCopied = 0;
+    for(NetBuffer *pBuffer = this; pBuffer && nCopied < nBytes; pBuffer = pBuffer->m_pNext)
+    {
+        // Skip over whole buffers before the offset
+        if(offset >= pBuffer->m_Length)
+        {
+            offset -= pBuffer->m_Length;
+            continue;
+        }
+
+        size_t n = pBuffer->m_Length - offset;
+        if(n > (nBytes - nCopied))
+            n = nBytes - nCopied;
+
+        memcpy(reinterpret_cast<void*>(buffer + nCopied),
+               reinterpret_cast<void*>(pBuffer->data() + offset),
+               n);
+        nCopied += n;
+        offset = 0;
+    }
+    return nCopied;
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef MACHINE_NETBUFFER_H
+#define MACHINE_NETBUFFER_H
+
+#include <processor/types.h>
+#include <Atomic.h>
+
+/// Room left in front of a buffer's data for the headers the layers below
+/// will prepend: Ethernet (14), IPv6 (40) and a TCP header with the largest
+/// set of options (60), rounded up.
+#define NETBUFFER_HEADROOM      128
+
+/**
+ * A packet on its way down the stack.
+ *
+ * The data sits part way into its memory, so that each layer can prepend
+ * its header with push() rather than moving everything it was given, and
+ * the memory is reference counted: clone() makes a second NetBuffer over
+ * the same bytes, which is how TCP sends a segment while keeping it on the
+ * retransmit queue. Buffers can be chained (next()) for data that arrives
+ * in pieces; linearize() joins a chain up for devices that need one
+ * contiguous buffer.
+ *
+ * A device is handed data() and length() of a linear buffer, which it may
+ * read from directly (by DMA or otherwise) until its send() returns.
+ */
+class NetBuffer
+{
+  public:
+    /** Allocates a buffer with room for nBytes of data, and headroom bytes
+     *  in front of it. The buffer starts out empty: put() the data in.
+     *  \return Null if there's no memory. */
+    static NetBuffer *allocate(size_t nBytes, size_t headroom = NETBUFFER_HEADROOM);
+
+    /** Wraps memory the caller owns, without copying it. The NetBuffer must
+     *  not outlive the memory, and the memory isn't freed with it.
+     *  \param base Start of the memory.
+     *  \param size Size of the memory.
+     *  \param offset Where the data starts.
+     *  \param nBytes Length of the data.
+     *  \return Null if there's no memory for the NetBuffer itself. */
+    static NetBuffer *wrap(uintptr_t base, size_t size, size_t offset, size_t nBytes);
+
+    /** Another reference to this buffer. */
+    void ref()
+    {
+        m_RefCount += 1;
+    }
+
+    /** Drops a reference. The last one frees the buffer, the rest of its
+     *  chain, and its memory if no clone still uses it. */
+    void unref();
+
+    /** A new NetBuffer over the same memory, with its own start and length,
+     *  so it can have headers pushed onto it without disturbing this one.
+     *  Headers pushed onto two clones at once would share the headroom, so
+     *  only one clone should be on its way down the stack at a time. A
+     *  wrapped buffer is copied instead, as its memory may not last.
+     *  \return Null if there's no memory. */
+    NetBuffer *clone();
+
+    /** A copy of the whole chain as a single buffer, with the given
+     *  headroom. */
+    NetBuffer *copy(size_t headroom = NETBUFFER_HEADROOM);
+
+    /** Start of the data */
+    inline uintptr_t data()
+    {
+        return m_pData->base + m_Offset;
+    }
+
+    /** Length of the data in this buffer (not the chain) */
+    inline size_t length()
+    {
+        return m_Length;
+    }
+
+    /** Space in front of the data */
+    inline size_t headroom()
+    {
+        return m_Offset;
+    }
+
+    /** Space after the data. A clone never grows into it, as the original
+     *  may. */
+    inline size_t tailroom()
+    {
+        if(m_pData->refCount > 1)
+            return 0;
+        return m_pData->size - (m_Offset + m_Length);
+    }
+
+    /** Grows the data at the front by nBytes, for a header.
+     *  \return The new start of the data, or zero without the headroom. */
+    uintptr_t push(size_t nBytes);
+
+    /** Removes nBytes from the front of the data.
+     *  \return The new start of the data, or zero if there isn't that much. */
+    uintptr_t pull(size_t nBytes);
+
+    /** Grows the data at the end by nBytes.
+     *  \return Where the new bytes go, or zero without the tailroom. */
+    uintptr_t put(size_t nBytes);
+
+    /** Appends nBytes from a caller's buffer to the data.
+     *  \return False without the tailroom. */
+    bool append(uintptr_t buffer, size_t nBytes);
+
+    /** The next buffer in the chain */
+    inline NetBuffer *next()
+    {
+        return m_pNext;
+    }
+
+    /** Adds a buffer (and its own chain) to the end of this chain, taking
+     *  over the caller's reference to it. */
+    void chain(NetBuffer *pBuffer);
+
+    /** Length of the data in the whole chain */
+    size_t chainLength();
+
+    /** Copies the chain into this buffer, so that data() and length() cover
+     *  all of it. Does nothing to a buffer that isn't chained.
+     *  \return False if there's no memory. */
+    bool linearize();
+
+    /** Copies nBytes of the chain's data, starting offset bytes in, out to
+     *  a caller's buffer.
+     *  \return The number of bytes copied. */
+    size_t read(uintptr_t buffer, size_t nBytes, size_t offset = 0);
+
+  private:
+    NetBuffer(const NetBuffer &);
+    NetBuffer &operator = (const NetBuffer &);
+
+    /** The memory, shared between clones */
+    struct Memory
+    {
+        Atomic<size_t> refCount;
+        uintptr_t base;
+        size_t size;
+        /** Did we allocate it? If not, it's a caller's, and isn't freed. */
+        bool bOwned;
+    };
+
+    NetBuffer(Memory *pMemory, size_t offset, size_t nBytes);
+    ~NetBuffer();
+
+    /** Drops a reference on the memory, freeing it with the last one. */
+    static void release(Memory *pMemory);
+
+    Memory *m_pData;
+
+    size_t m_Offset;
+    size_t m_Length;
+
+    NetBuffer *m_pNext;
+
+    Atomic<size_t> m_RefCount;
+};
+
+#endif
@@ -20,16 +20,99 @@
 #include <Module.h>
 #include <Log.h>
 #include <processor/Processor.h>
+#include <process/Scheduler.h>
+#include <LockGuard.h>
 
 #include "Dns.h"
 
 NetworkStack NetworkStack::stack;
 
+/** Raises an Atomic high-water mark to value, if it's higher */
+static void updateMaximum(Atomic<size_t> &max, size_t value)
+{
+  size_t current = max;
+  while (value > current && !max.compareAndSwap(current, value))
+    current = max;
+}
+
+NetworkRxQueue::NetworkRxQueue(Network *pCard, size_t nWorker) :
+  m_pCard(pCard), m_nWorker(nWorker), m_bPolling(false), m_nQueued(0), m_nDropped(0),
+  m_nMaxDepth(0), m_nBatches(0), m_nMaxBatch(0), m_nPolls(0), m_Slots(), m_Head(0), m_Tail(0)
+{
+  for (size_t i = 0; i < NETWORK_RX_RING_SIZE; i++)
+    m_Slots[i].sequence = i;
+}
+
+bool NetworkRxQueue::push(uintptr_t buffer, size_t nBytes, uint32_t offset)
+{
+  size_t pos = m_Head;
+  while (true)
+  {
+    Slot &slot = m_Slots[pos % NETWORK_RX_RING_SIZE];
+    ssize_t diff = static_cast<ssize_t>(slot.sequence) - static_cast<ssize_t>(pos);
+    if (diff == 0)
+    {
+      // The slot is free - try and claim it.
+      if (m_Head.compareAndSwap(pos, pos + 1))
+      {
+        slot.buffer = buffer;
+        slot.nBytes = nBytes;
+        slot.offset = offset;
+
+        // Publish the packet to the receive thread.
+        __sync_synchronize();
+        slot.sequence = pos + 1;
+        return true;
+      }
+    }
+    else if (diff < 0)
+    {
+      // The receive thread hasn't caught up with this slot yet: full.
+      return false;
+    }
+
+    // Another producer got in first.
+    pos = m_Head;
+  }
+}
+
+bool NetworkRxQueue::pop(uintptr_t &buffer, size_t &nBytes, uint32_t &offset)
+{
+  size_t pos = m_Tail;
+  Slot &slot = m_Slots[pos % NETWORK_RX_RING_SIZE];
+  if (slot.sequence != pos + 1)
+    return false;
+
+  __sync_synchronize();
+  buffer = slot.buffer;
+  nBytes = slot.nBytes;
+  offset = slot.offset;
+  __sync_synchronize();
+
+  // Hand the slot back to the producers, for the next time around the ring.
+  slot.sequence = pos + NETWORK_RX_RING_SIZE;
+  m_Tail = pos + 1;
+  return true;
+}
+
 NetworkStack::NetworkStack() :
-  RequestQueue(), m_pLoopback(0), m_Children(), m_MemPool("network-pool")
+  RequestQueue(), m_pLoopback(0), m_Children(), m_MemPool("network-pool"),
+  m_pWorkers(0), m_nWorkers(0), m_nNextWorker(0)
 {
   initialise();
 
+  // One receive thread per processor, within reason.
+  m_nWorkers = Processor::getCount();
+  if (m_nWorkers > NETWORK_RX_MAX_WORKERS)
+    m_nWorkers = NETWORK_RX_MAX_WORKERS;
+  else if (!m_nWorkers)
+    m_nWorkers = 1;
+  m_pWorkers = new RxWorker[m_nWorkers];
+  for (size_t i = 0; i < m_nWorkers; i++)
+    m_pWorkers[i].pThread = new Thread(Processor::information().getCurrentThread()->getParent(),
+                                       rxWorkerThread,
+                                       &m_pWorkers[i]);
+
 #if defined(X86_COMMON)
   // Lots of RAM to burn! Try 16 MB, then 8 MB, then 4 MB, then give up
   if(!m_MemPool.initialise(4096, 1600))
@@ -84,71 +167,220 @@ uint64_t NetworkStack::executeRequest(uint64_t p1, uint64_t p2, uint64_t p3, uin
     return 0;
 }
 
-int NetworkStack::packetThread(void *p)
+int NetworkStack::rxWorkerThread(void *p)
 {
-    Packet *pack = reinterpret_cast<Packet*>(p);
-    if(!pack)
-        return 0;
-
-    uintptr_t packet = pack->buffer;
-    size_t packetSize = pack->packetLength;
-    Network *pCard = pack->pCard;
-    uint32_t offset = pack->offset;
+    NetworkStack::instance().rxWorker(reinterpret_cast<RxWorker*>(p));
+    return 0;
+}
 
-    if(!packet || !packetSize)
+void NetworkStack::rxWorker(RxWorker *pWorker)
+{
+    while (true)
     {
-        delete pack;
-        return 0;
+        size_t nHandled = 0;
+        bool bPolling = false;
+
+        {
+            LockGuard<Mutex> guard(pWorker->queueLock);
+            for (List<NetworkRxQueue*>::Iterator it = pWorker->queues.begin();
+                 it != pWorker->queues.end();
+                 it++)
+            {
+                NetworkRxQueue *pQueue = *it;
+
+                // Pull packets off devices that have their interrupt turned off.
+                if (pQueue->m_bPolling)
+                {
+                    pQueue->m_nPolls += 1;
+                    if (pQueue->m_pCard->poll(NETWORK_RX_BUDGET) || pQueue->depth())
+                        bPolling = true;
+                    else
+                    {
+                        // The device has gone quiet, back to interrupts. Poll
+                        // once more for anything that arrived in the meantime.
+                        pQueue->m_bPolling = false;
+                        pQueue->m_pCard->setReceiveInterrupts(true);
+                        pQueue->m_pCard->poll(NETWORK_RX_BUDGET);
+                    }
+                }
+
+                nHandled += processQueue(pQueue, NETWORK_RX_BUDGET);
+            }
+        }
+
+        if (nHandled)
+            continue;
+        else if (bPolling)
+        {
+            // Give the devices we're polling time to receive something.
+            Scheduler::instance().yield();
+            continue;
+        }
+
+        // Nothing to do. Producers wake us if we're marked as sleeping, so
+        // check again after marking ourselves to catch packets queued before.
+        pWorker->bSleeping = true;
+        if (hasWork(pWorker) && pWorker->bSleeping.compareAndSwap(true, false))
+            continue;
+
+        pWorker->wakeup.acquire();
     }
+}
 
-    // Pass onto the ethernet layer
-    /// \todo We should accept a parameter here that specifies the type of packet
-    ///       so we can pass it on to the correct handler, rather than assuming
-    ///       Ethernet.
-    Ethernet::instance().receive(packetSize, packet, pCard, offset);
+size_t NetworkStack::processQueue(NetworkRxQueue *pQueue, size_t nBudget)
+{
+    uintptr_t packet;
+    size_t packetSize;
+    uint32_t offset;
+
+    size_t nHandled = 0;
+    while (nHandled < nBudget && pQueue->pop(packet, packetSize, offset))
+    {
+        // Pass onto the ethernet layer
+        /// \todo We should accept a parameter here that specifies the type of packet
+        ///       so we can pass it on to the correct handler, rather than assuming
+        ///       Ethernet.
+        Ethernet::instance().receive(packetSize, packet, pQueue->m_pCard, offset);
+
+        m_MemPool.free(packet);
+        nHandled++;
+    }
 
-    NetworkStack::instance().getMemPool().free(packet);
+    return nHandled;
+}
 
-    delete pack;
-    return 0;
+bool NetworkStack::hasWork(RxWorker *pWorker)
+{
+    LockGuard<Mutex> guard(pWorker->queueLock);
+    for (List<NetworkRxQueue*>::Iterator it = pWorker->queues.begin();
+         it != pWorker->queues.end();
+         it++)
+    {
+        if ((*it)->depth() || (*it)->m_bPolling)
+            return true;
+    }
+    return false;
 }
 
 void NetworkStack::receive(size_t nBytes, uintptr_t packet, Network* pCard, uint32_t offset)
 {
-  if(!packet || !nBytes)
-      return;
+  Frame frame;
+  frame.buffer = packet;
+  frame.nBytes = nBytes;
+  frame.offset = offset;
 
-  pCard->gotPacket();
+  receive(pCard, &frame, 1);
+}
+
+void NetworkStack::receive(Network *pCard, Frame *pFrames, size_t nFrames, bool bPoolBuffers)
+{
+  NetworkRxQueue *pQueue = pCard->m_pRxQueue;
 
-  // Some cards might be giving us a DMA address or something, so we copy
-  // before passing on to the worker thread...
-  uint8_t *safePacket = reinterpret_cast<uint8_t*>(m_MemPool.allocateNow());
-  if(!safePacket)
+  size_t nQueued = 0;
+  for (size_t i = 0; i < nFrames; i++)
   {
-    ERROR("Network Stack: Out of memory pool space, dropping incoming packet");
-    pCard->droppedPacket();
+    uintptr_t packet = pFrames[i].buffer;
+    size_t nBytes = pFrames[i].nBytes;
+    if(!packet || !nBytes)
+    {
+      if(packet && bPoolBuffers)
+        m_MemPool.free(packet);
+      continue;
+    }
+
+    pCard->gotPacket();
+
+    if(!pQueue)
+    {
+      WARNING("Network Stack: packet from an unregistered device, dropping it");
+      pCard->droppedPacket();
+      if(bPoolBuffers)
+        m_MemPool.free(packet);
+      continue;
+    }
+
+    // Some cards might be giving us a DMA address or something, so we copy
+    // before passing on to the worker thread...
+    if(!bPoolBuffers)
+    {
+      uint8_t *safePacket = reinterpret_cast<uint8_t*>(m_MemPool.allocateNow());
+      if(!safePacket)
+      {
+        ERROR("Network Stack: Out of memory pool space, dropping incoming packet");
+        pCard->droppedPacket();
+        pQueue->m_nDropped += 1;
+        continue;
+      }
+      memcpy(safePacket, reinterpret_cast<void*>(packet), nBytes);
+      packet = reinterpret_cast<uintptr_t>(safePacket);
+    }
+
+    if(!pQueue->push(packet, nBytes, pFrames[i].offset))
+    {
+      pCard->droppedPacket();
+      pQueue->m_nDropped += 1;
+      m_MemPool.free(packet);
+      continue;
+    }
+
+    nQueued++;
+  }
+
+  if(!pQueue || !nQueued)
     return;
+
+  pQueue->m_nQueued += nQueued;
+  pQueue->m_nBatches += 1;
+  updateMaximum(pQueue->m_nMaxBatch, nQueued);
+
+  size_t depth = pQueue->depth();
+  updateMaximum(pQueue->m_nMaxDepth, depth);
+
+  // If the receive thread is falling behind, stop the device interrupting
+  // for every packet and let the thread poll it instead.
+  if(depth >= NETWORK_RX_POLL_THRESHOLD && pCard->canPoll() &&
+     pQueue->m_bPolling.compareAndSwap(false, true))
+  {
+    pCard->setReceiveInterrupts(false);
   }
-  memcpy(safePacket, reinterpret_cast<void*>(packet), nBytes);
-  Packet *p = new Packet;
-  p->buffer = reinterpret_cast<uintptr_t>(safePacket);
-  p->packetLength = nBytes;
-  p->pCard = pCard;
-  p->offset = offset;
 
-  new Thread(Processor::information().getCurrentThread()->getParent(), packetThread, p);
+  RxWorker &worker = m_pWorkers[pQueue->m_nWorker];
+  if(worker.bSleeping.compareAndSwap(true, false))
+    worker.wakeup.release();
+}
 
-  /*
-  addAsyncRequest(0, reinterpret_cast<uint64_t>(safePacket),
-                     static_cast<uint64_t>(nBytes),
-                     reinterpret_cast<uint64_t>(pCard),
-                     static_cast<uint64_t>(offset));
-  */
+bool NetworkStack::getRxStatistics(Network *pCard, NetworkRxStatistics &stats)
+{
+  NetworkRxQueue *pQueue = pCard->m_pRxQueue;
+  if(!pQueue)
+    return false;
+
+  stats.nQueued = pQueue->m_nQueued;
+  stats.nDropped = pQueue->m_nDropped;
+  stats.nDepth = pQueue->depth();
+  stats.nMaxDepth = pQueue->m_nMaxDepth;
+  stats.nBatches = pQueue->m_nBatches;
+  stats.nMaxBatch = pQueue->m_nMaxBatch;
+  stats.nPolls = pQueue->m_nPolls;
+  stats.bPolling = pQueue->m_bPolling;
+  return true;
 }
 
 void NetworkStack::registerDevice(Network *pDevice)
 {
   m_Children.pushBack(pDevice);
+
+  if(pDevice->m_pRxQueue)
+    return;
+
+  // Spread devices over the receive threads.
+  size_t nWorker = m_nNextWorker++ % m_nWorkers;
+  NetworkRxQueue *pQueue = new NetworkRxQueue(pDevice, nWorker);
+  {
+    LockGuard<Mutex> guard(m_pWorkers[nWorker].queueLock);
+    m_pWorkers[nWorker].queues.pushBack(pQueue);
+  }
+  pDevice->m_pRxQueue = pQueue;
 }
 
 Network *NetworkStack::getDevice(size_t n)
@@ -172,6 +404,32 @@ void NetworkStack::deRegisterDevice(Network *pDevice)
     m_Children.erase(it);
     break;
   }
+
+  NetworkRxQueue *pQueue = pDevice->m_pRxQueue;
+  if(!pQueue)
+    return;
+  pDevice->m_pRxQueue = 0;
+
+  RxWorker &worker = m_pWorkers[pQueue->m_nWorker];
+  LockGuard<Mutex> guard(worker.queueLock);
+  for(List<NetworkRxQueue*>::Iterator it = worker.queues.begin();
+      it != worker.queues.end();
+      it++)
+  {
+    if(*it == pQueue)
+    {
+      worker.queues.erase(it);
+      break;
+    }
+  }
+
+  // Throw away anything still waiting. The queue itself is not freed, as an
+  // interrupt handler on another CPU may still be pushing to it.
+  uintptr_t packet;
+  size_t nBytes;
+  uint32_t offset;
+  while(pQueue->pop(packet, nBytes, offset))
+    m_MemPool.free(packet);
 }
 
 extern Ipv6Service *g_pIpv6Service;
@@ -22,6 +22,101 @@
 #include <machine/Network.h>
 #include <utilities/RequestQueue.h>
 #include <utilities/MemoryPool.h>
+#include <utilities/List.h>
+#include <process/Semaphore.h>
+#include <process/Mutex.h>
+#include <process/Thread.h>
+#include <Atomic.h>
+
+/// Number of packets each device's receive ring holds (must be a power of two)
+#define NETWORK_RX_RING_SIZE        256
+/// Maximum number of packets handled from one ring before moving to the next
+#define NETWORK_RX_BUDGET           32
+/// Ring depth at which a device that can poll is switched to polling
+#define NETWORK_RX_POLL_THRESHOLD   (NETWORK_RX_RING_SIZE / 2)
+/// Maximum number of receive threads
+#define NETWORK_RX_MAX_WORKERS      4
+
+/** Receive statistics for one network device */
+struct NetworkRxStatistics
+{
+    /** Packets queued for the receive threads */
+    size_t nQueued;
+    /** Packets dropped because the ring was full or there was no buffer */
+    size_t nDropped;
+    /** Packets waiting in the ring right now */
+    size_t nDepth;
+    /** Deepest the ring has been */
+    size_t nMaxDepth;
+    /** Batches handed over by the driver */
+    size_t nBatches;
+    /** Largest batch handed over by the driver */
+    size_t nMaxBatch;
+    /** Number of times the device was polled */
+    size_t nPolls;
+    /** Is the device being polled rather than interrupting? */
+    bool bPolling;
+};
+
+/**
+ * Ring of received packets for one device. Any number of producers (drivers, in
+ * interrupt context or not) may push, but only the device's receive thread pops.
+ */
+class NetworkRxQueue
+{
+  public:
+    NetworkRxQueue(Network *pCard, size_t nWorker);
+
+    /** Queues a packet, without blocking.
+     * \return false if the ring is full. */
+    bool push(uintptr_t buffer, size_t nBytes, uint32_t offset);
+
+    /** Takes the oldest packet off the ring. Receive thread only.
+     * \return false if the ring is empty. */
+    bool pop(uintptr_t &buffer, size_t &nBytes, uint32_t &offset);
+
+    /** Number of packets in the ring */
+    inline size_t depth()
+    {
+        return m_Head - m_Tail;
+    }
+
+    /** The device this ring belongs to */
+    Network *m_pCard;
+    /** Index of the receive thread that empties the ring */
+    size_t m_nWorker;
+    /** Is the device being polled? */
+    Atomic<bool> m_bPolling;
+
+    /** Statistics, see NetworkRxStatistics */
+    Atomic<size_t> m_nQueued;
+    Atomic<size_t> m_nDropped;
+    Atomic<size_t> m_nMaxDepth;
+    Atomic<size_t> m_nBatches;
+    Atomic<size_t> m_nMaxBatch;
+    Atomic<size_t> m_nPolls;
+
+  private:
+    NetworkRxQueue(const NetworkRxQueue&);
+    NetworkRxQueue &operator = (const NetworkRxQueue&);
+
+    struct Slot
+    {
+        /** Position in the ring this slot may next be written (== position) or
+         *  read (== position + 1) at. */
+        volatile size_t sequence;
+        uintptr_t buffer;
+        size_t nBytes;
+        uint32_t offset;
+    };
+
+    Slot m_Slots[NETWORK_RX_RING_SIZE];
+
+    /** Next position to write, claimed by producers */
+    Atomic<size_t> m_Head;
+    /** Next position to read */
+    volatile size_t m_Tail;
+};
 
 /**
  * The Pedigree network stack
@@ -40,9 +135,27 @@ public:
     return stack;
   }
   
-  /** Called when a packet arrives */
+  /** A received packet, for handing over several at once */
+  struct Frame
+  {
+      uintptr_t buffer;
+      size_t nBytes;
+      uint32_t offset;
+  };
+
+  /** Called when a packet arrives. The packet is copied, so the buffer can be
+   *  reused as soon as this returns. Safe to call from interrupt context. */
   void receive(size_t nBytes, uintptr_t packet, Network* pCard, uint32_t offset);
 
+  /** Called when a batch of packets arrives.
+   * \param bPoolBuffers If true, the buffers came from getMemPool() and the
+   *                     stack takes them over rather than copying them. */
+  void receive(Network *pCard, Frame *pFrames, size_t nFrames, bool bPoolBuffers = false);
+
+  /** Gets the receive statistics for a device.
+   * \return false if the device isn't registered. */
+  bool getRxStatistics(Network *pCard, NetworkRxStatistics &stats);
+
   /** Registers a given network device with the stack */
   void registerDevice(Network *pDevice);
 
@@ -76,17 +189,34 @@ public:
 private:
 
   static NetworkStack stack;
-  
-  static int packetThread(void *p);
-  
-  struct Packet
+
+  /** A receive thread, and the rings it empties */
+  struct RxWorker
   {
-      uintptr_t buffer;
-      size_t packetLength;
-      Network *pCard;
-      uint32_t offset;
+      RxWorker() : pThread(0), wakeup(0), bSleeping(false), queueLock(false), queues()
+      {}
+
+      Thread *pThread;
+      /** Released when a packet is queued while the thread sleeps */
+      Semaphore wakeup;
+      Atomic<bool> bSleeping;
+      /** Guards queues */
+      Mutex queueLock;
+      List<NetworkRxQueue*> queues;
   };
-  
+
+  static int rxWorkerThread(void *p);
+
+  /** Main loop of a receive thread */
+  void rxWorker(RxWorker *pWorker);
+
+  /** Passes up to nBudget packets from the ring to the Ethernet layer.
+   * \return The number of packets handled. */
+  size_t processQueue(NetworkRxQueue *pQueue, size_t nBudget);
+
+  /** Does any ring belonging to the worker have packets waiting? */
+  bool hasWork(RxWorker *pWorker);
+
   virtual uint64_t executeRequest(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5,
                                   uint64_t p6, uint64_t p7, uint64_t p8);
 
@@ -98,6 +228,12 @@ private:
 
   /** Networking memory pool */
   MemoryPool m_MemPool;
+
+  /** Receive threads */
+  RxWorker *m_pWorkers;
+  size_t m_nWorkers;
+  /** Worker to give the next registered device to */
+  size_t m_nNextWorker;
 };
 
 #endif
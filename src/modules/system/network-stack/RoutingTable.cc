@@ -21,7 +21,51 @@
 
 RoutingTable RoutingTable::m_Instance;
 
-RoutingTable::RoutingTable() : m_bHasRoutes(false), m_TableLock(false)
+/** Bit n of a key, counting from the most significant bit */
+static inline size_t keyBit(const uint8_t *key, size_t n)
+{
+    return (key[n / 8] >> (7 - (n % 8))) & 1;
+}
+
+/** Number of leading bits (up to max) that two keys have in common */
+static size_t commonBits(const uint8_t *a, const uint8_t *b, size_t max)
+{
+    size_t n = 0;
+    while(n < max)
+    {
+        uint8_t diff = a[n / 8] ^ b[n / 8];
+        if(!diff)
+        {
+            n += 8;
+            continue;
+        }
+
+        while(!(diff & 0x80))
+        {
+            diff <<= 1;
+            n++;
+        }
+        break;
+    }
+    return n < max ? n : max;
+}
+
+/** Clears every bit of a key from bit n onwards */
+static void maskKey(uint8_t *key, size_t n)
+{
+    for(size_t i = 0; i < 16; i++)
+    {
+        if(n >= (i + 1) * 8)
+            continue;
+        else if(n <= i * 8)
+            key[i] = 0;
+        else
+            key[i] &= 0xFF << (8 - (n % 8));
+    }
+}
+
+RoutingTable::RoutingTable() :
+    m_bHasRoutes(false), m_TableLock(false), m_Routes(), m_pFib(0), m_nReaders(0), m_RetiredFibs()
 {
 }
 
@@ -82,6 +126,28 @@ void RoutingTable::Add(Type type, IpAddress dest, IpAddress subIp, String meta,
         }
     }
 
+    // Compile it into the forwarding table. Direct matches are full-length
+    // prefixes, so longest prefix match finds them before any subnet.
+    RouteEntry *pEntry = new RouteEntry;
+    pEntry->type = type;
+    pEntry->subIp = subIp;
+    pEntry->name = meta;
+    pEntry->pCard = card;
+    if((dest.getType() == IpAddress::IPv4) && (type != NamedV6))
+    {
+        uint32_t ip = dest.getIp();
+        memcpy(pEntry->key, &ip, 4);
+        pEntry->prefixLen = 32;
+        pEntry->metric = 0;
+    }
+    else
+    {
+        dest.getIp(pEntry->key);
+        pEntry->prefixLen = 128;
+        pEntry->metric = 1;
+    }
+    addEntry(pEntry);
+
     m_bHasRoutes = true;
 
     delete pResult;
@@ -155,194 +221,330 @@ void RoutingTable::Add(Type type, IpAddress dest, IpAddress subnet, IpAddress su
         }
     }
 
+    RouteEntry *pEntry = new RouteEntry;
+    pEntry->type = type;
+    pEntry->subIp = subIp;
+    pEntry->name = meta;
+    pEntry->pCard = card;
+    if(dest.getType() == IpAddress::IPv4 && (type != NamedV6))
+    {
+        // The prefix length is the number of bits set in the subnet mask.
+        uint32_t ip = dest.getIp(), mask = subnet.getIp();
+        memcpy(pEntry->key, &ip, 4);
+        for(; mask; mask &= mask - 1)
+            pEntry->prefixLen++;
+        pEntry->metric = 0;
+    }
+    else
+    {
+        dest.getIp(pEntry->key);
+        pEntry->prefixLen = dest.getIpv6Prefix();
+        if(pEntry->prefixLen > 128)
+            pEntry->prefixLen = 128;
+        pEntry->metric = 1024;
+    }
+    maskKey(pEntry->key, pEntry->prefixLen);
+    addEntry(pEntry);
+
     m_bHasRoutes = true;
 
     delete pResult;
 }
 
-Network *RoutingTable::route(IpAddress *ip, Config::Result *pResult)
+void RoutingTable::addEntry(RouteEntry *pEntry)
 {
-    // Grab the interface
-    Network *pCard = static_cast<Network*>(DeviceHashTree::instance().getDevice(pResult->getNum(0, "iface")));
+    // Caller holds m_TableLock.
+    m_Routes.pushBack(pEntry);
+
+    // Publish the new table. Lookups from here on see it.
+    Fib *pOld = m_pFib;
+    Fib *pNew = compile();
+    __sync_synchronize();
+    m_pFib = pNew;
+    __sync_synchronize();
+
+    if(pOld)
+        m_RetiredFibs.pushBack(pOld);
+
+    // Any lookup still using an old table started before the swap, so once
+    // there are no lookups at all, none of the old tables can be in use.
+    if(m_nReaders == 0)
+    {
+        while(m_RetiredFibs.count())
+            destroy(m_RetiredFibs.popFront());
+    }
+}
 
-    // If we are to perform substitution, do so
-    Type t = static_cast<Type>(pResult->getNum(0, "type"));
-    if(t == DestIpSub || t == DestSubnetComplement)
-        ip->setIp(HOST_TO_BIG32(pResult->getNum(0, "subip")));
-    else if(t == DestIpv6Sub || t == DestPrefixComplement)
+RoutingTable::Fib *RoutingTable::compile()
+{
+    Fib *pFib = new Fib;
+    for(List<RouteEntry*>::Iterator it = m_Routes.begin();
+        it != m_Routes.end();
+        it++)
     {
-        uint32_t subIp[4];
-        subIp[0] = pResult->getNum(0, "subip1");
-        subIp[1] = pResult->getNum(0, "subip2");
-        subIp[2] = pResult->getNum(0, "subip3");
-        subIp[3] = pResult->getNum(0, "subip4");
+        RouteEntry *pEntry = *it;
+        switch(pEntry->type)
+        {
+            case DestIp:
+            case DestIpSub:
+            case DestSubnet:
+                pFib->pRoot4 = insert(pFib->pRoot4, pEntry);
+                break;
+            case DestIpv6:
+            case DestIpv6Sub:
+            case DestPrefix:
+                pFib->pRoot6 = insert(pFib->pRoot6, pEntry);
+                break;
+            case DestSubnetComplement:
+                pFib->complement4.pushBack(pEntry);
+                break;
+            case DestPrefixComplement:
+            {
+                // Keep these sorted by metric, oldest first for equal metrics.
+                Vector<RouteEntry*> sorted;
+                bool bInserted = false;
+                for(size_t i = 0; i < pFib->complement6.count(); i++)
+                {
+                    RouteEntry *pOther = pFib->complement6[i];
+                    if(!bInserted && pEntry->metric < pOther->metric)
+                    {
+                        sorted.pushBack(pEntry);
+                        bInserted = true;
+                    }
+                    sorted.pushBack(pOther);
+                }
+                if(!bInserted)
+                    sorted.pushBack(pEntry);
+                pFib->complement6 = sorted;
+                break;
+            }
+            case Named:
+            case NamedV6:
+                pFib->named.pushBack(pEntry);
+                break;
+        }
+    }
+    return pFib;
+}
+
+void RoutingTable::destroy(Fib *pFib)
+{
+    destroy(pFib->pRoot4);
+    destroy(pFib->pRoot6);
+    delete pFib;
+}
+
+void RoutingTable::destroy(TrieNode *pNode)
+{
+    if(!pNode)
+        return;
+    destroy(pNode->pChildren[0]);
+    destroy(pNode->pChildren[1]);
+    delete pNode;
+}
+
+RoutingTable::TrieNode *RoutingTable::insert(TrieNode *pNode, RouteEntry *pEntry)
+{
+    if(!pNode)
+        return new TrieNode(pEntry->key, pEntry->prefixLen, pEntry);
+
+    size_t len = pEntry->prefixLen;
+    size_t max = pNode->prefixLen < len ? pNode->prefixLen : len;
+    size_t common = commonBits(pNode->key, pEntry->key, max);
+
+    if(common == pNode->prefixLen)
+    {
+        if(len == pNode->prefixLen)
+        {
+            // Same prefix: the lowest metric wins, then the oldest route.
+            if(!pNode->pRoute || pEntry->metric < pNode->pRoute->metric)
+                pNode->pRoute = pEntry;
+            return pNode;
+        }
 
-        ip->setIp(reinterpret_cast<uint8_t*>(subIp));
+        // The new route is more specific than this node.
+        size_t bit = keyBit(pEntry->key, pNode->prefixLen);
+        pNode->pChildren[bit] = insert(pNode->pChildren[bit], pEntry);
+        return pNode;
+    }
+
+    if(common == len)
+    {
+        // The new route covers this node.
+        TrieNode *pNew = new TrieNode(pEntry->key, len, pEntry);
+        pNew->pChildren[keyBit(pNode->key, len)] = pNode;
+        return pNew;
+    }
+
+    // Diverges part-way through this node: join the two under a new node.
+    uint8_t key[16];
+    memcpy(key, pEntry->key, 16);
+    maskKey(key, common);
+
+    TrieNode *pJoin = new TrieNode(key, common, 0);
+    pJoin->pChildren[keyBit(pEntry->key, common)] = new TrieNode(pEntry->key, len, pEntry);
+    pJoin->pChildren[keyBit(pNode->key, common)] = pNode;
+    return pJoin;
+}
+
+RoutingTable::RouteEntry *RoutingTable::lookup(TrieNode *pNode, const uint8_t *key, size_t nBits)
+{
+    RouteEntry *pBest = 0;
+    while(pNode)
+    {
+        if(commonBits(pNode->key, key, pNode->prefixLen) != pNode->prefixLen)
+            break;
+
+        if(pNode->pRoute)
+            pBest = pNode->pRoute;
+
+        if(pNode->prefixLen >= nBits)
+            break;
+
+        pNode = pNode->pChildren[keyBit(key, pNode->prefixLen)];
+    }
+    return pBest;
+}
+
+RoutingTable::RouteEntry *RoutingTable::findNamed(Fib *pFib, const char *name, Type type)
+{
+    for(size_t i = 0; i < pFib->named.count(); i++)
+    {
+        RouteEntry *pEntry = pFib->named[i];
+        if(pEntry->type == type && !strcmp(static_cast<const char*>(pEntry->name), name))
+            return pEntry;
+    }
+    return 0;
+}
+
+RoutingTable::Fib *RoutingTable::beginLookup()
+{
+    m_nReaders += 1;
+    return m_pFib;
+}
+
+void RoutingTable::endLookup()
+{
+    m_nReaders -= 1;
+}
+
+Network *RoutingTable::route(IpAddress *ip, RouteEntry *pEntry)
+{
+    // If we are to perform substitution, do so
+    if(ip)
+    {
+        Type t = pEntry->type;
+        if(t == DestIpSub || t == DestSubnetComplement)
+            ip->setIp(pEntry->subIp.getIp());
+        else if(t == DestIpv6Sub || t == DestPrefixComplement)
+        {
+            uint8_t subIp[16];
+            pEntry->subIp.getIp(subIp);
+            ip->setIp(subIp);
+        }
     }
 
     // Return the interface to use
-    delete pResult;
-    return pCard;
+    return pEntry->pCard;
 }
 
 Network *RoutingTable::DetermineRoute(IpAddress *ip, bool bGiveDefault)
 {
-    LockGuard<Mutex> guard(m_TableLock);
+    Fib *pFib = beginLookup();
+    if(!pFib)
+    {
+        endLookup();
+        return 0;
+    }
+
+    Network *pCard = 0;
+    RouteEntry *pEntry = 0;
 
     // Use the IPv6 route table?
     if(ip->getType() == IpAddress::IPv6)
     {
-        // Can we directly match a route (/128)?
-        String str;
-        str.sprintf("SELECT * FROM routesv6 WHERE ipaddr='%s'", static_cast<const char *>(ip->prefixString(128))); // prefixString doesn't add /xx on the end.
-        Config::Result *pResult = Config::instance().query(str);
-        if(!pResult->succeeded())
-            ERROR("Routing table query failed: " << pResult->errorMessage());
-        else if(pResult->rows())
-        {
-            return route(ip, pResult);
-        }
-        delete pResult;
+        uint8_t key[16];
+        ip->getIp(key);
 
-        // Try a prefix lookup. This involves finding all the potential prefix numbers and then
-        // using those to find a usable prefix.
-        str.sprintf("SELECT id, prefixNum FROM routesv6 WHERE type = %u ORDER BY metric ASC", static_cast<int>(DestPrefix));
-        pResult = Config::instance().query(str);
-        if(!pResult->succeeded())
-            ERROR("Routing table query failed: " << pResult->errorMessage());
-        else if(pResult->rows())
-        {
-            // Got a bunch of prefixes!
-            for(size_t i = 0; i < pResult->rows(); i++)
-            {
-                // Check this prefix.
-                size_t prefixNum = pResult->getNum(i, "prefixNum");
-                str.sprintf("SELECT * FROM routesv6 WHERE prefix = '%s' AND type = %u ORDER BY metric ASC", static_cast<const char *>(ip->prefixString(prefixNum)), static_cast<int>(DestPrefix));
-                Config::Result *pTempResult = Config::instance().query(str);
-                if(!pTempResult->succeeded())
-                    continue;
-                else if(pTempResult->rows())
-                {
-                    delete pResult;
-                    return route(ip, pTempResult);
-                }
-            }
-        }
-        else
-            NOTICE("No prefixes");
-        delete pResult;
+        // Direct (/128) matches are the longest possible prefixes.
+        pEntry = lookup(pFib->pRoot6, key, 128);
 
-        // Still nothing, try a complement prefix search
-        str.sprintf("SELECT * FROM routesv6 WHERE (NOT prefix='%s') AND type=%u ORDER BY metric ASC", static_cast<const char *>(ip->prefixString()), static_cast<int>(DestPrefixComplement));
-        pResult = Config::instance().query(str);
-        if(!pResult->succeeded())
-            ERROR("Routing table query failed: " << pResult->errorMessage());
-        else if(pResult->rows())
+        // Still nothing, try the complement prefixes
+        for(size_t i = 0; !pEntry && i < pFib->complement6.count(); i++)
         {
-            return route(ip, pResult);
+            RouteEntry *pComplement = pFib->complement6[i];
+            if(commonBits(pComplement->key, key, pComplement->prefixLen) != pComplement->prefixLen)
+                pEntry = pComplement;
         }
-        delete pResult;
 
         // Nothing even still, try the default route if we're allowed
-        if(bGiveDefault)
-        {
-            return DefaultRouteV6();
-        }
+        if(!pEntry && bGiveDefault)
+            pEntry = findNamed(pFib, "default", NamedV6);
     }
     else
     {
-        // Build a query to search for a direct match
-        String str;
-        str.sprintf("SELECT * FROM routes WHERE ipaddr=%u", BIG_TO_HOST32(ip->getIp()));
-        Config::Result *pResult = Config::instance().query(str);
-        if(!pResult->succeeded())
-            ERROR("Routing table query failed: " << pResult->errorMessage());
-        else if(pResult->rows())
-        {
-            return route(ip, pResult);
-        }
-        delete pResult;
+        uint8_t key[16];
+        uint32_t addr = ip->getIp();
+        memset(key, 0, 16);
+        memcpy(key, &addr, 4);
 
-        // No rows! Try a subnet lookup first, without a complement.
-        str.sprintf("SELECT * FROM routes WHERE ((ipstart <= %u) AND (ipend >= %u)) AND (type == %u)", BIG_TO_HOST32(ip->getIp()), BIG_TO_HOST32(ip->getIp()), static_cast<int>(DestSubnet));
-        pResult = Config::instance().query(str);
-        if(!pResult->succeeded())
-            ERROR("Routing table query failed: " << pResult->errorMessage());
-        else if(pResult->rows())
-        {
-            return route(ip, pResult);
-        }
-        delete pResult;
+        pEntry = lookup(pFib->pRoot4, key, 32);
 
-        // Still nothing, try a complement subnet search
-        str.sprintf("SELECT * FROM routes WHERE (NOT ((ipstart <= %u) AND (ipend >= %u))) AND (type == %u)", BIG_TO_HOST32(ip->getIp()), BIG_TO_HOST32(ip->getIp()), static_cast<int>(DestSubnetComplement));
-        pResult = Config::instance().query(str);
-        if(!pResult->succeeded())
-            ERROR("Routing table query failed: " << pResult->errorMessage());
-        else if(pResult->rows())
+        // Still nothing, try the complement subnets
+        for(size_t i = 0; !pEntry && i < pFib->complement4.count(); i++)
         {
-            return route(ip, pResult);
+            RouteEntry *pComplement = pFib->complement4[i];
+            if(commonBits(pComplement->key, key, pComplement->prefixLen) != pComplement->prefixLen)
+                pEntry = pComplement;
         }
-        delete pResult;
 
         // Nothing even still, try the default route if we're allowed
-        if(bGiveDefault)
-        {
-            return DefaultRoute();
-        }
+        if(!pEntry && bGiveDefault)
+            pEntry = findNamed(pFib, "default", Named);
     }
 
-    // Not even the default route worked!
-    return 0;
+    // The default route never substitutes.
+    if(pEntry)
+        pCard = route((pEntry->type == Named || pEntry->type == NamedV6) ? 0 : ip, pEntry);
+
+    endLookup();
+    return pCard;
 }
 
-Network *RoutingTable::DefaultRoute()
+Network *RoutingTable::DetermineRoute(String name, bool bGiveDefault)
 {
-    // If already locked, will return false, so we don't unlock (DetermineRoute calls this function)
-    bool bLocked = m_TableLock.tryAcquire();
-
-    String str;
-    str.sprintf("SELECT * FROM routes WHERE name='default'");
-    Config::Result *pResult = Config::instance().query(str);
-    if(!pResult->succeeded())
-        ERROR("Routing table query failed: " << pResult->errorMessage());
-    else if(pResult->rows())
+    Fib *pFib = beginLookup();
+    if(!pFib)
     {
-        if(bLocked)
-            m_TableLock.release();
-        return route(0, pResult);
+        endLookup();
+        return 0;
     }
 
-    delete pResult;
+    RouteEntry *pEntry = findNamed(pFib, static_cast<const char*>(name), Named);
+    if(!pEntry)
+        pEntry = findNamed(pFib, static_cast<const char*>(name), NamedV6);
+    if(!pEntry && bGiveDefault)
+        pEntry = findNamed(pFib, "default", Named);
 
-    if(bLocked)
-        m_TableLock.release();
+    Network *pCard = pEntry ? route(0, pEntry) : 0;
+    endLookup();
+    return pCard;
+}
 
-    return 0;
+Network *RoutingTable::DefaultRoute()
+{
+    Fib *pFib = beginLookup();
+    RouteEntry *pEntry = pFib ? findNamed(pFib, "default", Named) : 0;
+    Network *pCard = pEntry ? route(0, pEntry) : 0;
+    endLookup();
+    return pCard;
 }
 
 Network *RoutingTable::DefaultRouteV6()
 {
-    // If already locked, will return false, so we don't unlock (DetermineRoute calls this function)
-    bool bLocked = m_TableLock.tryAcquire();
-
-    String str;
-    str.sprintf("SELECT * FROM routesv6 WHERE name='default'");
-    Config::Result *pResult = Config::instance().query(str);
-    if(!pResult->succeeded())
-        ERROR("Routing table query failed: " << pResult->errorMessage());
-    else if(pResult->rows())
-    {
-        if(bLocked)
-            m_TableLock.release();
-        return route(0, pResult);
-    }
-
-    delete pResult;
-
-    if(bLocked)
-        m_TableLock.release();
-
-    return 0;
+    Fib *pFib = beginLookup();
+    RouteEntry *pEntry = pFib ? findNamed(pFib, "default", NamedV6) : 0;
+    Network *pCard = pEntry ? route(0, pEntry) : 0;
+    endLookup();
+    return pCard;
 }
-
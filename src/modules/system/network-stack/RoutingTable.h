@@ -19,7 +19,9 @@
 #include <utilities/String.h>
 #include <utilities/Tree.h>
 #include <utilities/List.h>
+#include <utilities/Vector.h>
 #include <utilities/RadixTree.h>
+#include <Atomic.h>
 #include <process/Semaphore.h>
 #include <machine/Network.h>
 #include <config/Config.h>
@@ -47,6 +49,10 @@
  * A named route is a route with a specific name, such as "default".
  *
  * All of these are stored in the routes table in the configuration database.
+ * Lookups don't touch the database though: every route is also compiled into
+ * an in-memory forwarding table (one path-compressed binary trie per address
+ * family, searched by longest prefix match) which is rebuilt whenever a route
+ * is added, and swapped in atomically so readers never take a lock.
  */
 
 /** Routing table implementation */
@@ -110,14 +116,107 @@ class RoutingTable
 
     private:
 
+        /** A route, as compiled into the forwarding table. Never modified
+         *  or freed once created, so snapshots can share them. */
+        struct RouteEntry
+        {
+            RouteEntry() :
+                type(DestIp), prefixLen(0), subIp(), name(), pCard(0), metric(0)
+            {
+                memset(key, 0, 16);
+            }
+
+            Type type;
+
+            /** Destination, most significant byte first, masked to prefixLen */
+            uint8_t key[16];
+            size_t prefixLen;
+
+            /** Substitution address */
+            IpAddress subIp;
+
+            String name;
+            Network *pCard;
+            size_t metric;
+        };
+
+        /** A node in a path-compressed binary trie. Nodes without a route
+         *  only exist to join two subtrees at the bit where they differ. */
+        struct TrieNode
+        {
+            TrieNode(const uint8_t *k, size_t len, RouteEntry *pEntry) :
+                prefixLen(len), pRoute(pEntry)
+            {
+                memcpy(key, k, 16);
+                pChildren[0] = pChildren[1] = 0;
+            }
+
+            uint8_t key[16];
+            size_t prefixLen;
+            RouteEntry *pRoute;
+            TrieNode *pChildren[2];
+        };
+
+        /** An immutable snapshot of the forwarding table */
+        struct Fib
+        {
+            Fib() : pRoot4(0), pRoot6(0), complement4(), complement6(), named()
+            {}
+
+            TrieNode *pRoot4;
+            TrieNode *pRoot6;
+
+            /** Complement routes, in the order they should be tried */
+            Vector<RouteEntry*> complement4;
+            Vector<RouteEntry*> complement6;
+
+            Vector<RouteEntry*> named;
+        };
+
         static RoutingTable m_Instance;
 
         bool m_bHasRoutes;
 
+        /** Serialises writers. Readers use the current m_pFib. */
         Mutex m_TableLock;
 
+        /** Every route ever added, in order */
+        List<RouteEntry*> m_Routes;
+
+        /** The forwarding table in use */
+        Fib * volatile m_pFib;
+
+        /** Number of lookups currently in progress */
+        Atomic<size_t> m_nReaders;
+
+        /** Replaced tables that lookups may still be using */
+        List<Fib*> m_RetiredFibs;
+
+        /** Compiles a new route into the forwarding table and publishes it */
+        void addEntry(RouteEntry *pEntry);
+
+        /** Builds a forwarding table from m_Routes */
+        Fib *compile();
+
+        /** Frees a forwarding table (but not its routes) */
+        static void destroy(Fib *pFib);
+        static void destroy(TrieNode *pNode);
+
+        /** Inserts a route into a trie. \return The new root of the (sub)trie. */
+        static TrieNode *insert(TrieNode *pNode, RouteEntry *pEntry);
+
+        /** Longest prefix match of a key against a trie. Doesn't allocate. */
+        static RouteEntry *lookup(TrieNode *pNode, const uint8_t *key, size_t nBits);
+
+        /** Finds the first named route of the given type */
+        static RouteEntry *findNamed(Fib *pFib, const char *name, Type type);
+
         /** Used to finalise the determined route */
-        Network *route(IpAddress *ip, Config::Result *pResult);
+        Network *route(IpAddress *ip, RouteEntry *pEntry);
+
+        /** Marks the start and end of a lock-free lookup */
+        Fib *beginLookup();
+        void endLookup();
 };
 
 #endif
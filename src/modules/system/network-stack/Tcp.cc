@@ -41,7 +41,7 @@ Tcp::~Tcp()
 {
 }
 
-bool Tcp::send(IpAddress dest, uint16_t srcPort, uint16_t destPort, uint32_t seqNumber, uint32_t ackNumber, uint8_t flags, uint16_t window, size_t nBytes, uintptr_t payload)
+bool Tcp::sendBuffer(IpAddress dest, uint16_t srcPort, uint16_t destPort, uint32_t seqNumber, uint32_t ackNumber, uint8_t flags, uint16_t window, NetBuffer *pPayload, const SegmentOptions* options)
 {
   // IP base for all operations here.
   IpBase *pIp = &Ipv4::instance();
@@ -92,40 +92,176 @@ bool Tcp::send(IpAddress dest, uint16_t srcPort, uint16_t destPort, uint32_t seq
     }
   }
 
-  // Allocate a packet to send
-  uintptr_t packet = NetworkStack::instance().getMemPool().allocate();
+  // The payload may be on a retransmit queue, so the header goes onto a
+  // clone of it, in the headroom in front of the data
+  NetBuffer *pBuffer = pPayload ? pPayload->clone() : NetBuffer::allocate(0);
+  if(!pBuffer)
+    return false;
+
+  // The checksum wants the segment in one piece
+  if(!pBuffer->linearize())
+  {
+    pBuffer->unref();
+    return false;
+  }
+  size_t nBytes = pBuffer->length();
+
+  // Options, padded with NOPs so each starts where it would be aligned
+  uint8_t opt[40];
+  size_t n = 0;
+  if(options)
+  {
+    if(options->mss)
+    {
+      opt[n++] = OPT_MSS;
+      opt[n++] = 4;
+      opt[n++] = (options->mss >> 8) & 0xFF;
+      opt[n++] = options->mss & 0xFF;
+    }
+    if(options->bWindowScale)
+    {
+      opt[n++] = OPT_NOP;
+      opt[n++] = OPT_WSS;
+      opt[n++] = 3;
+      opt[n++] = options->wscale;
+    }
+    if(options->bSackPermitted)
+    {
+      opt[n++] = OPT_NOP;
+      opt[n++] = OPT_NOP;
+      opt[n++] = OPT_SACK_PERMITTED;
+      opt[n++] = 2;
+    }
+    if(options->bTimestamp)
+    {
+      opt[n++] = OPT_NOP;
+      opt[n++] = OPT_NOP;
+      opt[n++] = OPT_TMSTAMP;
+      opt[n++] = 10;
+      *reinterpret_cast<uint32_t*>(&opt[n]) = HOST_TO_BIG32(options->tsVal);
+      *reinterpret_cast<uint32_t*>(&opt[n + 4]) = HOST_TO_BIG32(options->tsEcr);
+      n += 8;
+    }
+
+    // Only as many SACK blocks as fit in 40 bytes of options
+    size_t nBlocks = options->nSackBlocks;
+    if(nBlocks > (40 - n - 4) / 8)
+      nBlocks = (40 - n - 4) / 8;
+    if(nBlocks)
+    {
+      opt[n++] = OPT_NOP;
+      opt[n++] = OPT_NOP;
+      opt[n++] = OPT_SACK;
+      opt[n++] = 2 + nBlocks * 8;
+      for(size_t i = 0; i < nBlocks; i++)
+      {
+        *reinterpret_cast<uint32_t*>(&opt[n]) = HOST_TO_BIG32(options->sackBlocks[i].left);
+        *reinterpret_cast<uint32_t*>(&opt[n + 4]) = HOST_TO_BIG32(options->sackBlocks[i].right);
+        n += 8;
+      }
+    }
+  }
+  size_t headerSize = sizeof(tcpHeader) + n;
 
   // Create TCP header
-  uintptr_t tcpPacket = packet;
+  uintptr_t tcpPacket = pBuffer->push(headerSize);
+  if(!tcpPacket)
+  {
+    ERROR("TCP: no headroom for the header");
+    pBuffer->unref();
+    return false;
+  }
   tcpHeader* header = reinterpret_cast<tcpHeader*>(tcpPacket);
   header->src_port = HOST_TO_BIG16(srcPort);
   header->dest_port = HOST_TO_BIG16(destPort);
   header->seqnum = HOST_TO_BIG32(seqNumber);
   header->acknum = HOST_TO_BIG32(ackNumber);
-  header->offset = sizeof(tcpHeader) / 4;
+  header->offset = headerSize / 4;
 
   header->rsvd = 0;
   header->flags = flags;
   header->winsize = HOST_TO_BIG16(window);
   header->urgptr = 0;
 
-  // Inject the payload
-  if(payload && nBytes)
-    memcpy(reinterpret_cast<void*>(tcpPacket + sizeof(tcpHeader)), reinterpret_cast<void*>(payload), nBytes);
+  if(n)
+    memcpy(reinterpret_cast<void*>(tcpPacket + sizeof(tcpHeader)), opt, n);
 
   header->checksum = 0;
-  header->checksum = pIp->ipChecksum(src, dest, IP_TCP, tcpPacket, nBytes + sizeof(tcpHeader));
+  if(!(pCard->getChecksumOffload() & Network::TxL4Checksum))
+    header->checksum = pIp->ipChecksum(src, dest, IP_TCP, tcpPacket, nBytes + headerSize);
 
   // Transmit
-  bool success = pIp->send(dest, src, IP_TCP, nBytes + sizeof(tcpHeader), packet, pCard);
+  bool success = pIp->send(dest, src, IP_TCP, pBuffer, pCard);
 
-  // Free the created packet
-  NetworkStack::instance().getMemPool().free(packet);
+  pBuffer->unref();
 
   // All done.
   return success;
 }
 
+bool Tcp::send(IpAddress dest, uint16_t srcPort, uint16_t destPort, uint32_t seqNumber, uint32_t ackNumber, uint8_t flags, uint16_t window, size_t nBytes, uintptr_t payload, const SegmentOptions* options)
+{
+  NetBuffer *pBuffer = NetBuffer::allocate(nBytes);
+  if(!pBuffer)
+    return false;
+
+  if(payload && nBytes)
+    pBuffer->append(payload, nBytes);
+
+  bool success = sendBuffer(dest, srcPort, destPort, seqNumber, ackNumber, flags, window, pBuffer, options);
+  pBuffer->unref();
+  return success;
+}
+
+void Tcp::parseOptions(tcpHeader* header, SegmentOptions &options)
+{
+  uint8_t* opt = reinterpret_cast<uint8_t*>(header) + sizeof(tcpHeader);
+  uint8_t* end = reinterpret_cast<uint8_t*>(header) + (header->offset * 4);
+
+  while(opt < end)
+  {
+    uint8_t kind = opt[0];
+    if(kind == OPT_END)
+      break;
+    if(kind == OPT_NOP)
+    {
+      opt++;
+      continue;
+    }
+
+    // Everything else has a length, which includes the kind and itself
+    if((opt + 1) >= end || opt[1] < 2 || (opt + opt[1]) > end)
+      break;
+
+    if(kind == OPT_MSS && opt[1] == 4)
+      options.mss = (opt[2] << 8) | opt[3];
+    else if(kind == OPT_WSS && opt[1] == 3)
+    {
+      options.bWindowScale = true;
+      options.wscale = (opt[2] > 14) ? 14 : opt[2];
+    }
+    else if(kind == OPT_SACK_PERMITTED && opt[1] == 2)
+      options.bSackPermitted = true;
+    else if(kind == OPT_TMSTAMP && opt[1] == 10)
+    {
+      options.bTimestamp = true;
+      options.tsVal = BIG_TO_HOST32(*reinterpret_cast<uint32_t*>(&opt[2]));
+      options.tsEcr = BIG_TO_HOST32(*reinterpret_cast<uint32_t*>(&opt[6]));
+    }
+    else if(kind == OPT_SACK && ((opt[1] - 2) % 8) == 0)
+    {
+      for(size_t i = 0; (i < static_cast<size_t>((opt[1] - 2) / 8)) && (options.nSackBlocks < TCP_MAX_SACK_BLOCKS); i++)
+      {
+        SackBlock &block = options.sackBlocks[options.nSackBlocks++];
+        block.left = BIG_TO_HOST32(*reinterpret_cast<uint32_t*>(&opt[2 + i * 8]));
+        block.right = BIG_TO_HOST32(*reinterpret_cast<uint32_t*>(&opt[6 + i * 8]));
+      }
+    }
+
+    opt += opt[1];
+  }
+}
+
 void Tcp::receive(IpAddress from, IpAddress to, uintptr_t packet, size_t nBytes, IpBase *pIp, Network* pCard)
 {
   if(!packet || !nBytes)
@@ -164,7 +300,11 @@ void Tcp::receive(IpAddress from, IpAddress to, uintptr_t packet, size_t nBytes,
   size_t payloadSize = nBytes - headerSize;
 
   // check the checksum, if it's not zero
-  if(header->checksum != 0)
+  if(pCard->getChecksumOffload() & Network::RxL4Checksum)
+  {
+    // the card has already checked it
+  }
+  else if(header->checksum != 0)
   {
     uint16_t checksum = pIp->ipChecksum(from, to, IP_TCP, reinterpret_cast<uintptr_t>(header), nBytes);
     if(checksum)
@@ -23,6 +23,7 @@
 #include <machine/Network.h>
 
 #include "IpCommon.h"
+#include "NetBuffer.h"
 
 /**
  * The Pedigree network stack - TCP layer
@@ -74,6 +75,45 @@ public:
     uint16_t  urgptr;
   } __attribute__ ((packed));
 
+  /// Most SACK blocks an option can carry.
+  #define TCP_MAX_SACK_BLOCKS 4
+
+  /** A block of sequence space the receiver has, past its cumulative ACK */
+  struct SackBlock
+  {
+    uint32_t left;
+    uint32_t right; // one past the last byte
+  };
+
+  /** Options from a segment's header that we make use of, and those we
+      put on the segments we send */
+  struct SegmentOptions
+  {
+    SegmentOptions() :
+      mss(0), bWindowScale(false), wscale(0), bSackPermitted(false),
+      bTimestamp(false), tsVal(0), tsEcr(0), nSackBlocks(0)
+    {}
+
+    /// Largest segment the sender will take (SYN only), or zero if absent
+    uint16_t mss;
+
+    /// Window scale shift (SYN only, RFC 7323)
+    bool     bWindowScale;
+    uint8_t  wscale;
+
+    /// Selective acknowledgements may be used (SYN only, RFC 2018)
+    bool     bSackPermitted;
+
+    /// Timestamps (RFC 7323)
+    bool     bTimestamp;
+    uint32_t tsVal;
+    uint32_t tsEcr;
+
+    /// Selective acknowledgements
+    size_t   nSackBlocks;
+    SackBlock sackBlocks[TCP_MAX_SACK_BLOCKS];
+  };
+
   /** Packet arrival callback */
   void receive(IpAddress from, IpAddress to, uintptr_t packet, size_t nBytes, IpBase *pIp, Network* pCard);
 
@@ -86,7 +126,44 @@ public:
                    uint8_t flags,
                    uint16_t window,
                    size_t nBytes,
-                   uintptr_t payload);
+                   uintptr_t payload,
+                   const SegmentOptions* options = 0);
+
+  /** Sends a TCP packet whose payload is in a NetBuffer. The header goes
+   *  onto a clone, so the payload is left as it was, and can be sent again.
+   *  A null payload sends just the header. */
+  static bool sendBuffer(IpAddress dest,
+                         uint16_t srcPort,
+                         uint16_t destPort,
+                         uint32_t seqNumber,
+                         uint32_t ackNumber,
+                         uint8_t flags,
+                         uint16_t window,
+                         NetBuffer *pPayload,
+                         const SegmentOptions* options = 0);
+
+  /** Picks the options we understand out of a segment's header */
+  static void parseOptions(tcpHeader* header, SegmentOptions &options);
+
+  /** Sequence number comparisons. Sequence numbers wrap, so these compare
+   *  modulo 2^32 (RFC 793, section 3.3): a is before b if it's less than
+   *  2^31 behind it. */
+  static inline bool seqLt(uint32_t a, uint32_t b)
+  {
+    return static_cast<int32_t>(a - b) < 0;
+  }
+  static inline bool seqLe(uint32_t a, uint32_t b)
+  {
+    return static_cast<int32_t>(a - b) <= 0;
+  }
+  static inline bool seqGt(uint32_t a, uint32_t b)
+  {
+    return static_cast<int32_t>(a - b) > 0;
+  }
+  static inline bool seqGe(uint32_t a, uint32_t b)
+  {
+    return static_cast<int32_t>(a - b) >= 0;
+  }
 
   /** Calculates a TCP checksum */
   uint16_t tcpChecksum(IpAddress srcip, IpAddress destip, tcpHeader* data, uint16_t len);
@@ -110,8 +187,9 @@ public:
     OPT_NOP,
     OPT_MSS,
     OPT_WSS,
+    OPT_SACK_PERMITTED,
     OPT_SACK,
-    OPT_TMSTAMP
+    OPT_TMSTAMP = 8
   };
 
   enum TcpState
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "TcpConnectionTable.h"
+#include "TcpManager.h"
+
+TcpConnectionTable::TcpConnectionTable() :
+  m_ConnectionLocks(), m_ListenerLock(), m_IdLocks()
+{
+  for(size_t i = 0; i < TCP_CONNECTION_BUCKETS; i++)
+  {
+    m_Connections[i] = 0;
+    m_Listeners[i] = 0;
+    m_Ids[i] = 0;
+  }
+}
+
+TcpConnectionTable::~TcpConnectionTable()
+{
+}
+
+size_t TcpConnectionTable::hash(uint16_t localPort, IpAddress remoteIp, uint16_t remotePort)
+{
+  uint32_t h = (static_cast<uint32_t>(localPort) << 16) | remotePort;
+  if(remoteIp.getType() == IpAddress::IPv4)
+    h ^= remoteIp.getIp();
+  else
+  {
+    uint8_t ip[16];
+    remoteIp.getIp(ip);
+    for(size_t i = 0; i < 16; i += 4)
+      h ^= (ip[i] << 24) | (ip[i + 1] << 16) | (ip[i + 2] << 8) | ip[i + 3];
+  }
+
+  // Mix the high bits down, so that ports and addresses that differ only
+  // in their upper bits still spread out.
+  h *= 2654435761U;
+  return (h >> 16) & (TCP_CONNECTION_BUCKETS - 1);
+}
+
+bool TcpConnectionTable::matches(StateBlock* stateBlock, uint16_t localPort, IpAddress remoteIp, uint16_t remotePort)
+{
+  return (stateBlock->localPort == localPort) &&
+         (stateBlock->remoteHost.remotePort == remotePort) &&
+         (stateBlock->remoteHost.ip == remoteIp);
+}
+
+bool TcpConnectionTable::unlink(StateBlock** ppChain, StateBlock* stateBlock, bool bById)
+{
+  while(*ppChain)
+  {
+    if(*ppChain == stateBlock)
+    {
+      *ppChain = bById ? stateBlock->idHashNext : stateBlock->hashNext;
+      return true;
+    }
+    ppChain = bById ? &(*ppChain)->idHashNext : &(*ppChain)->hashNext;
+  }
+  return false;
+}
+
+bool TcpConnectionTable::insert(StateBlock* stateBlock)
+{
+  if(stateBlock->currentState == Tcp::LISTEN)
+  {
+    size_t bucket = stateBlock->localPort & (TCP_CONNECTION_BUCKETS - 1);
+
+    m_ListenerLock.acquire();
+    for(StateBlock* p = m_Listeners[bucket]; p; p = p->hashNext)
+    {
+      if(p->localPort == stateBlock->localPort)
+      {
+        m_ListenerLock.release();
+        return false;
+      }
+    }
+    stateBlock->ref(); // the table's reference
+    stateBlock->hashNext = m_Listeners[bucket];
+    m_Listeners[bucket] = stateBlock;
+    m_ListenerLock.release();
+  }
+  else
+  {
+    size_t bucket = hash(stateBlock->localPort, stateBlock->remoteHost.ip, stateBlock->remoteHost.remotePort);
+    Spinlock& lock = m_ConnectionLocks[bucket & (TCP_CONNECTION_STRIPES - 1)];
+
+    lock.acquire();
+    for(StateBlock* p = m_Connections[bucket]; p; p = p->hashNext)
+    {
+      if(matches(p, stateBlock->localPort, stateBlock->remoteHost.ip, stateBlock->remoteHost.remotePort))
+      {
+        lock.release();
+        return false;
+      }
+    }
+    stateBlock->ref(); // the table's reference
+    stateBlock->hashNext = m_Connections[bucket];
+    m_Connections[bucket] = stateBlock;
+    lock.release();
+  }
+
+  size_t bucket = hash(stateBlock->connId);
+  Spinlock& lock = m_IdLocks[bucket & (TCP_CONNECTION_STRIPES - 1)];
+
+  lock.acquire();
+  stateBlock->idHashNext = m_Ids[bucket];
+  m_Ids[bucket] = stateBlock;
+  lock.release();
+
+  return true;
+}
+
+void TcpConnectionTable::remove(StateBlock* stateBlock)
+{
+  // A listening socket's state has moved on by the time it's removed, so
+  // look in both places.
+  bool bFound = false;
+
+  size_t bucket = stateBlock->localPort & (TCP_CONNECTION_BUCKETS - 1);
+  m_ListenerLock.acquire();
+  bFound = unlink(&m_Listeners[bucket], stateBlock, false);
+  m_ListenerLock.release();
+
+  if(!bFound)
+  {
+    bucket = hash(stateBlock->localPort, stateBlock->remoteHost.ip, stateBlock->remoteHost.remotePort);
+    Spinlock& lock = m_ConnectionLocks[bucket & (TCP_CONNECTION_STRIPES - 1)];
+
+    lock.acquire();
+    bFound = unlink(&m_Connections[bucket], stateBlock, false);
+    lock.release();
+  }
+
+  if(!bFound)
+    return;
+
+  bucket = hash(stateBlock->connId);
+  Spinlock& lock = m_IdLocks[bucket & (TCP_CONNECTION_STRIPES - 1)];
+
+  lock.acquire();
+  unlink(&m_Ids[bucket], stateBlock, true);
+  lock.release();
+
+  stateBlock->unref();
+}
+
+StateBlock* TcpConnectionTable::lookup(uint16_t localPort, IpAddress remoteIp, uint16_t remotePort)
+{
+  size_t bucket = hash(localPort, remoteIp, remotePort);
+  Spinlock& lock = m_ConnectionLocks[bucket & (TCP_CONNECTION_STRIPES - 1)];
+
+  lock.acquire();
+  StateBlock* stateBlock = m_Connections[bucket];
+  while(stateBlock && !matches(stateBlock, localPort, remoteIp, remotePort))
+    stateBlock = stateBlock->hashNext;
+  if(stateBlock)
+    stateBlock->ref();
+  lock.release();
+
+  return stateBlock;
+}
+
+StateBlock* TcpConnectionTable::lookupListener(uint16_t localPort)
+{
+  size_t bucket = localPort & (TCP_CONNECTION_BUCKETS - 1);
+
+  m_ListenerLock.acquire();
+  StateBlock* stateBlock = m_Listeners[bucket];
+  while(stateBlock && stateBlock->localPort != localPort)
+    stateBlock = stateBlock->hashNext;
+  if(stateBlock)
+    stateBlock->ref();
+  m_ListenerLock.release();
+
+  return stateBlock;
+}
+
+StateBlock* TcpConnectionTable::lookup(size_t connId)
+{
+  size_t bucket = hash(connId);
+  Spinlock& lock = m_IdLocks[bucket & (TCP_CONNECTION_STRIPES - 1)];
+
+  lock.acquire();
+  StateBlock* stateBlock = m_Ids[bucket];
+  while(stateBlock && stateBlock->connId != connId)
+    stateBlock = stateBlock->idHashNext;
+  if(stateBlock)
+    stateBlock->ref();
+  lock.release();
+
+  return stateBlock;
+}
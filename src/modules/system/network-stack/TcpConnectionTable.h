@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef MACHINE_TCPCONNECTIONTABLE_H
+#define MACHINE_TCPCONNECTIONTABLE_H
+
+#include <processor/types.h>
+#include <network/IpAddress.h>
+#include <Spinlock.h>
+
+class StateBlock;
+
+/// Number of hash chains for each of the tables. A power of two.
+#define TCP_CONNECTION_BUCKETS    1024
+/// Number of locks the chains are shared out between. A power of two, no
+/// larger than TCP_CONNECTION_BUCKETS.
+#define TCP_CONNECTION_STRIPES    64
+
+/** Finds the StateBlock for an incoming segment or a connection ID.
+ *
+ *  Connections are hashed on (local port, remote address, remote port),
+ *  listening sockets on their local port, and every block on its
+ *  connection ID. Each chain is guarded by one of a set of striped
+ *  spinlocks, held only while the chain is walked, so lookups for different
+ *  connections almost never meet.
+ *
+ *  Every lookup takes a reference on the block it returns (see
+ *  StateBlock::ref), which the caller drops when done with it - usually with
+ *  a StateBlockRef. The table holds a reference of its own for as long as
+ *  the block is in it, so a block that is removed while someone is still
+ *  using it goes away when they are finished. */
+class TcpConnectionTable
+{
+  public:
+    TcpConnectionTable();
+    ~TcpConnectionTable();
+
+    /** Adds a connection, or a listening socket (if its state is LISTEN).
+     *  \return False if there's one for the same ports and address already. */
+    bool insert(StateBlock* stateBlock);
+
+    /** Takes a block out of the tables, and drops the table's reference. */
+    void remove(StateBlock* stateBlock);
+
+    /** Finds the connection an incoming segment belongs to. */
+    StateBlock* lookup(uint16_t localPort, IpAddress remoteIp, uint16_t remotePort);
+
+    /** Finds the socket listening on a given port. */
+    StateBlock* lookupListener(uint16_t localPort);
+
+    /** Finds a block by its connection ID. */
+    StateBlock* lookup(size_t connId);
+
+  private:
+    TcpConnectionTable(const TcpConnectionTable &);
+    TcpConnectionTable &operator = (const TcpConnectionTable &);
+
+    static size_t hash(uint16_t localPort, IpAddress remoteIp, uint16_t remotePort);
+    static size_t hash(size_t connId)
+    {
+      return (connId * 2654435761U) & (TCP_CONNECTION_BUCKETS - 1);
+    }
+
+    /** Is the block a match for the given ports and address? */
+    static bool matches(StateBlock* stateBlock, uint16_t localPort, IpAddress remoteIp, uint16_t remotePort);
+
+    /** Removes the block from the given chain, if it's there.
+     *  \note The chain's lock must be held. */
+    static bool unlink(StateBlock** ppChain, StateBlock* stateBlock, bool bById);
+
+    /** Connections, by (local port, remote address, remote port). */
+    StateBlock* m_Connections[TCP_CONNECTION_BUCKETS];
+    Spinlock m_ConnectionLocks[TCP_CONNECTION_STRIPES];
+
+    /** Listening sockets, by local port. There are few, and they come and
+     *  go rarely, so one lock does. */
+    StateBlock* m_Listeners[TCP_CONNECTION_BUCKETS];
+    Spinlock m_ListenerLock;
+
+    /** Everything, by connection ID. */
+    StateBlock* m_Ids[TCP_CONNECTION_BUCKETS];
+    Spinlock m_IdLocks[TCP_CONNECTION_STRIPES];
+};
+
+#endif
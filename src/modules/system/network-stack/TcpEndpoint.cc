@@ -109,7 +109,13 @@ int TcpEndpoint::recv(uintptr_t buffer, size_t maxSize, bool bBlock, bool bPeek)
         lock->release();
         return nBytes;*/
 
-        return m_DataStream.read(buffer, maxSize, bPeek);
+        int ret = m_DataStream.read(buffer, maxSize, bPeek);
+
+        // Reading may have opened up the window
+        if (ret > 0 && !bPeek)
+            TcpManager::instance().windowUpdate(m_ConnId);
+
+        return ret;
     }
 
     // no data is available - EOF?
@@ -132,30 +138,36 @@ size_t TcpEndpoint::depositPayload(size_t nBytes, uintptr_t payload, uint32_t se
         return 0;
     }
 
-    // If there's data to add to the shadow stream, add it now. Then, if the PUSH flag
-    // is set, copy the shadow stream into the main stream. By allowing a zero-byte
-    // deposit, data that did not have the PSH flag can be pushed to the application
-    // when we receive a FIN.
+    // If there's data to add to the shadow stream, add it now - no more than the
+    // window, so that it will all fit in the data stream once pushed. Then, if the
+    // PUSH flag is set, copy the shadow stream into the main stream. By allowing a
+    // zero-byte deposit, data that did not have the PSH flag can be pushed to the
+    // application when we receive a FIN.
     size_t ret = 0;
     if (nBytes && payload)
-        ret = m_ShadowDataStream.write(payload, nBytes);
+    {
+        size_t space = receiveSpace();
+        if (nBytes > space)
+            nBytes = space;
+        if (nBytes)
+            ret = m_ShadowDataStream.write(payload, nBytes);
+    }
     if (push && m_ShadowDataStream.getDataSize())
     {
-        // Copy the buffer into the real data stream
-        /// \bug Caveat here: If the shadow stream read is successful, but the write
-        ///      to the data stream is not, the data will be lost without any method
-        ///      of regaining access to it! The shadow stream needs to be read without
-        ///      removing bytes from it initially, and then if all goes well the bytes
-        ///      that were written to the data stream should be removed.
+        // Copy as much as the data stream has room for into it. Only what was
+        // written is taken off the shadow stream, so nothing is lost if the
+        // application hasn't read enough yet - the rest goes on the next push.
         size_t sz = m_ShadowDataStream.getDataSize();
-        if(sz > m_ShadowDataStream.getSize())
-        {
-            ERROR("TCP: Shadow data stream has potentially been corrupted: " << sz << ", " << m_ShadowDataStream.getSize() << "!");
-            return 0;
-        }
+        if(sz > m_DataStream.getRemainingSize())
+            sz = m_DataStream.getRemainingSize();
+        if(!sz)
+            return ret;
+
         uint8_t *buff = new uint8_t[sz];
-        sz = m_ShadowDataStream.read(reinterpret_cast<uintptr_t>(buff), sz);
+        sz = m_ShadowDataStream.read(reinterpret_cast<uintptr_t>(buff), sz, true);
         size_t o = m_DataStream.write(reinterpret_cast<uintptr_t>(buff), sz);
+        m_ShadowDataStream.read(reinterpret_cast<uintptr_t>(buff), o);
+        delete [] buff;
 
         if(!o)
             DEBUG_LOG("TCP: wrote zero bytes to a data stream!");
@@ -170,6 +182,18 @@ size_t TcpEndpoint::depositPayload(size_t nBytes, uintptr_t payload, uint32_t se
     return ret;
 }
 
+size_t TcpEndpoint::receiveSpace()
+{
+    size_t space = m_DataStream.getRemainingSize();
+    size_t held = m_ShadowDataStream.getDataSize();
+    if (held >= space)
+        return 0;
+    space -= held;
+
+    size_t shadowSpace = m_ShadowDataStream.getRemainingSize();
+    return (space < shadowSpace) ? space : shadowSpace;
+}
+
 bool TcpEndpoint::dataReady(bool block, uint32_t tmout)
 {
     if (block)
@@ -101,6 +101,11 @@ class TcpEndpoint : public ConnectionBasedEndpoint
     /** TcpManager functionality - called to deposit data into our local buffer */
     virtual size_t depositPayload(size_t nBytes, uintptr_t payload, uint32_t sequenceNumber, bool push);
 
+    /** Bytes that can be deposited without losing any: what's left of the data
+     *  stream once the shadow stream has been pushed into it, and no more than
+     *  the shadow stream has room for. This is the receive window. */
+    size_t receiveSpace();
+
     /** Setters */
     void setCard(Network* pCard)
     {
@@ -30,34 +30,16 @@ size_t TcpManager::Listen(Endpoint* e, uint16_t port, Network* pCard)
   if(!e || !pCard || !port)
     return 0;
 
-  StateBlockHandle* handle = new StateBlockHandle;
-  if(!handle)
-    return 0;
-  handle->localPort = port;
-  handle->remotePort = 0;
-  handle->remoteHost.ip.setIp(static_cast<uint32_t>(0));
-  handle->listen = true;
-  StateBlock* stateBlock;
-  {
-    LockGuard<Mutex> guard(m_TcpMutex);
-    if((stateBlock = m_StateBlocks.lookup(*handle)) != 0)
-    {
-      delete handle;
-      return 0;
-    }
-  }
-
   // build a state block for it
-  size_t connId = getConnId();
-
-  stateBlock = new StateBlock;
+  StateBlock* stateBlock = new StateBlock;
   if(!stateBlock)
     return 0;
+  StateBlockRef ref(stateBlock);
 
   stateBlock->localPort = port;
-  stateBlock->remoteHost = handle->remoteHost;
+  stateBlock->remoteHost.ip.setIp(static_cast<uint32_t>(0));
 
-  stateBlock->connId = connId;
+  stateBlock->connId = getConnId();
 
   stateBlock->currentState = Tcp::LISTEN;
 
@@ -65,13 +47,11 @@ size_t TcpManager::Listen(Endpoint* e, uint16_t port, Network* pCard)
 
   stateBlock->numEndpointPackets = 0;
 
-  {
-    LockGuard<Mutex> guard(m_TcpMutex);
-    m_ListeningStateBlocks.insert(*handle, stateBlock);
-    m_CurrentConnections.insert(connId, handle);
-  }
+  // someone else may already be listening on this port
+  if(!m_Connections.insert(stateBlock))
+    return 0;
 
-  return connId;
+  return stateBlock->connId;
 }
 
 size_t TcpManager::Connect(Endpoint::RemoteEndpoint remoteHost, uint16_t localPort, TcpEndpoint* endpoint, bool bBlock)
@@ -79,33 +59,13 @@ size_t TcpManager::Connect(Endpoint::RemoteEndpoint remoteHost, uint16_t localPo
   if(!endpoint)
     return 0;
 
-  StateBlockHandle* handle = new StateBlockHandle;
-  if(!handle)
-    return 0;
-
-  handle->localPort = localPort;
-  handle->remotePort = remoteHost.remotePort;
-  handle->remoteHost = remoteHost;
-  handle->listen = false;
-  StateBlock* stateBlock;
-  {
-    LockGuard<Mutex> guard(m_TcpMutex);
-    if((stateBlock = m_StateBlocks.lookup(*handle)) != 0)
-    {
-      delete handle;
-      return 0;
-    }
-  }
-
   // build a state block for it
-  size_t connId = getConnId();
-
-  stateBlock = new StateBlock;
+  StateBlock* stateBlock = new StateBlock;
   if(!stateBlock)
-  {
-    delete handle;
     return 0;
-  }
+  StateBlockRef ref(stateBlock);
+
+  size_t connId = getConnId();
 
   stateBlock->localPort = localPort;
   stateBlock->remoteHost = remoteHost;
@@ -115,9 +75,10 @@ size_t TcpManager::Connect(Endpoint::RemoteEndpoint remoteHost, uint16_t localPo
   stateBlock->iss = getNextSequenceNumber();
   stateBlock->snd_nxt = stateBlock->iss + 1;
   stateBlock->snd_una = stateBlock->iss;
-  stateBlock->snd_wnd = endpoint->m_ShadowDataStream.getSize();
+  stateBlock->snd_wnd = 0; // until the SYN/ACK tells us
   stateBlock->snd_up = 0;
   stateBlock->snd_wl1 = stateBlock->snd_wl2 = 0;
+  stateBlock->snd_end = stateBlock->snd_nxt;
 
   stateBlock->currentState = Tcp::SYN_SENT;
 
@@ -125,13 +86,17 @@ size_t TcpManager::Connect(Endpoint::RemoteEndpoint remoteHost, uint16_t localPo
 
   stateBlock->numEndpointPackets = 0;
 
+  // there may already be a connection between these ports
+  if(!m_Connections.insert(stateBlock))
+    return 0;
+
   {
-    LockGuard<Mutex> guard(m_TcpMutex);
-    m_StateBlocks.insert(*handle, stateBlock);
-    m_CurrentConnections.insert(connId, handle);
-  }
+    LockGuard<Mutex> guard(stateBlock->lock);
 
-  Tcp::send(stateBlock->remoteHost.ip, stateBlock->localPort, stateBlock->remoteHost.remotePort, stateBlock->iss, 0, Tcp::SYN, stateBlock->snd_wnd, 0, 0);
+    Tcp::SegmentOptions opts;
+    stateBlock->synOptions(opts);
+    Tcp::send(stateBlock->remoteHost.ip, stateBlock->localPort, stateBlock->remoteHost.remotePort, stateBlock->iss, 0, Tcp::SYN, stateBlock->receiveWindow(true), 0, 0, &opts);
+  }
 
   if(!bBlock)
     return connId; // connection in progress - assume it works
@@ -149,15 +114,12 @@ size_t TcpManager::Connect(Endpoint::RemoteEndpoint remoteHost, uint16_t localPo
 
 void TcpManager::Shutdown(size_t connectionId, bool bOnlyStopReceive)
 {
-  LockGuard<Mutex> guard(m_TcpMutex);
-
-  StateBlockHandle* handle;
-  if((handle = m_CurrentConnections.lookup(connectionId)) == 0)
+  StateBlock* stateBlock = m_Connections.lookup(connectionId);
+  if(!stateBlock)
     return;
+  StateBlockRef ref(stateBlock);
 
-  StateBlock* stateBlock;
-  if((stateBlock = m_StateBlocks.lookup(*handle)) == 0)
-    return;
+  LockGuard<Mutex> guard(stateBlock->lock);
     
   if(bOnlyStopReceive)
   {
@@ -172,36 +134,31 @@ void TcpManager::Shutdown(size_t connectionId, bool bOnlyStopReceive)
   /** ESTABLISHED: No FIN received - send our own **/
   if(stateBlock->currentState == Tcp::ESTABLISHED)
   {
-    stateBlock->fin_seq = stateBlock->snd_nxt;
+    stateBlock->fin_seq = stateBlock->snd_end;
 
     stateBlock->currentState = Tcp::FIN_WAIT_1;
     stateBlock->seg_wnd = 0;
     stateBlock->sendSegment(Tcp::FIN | Tcp::ACK, 0, 0, true);
-    stateBlock->snd_nxt++;
   }
   /** CLOSE_WAIT: FIN received - reply **/
   else if(stateBlock->currentState == Tcp::CLOSE_WAIT)
   {
-    stateBlock->fin_seq = stateBlock->snd_nxt;
+    stateBlock->fin_seq = stateBlock->snd_end;
 
     stateBlock->currentState = Tcp::LAST_ACK;
     stateBlock->seg_wnd = 0;
     stateBlock->sendSegment(Tcp::FIN | Tcp::ACK, 0, 0, true);
-    stateBlock->snd_nxt++;
   }
 }
 
 void TcpManager::Disconnect(size_t connectionId)
 {
-  LockGuard<Mutex> guard(m_TcpMutex);
-
-  StateBlockHandle* handle;
-  if((handle = m_CurrentConnections.lookup(connectionId)) == 0)
+  StateBlock* stateBlock = m_Connections.lookup(connectionId);
+  if(!stateBlock)
     return;
+  StateBlockRef ref(stateBlock);
 
-  StateBlock* stateBlock;
-  if((stateBlock = m_StateBlocks.lookup(*handle)) == 0)
-    return;
+  LockGuard<Mutex> guard(stateBlock->lock);
 
   IpAddress dest;
   dest = stateBlock->remoteHost.ip;
@@ -209,23 +166,21 @@ void TcpManager::Disconnect(size_t connectionId)
   // no FIN received yet
   if(stateBlock->currentState >= Tcp::ESTABLISHED && stateBlock->currentState <= Tcp::FIN_WAIT_2)
   {
-    stateBlock->fin_seq = stateBlock->snd_nxt;
+    stateBlock->fin_seq = stateBlock->snd_end;
 
     stateBlock->currentState = Tcp::FIN_WAIT_1;
     stateBlock->seg_wnd = 0;
     stateBlock->sendSegment(Tcp::FIN | Tcp::ACK, 0, 0, true);
-    stateBlock->snd_nxt++;
     //Tcp::send(dest, stateBlock->localPort, stateBlock->remoteHost.remotePort, stateBlock->fin_seq, stateBlock->rcv_nxt, Tcp::FIN | Tcp::ACK, stateBlock->snd_wnd, 0, 0, stateBlock->pCard);
   }
   // received a FIN already
   else if(stateBlock->currentState == Tcp::CLOSE_WAIT)
   {
-    stateBlock->fin_seq = stateBlock->snd_nxt;
+    stateBlock->fin_seq = stateBlock->snd_end;
 
     stateBlock->currentState = Tcp::LAST_ACK;
     stateBlock->seg_wnd = 0;
     stateBlock->sendSegment(Tcp::FIN | Tcp::ACK, 0, 0, true);
-    stateBlock->snd_nxt++;
     //Tcp::send(dest, stateBlock->localPort, stateBlock->remoteHost.remotePort, stateBlock->fin_seq, stateBlock->rcv_nxt, Tcp::FIN | Tcp::ACK, stateBlock->snd_wnd, 0, 0, stateBlock->pCard);
   }
   // LISTEN socket closing
@@ -241,69 +196,90 @@ void TcpManager::Disconnect(size_t connectionId)
   }
 }
 
-int TcpManager::send(size_t connId, uintptr_t payload, bool push, size_t nBytes, bool addToRetransmitQueue)
+int TcpManager::send(size_t connId, uintptr_t payload, bool push, size_t nBytes, bool addToRetransmitQueue, bool bBlock)
 {
-  LockGuard<Mutex> guard(m_TcpMutex);
-
   if(!payload || !nBytes)
     return -1;
 
-  StateBlockHandle* handle;
-  if((handle = m_CurrentConnections.lookup(connId)) == 0)
-    return -1;
-
-  StateBlock* stateBlock;
-  if((stateBlock = m_StateBlocks.lookup(*handle)) == 0)
+  StateBlock* stateBlock = m_Connections.lookup(connId);
+  if(!stateBlock)
     return -1;
+  StateBlockRef ref(stateBlock);
 
-  if(stateBlock->currentState != Tcp::ESTABLISHED &&
-        stateBlock->currentState != Tcp::CLOSE_WAIT)
-     /*
-     &&
-     stateBlock->currentState != Tcp::FIN_WAIT_1 &&
-     stateBlock->currentState != Tcp::FIN_WAIT_2
-     */
-    return -1; // When we SHUT_WR, we send FIN meaning no more data from us.
+  size_t nQueued = 0;
+  while(nQueued < nBytes)
+  {
+    {
+      LockGuard<Mutex> guard(stateBlock->lock);
+
+      if(stateBlock->currentState != Tcp::ESTABLISHED &&
+            stateBlock->currentState != Tcp::CLOSE_WAIT)
+         /*
+         &&
+         stateBlock->currentState != Tcp::FIN_WAIT_1 &&
+         stateBlock->currentState != Tcp::FIN_WAIT_2
+         */
+        break; // When we SHUT_WR, we send FIN meaning no more data from us.
+
+      // Unreliable sends aren't kept, so they don't fill the buffer
+      size_t n = nBytes - nQueued;
+      if(addToRetransmitQueue && n > stateBlock->sendSpace())
+        n = stateBlock->sendSpace();
+
+      if(n)
+      {
+        // Each piece is pushed: the remote end may not make room for more
+        // until it has handed what it has to the application.
+        size_t nSent = stateBlock->sendSegment(Tcp::ACK | (push ? Tcp::PSH : 0), n, payload + nQueued, addToRetransmitQueue);
+        nQueued += nSent;
+        if(nSent < n)
+          break; // Out of memory
+        continue;
+      }
+
+      if(!bBlock)
+        break;
+      stateBlock->sendWaiting = true;
+    }
 
-  stateBlock->sendSegment(Tcp::ACK | (push ? Tcp::PSH : 0), nBytes, payload, addToRetransmitQueue);
+    // Wait for an ACK to make room. Check again every so often, in case
+    // the connection is gone.
+    stateBlock->sendSpaceWait.acquire(1, 1);
+  }
 
-  // success!
-  return nBytes;
+  return nQueued ? static_cast<int>(nQueued) : -1;
 }
 
-void TcpManager::removeConn(size_t connId)
+void TcpManager::windowUpdate(size_t connId)
 {
-  LockGuard<Mutex> guard(m_TcpMutex);
-
-  //return;
-  StateBlockHandle* handle;
-  if((handle = m_CurrentConnections.lookup(connId)) == 0)
+  StateBlock* stateBlock = m_Connections.lookup(connId);
+  if(!stateBlock)
     return;
+  StateBlockRef ref(stateBlock);
 
-  StateBlock* stateBlock;
-  if(handle->listen)
-    stateBlock = m_ListeningStateBlocks.lookup(*handle);
-  else
-    stateBlock = m_StateBlocks.lookup(*handle);
-  if(stateBlock == 0)
+  LockGuard<Mutex> guard(stateBlock->lock);
+  stateBlock->windowUpdate();
+}
+
+void TcpManager::removeConn(size_t connId)
+{
+  // Callers may hold the block's lock, so this doesn't take it: the state
+  // only reaches CLOSED once, under the lock, and never leaves it.
+  StateBlock* stateBlock = m_Connections.lookup(connId);
+  if(!stateBlock)
     return;
+  StateBlockRef ref(stateBlock);
 
   // only remove closed connections!
   if(stateBlock->currentState != Tcp::CLOSED)
-  {
     return;
-  }
 
-  // remove from the lists
-  if(handle->listen)
-    m_ListeningStateBlocks.remove(*handle);
-  else
-    m_StateBlocks.remove(*handle);
-  m_CurrentConnections.remove(connId);
+  m_Connections.remove(stateBlock);
 
-  // destroy the state block (and its internals)
+  // wake anyone still waiting on the connection; the block itself goes
+  // once they (and anyone else using it) let go of it
   stateBlock->waitState.release();
-  delete stateBlock;
+  stateBlock->sendSpaceWait.release();
 
   // stateBlock->endpoint is what applications are using right now, so
   // we can't really delete it yet. They will do that with returnEndpoint().
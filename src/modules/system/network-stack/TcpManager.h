@@ -24,6 +24,7 @@
 #include <machine/Network.h>
 #include <process/Mutex.h>
 #include <LockGuard.h>
+#include <Atomic.h>
 
 #include <Log.h>
 
@@ -35,6 +36,7 @@
 #include "Endpoint.h"
 #include "TcpEndpoint.h"
 #include "TcpStateBlock.h"
+#include "TcpConnectionTable.h"
 
 /**
  * The Pedigree network stack - TCP Protocol Manager
@@ -43,8 +45,8 @@ class TcpManager : public ProtocolManager
 {
 public:
   TcpManager() :
-    m_NextTcpSequence(0), m_NextConnId(1), m_StateBlocks(), m_ListeningStateBlocks(),
-    m_CurrentConnections(), m_Endpoints(), m_PortsAvailable(), m_TcpMutex(false)
+    m_NextTcpSequence(0), m_NextConnId(0), m_Connections(),
+    m_Endpoints(), m_PortsAvailable(), m_TcpMutex(false)
   {};
   virtual ~TcpManager()
   {};
@@ -78,8 +80,15 @@ public:
   /** A new packet has arrived! */
   void receive(IpAddress from, uint16_t sourcePort, uint16_t destPort, Tcp::tcpHeader* header, uintptr_t payload, size_t payloadSize, Network* pCard);
 
-  /** Sends a TCP packet over the given connection ID */
-  int send(size_t connId, uintptr_t payload, bool push, size_t nBytes, bool addToRetransmitQueue = true);
+  /** Queues data to send over the given connection ID. Only TCP_SEND_BUFFER
+   *  bytes can be waiting for an ACK at once: beyond that this waits for room,
+   *  or if bBlock is false, stops short.
+   *  \return The number of bytes queued, or -1 if none could be. */
+  int send(size_t connId, uintptr_t payload, bool push, size_t nBytes, bool addToRetransmitQueue = true, bool bBlock = true);
+
+  /** Tells the remote end of a connection that its receive window has opened,
+   *  if it's opened far enough to be worth a segment. */
+  void windowUpdate(size_t connId);
 
   /** Removes a given (closed) connection from the system */
   void removeConn(size_t connId);
@@ -87,70 +96,55 @@ public:
   /** Grabs the current state of a given connection */
   Tcp::TcpState getState(size_t connId)
   {
-    LockGuard<Mutex> guard(m_TcpMutex);
-
-    StateBlockHandle* handle;
-    if((handle = m_CurrentConnections.lookup(connId)) == 0)
-      return Tcp::UNKNOWN;
-
-    StateBlock* stateBlock;
-    if((stateBlock = m_StateBlocks.lookup(*handle)) == 0)
+    StateBlock* stateBlock = m_Connections.lookup(connId);
+    if(!stateBlock)
       return Tcp::UNKNOWN;
 
-    return stateBlock->currentState;
+    Tcp::TcpState state = stateBlock->currentState;
+    stateBlock->unref();
+    return state;
   }
 
   /** Gets the next sequence number to use */
   uint32_t getNextSequenceNumber()
   {
-    /// \todo Need recursive mutexes!
-
     /// \todo These need to be randomised to avoid sequence attacks
-    m_NextTcpSequence += 0xffff;
-    return m_NextTcpSequence;
+    return m_NextTcpSequence += 0xffff;
   }
 
   /** Gets a unique connection ID */
   size_t getConnId()
   {
-    /// \todo Need recursive mutexes!
-
-    size_t ret = m_NextConnId;
-    while(m_CurrentConnections.lookup(ret) != 0) // ensure it's unique
-      ret++;
-    m_NextConnId = ret + 1;
+    // IDs wrap long before one still in use comes round again
+    size_t ret;
+    do
+    {
+      ret = m_NextConnId += 1;
+    } while(!ret);
     return ret;
   }
 
   /** Grabs the number of packets that have been queued for a given connection */
   uint32_t getNumQueuedPackets(size_t connId)
   {
-    LockGuard<Mutex> guard(m_TcpMutex);
-
-    StateBlockHandle* handle;
-    if((handle = m_CurrentConnections.lookup(connId)) == 0)
+    StateBlock* stateBlock = m_Connections.lookup(connId);
+    if(!stateBlock)
       return 0;
 
-    StateBlock* stateBlock;
-    if((stateBlock = m_StateBlocks.lookup(*handle)) == 0)
-      return 0;
-
-    return stateBlock->numEndpointPackets;
+    uint32_t ret = stateBlock->numEndpointPackets;
+    stateBlock->unref();
+    return ret;
   }
 
   /** Reduces the number of queued packets by the specified amount */
   void removeQueuedPackets(size_t connId, uint32_t n = 1)
   {
-    LockGuard<Mutex> guard(m_TcpMutex);
-
-    StateBlockHandle* handle;
-    if((handle = m_CurrentConnections.lookup(connId)) == 0)
-      return;
-
-    StateBlock* stateBlock;
-    if((stateBlock = m_StateBlocks.lookup(*handle)) == 0)
+    StateBlock* stateBlock = m_Connections.lookup(connId);
+    if(!stateBlock)
       return;
 
+    StateBlockRef ref(stateBlock);
+    LockGuard<Mutex> guard(stateBlock->lock);
     stateBlock->numEndpointPackets -= n;
   }
 
@@ -197,19 +191,13 @@ private:
   static TcpManager manager;
 
   // next TCP sequence number to allocate
-  uint32_t m_NextTcpSequence;
-
-  // this keeps track of the next valid connection ID
-  size_t m_NextConnId;
-
-  // standard state blocks
-  Tree<StateBlockHandle, StateBlock*> m_StateBlocks;
+  Atomic<uint32_t> m_NextTcpSequence;
 
-  // server state blocks (separated from standard blocks in the list)
-  Tree<StateBlockHandle, StateBlock*> m_ListeningStateBlocks;
+  // the last connection ID handed out
+  Atomic<size_t> m_NextConnId;
 
-  /** Current connections - basically a map between connection IDs and handles */
-  Tree<size_t, StateBlockHandle*> m_CurrentConnections;
+  /** Every connection and listening socket, by address and by ID */
+  TcpConnectionTable m_Connections;
 
   /** Currently known endpoints (all actually TcpEndpoints). */
   Tree<size_t, Endpoint*> m_Endpoints;
@@ -217,7 +205,8 @@ private:
   /** Port availability */
   Tree<size_t, bool*> m_PortsAvailable;
 
-  /** Lock to control access to state blocks. */
+  /** Lock for port allocation. Each connection has its own lock, in its
+   *  StateBlock. */
   Mutex m_TcpMutex;
 };
 
@@ -28,35 +28,29 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
   if(!header)
     return;
 
-  LockGuard<Mutex> guard(m_TcpMutex);
-
   // Find the state block if possible, if none exists create one
-  bool bDidAllocateStateBlock = false;
-  StateBlockHandle handle;
-  handle.localPort = destPort;
-  handle.remotePort = sourcePort;
-  handle.remoteHost.ip = from;
-  handle.listen = false; // DON'T look for listen sockets yet
-  StateBlock* stateBlock;
-  if((stateBlock = m_StateBlocks.lookup(handle)) == 0)
+  StateBlock* stateBlock = m_Connections.lookup(destPort, from, sourcePort);
+  if(!stateBlock)
   {
     // Check for a listen socket
-    handle.listen = true;
-    if((stateBlock = m_ListeningStateBlocks.lookup(handle)) == 0)
+    if((stateBlock = m_Connections.lookupListener(destPort)) == 0)
     {
       // Port doesn't exist, so temporary stateBlock required for proper RST handle
       stateBlock = new StateBlock;
       if(stateBlock == 0)
         return;
 
-      WARNING("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " has no destination.");
-
-      bDidAllocateStateBlock = true;
+      WARNING("TCP Packet arriving on port " << Dec << destPort << Hex << " has no destination.");
 
       stateBlock->currentState = Tcp::CLOSED;
     }
   }
 
+  // The lookup's reference (or, for a temporary block, the only one) goes
+  // when we return, after the lock does
+  StateBlockRef ref(stateBlock);
+  LockGuard<Mutex> guard(stateBlock->lock);
+
   // fill current segment information
   stateBlock->seg_seq = BIG_TO_HOST32(header->seqnum);
   stateBlock->seg_ack = BIG_TO_HOST32(header->acknum);
@@ -64,13 +58,30 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
   stateBlock->seg_wnd = BIG_TO_HOST16(header->winsize);
   stateBlock->seg_up = BIG_TO_HOST16(header->urgptr);
   stateBlock->seg_prc = 0; // IP header contains precedence information
-  stateBlock->rcv_wnd = stateBlock->seg_wnd;
+  stateBlock->rcv_wnd = stateBlock->receiveSpace();
+
+  // Windows on anything but a SYN are scaled (RFC 7323)
+  if(!(header->flags & Tcp::SYN))
+    stateBlock->seg_wnd <<= stateBlock->snd_wscale;
 
   stateBlock->fin_ack = false;
 
+  Tcp::SegmentOptions options;
+  Tcp::parseOptions(header, options);
+
+  // Remember the timestamp to echo, unless the segment's from the future
+  // (RFC 7323, section 4.3)
+  if(stateBlock->tsOk && options.bTimestamp && Tcp::seqLe(stateBlock->seg_seq, stateBlock->rcv_nxt))
+    stateBlock->ts_recent = options.tsVal;
+
   // has an Ack already been sent in this segment?
   bool alreadyAck = false;
 
+  // Is there a FIN to act on, and where is it? An out-of-order FIN waits
+  // in the reassembly queue until the data before it arrives.
+  bool bFin = (header->flags & Tcp::FIN) == Tcp::FIN;
+  uint32_t finSeq = stateBlock->seg_seq + stateBlock->seg_len;
+
   // what state are we in?
   // RFC793, page 65 onwards
   Tcp::TcpState oldState = stateBlock->currentState;
@@ -115,13 +126,10 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
           ack = BIG_TO_HOST32(header->seqnum) + 1;
           flags = Tcp::RST | Tcp::ACK;
         }
-        if(!Tcp::send(from, handle.localPort, handle.remotePort, seq, ack, flags, window, 0, 0))
+        if(!Tcp::send(from, destPort, sourcePort, seq, ack, flags, window, 0, 0))
           WARNING("TCP: Sending RST due to incoming segment while in CLOSED state failed.");
       }
 
-      if(bDidAllocateStateBlock)
-          delete stateBlock;
-
       return;
 
       break;
@@ -136,7 +144,7 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
       else if(header->flags & Tcp::ACK)
       {
         // An ACK on a listen state is invalid
-        if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->seg_ack, 0, Tcp::RST, 0, 0, 0))
+        if(!Tcp::send(from, destPort, sourcePort, stateBlock->seg_ack, 0, Tcp::RST, 0, 0, 0))
           WARNING("TCP: Sending RST due to ACK while in LISTEN state failed.");
       }
       else if(header->flags & Tcp::SYN)
@@ -150,7 +158,7 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
         if(!newStateBlock)
         {
           // If we don't get this new block, pretend we're not listening
-          if(!Tcp::send(from, handle.localPort, handle.remotePort, 0, stateBlock->seg_ack, Tcp::RST | Tcp::ACK, 0, 0, 0))
+          if(!Tcp::send(from, destPort, sourcePort, 0, stateBlock->seg_ack, Tcp::RST | Tcp::ACK, 0, 0, 0))
             WARNING("TCP: Couldn't ACK a SYN because no memory was available for a state block.");
           return;
         }
@@ -164,13 +172,16 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
         newStateBlock->iss = getNextSequenceNumber();
         newStateBlock->snd_nxt = newStateBlock->iss + 1;
         newStateBlock->snd_una = newStateBlock->iss;
-        newStateBlock->snd_wnd = 16384;
+        newStateBlock->snd_wnd = stateBlock->seg_wnd;
         newStateBlock->snd_up = 0;
-        newStateBlock->snd_wl1 = newStateBlock->snd_wl2 = 0;
+        newStateBlock->snd_wl1 = stateBlock->seg_seq;
+        newStateBlock->snd_wl2 = 0;
+        newStateBlock->snd_end = newStateBlock->snd_nxt;
+        newStateBlock->setOptions(options);
 
         newStateBlock->irs = stateBlock->seg_seq;
         newStateBlock->rcv_nxt = stateBlock->seg_seq + 1;
-        newStateBlock->rcv_wnd = stateBlock->seg_wnd;
+        newStateBlock->rcv_wnd = newStateBlock->receiveSpace();
         newStateBlock->rcv_up = 0;
 
         newStateBlock->seg_seq = newStateBlock->rcv_nxt;
@@ -181,34 +192,25 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
 
         newStateBlock->numEndpointPackets = 0;
 
-        handle.listen = false;
-        handle.localPort = destPort;
-        handle.remotePort = sourcePort;
-        handle.remoteHost.ip = from;
-
-        StateBlockHandle* tmp = new StateBlockHandle;
-        if(!tmp)
-        {
-          delete newStateBlock;
-          if(!Tcp::send(from, handle.localPort, handle.remotePort, 0, stateBlock->seg_ack, Tcp::RST | Tcp::ACK, 0, 0, 0))
-            WARNING("TCP: Couldn't ACK a SYN because no memory was available for a state block handle.");
-          return;
-        }
-
-        *tmp = handle;
+        // Hold the new connection until its SYN/ACK is out
+        StateBlockRef newRef(newStateBlock);
+        LockGuard<Mutex> newGuard(newStateBlock->lock);
 
-        m_StateBlocks.insert(handle, newStateBlock);
-        m_CurrentConnections.insert(connId, tmp);
+        // Another SYN for the same connection may have beaten us to it
+        if(!m_Connections.insert(newStateBlock))
+          break;
 
         // ACK the SYN
         IpAddress dest;
         dest = newStateBlock->remoteHost.ip;
-        if(!Tcp::send(dest, newStateBlock->localPort, newStateBlock->remoteHost.remotePort, newStateBlock->iss, newStateBlock->rcv_nxt, Tcp::SYN | Tcp::ACK, newStateBlock->snd_wnd, 0, 0))
+        Tcp::SegmentOptions synOptions;
+        newStateBlock->synOptions(synOptions);
+        if(!Tcp::send(dest, newStateBlock->localPort, newStateBlock->remoteHost.remotePort, newStateBlock->iss, newStateBlock->rcv_nxt, Tcp::SYN | Tcp::ACK, newStateBlock->receiveWindow(true), 0, 0, &synOptions))
           WARNING("TCP: Sending SYN/ACK failed");
       }
       else
       {
-        WARNING("TCP Packet incoming on port " << Dec << handle.localPort << Hex << " during LISTEN without RST, ACK, or SYN set.");
+        WARNING("TCP Packet incoming on port " << Dec << destPort << Hex << " during LISTEN without RST, ACK, or SYN set.");
       }
 
       break;
@@ -219,23 +221,23 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
       // ACK verification
       if(header->flags & Tcp::ACK)
       {
-        if((stateBlock->seg_ack <= stateBlock->iss) || (stateBlock->seg_ack > stateBlock->snd_nxt))
+        if(Tcp::seqLe(stateBlock->seg_ack, stateBlock->iss) || Tcp::seqGt(stateBlock->seg_ack, stateBlock->snd_nxt))
         {
-          NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " during SYN-SENT has unacceptable ACK 1.");
+          NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " during SYN-SENT has unacceptable ACK 1.");
 
           // RST required
           if(!(header->flags & Tcp::RST))
           {
-            if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->seg_ack, 0, Tcp::RST, 0, 0, 0))
+            if(!Tcp::send(from, destPort, sourcePort, stateBlock->seg_ack, 0, Tcp::RST, 0, 0, 0))
               WARNING("TCP: Sending RST due to invalid ACK while in SYN_SENT state failed.");
             break;
           }
         }
 
-        if(!((stateBlock->snd_una <= stateBlock->seg_ack) && (stateBlock->seg_ack <= stateBlock->snd_nxt)))
+        if(!(Tcp::seqLe(stateBlock->snd_una, stateBlock->seg_ack) && Tcp::seqLe(stateBlock->seg_ack, stateBlock->snd_nxt)))
         {
           // ACK unacceptable
-          NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " during SYN-SENT has unacceptable ACK 2.");
+          NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " during SYN-SENT has unacceptable ACK 2.");
           break;
         }
       }
@@ -257,12 +259,17 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
           stateBlock->rcv_nxt = stateBlock->seg_seq + 1;
           stateBlock->irs = stateBlock->seg_seq;
           stateBlock->snd_una = stateBlock->seg_ack;
+          stateBlock->setOptions(options);
 
-          if(stateBlock->snd_una > stateBlock->iss)
+          if(Tcp::seqGt(stateBlock->snd_una, stateBlock->iss))
           {
             stateBlock->currentState = Tcp::ESTABLISHED;
 
-            if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK, stateBlock->snd_wnd, 0, 0))
+            stateBlock->snd_wnd = stateBlock->seg_wnd;
+            stateBlock->snd_wl1 = stateBlock->seg_seq;
+            stateBlock->snd_wl2 = stateBlock->seg_ack;
+
+            if(!stateBlock->sendAck())
               WARNING("TCP: Sending ACK due to SYN/ACK while in SYN_SENT state failed.");
 
             break;
@@ -271,7 +278,9 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
           {
             stateBlock->currentState = Tcp::SYN_RECEIVED;
 
-            if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->iss, stateBlock->rcv_nxt, Tcp::SYN | Tcp::ACK, stateBlock->snd_wnd, 0, 0))
+            Tcp::SegmentOptions synOptions;
+            stateBlock->synOptions(synOptions);
+            if(!Tcp::send(from, destPort, sourcePort, stateBlock->iss, stateBlock->rcv_nxt, Tcp::SYN | Tcp::ACK, stateBlock->receiveWindow(true), 0, 0, &synOptions))
               WARNING("TCP: Sending SYN/ACK due to incorrect SYN/ACK while in SYN_SENT state failed.");
 
             break;
@@ -295,7 +304,7 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
       if(header->flags & Tcp::SYN)
       {
         NOTICE("TCP: unexpected SYN!");
-        if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK | Tcp::RST, stateBlock->snd_wnd, 0, 0))
+        if(!Tcp::send(from, destPort, sourcePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK | Tcp::RST, stateBlock->receiveWindow(), 0, 0))
           WARNING("TCP: Sending RST due to SYN during non-SYN phase failed.");
         break;
       }
@@ -305,8 +314,8 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
         // Unacceptable
         if(!(stateBlock->seg_seq == stateBlock->rcv_nxt))
         {
-          NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is unacceptable 1.");
-          if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK, stateBlock->snd_wnd, 0, 0))
+          NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is unacceptable 1.");
+          if(!stateBlock->sendAck())
             WARNING("TCP: Sending ACK due to unacceptable ACK (1) while in post-SYN_SENT state failed.");
           break;
         }
@@ -322,13 +331,13 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
       if((stateBlock->seg_len == 0) && (stateBlock->rcv_wnd > 0))
       {
         // Unacceptable
-        if(!((stateBlock->rcv_nxt <= stateBlock->seg_seq) && (stateBlock->seg_seq < (stateBlock->rcv_nxt + stateBlock->rcv_wnd))))
+        if(!(Tcp::seqLe(stateBlock->rcv_nxt, stateBlock->seg_seq) && Tcp::seqLt(stateBlock->seg_seq, stateBlock->rcv_nxt + stateBlock->rcv_wnd)))
         {
-          NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is unacceptable 2.");
+          NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is unacceptable 2.");
           NOTICE("    >> RCV_NXT = " << stateBlock->rcv_nxt);
           NOTICE("    >> SEG_SEQ = " << stateBlock->seg_seq);
           NOTICE("    >> RCV_NXT + RCV_WND = " << (stateBlock->rcv_nxt + stateBlock->rcv_wnd));
-          if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK, stateBlock->snd_wnd, 0, 0))
+          if(!stateBlock->sendAck())
             WARNING("TCP: Sending ACK due to unacceptable ACK (2) while in post-SYN_SENT state failed.");
           break;
         }
@@ -337,21 +346,22 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
       // Unacceptable
       if((stateBlock->seg_len > 0) && (stateBlock->rcv_wnd == 0))
       {
-        NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is unacceptable 3.");
-        if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK, stateBlock->snd_wnd, 0, 0))
+        NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is unacceptable 3.");
+        if(!stateBlock->sendAck())
           WARNING("TCP: Sending ACK due to unacceptable ACK (3) while in post-SYN_SENT state failed.");
         break;
       }
 
       if((stateBlock->seg_len > 0) && (stateBlock->rcv_wnd > 0))
       {
+        uint32_t seg_last = stateBlock->seg_seq + stateBlock->seg_len - 1;
         if(!(
-          ((stateBlock->rcv_nxt <= stateBlock->seg_seq) && (stateBlock->seg_seq < (stateBlock->rcv_nxt + stateBlock->rcv_wnd)))
+          (Tcp::seqLe(stateBlock->rcv_nxt, stateBlock->seg_seq) && Tcp::seqLt(stateBlock->seg_seq, stateBlock->rcv_nxt + stateBlock->rcv_wnd))
           ||
-          ((stateBlock->rcv_nxt <= (stateBlock->seg_seq + stateBlock->seg_len - 1)) && ((stateBlock->seg_seq + stateBlock->seg_len - 1) < (stateBlock->rcv_nxt + stateBlock->rcv_wnd)))))
+          (Tcp::seqLe(stateBlock->rcv_nxt, seg_last) && Tcp::seqLt(seg_last, stateBlock->rcv_nxt + stateBlock->rcv_wnd))))
         {
-          NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is unacceptable 4.");
-          if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK, stateBlock->snd_wnd, 0, 0))
+          NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is unacceptable 4.");
+          if(!stateBlock->sendAck())
             WARNING("TCP: Sending ACK due to unacceptable ACK (4) while in post-SYN_SENT state failed.");
           break;
         }
@@ -403,10 +413,10 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
         {
           case Tcp::SYN_RECEIVED:
           {
-            if(!(stateBlock->snd_una <= stateBlock->seg_ack && stateBlock->seg_ack <= stateBlock->snd_nxt))
+            if(!(Tcp::seqLe(stateBlock->snd_una, stateBlock->seg_ack) && Tcp::seqLe(stateBlock->seg_ack, stateBlock->snd_nxt)))
             {
-              NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is an unacceptable segment ACK.");
-              if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->seg_ack, 0, Tcp::RST, 0, 0, 0))
+              NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " is an unacceptable segment ACK.");
+              if(!Tcp::send(from, destPort, sourcePort, stateBlock->seg_ack, 0, Tcp::RST, 0, 0, 0))
                 WARNING("TCP: Sending ACK due to unacceptable segment ACK while in post-SYN_SENT state failed.");
               break;
             }
@@ -422,8 +432,9 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
             stateBlock->endpoint = new TcpEndpoint(connId, from, stateBlock->localPort, stateBlock->remoteHost.remotePort);
             if(!stateBlock->endpoint)
             {
+              stateBlock->currentState = Tcp::CLOSED;
               removeConn(connId);
-              if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->seg_ack, 0, Tcp::RST, 0, 0, 0))
+              if(!Tcp::send(from, destPort, sourcePort, stateBlock->seg_ack, 0, Tcp::RST, 0, 0, 0))
                 WARNING("TCP: Sending RST due to no memory for incoming connection's endpoint");
               return;
             }
@@ -441,46 +452,40 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
           case Tcp::CLOSE_WAIT:
           case Tcp::CLOSING:
 
-            if(stateBlock->seg_ack < stateBlock->snd_una)
-              break; // Dupe ack, just skip it and continue
-
-            // Remove from retransmission queue any acknowledged packets...
-            //stateBlock->retransmitQueue.remove(stateBlock->snd_una - stateBlock->nRemovedFromRetransmit, stateBlock->seg_len);
-            //stateBlock->nRemovedFromRetransmit += (stateBlock->seg_ack - stateBlock->snd_una);
-
-            // update the unack'd data information
-            if(stateBlock->snd_una < stateBlock->seg_ack && stateBlock->seg_ack <= stateBlock->snd_nxt)
-              stateBlock->snd_una = stateBlock->seg_ack;
-
-            // Reset the retransmit timer
-            stateBlock->resetTimer();
-
-            if(stateBlock->snd_una >= stateBlock->snd_nxt)
-              stateBlock->waitingForTimeout = false;
+            if(Tcp::seqLt(stateBlock->seg_ack, stateBlock->snd_una))
+              break; // Old ack, just skip it and continue
 
-            if(stateBlock->seg_ack > stateBlock->snd_nxt)
+            if(Tcp::seqGt(stateBlock->seg_ack, stateBlock->snd_nxt))
             {
               // Ack the ack with the proper sequence number, because the remote TCP has ack'd data that hasn't been sent
-              if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->seg_seq, Tcp::ACK, stateBlock->snd_wnd, 0, 0))
+              if(!Tcp::send(from, destPort, sourcePort, stateBlock->snd_nxt, stateBlock->seg_seq, Tcp::ACK, stateBlock->receiveWindow(), 0, 0))
                 WARNING("TCP: Sending ACK with proper sequence number (remote TCP ack'd data that we didn't send) failed.");
               else
                 alreadyAck = true;
               break;
             }
 
-            if(stateBlock->snd_una < stateBlock->seg_ack && stateBlock->seg_ack <= stateBlock->snd_nxt)
             {
-              if((stateBlock->snd_wl1 < stateBlock->seg_seq) || (stateBlock->snd_wl1 == stateBlock->seg_seq && stateBlock->snd_wl2 <= stateBlock->seg_ack))
+              // Window update - an ACK of nothing new can still open the window
+              uint32_t oldWnd = stateBlock->snd_wnd;
+              if(Tcp::seqLt(stateBlock->snd_wl1, stateBlock->seg_seq) || (stateBlock->snd_wl1 == stateBlock->seg_seq && Tcp::seqLe(stateBlock->snd_wl2, stateBlock->seg_ack)))
               {
                 stateBlock->snd_wnd = stateBlock->seg_wnd;
                 stateBlock->snd_wl1 = stateBlock->seg_seq;
                 stateBlock->snd_wl2 = stateBlock->seg_ack;
               }
+
+              // Updates snd_una, congestion control and the retransmit timer
+              bool bDuplicate = !stateBlock->seg_len && !(header->flags & (Tcp::SYN | Tcp::FIN)) && (stateBlock->seg_wnd == oldWnd);
+              stateBlock->ackReceived(bDuplicate, options);
+
+              // Send whatever there's now room for
+              stateBlock->sendQueued();
             }
 
             if(stateBlock->currentState == Tcp::FIN_WAIT_1)
             {
-              if(stateBlock->fin_seq <= stateBlock->seg_ack)
+              if(Tcp::seqLe(stateBlock->fin_seq, stateBlock->seg_ack))
               {
                 stateBlock->currentState = Tcp::FIN_WAIT_2;
                 stateBlock->fin_ack = true; // FIN has been acked
@@ -490,7 +495,7 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
             {
               // user's close can return now, but no deletion of the state block yet
 
-              if(stateBlock->fin_seq <= stateBlock->seg_ack)
+              if(Tcp::seqLe(stateBlock->fin_seq, stateBlock->seg_ack))
               {
                 stateBlock->currentState = Tcp::FIN_WAIT_2;
                 stateBlock->fin_ack = true; // FIN has been acked
@@ -498,7 +503,7 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
             }
             else if(stateBlock->currentState == Tcp::CLOSING)
             {
-              if(stateBlock->fin_seq <= stateBlock->seg_ack)
+              if(Tcp::seqLe(stateBlock->fin_seq, stateBlock->seg_ack))
               {
                 //stateBlock->currentState = Tcp::TIME_WAIT;
                 stateBlock->currentState = Tcp::CLOSED;
@@ -510,6 +515,13 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
 
           case Tcp::LAST_ACK:
 
+            // data queued before our FIN may still be going out
+            if(Tcp::seqLe(stateBlock->snd_una, stateBlock->seg_ack) && Tcp::seqLe(stateBlock->seg_ack, stateBlock->snd_nxt))
+            {
+              stateBlock->ackReceived(false, options);
+              stateBlock->sendQueued();
+            }
+
             // only our FIN ack can come now, so close
             if((stateBlock->fin_seq + 1) == stateBlock->seg_ack)
             {
@@ -535,7 +547,7 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
 
       }
       else
-        NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " has no ACK.");
+        NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " during " << Tcp::stateString(stateBlock->currentState) << " has no ACK.");
 
       if(header->flags & Tcp::URG)
       {
@@ -545,47 +557,73 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
       /* Finally, process the actual segment payload */
       if(stateBlock->currentState == Tcp::ESTABLISHED || stateBlock->currentState == Tcp::FIN_WAIT_1 || stateBlock->currentState == Tcp::FIN_WAIT_2)
       {
+        // Trim off the front anything we already have
+        if(Tcp::seqLt(stateBlock->seg_seq, stateBlock->rcv_nxt) && Tcp::seqGt(stateBlock->seg_seq + stateBlock->seg_len, stateBlock->rcv_nxt))
+        {
+          size_t nHave = stateBlock->rcv_nxt - stateBlock->seg_seq;
+          payload += nHave;
+          stateBlock->seg_len -= nHave;
+          stateBlock->seg_seq = stateBlock->rcv_nxt;
+        }
+
         // Is this a valid data segment?
-        if(stateBlock->seg_seq < stateBlock->rcv_nxt)
+        if(Tcp::seqLt(stateBlock->seg_seq, stateBlock->rcv_nxt))
         {
           // Transmission of already-acked data. Resend an ACK.
-          WARNING(" + (sequence is already partially acked)");
-          if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK, stateBlock->snd_wnd, 0, 0))
-            WARNING("TCP: Sending ACK for incoming data failed!");
-          else
-            alreadyAck = true;
+          WARNING(" + (sequence is already acked)");
+          stateBlock->sendAck();
+          alreadyAck = true;
+          bFin = false;
         }
-        else if(stateBlock->seg_seq > stateBlock->rcv_nxt)
+        else if(Tcp::seqGt(stateBlock->seg_seq, stateBlock->rcv_nxt))
         {
-          // Packet has come in out-of-order - drop on the floor.
-          WARNING(" + (sequence out of order)");
-          alreadyAck = true;
+          // Packet has come in out-of-order - keep it until the gap is
+          // filled, and ACK straight away: the duplicate ACKs (and the SACK
+          // blocks on them) start a fast retransmit.
+          if(stateBlock->seg_len || bFin)
+          {
+            WARNING(" + (sequence out of order)");
+            stateBlock->queueOutOfOrder(stateBlock->seg_seq, payload, stateBlock->seg_len, header->flags);
+            stateBlock->sendAck();
+            alreadyAck = true;
+          }
+          bFin = false;
         }
         else if(stateBlock->seg_len)
         {
-          NOTICE(" + Payload: " << String(reinterpret_cast<const char*>(payload)));
-          if(stateBlock->endpoint)
-          {
-            size_t winChange = stateBlock->endpoint->depositPayload(stateBlock->seg_len, payload, stateBlock->seg_seq - stateBlock->irs - 1, (header->flags & Tcp::PSH) == Tcp::PSH);
-            stateBlock->rcv_nxt += winChange;
-            if(winChange > stateBlock->rcv_wnd)
-            {
-                WARNING("TCP: incoming data was larger than rcv_wind");
-                winChange = stateBlock->rcv_wnd;
-            }
-            stateBlock->snd_wnd -= winChange;
+          bool bFilledGap = (stateBlock->reassemblyQueue != 0);
 
-            if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK, stateBlock->snd_wnd, 0, 0))
-              WARNING("TCP: Sending ACK for incoming data failed!");
-            else
-              alreadyAck = true;
+          size_t nTaken = stateBlock->deposit(payload, stateBlock->seg_len, (header->flags & Tcp::PSH) == Tcp::PSH);
+          if(nTaken > stateBlock->rcv_wnd)
+              WARNING("TCP: incoming data was larger than rcv_wind");
+
+          // A FIN only counts once everything before it has been taken
+          if(bFin && (stateBlock->rcv_nxt != finSeq))
+            bFin = false;
+
+          // Data that was waiting on this segment can go in now too
+          if(stateBlock->drainReassemblyQueue())
+          {
+            bFin = true;
+            finSeq = stateBlock->rcv_nxt;
           }
 
-          stateBlock->numEndpointPackets++;
+          // Filling a gap is ACKed at once, so the sender's recovery ends
+          // quickly; a FIN on this segment is ACKed straight away below.
+          if(bFilledGap && !bFin)
+          {
+            stateBlock->sendAck();
+            alreadyAck = true;
+          }
+          else if(!bFin)
+          {
+            stateBlock->delayAck();
+            alreadyAck = true;
+          }
         }
       }
 
-      if(header->flags & Tcp::FIN)
+      if(bFin)
       {
         if(stateBlock->currentState == Tcp::CLOSED || stateBlock->currentState == Tcp::LISTEN || stateBlock->currentState == Tcp::SYN_SENT)
           break;
@@ -594,14 +632,13 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
         if(stateBlock->endpoint)
           stateBlock->endpoint->depositPayload(0, 0, 0, true);
 
-        stateBlock->rcv_nxt = stateBlock->seg_seq + 1;
+        // the FIN follows any data before it
+        stateBlock->rcv_nxt = finSeq + 1;
 
         if(!alreadyAck)
         {
-          if(!Tcp::send(from, handle.localPort, handle.remotePort, stateBlock->snd_nxt, stateBlock->rcv_nxt, Tcp::ACK, stateBlock->snd_wnd, 0, 0))
-            WARNING("TCP: Sending ACK to FIN failed.");
-          else
-            alreadyAck = true;
+          stateBlock->sendAck();
+          alreadyAck = true;
         }
 
         switch(stateBlock->currentState)
@@ -668,7 +705,7 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
   if(oldState != stateBlock->currentState)
   {
 #if TCP_DEBUG
-    NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " caused state change from " << Tcp::stateString(oldState) << " to " << Tcp::stateString(stateBlock->currentState) << ".");
+    NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " caused state change from " << Tcp::stateString(oldState) << " to " << Tcp::stateString(stateBlock->currentState) << ".");
 #endif
     stateBlock->endpoint->stateChanged(stateBlock->currentState);
     stateBlock->waitState.release();
@@ -677,7 +714,7 @@ void TcpManager::receive(IpAddress from, uint16_t sourcePort, uint16_t destPort,
   if(stateBlock->currentState == Tcp::CLOSED)
   {
 #if TCP_DEBUG
-    NOTICE("TCP Packet arriving on port " << Dec << handle.localPort << Hex << " caused connection to close.");
+    NOTICE("TCP Packet arriving on port " << Dec << destPort << Hex << " caused connection to close.");
 #endif
 
     // If we are in a state that's not created by user intervention, we can safely remove and close the connection
@@ -0,0 +1,881 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "TcpManager.h"
+#include <machine/Machine.h>
+#include <Log.h>
+
+StateBlock::~StateBlock()
+{
+  Timer* t = Machine::instance().getTimer();
+  if(t)
+  {
+    t->removeAlarm(this);
+    t->removeAlarm(&delayedAck);
+  }
+
+  while(sendQueue.count())
+  {
+    Segment *seg = reinterpret_cast<Segment*>(sendQueue.popFront());
+    if(seg->buffer)
+      seg->buffer->unref();
+    delete seg;
+  }
+  while(retransmitQueue.count())
+  {
+    Segment *seg = reinterpret_cast<Segment*>(retransmitQueue.popFront());
+    if(seg->buffer)
+      seg->buffer->unref();
+    delete seg;
+  }
+  while(reassemblyQueue)
+  {
+    Segment *seg = reassemblyQueue;
+    reassemblyQueue = seg->next;
+    if(seg->buffer)
+      seg->buffer->unref();
+    delete seg;
+  }
+}
+
+void StateBlock::ackSegment()
+{
+  // we assume the seg_* variables have been set by the caller (always done in TcpManager::receive)
+  uint32_t segAck = seg_ack;
+  while(retransmitQueue.count())
+  {
+    // grab the first segment from the queue
+    Segment* seg = reinterpret_cast<Segment*>(retransmitQueue.popFront());
+    if(Tcp::seqLe(seg->seg_seq + seg->seg_len, segAck))
+    {
+      // this segment is acked, leave it off the queue and free the memory used
+      if(seg->buffer)
+        seg->buffer->unref();
+
+      delete seg;
+      continue;
+    }
+
+    // check if the ack is within this segment
+    if(Tcp::seqGt(segAck, seg->seg_seq))
+    {
+      // it is, so trim the acked bytes off the front
+      size_t nBytesAcked = segAck - seg->seg_seq;
+      if(nBytesAcked > seg->nBytes)
+        nBytesAcked = seg->nBytes;
+
+      seg->seg_seq += nBytesAcked;
+      seg->seg_len -= nBytesAcked;
+      seg->nBytes -= nBytesAcked;
+
+      // No need to move anything, the buffer just starts further in
+      if(seg->buffer)
+        seg->buffer->pull(nBytesAcked);
+    }
+
+    // push it back on the front, there's no potential for further ACKs
+    retransmitQueue.pushFront(reinterpret_cast<void*>(seg));
+    return;
+  }
+}
+
+bool StateBlock::sendSegment(Segment* seg)
+{
+  if(seg)
+  {
+    Tcp::SegmentOptions options;
+    segmentOptions(options, !seg->nBytes);
+    return Tcp::sendBuffer(remoteHost.ip, localPort, remoteHost.remotePort, seg->seg_seq, rcv_nxt, seg->flags, receiveWindow(), seg->buffer, &options);
+  }
+  return false;
+}
+
+size_t StateBlock::sendSegment(uint8_t flags, size_t nBytes, uintptr_t payload, bool addToRetransmitQueue)
+{
+  if(!payload)
+    nBytes = 0;
+
+  size_t offset = 0;
+
+  // Top up the last queued segment if it's short, so that small writes
+  // don't each go out as a small segment.
+  if(nBytes && addToRetransmitQueue && sendQueue.count() && !(flags & (Tcp::SYN | Tcp::FIN)))
+  {
+    Segment *tail = reinterpret_cast<Segment*>(*sendQueue.rbegin());
+    if(!(tail->flags & (Tcp::SYN | Tcp::FIN)) && tail->nBytes < snd_mss)
+    {
+      size_t n = snd_mss - tail->nBytes;
+      if(n > nBytes)
+        n = nBytes;
+
+      // Segments are allocated a full MSS, so there's room to grow into
+      // unless the MSS has changed since.
+      if(tail->buffer && tail->buffer->append(payload, n))
+      {
+        tail->nBytes += n;
+        tail->seg_len += n;
+        tail->flags |= flags;
+
+        snd_end += n;
+        offset = n;
+      }
+    }
+  }
+
+  // split the rest of the passed buffer up into snd_mss byte segments
+  while((offset < nBytes) || (!nBytes && !offset))
+  {
+    Segment* seg = new Segment;
+
+    size_t segmentSize = nBytes - offset;
+    if(segmentSize > snd_mss)
+      segmentSize = snd_mss;
+
+    seg->seg_seq = snd_end;
+    seg->seg_ack = rcv_nxt;
+    seg->seg_len = segmentSize;
+    seg->seg_wnd = 0;
+    seg->seg_up = 0;
+    seg->flags = flags;
+    seg->sacked = false;
+    seg->next = 0;
+
+    // Only the last segment of the buffer gets PSH, SYN or FIN
+    if(offset + segmentSize < nBytes)
+      seg->flags &= ~(Tcp::PSH | Tcp::SYN | Tcp::FIN);
+
+    // SYN and FIN each take up a sequence number
+    if(seg->flags & (Tcp::SYN | Tcp::FIN))
+      seg->seg_len++;
+
+    seg->buffer = 0;
+    if(segmentSize)
+    {
+      // Room for a full segment, so later small writes can top it up
+      seg->buffer = NetBuffer::allocate(addToRetransmitQueue ? snd_mss : segmentSize);
+      if(!seg->buffer)
+      {
+        delete seg;
+        break;
+      }
+      seg->buffer->append(payload + offset, segmentSize);
+    }
+    seg->nBytes = segmentSize;
+
+    snd_end += seg->seg_len;
+
+    if(addToRetransmitQueue)
+      sendQueue.pushBack(reinterpret_cast<void*>(seg));
+    else
+    {
+      // Unreliable: straight out, and forgotten.
+      seg_seq = seg->seg_seq;
+      if(Tcp::seqLt(snd_nxt, snd_end))
+        snd_nxt = snd_end;
+      sendSegment(seg);
+
+      if(seg->buffer)
+        seg->buffer->unref();
+      delete seg;
+    }
+
+    offset += segmentSize;
+    if(!segmentSize)
+      break;
+  }
+
+  sendQueued();
+  return offset;
+}
+
+void StateBlock::sendQueued(bool bForce)
+{
+  while(sendQueue.count())
+  {
+    Segment *seg = reinterpret_cast<Segment*>(*sendQueue.begin());
+
+    uint32_t window = (cwnd < snd_wnd) ? cwnd : snd_wnd;
+    uint32_t inFlight = flightSize();
+
+    if(!bForce)
+    {
+      // Does it fit in the window? (A bare FIN always does.)
+      if(seg->nBytes && (inFlight + seg->nBytes > window))
+        break;
+
+      // Nagle: only one small segment in flight at a time.
+      if(nagle && inFlight && (seg->nBytes < snd_mss) && !(seg->flags & Tcp::FIN))
+        break;
+    }
+    bForce = false;
+
+    sendQueue.popFront();
+    transmit(seg);
+    retransmitQueue.pushBack(reinterpret_cast<void*>(seg));
+  }
+
+  // Anything outstanding (or stuck behind a closed window) needs the
+  // retransmission timer running.
+  if(!waitingForTimeout && (retransmitQueue.count() || sendQueue.count()))
+    resetRetransmitTimer();
+}
+
+void StateBlock::transmit(Segment *seg)
+{
+  seg_seq = seg->seg_seq;
+  if(Tcp::seqLt(snd_nxt, seg->seg_seq + seg->seg_len))
+    snd_nxt = seg->seg_seq + seg->seg_len;
+
+  // Time one segment per round trip.
+  if(!rttTiming)
+  {
+    Timer* t = Machine::instance().getTimer();
+    if(t)
+    {
+      rttTiming = true;
+      rttSeq = seg->seg_seq + seg->seg_len;
+      rttStart = t->getTickCount();
+    }
+  }
+
+  // The segment carries our ACK, so anything held back has gone with it.
+  if(nDelayedSegments)
+  {
+    nDelayedSegments = 0;
+    Timer* t = Machine::instance().getTimer();
+    if(t)
+      t->removeAlarm(&delayedAck);
+  }
+
+  sendSegment(seg);
+}
+
+void StateBlock::retransmitFirst()
+{
+  // The first one the remote end doesn't have
+  for(List<void*>::Iterator it = retransmitQueue.begin(); it != retransmitQueue.end(); ++it)
+  {
+    Segment* seg = reinterpret_cast<Segment*>(*it);
+    if(seg->sacked)
+      continue;
+
+    sendSegment(seg);
+    break;
+  }
+
+  // Karn: an ACK for retransmitted data says nothing about the RTT.
+  rttTiming = false;
+}
+
+void StateBlock::retransmitLost()
+{
+  if(Tcp::seqLt(rexmit_nxt, snd_una))
+    rexmit_nxt = snd_una;
+
+  for(List<void*>::Iterator it = retransmitQueue.begin(); it != retransmitQueue.end(); ++it)
+  {
+    Segment* seg = reinterpret_cast<Segment*>(*it);
+    if(Tcp::seqLt(seg->seg_seq, rexmit_nxt) || seg->sacked)
+      continue;
+
+    // The first one always goes, otherwise as much as cwnd allows.
+    uint32_t end = seg->seg_seq + seg->seg_len;
+    if((seg->seg_seq != snd_una) && (end - snd_una > cwnd))
+      break;
+
+    sendSegment(seg);
+    rexmit_nxt = end;
+  }
+
+  rttTiming = false;
+}
+
+void StateBlock::ackReceived(bool bDuplicate, const Tcp::SegmentOptions &options)
+{
+  if(sackOk && options.nSackBlocks)
+    markSacked(options);
+
+  if(seg_ack == snd_una)
+  {
+    // Only a duplicate if there's still something to acknowledge.
+    if(!bDuplicate || !flightSize())
+      return;
+
+    dupAcks++;
+    if(recovery == FastRecovery)
+    {
+      // Each duplicate means a segment has left the network.
+      cwnd += snd_mss;
+      sendQueued();
+    }
+    else if((recovery == NotRecovering) && (dupAcks == TCP_DUPACK_THRESHOLD))
+    {
+      // Fast retransmit
+      ssthresh = flightSize() / 2;
+      if(ssthresh < 2 * snd_mss)
+        ssthresh = 2 * snd_mss;
+      recover = snd_nxt;
+
+      retransmitFirst();
+
+      cwnd = ssthresh + TCP_DUPACK_THRESHOLD * snd_mss;
+      recovery = FastRecovery;
+    }
+    return;
+  }
+
+  uint32_t nAcked = seg_ack - snd_una;
+  snd_una = seg_ack;
+  dupAcks = 0;
+
+  // That made room in the send buffer
+  if(sendWaiting)
+  {
+    sendWaiting = false;
+    sendSpaceWait.release();
+  }
+
+  if(tsOk && options.bTimestamp && options.tsEcr)
+  {
+    // The echoed timestamp times every ACK, retransmission or not.
+    rttTiming = false;
+    rttSample((timestamp() - options.tsEcr) * 1000);
+  }
+  else if(rttTiming && Tcp::seqGe(seg_ack, rttSeq))
+  {
+    rttTiming = false;
+    Timer* t = Machine::instance().getTimer();
+    if(t)
+      rttSample(static_cast<uint32_t>(t->getTickCount() - rttStart));
+  }
+
+  if(recovery != NotRecovering && Tcp::seqGe(seg_ack, recover))
+  {
+    // Everything outstanding when recovery began is now in.
+    if(recovery == FastRecovery)
+      cwnd = ssthresh;
+    recovery = NotRecovering;
+  }
+  else if(recovery == FastRecovery)
+  {
+    // Partial ACK: the next hole is lost too.
+    retransmitFirst();
+
+    if(cwnd > nAcked)
+      cwnd -= nAcked;
+    else
+      cwnd = 0;
+    cwnd += snd_mss;
+  }
+  else
+  {
+    if(cwnd < ssthresh)
+    {
+      // Slow start
+      cwnd += (nAcked < snd_mss) ? nAcked : snd_mss;
+    }
+    else
+    {
+      // Congestion avoidance: about one MSS per round trip
+      uint32_t inc = (snd_mss * snd_mss) / cwnd;
+      cwnd += inc ? inc : 1;
+    }
+
+    if(recovery == TimeoutRecovery)
+      retransmitLost();
+  }
+
+  // New data acked: restart the timer, or stop it if nothing's left.
+  if(retransmitQueue.count() || sendQueue.count())
+    resetRetransmitTimer();
+  else
+  {
+    waitingForTimeout = false;
+    Timer* t = Machine::instance().getTimer();
+    if(t)
+      t->removeAlarm(this);
+  }
+}
+
+void StateBlock::rttSample(uint32_t rtt)
+{
+  if(!srtt)
+  {
+    srtt = rtt;
+    rttvar = rtt / 2;
+  }
+  else
+  {
+    uint32_t delta = (srtt > rtt) ? (srtt - rtt) : (rtt - srtt);
+    rttvar = (3 * rttvar + delta) / 4;
+    srtt = (7 * srtt + rtt) / 8;
+  }
+
+  rto = srtt + 4 * rttvar;
+  if(rto < TCP_RTO_MIN)
+    rto = TCP_RTO_MIN;
+  if(rto > TCP_RTO_MAX)
+    rto = TCP_RTO_MAX;
+}
+
+void StateBlock::delayAck()
+{
+  // ACK at least every second full segment (RFC 1122).
+  if(++nDelayedSegments >= 2)
+  {
+    sendAck();
+    return;
+  }
+
+  Timer* t = Machine::instance().getTimer();
+  if(t)
+    t->addAlarm(&delayedAck, 0, TCP_DELAYED_ACK);
+  else
+    sendAck();
+}
+
+bool StateBlock::sendAck()
+{
+  nDelayedSegments = 0;
+
+  Timer* t = Machine::instance().getTimer();
+  if(t)
+    t->removeAlarm(&delayedAck);
+
+  Tcp::SegmentOptions options;
+  segmentOptions(options, true);
+  if(!Tcp::send(remoteHost.ip, localPort, remoteHost.remotePort, snd_nxt, rcv_nxt, Tcp::ACK, receiveWindow(), 0, 0, &options))
+  {
+    WARNING("TCP: Sending ACK failed.");
+    return false;
+  }
+  return true;
+}
+
+void StateBlock::setOptions(const Tcp::SegmentOptions &options)
+{
+  // Only what both ends offered
+  sackOk = sackOk && options.bSackPermitted;
+  tsOk = tsOk && options.bTimestamp;
+  wscaleOk = wscaleOk && options.bWindowScale;
+
+  if(wscaleOk)
+  {
+    snd_wscale = options.wscale;
+    rcv_wscale = TCP_RECV_WSCALE;
+  }
+  else
+    snd_wscale = rcv_wscale = 0;
+
+  if(tsOk)
+    ts_recent = options.tsVal;
+
+  uint32_t mss = options.mss;
+  if(!mss)
+    mss = TCP_DEFAULT_MSS;
+  if(mss > TCP_LOCAL_MSS)
+    mss = TCP_LOCAL_MSS;
+
+  // The timestamp on every segment comes out of the payload
+  if(tsOk)
+    mss -= TCP_TIMESTAMP_SIZE;
+  snd_mss = mss;
+
+  // Initial window (RFC 3390)
+  cwnd = 4 * snd_mss;
+  if(cwnd > 4380)
+    cwnd = (2 * snd_mss > 4380) ? 2 * snd_mss : 4380;
+}
+
+void StateBlock::synOptions(Tcp::SegmentOptions &options)
+{
+  options.mss = TCP_LOCAL_MSS;
+  options.bWindowScale = wscaleOk;
+  options.wscale = TCP_RECV_WSCALE;
+  options.bSackPermitted = sackOk;
+  options.bTimestamp = tsOk;
+  options.tsVal = timestamp();
+  options.tsEcr = ts_recent;
+}
+
+void StateBlock::segmentOptions(Tcp::SegmentOptions &options, bool bSack)
+{
+  if(tsOk)
+  {
+    options.bTimestamp = true;
+    options.tsVal = timestamp();
+    options.tsEcr = ts_recent;
+  }
+
+  if(!bSack || !sackOk || !reassemblyQueue)
+    return;
+
+  // The queue is in order, so contiguous segments are next to each other.
+  // The block with the latest arrival goes first (RFC 2018), and the rest
+  // follow in order.
+  Tcp::SackBlock blocks[TCP_MAX_SACK_BLOCKS];
+  size_t nBlocks = 0;
+  for(Segment *seg = reassemblyQueue; seg; )
+  {
+    Tcp::SackBlock block;
+    block.left = block.right = seg->seg_seq;
+
+    bool bRecent = false;
+    while(seg && seg->seg_seq == block.right)
+    {
+      if(seg->seg_seq == sackRecent)
+        bRecent = true;
+      block.right = seg->seg_seq + seg->nBytes;
+      seg = seg->next;
+    }
+
+    // A bare FIN isn't worth a block
+    if(block.left == block.right)
+      continue;
+
+    if(bRecent && !options.nSackBlocks)
+    {
+      options.sackBlocks[options.nSackBlocks++] = block;
+    }
+    else if(nBlocks < TCP_MAX_SACK_BLOCKS)
+      blocks[nBlocks++] = block;
+  }
+
+  for(size_t i = 0; i < nBlocks && options.nSackBlocks < TCP_MAX_SACK_BLOCKS; i++)
+    options.sackBlocks[options.nSackBlocks++] = blocks[i];
+}
+
+size_t StateBlock::receiveSpace()
+{
+  if(!endpoint)
+    return 0;
+
+  return endpoint->receiveSpace();
+}
+
+uint16_t StateBlock::receiveWindow(bool bSyn)
+{
+  // Windows on a SYN are never scaled
+  uint8_t shift = bSyn ? 0 : rcv_wscale;
+  size_t window = receiveSpace() >> shift;
+  if(window > 0xFFFF)
+    window = 0xFFFF;
+
+  rcv_adv = window << shift;
+  return static_cast<uint16_t>(window);
+}
+
+void StateBlock::windowUpdate()
+{
+  if(!endpoint)
+    return;
+  if(currentState != Tcp::ESTABLISHED && currentState != Tcp::FIN_WAIT_1 && currentState != Tcp::FIN_WAIT_2)
+    return;
+
+  // Only announce the window once it has opened by a full segment or half
+  // the buffer, not a few bytes at a time (RFC 1122, 4.2.3.3).
+  size_t space = receiveSpace();
+  if(space <= rcv_adv)
+    return;
+
+  size_t threshold = endpoint->m_DataStream.getSize() / 2;
+  if(threshold > TCP_LOCAL_MSS)
+    threshold = TCP_LOCAL_MSS;
+  if(space - rcv_adv >= threshold)
+    sendAck();
+}
+
+uint32_t StateBlock::timestamp()
+{
+  Timer* t = Machine::instance().getTimer();
+  if(!t)
+    return 0;
+  return static_cast<uint32_t>(t->getTickCount() / 1000);
+}
+
+void StateBlock::markSacked(const Tcp::SegmentOptions &options)
+{
+  for(size_t i = 0; i < options.nSackBlocks; i++)
+  {
+    const Tcp::SackBlock &block = options.sackBlocks[i];
+    for(List<void*>::Iterator it = retransmitQueue.begin(); it != retransmitQueue.end(); ++it)
+    {
+      Segment* seg = reinterpret_cast<Segment*>(*it);
+      if(Tcp::seqGe(seg->seg_seq, block.left) && Tcp::seqLe(seg->seg_seq + seg->seg_len, block.right))
+        seg->sacked = true;
+    }
+  }
+}
+
+size_t StateBlock::deposit(uintptr_t payload, size_t nBytes, bool push)
+{
+  if(!endpoint || !nBytes)
+    return 0;
+
+  size_t n = endpoint->depositPayload(nBytes, payload, rcv_nxt - irs - 1, push);
+  rcv_nxt += n;
+  numEndpointPackets++;
+
+  tuneReceiveBuffer(n);
+  return n;
+}
+
+void StateBlock::queueOutOfOrder(uint32_t seq, uintptr_t payload, size_t nBytes, uint8_t flags)
+{
+  // Nothing past the window we offered
+  if(Tcp::seqGt(seq + nBytes, rcv_nxt + rcv_wnd))
+  {
+    if(Tcp::seqGe(seq, rcv_nxt + rcv_wnd))
+      return;
+    nBytes = rcv_nxt + rcv_wnd - seq;
+    flags &= ~Tcp::FIN;
+  }
+
+  Segment **ppSeg = &reassemblyQueue;
+  while(*ppSeg)
+  {
+    Segment *q = *ppSeg;
+    uint32_t qEnd = q->seg_seq + q->nBytes;
+
+    if(Tcp::seqLe(qEnd, seq))
+    {
+      // All before us
+      ppSeg = &q->next;
+      continue;
+    }
+    if(Tcp::seqGe(q->seg_seq, seq + nBytes))
+    {
+      // All after us - we go in front of it
+      break;
+    }
+
+    if(Tcp::seqLe(q->seg_seq, seq) && Tcp::seqGe(qEnd, seq + nBytes))
+    {
+      // We have all of this already
+      q->flags |= flags & Tcp::PSH;
+      if(qEnd == seq + nBytes)
+        q->flags |= flags & Tcp::FIN;
+      return;
+    }
+
+    if(Tcp::seqGe(q->seg_seq, seq) && Tcp::seqLe(qEnd, seq + nBytes))
+    {
+      // We cover all of it: it goes
+      *ppSeg = q->next;
+      if(q->buffer)
+        q->buffer->unref();
+      delete q;
+      continue;
+    }
+
+    if(Tcp::seqLt(q->seg_seq, seq))
+    {
+      // It overlaps our front
+      size_t overlap = qEnd - seq;
+      payload += overlap;
+      nBytes -= overlap;
+      seq = qEnd;
+      ppSeg = &q->next;
+      continue;
+    }
+
+    // It overlaps our back
+    nBytes = q->seg_seq - seq;
+    flags &= ~Tcp::FIN;
+    break;
+  }
+
+  if(!nBytes && !(flags & Tcp::FIN))
+    return;
+
+  Segment *seg = new Segment;
+  seg->seg_seq = seq;
+  seg->seg_ack = 0;
+  seg->seg_len = nBytes;
+  seg->seg_wnd = 0;
+  seg->seg_up = 0;
+  seg->flags = flags;
+  seg->nBytes = nBytes;
+  seg->buffer = 0;
+  seg->sacked = false;
+  if(nBytes)
+  {
+    // The incoming packet's memory goes back to the pool, so keep a copy
+    seg->buffer = NetBuffer::allocate(nBytes, 0);
+    if(!seg->buffer)
+    {
+      delete seg;
+      return;
+    }
+    seg->buffer->append(payload, nBytes);
+  }
+
+  seg->next = *ppSeg;
+  *ppSeg = seg;
+
+  sackRecent = seq;
+}
+
+bool StateBlock::drainReassemblyQueue()
+{
+  bool bFin = false;
+  while(reassemblyQueue && Tcp::seqLe(reassemblyQueue->seg_seq, rcv_nxt))
+  {
+    Segment *seg = reassemblyQueue;
+    uint32_t end = seg->seg_seq + seg->nBytes;
+
+    if(Tcp::seqGt(end, rcv_nxt))
+    {
+      size_t skip = rcv_nxt - seg->seg_seq;
+      size_t n = deposit(seg->buffer->data() + skip, seg->nBytes - skip, (seg->flags & Tcp::PSH) == Tcp::PSH);
+      if(n < seg->nBytes - skip)
+      {
+        // The buffer's full. Leave the rest queued, it'll be trimmed
+        // when we get to it again.
+        break;
+      }
+    }
+
+    if((seg->flags & Tcp::FIN) && (rcv_nxt == end))
+      bFin = true;
+
+    reassemblyQueue = seg->next;
+    if(seg->buffer)
+      seg->buffer->unref();
+    delete seg;
+
+    if(bFin)
+      break;
+  }
+
+  return bFin;
+}
+
+void StateBlock::tuneReceiveBuffer(size_t nBytes)
+{
+  Timer* t = Machine::instance().getTimer();
+  if(!t || !endpoint)
+    return;
+
+  uint64_t now = t->getTickCount();
+  if(!rcvSpaceStart)
+    rcvSpaceStart = now;
+  rcvSpaceBytes += nBytes;
+
+  // Measure over a round trip (a guess, if we haven't sent enough to know)
+  uint32_t rtt = srtt ? srtt : 100000;
+  if(now - rcvSpaceStart < rtt)
+    return;
+
+  // If the sender got through more than half the buffer in that time, the
+  // buffer is what's holding it back.
+  size_t size = endpoint->m_ShadowDataStream.getSize();
+  if((rcvSpaceBytes * 2 > size) && (size < TCP_MAX_RECV_BUFFER))
+  {
+    size *= 2;
+    if(size > TCP_MAX_RECV_BUFFER)
+      size = TCP_MAX_RECV_BUFFER;
+
+    endpoint->m_ShadowDataStream.setSize(size);
+    endpoint->m_DataStream.setSize(size);
+  }
+
+  rcvSpaceBytes = 0;
+  rcvSpaceStart = now;
+}
+
+void StateBlock::fire()
+{
+  Timer* t = Machine::instance().getTimer();
+
+  // This is interrupt context, so if a thread has the connection we can't
+  // wait for it; come back shortly instead.
+  if(!lock.tryAcquire())
+  {
+    if(t)
+      t->addAlarm(this, 0, TCP_LOCK_RETRY);
+    return;
+  }
+
+  // Whoever had the lock may have pushed the timer back meanwhile
+  uint64_t now = t ? t->getTickCount() : 0;
+  if(now < timerDeadline)
+  {
+    uint64_t remaining = timerDeadline - now;
+    t->addAlarm(this, remaining / 1000000, remaining % 1000000);
+  }
+  else
+    timeout();
+
+  lock.release();
+}
+
+void StateBlock::timeout()
+{
+  if(!waitingForTimeout)
+    return;
+
+  // timeout is hit!
+  waitingForTimeout = false;
+  didTimeout = true;
+  if(useWaitSem)
+    timeoutWait.release();
+
+  // check to see if there's data on the retransmission queue to send
+  if(retransmitQueue.count())
+  {
+    NOTICE("Remote TCP did not ack all the data!");
+
+    // Everything in flight is presumed lost: back to one segment, and
+    // slow start from there (RFC 5681).
+    ssthresh = flightSize() / 2;
+    if(ssthresh < 2 * snd_mss)
+      ssthresh = 2 * snd_mss;
+    cwnd = snd_mss;
+    dupAcks = 0;
+
+    recover = snd_nxt;
+    recovery = TimeoutRecovery;
+    rexmit_nxt = snd_una;
+    retransmitLost();
+
+    // Back off
+    rto *= 2;
+    if(rto > TCP_RTO_MAX)
+      rto = TCP_RTO_MAX;
+
+    // reset the timeout
+    resetRetransmitTimer();
+  }
+  else if(sendQueue.count())
+  {
+    // Nothing in flight, but a closed window is holding data back. Probe
+    // it, so that we hear when it opens.
+    sendQueued(true);
+  }
+  else if(currentState == Tcp::TIME_WAIT)
+  {
+    // timer has fired, we need to close the connection
+    NOTICE("TIME_WAIT timeout complete");
+    currentState = Tcp::CLOSED;
+
+    // create the cleanup thread, which keeps the block alive until it's done
+    ref();
+    new Thread(Processor::information().getCurrentThread()->getParent(),
+      reinterpret_cast<Thread::ThreadStartFunc> (&stateBlockFree),
+      reinterpret_cast<void*> (this));
+  }
+}
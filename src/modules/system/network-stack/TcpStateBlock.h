@@ -19,7 +19,9 @@
 #include <processor/types.h>
 #include <machine/Network.h>
 #include <process/Semaphore.h>
+#include <process/Mutex.h>
 #include <processor/Processor.h>
+#include <Atomic.h>
 
 #include "NetworkStack.h"
 #include "Endpoint.h"
@@ -28,6 +30,41 @@
 
 /// \todo Eventify.
 
+/// MSS assumed when the remote end doesn't send one (RFC 1122).
+#define TCP_DEFAULT_MSS         536
+/// MSS we offer: an Ethernet MTU less the IPv4 and TCP headers.
+#define TCP_LOCAL_MSS           1460
+
+/// Retransmission timeout before any RTT has been measured, in microseconds.
+#define TCP_RTO_INITIAL         1000000
+/// Bounds on the retransmission timeout, in microseconds. The minimum is
+/// lower than RFC 6298's one second, as most stacks' is.
+#define TCP_RTO_MIN             200000
+#define TCP_RTO_MAX             60000000
+
+/// Longest we hold back an ACK for in-order data, in microseconds.
+#define TCP_DELAYED_ACK         200000
+
+/// Number of duplicate ACKs that trigger a fast retransmit.
+#define TCP_DUPACK_THRESHOLD    3
+
+/// Window scale shift we ask for. 5 lets the window reach 2MB.
+#define TCP_RECV_WSCALE         5
+/// Bytes of option a timestamp takes on every segment (with padding).
+#define TCP_TIMESTAMP_SIZE      12
+
+/// Receive buffers start at TcpBuffer's default size, and are grown while
+/// the sender keeps filling them within a round trip, up to this size.
+#define TCP_MAX_RECV_BUFFER     (1024 * 1024)
+
+/// Unacknowledged data a connection holds for sending. A send waits for
+/// ACKs to make room beyond this, or writes short if it can't block.
+#define TCP_SEND_BUFFER         (64 * 1024)
+
+/// How long a timer that finds the connection locked waits before it tries
+/// again, in microseconds.
+#define TCP_LOCK_RETRY          1000
+
 /// This is passed a given StateBlock and its sole purpose is to remove it
 /// from the system. It's called as a thread when the TIME_WAIT timeout expires
 /// to enable the block to be freed without requiring intervention.
@@ -36,7 +73,7 @@ int stateBlockFree(void* p);
 // TCP is based on connections, so we need to keep track of them
 // before we even think about depositing into Endpoints. These state blocks
 // keep track of important information relating to the connection state.
-class StateBlock : public TimerHandler
+class StateBlock : public Alarm
 {
   private:
 
@@ -44,38 +81,84 @@ class StateBlock : public TimerHandler
     {
       uint32_t  seg_seq; // Segment sequence number
       uint32_t  seg_ack; // Ack number
-      uint32_t  seg_len; // Segment length
+      uint32_t  seg_len; // Segment length (including a FIN)
       uint32_t  seg_wnd; // Segment window
       uint32_t  seg_up; // Urgent pointer
       uint8_t   flags;
 
-      uintptr_t payload;
+      NetBuffer* buffer; // the data, or null if there's none
       size_t    nBytes;
+
+      bool      sacked; // the remote end has it, but not contiguously
+      Segment*  next; // next segment in the reassembly queue
+    };
+
+    /// Sends the ACK we've been holding back if no segment has carried it
+    /// in the meantime.
+    class DelayedAck : public Alarm
+    {
+      public:
+        DelayedAck(StateBlock *pBlock) : Alarm(), m_pBlock(pBlock)
+        {}
+        virtual ~DelayedAck()
+        {}
+
+        virtual void fire()
+        {
+          // Interrupt context: we can't wait for whoever has the connection
+          if(!m_pBlock->lock.tryAcquire())
+          {
+            Timer* t = Machine::instance().getTimer();
+            if(t)
+              t->addAlarm(this, 0, TCP_LOCK_RETRY);
+            return;
+          }
+
+          // A segment may have carried the ACK while we waited
+          if(m_pBlock->nDelayedSegments)
+            m_pBlock->sendAck();
+
+          m_pBlock->lock.release();
+        }
+
+      private:
+        DelayedAck(const DelayedAck &);
+        DelayedAck &operator = (const DelayedAck &);
+
+        StateBlock *m_pBlock;
     };
 
   public:
+
+    // Where we are in loss recovery
+    enum Recovery
+    {
+      NotRecovering = 0,
+      FastRecovery, // after a fast retransmit (RFC 6582)
+      TimeoutRecovery // after a retransmission timeout
+    };
+
     StateBlock() :
-      currentState(Tcp::CLOSED), localPort(0), remoteHost(),
+      Alarm(), currentState(Tcp::CLOSED), localPort(0), remoteHost(),
       iss(0), snd_nxt(0), snd_una(0), snd_wnd(0), snd_up(0), snd_wl1(0), snd_wl2(0),
-      rcv_nxt(0), rcv_wnd(0), rcv_up(0), irs(0),
+      snd_end(0),
+      rcv_nxt(0), rcv_wnd(0), rcv_up(0), irs(0), rcv_adv(0),
       seg_seq(0), seg_ack(0), seg_len(0), seg_wnd(0), seg_up(0), seg_prc(0),
       fin_ack(false), fin_seq(0),
+      snd_mss(TCP_DEFAULT_MSS), cwnd(TCP_DEFAULT_MSS), ssthresh(~0U), recover(0), rexmit_nxt(0),
+      dupAcks(0), recovery(NotRecovering),
+      srtt(0), rttvar(0), rto(TCP_RTO_INITIAL), rttTiming(false), rttSeq(0), rttStart(0),
+      nagle(true), nDelayedSegments(0), delayedAck(this),
+      sackOk(true), tsOk(true), wscaleOk(true), snd_wscale(0), rcv_wscale(0), ts_recent(0),
+      reassemblyQueue(0), sackRecent(0), rcvSpaceBytes(0), rcvSpaceStart(0),
       numEndpointPackets(0), /// \todo Remove, obsolete
-      waitState(0), endpoint(0), connId(0),
-      retransmitQueue(), nRemovedFromRetransmit(0),
-      waitingForTimeout(false), didTimeout(false), timeoutWait(0), useWaitSem(true),
-      m_Nanoseconds(0), m_Seconds(0), m_Timeout(10)
+      waitState(0), sendWaiting(false), sendSpaceWait(0),
+      endpoint(0), connId(0), lock(false), refCount(1), hashNext(0), idHashNext(0),
+      sendQueue(), retransmitQueue(), nRemovedFromRetransmit(0),
+      timerDeadline(0), waitingForTimeout(false), didTimeout(false), timeoutWait(0), useWaitSem(true)
     {
-      Timer* t = Machine::instance().getTimer();
-      if(t)
-        t->registerHandler(this);
-    };
-    ~StateBlock()
-    {
-      Timer* t = Machine::instance().getTimer();
-      if(t)
-        t->unregisterHandler(this);
     };
+    ~StateBlock();
 
     Tcp::TcpState currentState;
 
@@ -91,12 +174,14 @@ class StateBlock : public TimerHandler
     uint32_t snd_up; // urgent pointer?
     uint32_t snd_wl1; // segment sequence number for last WND update
     uint32_t snd_wl2; // segment ack number for last WND update
+    uint32_t snd_end; // sequence number after the last byte queued to send
 
     // Receive sequence variables
     uint32_t rcv_nxt; // receive next - what we're expecting perhaps?
     uint32_t rcv_wnd; // receive window ----> How much we want to receive methinks...
     uint32_t rcv_up; // receive urgent pointer
     uint32_t irs; // initial receiver sequence number (SERVER)
+    uint32_t rcv_adv; // window we last advertised, in bytes
 
     // Segment variables
     uint32_t seg_seq; // segment sequence number
@@ -110,6 +195,47 @@ class StateBlock : public TimerHandler
     bool     fin_ack; // is ACK already set (for use with FIN bit checks)
     uint32_t fin_seq; // last FIN we sent had this sequence number
 
+    // Congestion control (RFC 5681, with NewReno recovery from RFC 6582)
+    uint32_t snd_mss; // largest segment the remote end takes
+    uint32_t cwnd; // congestion window
+    uint32_t ssthresh; // slow start threshold
+    uint32_t recover; // snd_nxt when loss recovery began
+    uint32_t rexmit_nxt; // next sequence number to resend after a timeout
+    size_t   dupAcks; // duplicate ACKs in a row
+    Recovery recovery;
+
+    // Round trip time estimation (RFC 6298), all in microseconds
+    uint32_t srtt; // smoothed RTT, zero until the first sample
+    uint32_t rttvar; // RTT variation
+    uint32_t rto; // retransmission timeout
+    bool     rttTiming; // is a segment being timed?
+    uint32_t rttSeq; // ...if so, the ACK that ends the measurement
+    uint64_t rttStart; // ...and the time it was sent
+
+    // Hold back small segments while data is unacknowledged (RFC 896)?
+    bool nagle;
+
+    // In-order segments received that we haven't yet ACKed
+    size_t nDelayedSegments;
+    DelayedAck delayedAck;
+
+    // Options agreed on the handshake (RFC 2018, RFC 7323), or before
+    // then, the ones we offer
+    bool     sackOk; // selective acknowledgements
+    bool     tsOk; // timestamps
+    bool     wscaleOk; // window scaling
+    uint8_t  snd_wscale; // shift for the windows the remote end advertises
+    uint8_t  rcv_wscale; // shift for the windows we advertise
+    uint32_t ts_recent; // timestamp to echo back
+
+    // Segments received ahead of rcv_nxt, in sequence order, not overlapping
+    Segment* reassemblyQueue;
+    uint32_t sackRecent; // start of the segment most recently queued
+
+    // Receive buffer tuning: bytes taken since rcvSpaceStart
+    size_t   rcvSpaceBytes;
+    uint64_t rcvSpaceStart;
+
     // Number of packets we've deposited into our Endpoint
     // (decremented when a packet is picked up by the receiver)
     uint32_t numEndpointPackets;
@@ -117,13 +243,44 @@ class StateBlock : public TimerHandler
     // Waiting for something?
     Semaphore waitState;
 
+    // A send is waiting for room in the send buffer, on sendSpaceWait
+    bool sendWaiting;
+    Semaphore sendSpaceWait;
+
     // The endpoint applications use for this TCP connection
     TcpEndpoint* endpoint;
 
     // the id of this specific connection
     size_t connId;
 
-    // Retransmission queue
+    // Held by whoever is working on the connection: the receive path, a
+    // send or close from the application, or one of the timers.
+    Mutex lock;
+
+    // References held on the block: one by TcpConnectionTable while it's in
+    // there, and one by each lookup still using it. The last one out
+    // deletes it.
+    Atomic<size_t> refCount;
+
+    void ref()
+    {
+      refCount += 1;
+    }
+
+    void unref()
+    {
+      if((refCount -= 1) == 0)
+        delete this;
+    }
+
+    // Next in the TcpConnectionTable chains
+    StateBlock* hashNext;
+    StateBlock* idHashNext;
+
+    // Segments queued but not yet sent, waiting for room in the windows
+    List<void*> sendQueue;
+
+    // Retransmission queue: segments sent but not yet acked
     //TcpBuffer retransmitQueue;
     List<void*> retransmitQueue;
 
@@ -132,178 +289,114 @@ class StateBlock : public TimerHandler
 
     /// Handles a segment ack
     /// \note This will remove acked segments, however if there is only a partial ack on a segment
-    ///       it will split it into two, remove the first, and leave a partial segment on the queue.
+    ///       it will trim the acked bytes off the front of it and leave the rest on the queue.
     ///       This behaviour does not affect anything internally as long as this function is always
     ///       used to acknowledge segments.
-    void ackSegment()
-    {
-      // we assume the seg_* variables have been set by the caller (always done in TcpManager::receive)
-      uint32_t segAck = seg_ack;
-      while(retransmitQueue.count())
-      {
-        // grab the first segment from the queue
-        Segment* seg = reinterpret_cast<Segment*>(retransmitQueue.popFront());
-        if((seg->seg_seq + seg->seg_len) <= segAck)
-        {
-          // this segment is acked, leave it off the queue and free the memory used
-          if(seg->payload)
-            delete [] (reinterpret_cast<uint8_t*>(seg->payload));
-
-          delete seg;
-          continue;
-        }
-        else
-        {
-          // check if the ack is within this segment
-          if(segAck >= seg->seg_seq)
-          {
-            // it is, so we need to split the segment payload
-            Segment* splitSeg = new Segment;
-            *splitSeg = *seg;
-
-            // how many bytes are acked?
-            /// \bug This calculation *may* have an off-by-one error
-            size_t nBytesAcked = segAck - seg->seg_seq;
-
-            // update the sequence number
-            splitSeg->seg_seq = seg->seg_seq + nBytesAcked;
-            splitSeg->seg_len -= nBytesAcked;
-
-            // and most importantly, recopy the payload
-            if(seg->nBytes && seg->payload)
-            {
-              uint8_t* newPayload = new uint8_t[splitSeg->seg_len];
-              memcpy(newPayload, reinterpret_cast<void*>(seg->payload), seg->nBytes);
-
-              splitSeg->payload = reinterpret_cast<uintptr_t>(newPayload);
-            }
-
-            // push on the front, and don't continue (we know there's no potential for further ACKs)
-            retransmitQueue.pushFront(reinterpret_cast<void*>(splitSeg));
-            if(seg->payload)
-              delete [] (reinterpret_cast<uint8_t*>(seg->payload));
-            delete seg;
-            return;
-          }
-        }
-      }
-    }
+    void ackSegment();
 
     /// Sends a segment over the network
-    bool sendSegment(Segment* seg)
+    bool sendSegment(Segment* seg);
+
+    /// Queues data (or a FIN) to be sent, split into segments of at most
+    /// snd_mss bytes, and sends as much as the windows allow.
+    /// A SYN or FIN takes up a sequence number of its own.
+    /// \return The number of bytes of payload queued, which is less than
+    ///         nBytes if we ran out of memory.
+    size_t sendSegment(uint8_t flags, size_t nBytes, uintptr_t payload, bool addToRetransmitQueue);
+
+    /// Sends queued segments while the send and congestion windows have
+    /// room for them.
+    /// \param bForce Send the first segment regardless (a window probe).
+    void sendQueued(bool bForce = false);
+
+    /// Congestion control and RTT measurement for an acceptable ACK (the
+    /// seg_* variables hold the segment). Updates snd_una.
+    /// \param bDuplicate The segment could be a duplicate ACK: it carries
+    ///        no data, SYN or FIN and doesn't change the window.
+    /// \param options The segment's options, for timestamps and SACK.
+    void ackReceived(bool bDuplicate, const Tcp::SegmentOptions &options);
+
+    /// Hands in-order data to the endpoint and moves rcv_nxt past what it
+    /// took (which is less than nBytes if the buffer is full).
+    size_t deposit(uintptr_t payload, size_t nBytes, bool push);
+
+    /// Keeps a segment that arrived ahead of rcv_nxt until the gap before
+    /// it is filled. Anything already queued is trimmed off it.
+    void queueOutOfOrder(uint32_t seq, uintptr_t payload, size_t nBytes, uint8_t flags);
+
+    /// Deposits queued segments that rcv_nxt has caught up with.
+    /// \return True if this reached a FIN (rcv_nxt is then at the FIN).
+    bool drainReassemblyQueue();
+
+    /// Called for each in-order data segment received: ACKs every second
+    /// one, and holds back the ACK for the others for TCP_DELAYED_ACK.
+    void delayAck();
+
+    /// Sends an ACK now, dropping any that was being held back.
+    bool sendAck();
+
+    /// Agrees options with those on the remote end's SYN, and sets the
+    /// MSS and the initial congestion window to go with them.
+    void setOptions(const Tcp::SegmentOptions &options);
+
+    /// Options to put on our SYN or SYN/ACK.
+    void synOptions(Tcp::SegmentOptions &options);
+
+    /// Options to put on any other segment.
+    /// \param bSack Include SACK blocks (there's no room on a full segment).
+    void segmentOptions(Tcp::SegmentOptions &options, bool bSack);
+
+    /// Free space in the endpoint's receive buffer.
+    size_t receiveSpace();
+
+    /// Room left in the send buffer: TCP_SEND_BUFFER less what's queued
+    /// or in flight.
+    size_t sendSpace()
     {
-      if(seg)
-      {
-        return Tcp::send(remoteHost.ip, localPort, remoteHost.remotePort, seg->seg_seq, rcv_nxt, seg->flags, seg->seg_wnd, seg->nBytes, seg->payload);
-      }
-      return false;
+      uint32_t queued = snd_end - snd_una;
+      return (queued < TCP_SEND_BUFFER) ? TCP_SEND_BUFFER - queued : 0;
     }
 
-    /// Sends a segment over the network
-    bool sendSegment(uint8_t flags, size_t nBytes, uintptr_t payload, bool addToRetransmitQueue)
-    {
-      // split the passed buffer up into 1024 byte segments and send each
-      size_t offset;
-      for(offset = 0; offset < (nBytes == 0 ? 1 : nBytes); offset += 1024)
-      {
-        Segment* seg = new Segment;
-
-        size_t segmentSize = 1024;
-        if((offset + 1024) >= nBytes)
-          segmentSize = nBytes - offset;
-
-        seg_seq = snd_nxt;
-        snd_nxt += segmentSize;
+    /// The window to advertise, scaled unless it's for a SYN.
+    uint16_t receiveWindow(bool bSyn = false);
 
-        seg->seg_seq = seg_seq;
-        seg->seg_ack = rcv_nxt;
-        seg->seg_len = segmentSize;
-        seg->seg_wnd = snd_wnd;
-        seg->seg_up = 0;
-        seg->flags = flags;
-
-        if(nBytes && payload)
-        {
-          uint8_t* newPayload = new uint8_t[segmentSize];
-          memcpy(newPayload, reinterpret_cast<void*>(payload + offset), segmentSize);
+    /// Called once the application has read data: tells the remote end
+    /// the window has opened, if it has opened far enough to be worth it.
+    void windowUpdate();
 
-          seg->payload = reinterpret_cast<uintptr_t>(newPayload);
-        }
-        else
-          seg->payload = 0;
-        seg->nBytes = seg->seg_len;
+    // timer for all retransmissions (and state changes such as TIME_WAIT)
+    virtual void fire();
 
-        sendSegment(seg);
+    // resets the timer (to restart a timeout)
+    void resetTimer(uint32_t timeout = 10)
+    {
+      didTimeout = false;
 
-        if(addToRetransmitQueue)
-          retransmitQueue.pushBack(reinterpret_cast<void*>(seg));
-        else
-          delete seg;
+      Timer* t = Machine::instance().getTimer();
+      if(t)
+      {
+        timerDeadline = t->getTickCount() + static_cast<uint64_t>(timeout) * 1000000;
+        t->addAlarm(this, timeout);
       }
-
-      return true;
     }
 
-    // timer for all retransmissions (and state changes such as TIME_WAIT)
-    virtual void timer(uint64_t delta, InterruptState& state)
+    // (re)starts the retransmission timer with the current RTO
+    void resetRetransmitTimer()
     {
-      if(!waitingForTimeout)
-        return;
+      didTimeout = false;
+      waitingForTimeout = true;
 
-      if(UNLIKELY(m_Seconds < m_Timeout))
+      Timer* t = Machine::instance().getTimer();
+      if(t)
       {
-        m_Nanoseconds += delta;
-        if(UNLIKELY(m_Nanoseconds >= 1000000000ULL))
-        {
-          ++m_Seconds;
-          m_Nanoseconds -= 1000000000ULL;
-        }
-
-        if(UNLIKELY(m_Seconds >= m_Timeout))
-        {
-          // timeout is hit!
-          waitingForTimeout = false;
-          didTimeout = true;
-          if(useWaitSem)
-            timeoutWait.release();
-
-          // check to see if there's data on the retransmission queue to send
-          if(retransmitQueue.count())
-          {
-            NOTICE("Remote TCP did not ack all the data!");
-
-            // still more data unacked - grab the first segment and transmit it
-            // note that we don't pop it off the queue permanently, as we are still
-            // waiting for an ack for the segment
-            Segment* seg = reinterpret_cast<Segment*>(retransmitQueue.popFront());
-            sendSegment(seg);
-            retransmitQueue.pushFront(reinterpret_cast<void*>(seg));
-
-            // reset the timeout
-            resetTimer();
-          }
-          else if(currentState == Tcp::TIME_WAIT)
-          {
-            // timer has fired, we need to close the connection
-            NOTICE("TIME_WAIT timeout complete");
-            currentState = Tcp::CLOSED;
-
-            // create the cleanup thread
-            new Thread(Processor::information().getCurrentThread()->getParent(),
-              reinterpret_cast<Thread::ThreadStartFunc> (&stateBlockFree),
-              reinterpret_cast<void*> (this));
-          }
-        }
+        timerDeadline = t->getTickCount() + rto;
+        t->addAlarm(this, rto / 1000000, rto % 1000000);
       }
     }
 
-    // resets the timer (to restart a timeout)
-    void resetTimer(uint32_t timeout = 10)
-    {
-      m_Seconds = m_Nanoseconds = 0;
-      m_Timeout = timeout;
-      didTimeout = false;
-    }
+    // when the timer is next due (fire() may be early if it had to retry
+    // for the lock in the meantime)
+    uint64_t timerDeadline;
 
     // are we waiting on a timeout?
     bool waitingForTimeout;
@@ -320,22 +413,58 @@ class StateBlock : public TimerHandler
 
   private:
 
-    // number of nanoseconds & seconds for the timer
-    uint64_t m_Nanoseconds;
-    uint64_t m_Seconds;
-    uint32_t m_Timeout;
+    /// The timer has expired: retransmit, probe the window or finish
+    /// TIME_WAIT. Called with the lock held.
+    void timeout();
+
+    /// Sends a queued segment for the first time.
+    void transmit(Segment *seg);
+
+    /// Resends the oldest unacknowledged segment.
+    void retransmitFirst();
+
+    /// After a timeout: resends unacknowledged segments from rexmit_nxt on,
+    /// as many as the congestion window allows.
+    void retransmitLost();
+
+    /// Feeds a round trip time sample into the RTO estimate.
+    void rttSample(uint32_t rtt);
+
+    /// Marks segments on the retransmit queue that the remote end has
+    /// selectively acknowledged.
+    void markSacked(const Tcp::SegmentOptions &options);
+
+    /// Grows the receive buffer if the sender fills most of it within a
+    /// round trip (dynamic right-sizing).
+    void tuneReceiveBuffer(size_t nBytes);
+
+    /// Our timestamp clock, in milliseconds.
+    uint32_t timestamp();
+
+    /// Bytes sent but not yet acknowledged.
+    uint32_t flightSize()
+    {
+      return snd_nxt - snd_una;
+    }
 
     StateBlock(const StateBlock& s) :
-      currentState(Tcp::CLOSED), localPort(0), remoteHost(),
+      Alarm(), currentState(Tcp::CLOSED), localPort(0), remoteHost(),
       iss(0), snd_nxt(0), snd_una(0), snd_wnd(0), snd_up(0), snd_wl1(0), snd_wl2(0),
-      rcv_nxt(0), rcv_wnd(0), rcv_up(0), irs(0),
+      snd_end(0),
+      rcv_nxt(0), rcv_wnd(0), rcv_up(0), irs(0), rcv_adv(0),
       seg_seq(0), seg_ack(0), seg_len(0), seg_wnd(0), seg_up(0), seg_prc(0),
       fin_ack(false), fin_seq(0),
+      snd_mss(TCP_DEFAULT_MSS), cwnd(TCP_DEFAULT_MSS), ssthresh(~0U), recover(0), rexmit_nxt(0),
+      dupAcks(0), recovery(NotRecovering),
+      srtt(0), rttvar(0), rto(TCP_RTO_INITIAL), rttTiming(false), rttSeq(0), rttStart(0),
+      nagle(true), nDelayedSegments(0), delayedAck(this),
+      sackOk(true), tsOk(true), wscaleOk(true), snd_wscale(0), rcv_wscale(0), ts_recent(0),
+      reassemblyQueue(0), sackRecent(0), rcvSpaceBytes(0), rcvSpaceStart(0),
       numEndpointPackets(0), /// \todo Remove, obsolete
-      waitState(0), endpoint(0), connId(0),
-      retransmitQueue(), nRemovedFromRetransmit(0),
-      waitingForTimeout(false), didTimeout(false), timeoutWait(0), useWaitSem(true),
-      m_Nanoseconds(0), m_Seconds(0), m_Timeout(10)
+      waitState(0), sendWaiting(false), sendSpaceWait(0),
+      endpoint(0), connId(0), lock(false), refCount(1), hashNext(0), idHashNext(0),
+      sendQueue(), retransmitQueue(), nRemovedFromRetransmit(0),
+      timerDeadline(0), waitingForTimeout(false), didTimeout(false), timeoutWait(0), useWaitSem(true)
     {
       // same as TcpEndpoint - the copy constructor should not be called
       ERROR("Tcp: StateBlock copy constructor called");
@@ -348,4 +477,25 @@ class StateBlock : public TimerHandler
     }
 };
 
+/// Drops a reference on a StateBlock when it goes out of scope, in the same
+/// way LockGuard releases a lock. Declare it before any LockGuard on the
+/// block's lock, so that the lock is released first.
+class StateBlockRef
+{
+  public:
+    StateBlockRef(StateBlock* stateBlock) : m_StateBlock(stateBlock)
+    {}
+    ~StateBlockRef()
+    {
+      if(m_StateBlock)
+        m_StateBlock->unref();
+    }
+
+  private:
+    StateBlockRef(const StateBlockRef&);
+    StateBlockRef& operator = (const StateBlockRef&);
+
+    StateBlock* m_StateBlock;
+};
+
 #endif
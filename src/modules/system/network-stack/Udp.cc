@@ -125,8 +125,9 @@ bool Udp::send(IpAddress dest, uint16_t srcPort, uint16_t destPort, size_t nByte
   if(nBytes)
     memcpy(reinterpret_cast<void*>(packet + sizeof(udpHeader)), reinterpret_cast<void*>(payload), nBytes);
 
-  // Calculate the checksum
-  header->checksum = pIp->ipChecksum(src, dest, IP_UDP, reinterpret_cast<uintptr_t>(header), sizeof(udpHeader) + nBytes);
+  // Calculate the checksum, unless the card is going to
+  if(!(pCard->getChecksumOffload() & Network::TxL4Checksum))
+    header->checksum = pIp->ipChecksum(src, dest, IP_UDP, reinterpret_cast<uintptr_t>(header), sizeof(udpHeader) + nBytes);
 
   // Transmit
   bool success = pIp->send(dest, src, IP_UDP, nBytes + sizeof(udpHeader), packet, pCard);
@@ -168,8 +169,8 @@ void Udp::receive(IpAddress from, IpAddress to, uintptr_t packet, size_t nBytes,
     uintptr_t payload = reinterpret_cast<uintptr_t>(header) + sizeof(udpHeader);
     size_t payloadSize = BIG_TO_HOST16(header->len) - sizeof(udpHeader);
 
-    // Check the checksum, if it's not zero
-    if(header->checksum != 0)
+    // Check the checksum, if it's not zero and the card hasn't already
+    if(header->checksum != 0 && !(pCard->getChecksumOffload() & Network::RxL4Checksum))
     {
         uint16_t checksum = pIp->ipChecksum(from, to, IP_UDP, reinterpret_cast<uintptr_t>(header), BIG_TO_HOST16(header->len));
         if(checksum)
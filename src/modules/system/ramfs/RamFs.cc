@@ -31,7 +31,7 @@ bool RamDir::addEntry(String filename, File *pFile, size_t type)
     // This'll get destroyed in the first write
     uint8_t *newFile = new uint8_t;
     pFile->setInode(reinterpret_cast<uintptr_t>(newFile));
-    m_Cache.insert(filename, pFile);
+    addToCache(filename, pFile);
     m_bCachePopulated = true;
     return true;
 }
@@ -41,7 +41,7 @@ bool RamDir::removeEntry(File *pFile)
     uint8_t *buff = reinterpret_cast<uint8_t*>(pFile->getInode());
     if (buff)
         delete [] buff;
-    m_Cache.remove(pFile->getName());
+    removeFromCache(pFile->getName());
     return true;
 }
 
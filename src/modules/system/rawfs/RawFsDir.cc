@@ -31,12 +31,12 @@ RawFsDir::RawFsDir(String name, RawFs *pFs, File *pParent) :
 
 void RawFsDir::addEntry(File *pEntry)
 {
-    m_Cache.insert(pEntry->getName(), pEntry);
+    addToCache(pEntry->getName(), pEntry);
 }
 
 void RawFsDir::removeRecursive()
 {
     /// \todo Leaky.
     NOTICE("rawfs: removing '" << getName() << "'");
-    m_Cache.clear();
+    clearCache();
 }
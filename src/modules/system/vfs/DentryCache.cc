@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "DentryCache.h"
+#include "Directory.h"
+#include <utilities/utility.h>
+
+DentryCache DentryCache::m_Instance;
+
+DentryCache::DentryCache() :
+    m_pLruHead(0), m_pLruTail(0), m_nEntries(0), m_Generation(0), m_Lock()
+{
+    for (size_t i = 0; i < DENTRY_CACHE_BUCKETS; i++)
+        m_pBuckets[i] = 0;
+}
+
+DentryCache::~DentryCache()
+{
+    while (m_pLruHead)
+    {
+        Entry *pEntry = m_pLruHead;
+        unlink(pEntry);
+        delete pEntry;
+    }
+}
+
+bool DentryCache::lookup(File *pStartNode, const String &path, File *&pFile)
+{
+    uint32_t h = hash(pStartNode, path);
+    Entry *pStale = 0;
+    bool bHit = false;
+
+    m_Lock.acquire();
+
+    for (Entry *pEntry = m_pBuckets[h % DENTRY_CACHE_BUCKETS]; pEntry; pEntry = pEntry->pHashNext)
+    {
+        if (pEntry->hash != h || pEntry->pStartNode != pStartNode ||
+            strcmp(pEntry->path, path))
+            continue;
+
+        if (isStale(pEntry))
+        {
+            unlink(pEntry);
+            pStale = pEntry;
+            break;
+        }
+
+        // Move to the head of the LRU list.
+        if (pEntry != m_pLruHead)
+        {
+            pEntry->pLruPrev->pLruNext = pEntry->pLruNext;
+            if (pEntry->pLruNext)
+                pEntry->pLruNext->pLruPrev = pEntry->pLruPrev;
+            else
+                m_pLruTail = pEntry->pLruPrev;
+
+            pEntry->pLruPrev = 0;
+            pEntry->pLruNext = m_pLruHead;
+            m_pLruHead->pLruPrev = pEntry;
+            m_pLruHead = pEntry;
+        }
+
+        pFile = pEntry->pFile;
+        bHit = true;
+        break;
+    }
+
+    m_Lock.release();
+
+    delete pStale;
+    return bHit;
+}
+
+void DentryCache::insert(File *pStartNode, const String &path, File *pFile, size_t generation,
+                         const Source &source)
+{
+    // Build the entry before taking the lock, the path copy may allocate.
+    Entry *pNew = new Entry;
+    pNew->pStartNode = pStartNode;
+    pNew->path = path;
+    pNew->hash = hash(pStartNode, path);
+    pNew->pFile = pFile;
+    pNew->generation = generation;
+    pNew->source = source;
+
+    Entry *pOld = 0;
+
+    m_Lock.acquire();
+
+    if (isStale(pNew))
+    {
+        m_Lock.release();
+        delete pNew;
+        return;
+    }
+
+    // Replace any existing entry for the same path.
+    Entry **ppBucket = &m_pBuckets[pNew->hash % DENTRY_CACHE_BUCKETS];
+    for (Entry *pEntry = *ppBucket; pEntry; pEntry = pEntry->pHashNext)
+    {
+        if (pEntry->hash == pNew->hash && pEntry->pStartNode == pStartNode &&
+            !strcmp(pEntry->path, path))
+        {
+            unlink(pEntry);
+            pOld = pEntry;
+            break;
+        }
+    }
+
+    // Make room by evicting the least recently used entry.
+    if (!pOld && m_nEntries >= DENTRY_CACHE_SIZE)
+    {
+        pOld = m_pLruTail;
+        unlink(pOld);
+    }
+
+    pNew->pHashNext = *ppBucket;
+    *ppBucket = pNew;
+
+    pNew->pLruNext = m_pLruHead;
+    if (m_pLruHead)
+        m_pLruHead->pLruPrev = pNew;
+    else
+        m_pLruTail = pNew;
+    m_pLruHead = pNew;
+
+    m_nEntries++;
+
+    m_Lock.release();
+
+    delete pOld;
+}
+
+void DentryCache::invalidate()
+{
+    m_Lock.acquire();
+    m_Generation++;
+    m_Lock.release();
+}
+
+bool DentryCache::isStale(Entry *pEntry)
+{
+    // The global generation goes first: if a directory has been removed
+    // since, pEntry->source.pDirectory may no longer exist.
+    if (pEntry->generation != m_Generation)
+        return true;
+
+    Directory *pDir = pEntry->source.pDirectory;
+    return pDir && pDir->generation() != pEntry->source.generation;
+}
+
+uint32_t DentryCache::hash(File *pStartNode, const String &path)
+{
+    // djb2, seeded with the start node.
+    uint32_t h = 5381 ^ static_cast<uint32_t>(reinterpret_cast<uintptr_t>(pStartNode) >> 4);
+    for (const char *p = path; *p; p++)
+        h = ((h << 5) + h) + static_cast<uint8_t>(*p);
+    return h;
+}
+
+void DentryCache::unlink(Entry *pEntry)
+{
+    Entry **ppEntry = &m_pBuckets[pEntry->hash % DENTRY_CACHE_BUCKETS];
+    while (*ppEntry != pEntry)
+        ppEntry = &(*ppEntry)->pHashNext;
+    *ppEntry = pEntry->pHashNext;
+
+    if (pEntry->pLruPrev)
+        pEntry->pLruPrev->pLruNext = pEntry->pLruNext;
+    else
+        m_pLruHead = pEntry->pLruNext;
+    if (pEntry->pLruNext)
+        pEntry->pLruNext->pLruPrev = pEntry->pLruPrev;
+    else
+        m_pLruTail = pEntry->pLruPrev;
+
+    pEntry->pHashNext = pEntry->pLruPrev = pEntry->pLruNext = 0;
+    m_nEntries--;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef DENTRY_CACHE_H
+#define DENTRY_CACHE_H
+
+#include <processor/types.h>
+#include <utilities/String.h>
+#include <Spinlock.h>
+
+class File;
+class Directory;
+
+/// Number of hash chains in the cache.
+#define DENTRY_CACHE_BUCKETS    1024
+/// Most entries the cache holds before it starts throwing away the least
+/// recently used.
+#define DENTRY_CACHE_SIZE       4096
+
+/** Caches the result of resolving a path from a starting node, whether it
+ *  found a File or found nothing (a negative entry), so that repeated
+ *  lookups of the same path don't have to walk it a component at a time.
+ *
+ *  Each entry remembers the last directory the lookup searched, and that
+ *  directory's generation: creating, removing or renaming a file there
+ *  bumps it, which makes the entry stale. Nothing else a path goes through
+ *  can change its result without removing a directory or symlink on the
+ *  way, and that (or a filesystem going away) invalidates every entry with
+ *  a global generation count instead. Either way it costs nothing up front;
+ *  stale entries are dropped when they are next looked at, or age out of
+ *  the LRU list. */
+class DentryCache
+{
+public:
+    DentryCache();
+    ~DentryCache();
+
+    /** Returns the singleton DentryCache instance. */
+    static DentryCache &instance()
+    {return m_Instance;}
+
+    /** What a lookup's result depends on: the last directory it searched,
+        and that directory's generation before it was searched. */
+    struct Source
+    {
+        Source() : pDirectory(0), generation(0)
+        {}
+
+        Directory *pDirectory;
+        size_t generation;
+    };
+
+    /** Looks up a path.
+        \param[out] pFile The cached result; zero for a negative entry.
+        \return True on a hit. */
+    bool lookup(File *pStartNode, const String &path, File *&pFile);
+
+    /** Caches the result of resolving path from pStartNode, which may be zero.
+        \param generation The value of generation() from before the path was
+                          resolved; if the namespace changed since, the result
+                          may be stale and isn't cached.
+        \param source The directory the result came from. */
+    void insert(File *pStartNode, const String &path, File *pFile, size_t generation,
+                const Source &source);
+
+    /** Invalidates every entry. Called when a directory or symlink is
+        removed, or a filesystem goes away. */
+    void invalidate();
+
+    /** Returns the current generation, to pass to insert(). */
+    size_t generation()
+    {return m_Generation;}
+
+private:
+    /** Private copy constructor
+        \note NOT implemented. */
+    DentryCache(const DentryCache &);
+    /** Private operator=
+        \note NOT implemented. */
+    DentryCache &operator = (const DentryCache &);
+
+    struct Entry
+    {
+        Entry() : pStartNode(0), path(), hash(0), pFile(0), generation(0),
+                  source(), pHashNext(0), pLruPrev(0), pLruNext(0)
+        {}
+
+        File *pStartNode;
+        String path;
+        uint32_t hash;
+        File *pFile;
+        size_t generation;
+        Source source;
+
+        /** Next entry in the same hash chain. */
+        Entry *pHashNext;
+        /** Neighbours in the LRU list; the head is the most recently used. */
+        Entry *pLruPrev;
+        Entry *pLruNext;
+    };
+
+    /** Has pEntry been invalidated?
+        \note m_Lock must be held. */
+    bool isStale(Entry *pEntry);
+
+    /** Hashes a (start node, path) pair. */
+    static uint32_t hash(File *pStartNode, const String &path);
+
+    /** Unlinks pEntry from its hash chain and the LRU list.
+        \note m_Lock must be held. */
+    void unlink(Entry *pEntry);
+
+    static DentryCache m_Instance;
+
+    Entry *m_pBuckets[DENTRY_CACHE_BUCKETS];
+    Entry *m_pLruHead;
+    Entry *m_pLruTail;
+    size_t m_nEntries;
+    /** Bumped by invalidate(); entries from an older generation are stale. */
+    volatile size_t m_Generation;
+    Spinlock m_Lock;
+};
+
+#endif
@@ -16,16 +16,17 @@
 
 #include "Directory.h"
 #include "Filesystem.h"
+#include "DentryCache.h"
 
 Directory::Directory() :
-    File(), m_Cache(), m_bCachePopulated(false)
+    File(), m_Cache(), m_bCachePopulated(false), m_nGeneration(0)
 {
 }
 
 Directory::Directory(String name, Time accessedTime, Time modifiedTime, Time creationTime,
                      uintptr_t inode, Filesystem *pFs, size_t size, File *pParent) :
     File(name,accessedTime,modifiedTime,creationTime,inode,pFs,size,pParent),
-    m_Cache(), m_bCachePopulated(false)
+    m_Cache(), m_bCachePopulated(false), m_nGeneration(0)
 {
 }
 
@@ -34,6 +35,12 @@ Directory::~Directory()
 }
 
 File* Directory::getChild(size_t n)
+{
+    DirectoryCursor cursor;
+    return getChild(n, cursor);
+}
+
+File* Directory::getChild(size_t n, DirectoryCursor &cursor)
 {
     if (!m_bCachePopulated)
     {
@@ -41,20 +48,63 @@ File* Directory::getChild(size_t n)
         m_bCachePopulated = true;
     }
 
-    unsigned int i = 0;
-    for (RadixTree<File*>::Iterator it = m_Cache.begin();
-         it != m_Cache.end();
-         it++)
+    // Start again from the beginning unless the cursor is exactly where we
+    // want it and the directory hasn't changed underneath it.
+    if (cursor.pDirectory != this || cursor.generation != m_nGeneration ||
+        cursor.index != n)
     {
-        if (i == n)
-            return *it;
-        i++;
+        cursor.pDirectory = this;
+        cursor.generation = m_nGeneration;
+        cursor.index = 0;
+        cursor.it = m_Cache.begin();
+        while (cursor.index < n && cursor.it != m_Cache.end())
+        {
+            cursor.it++;
+            cursor.index++;
+        }
     }
 
-    // Not found.
-    return 0;
+    if (cursor.it == m_Cache.end())
+        return 0;
+
+    File *pFile = *cursor.it;
+    cursor.it++;
+    cursor.index++;
+    return pFile;
 }
 
 void Directory::cacheDirectoryContents()
 {
 }
+
+void Directory::addToCache(const String &name, File *pFile)
+{
+    // Only lookups that ended here can have been affected.
+    m_Cache.insert(name, pFile);
+    m_nGeneration++;
+}
+
+void Directory::populateCache(const String &name, File *pFile)
+{
+    m_Cache.insert(name, pFile);
+}
+
+void Directory::removeFromCache(const String &name)
+{
+    // Lookups may have gone through a directory or symlink on their way
+    // somewhere else, which only a global invalidation catches.
+    File *pFile = m_Cache.lookup(name);
+    bool bGlobal = pFile && (pFile->isDirectory() || pFile->isSymlink());
+
+    m_Cache.remove(name);
+    m_nGeneration++;
+    if (bGlobal)
+        DentryCache::instance().invalidate();
+}
+
+void Directory::clearCache()
+{
+    m_Cache.clear();
+    m_nGeneration++;
+    DentryCache::instance().invalidate();
+}
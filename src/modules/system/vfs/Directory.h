@@ -22,6 +22,26 @@
 #include <utilities/RadixTree.h>
 #include "File.h"
 
+class Directory;
+
+/** Where a reader has got to in a directory listing, so that the next
+ *  getChild() carries on from there instead of counting from the start.
+ *  Lives with whoever is iterating (e.g. a file descriptor). */
+struct DirectoryCursor
+{
+    DirectoryCursor() : pDirectory(0), index(0), generation(0), it()
+    {}
+
+    /** The directory this cursor was last used on. */
+    Directory *pDirectory;
+    /** The index of the child 'it' points at. */
+    size_t index;
+    /** The directory's generation when the cursor was last moved; if the
+        contents have changed since, the cursor is rebuilt. */
+    size_t generation;
+    RadixTree<File*>::Iterator it;
+};
+
 /** A Directory node. */
 class Directory : public File
 {
@@ -58,13 +78,42 @@ public:
     /** Returns the n'th child of this directory, or an invalid file. */
     File* getChild(size_t n);
 
+    /** Returns the n'th child of this directory, or an invalid file. If
+        cursor was left at n by the previous call, this is O(1), so reading
+        a directory in order is linear rather than quadratic. */
+    File* getChild(size_t n, DirectoryCursor &cursor);
+
     /** Load the directory's contents into the cache. */
     virtual void cacheDirectoryContents();
 
+    /** Adds a child to the contents cache. Filesystems must use this (and
+        removeFromCache) rather than change m_Cache directly, so that readdir
+        cursors and cached path lookups know the contents have changed. */
+    void addToCache(const String &name, File *pFile);
+
+    /** Adds a child that was already there to the contents cache: for
+        cacheDirectoryContents() to use as it reads the directory in. The
+        contents haven't changed, so nothing is invalidated. */
+    void populateCache(const String &name, File *pFile);
+
+    /** Removes a child from the contents cache. */
+    void removeFromCache(const String &name);
+
+    /** Empties the contents cache. */
+    void clearCache();
+
+    /** Bumped every time a child is added or removed. */
+    size_t generation() const
+    {return m_nGeneration;}
+
 public:
     /** Directory contents cache. */
     RadixTree<File*> m_Cache;
     bool m_bCachePopulated;
+
+private:
+    /** Bumped every time m_Cache changes. */
+    size_t m_nGeneration;
 };
 
 #endif
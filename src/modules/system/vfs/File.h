@@ -73,6 +73,15 @@ public:
      */
     physical_uintptr_t getPhysicalPage(size_t offset);
 
+    /** Returns the block on disk that block \p nBlock of the file (counted
+     *  in getBlockSize() units) is stored in, as for FIBMAP.
+     *  \return Zero if it's a hole, or the filesystem can't say. */
+    virtual uint64_t getDiskBlock(uint64_t nBlock)
+    {return 0;}
+    /** Returns the size of the blocks getDiskBlock counts in, as for FIGETBSZ. */
+    size_t getDiskBlockSize() const
+    {return getBlockSize();}
+
     /** Returns the time the file was created. */
     Time getCreationTime();
     /** Sets the time the file was created. */
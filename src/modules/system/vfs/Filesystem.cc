@@ -16,6 +16,7 @@
 
 #include "VFS.h"
 #include "Filesystem.h"
+#include "DentryCache.h"
 #include <Log.h>
 #include <utilities/utility.h>
 #include <processor/Processor.h>
@@ -38,7 +39,24 @@ Filesystem::Filesystem() :
 File *Filesystem::find(String path, File *pStartNode)
 {
     if (!pStartNode) pStartNode = getRoot();
-    File *a = findNode(pStartNode, path);
+
+    File *a;
+    DentryCache &cache = DentryCache::instance();
+    if (cache.lookup(pStartNode, path, a))
+        return a;
+
+    // Note the generation first, so that if the namespace changes while we
+    // walk the path the result doesn't get cached.
+    size_t generation = cache.generation();
+    DentryCache::Source source;
+    bool bError = false;
+    a = findNode(pStartNode, path, &bError, &source);
+
+    // Misses that were errors (rather than the file simply not existing)
+    // aren't cached, so that the error is raised again next time.
+    if (a || !bError)
+        cache.insert(pStartNode, path, a, generation, source);
+
     return a;
 }
 
@@ -149,11 +167,11 @@ bool Filesystem::remove(String path, File *pStartNode)
         FATAL("Filesystem::remove: Massive algorithmic error (2)");
         return false;
     }
-    pDParent->m_Cache.remove(filename);
+    pDParent->removeFromCache(filename);
     return remove(pParent, pFile);
 }
 
-File *Filesystem::findNode(File *pNode, String path)
+File *Filesystem::findNode(File *pNode, String path, bool *pbError, DentryCache::Source *pSource)
 {
     if (path.length() == 0)
         return pNode;
@@ -184,7 +202,7 @@ File *Filesystem::findNode(File *pNode, String path)
 
     // If 'path' is zero-lengthed, ignore and recurse.
     if (path.length() == 0)
-        return findNode(pNode, restOfPath);
+        return findNode(pNode, restOfPath, pbError, pSource);
 
     // Firstly, if the current node is a symlink, follow it.
     while (pNode->isSymlink())
@@ -194,25 +212,37 @@ File *Filesystem::findNode(File *pNode, String path)
     if (!pNode->isDirectory())
     {
         SYSCALL_ERROR(NotADirectory);
+        if (pbError)
+            *pbError = true;
         return 0;
     }
 
     if (!strcmp(path, ".") || (!strcmp(path, "..") && pNode->m_pParent == 0))
     {
-        return findNode(pNode, restOfPath);
+        return findNode(pNode, restOfPath, pbError, pSource);
     }
     else if (!strcmp(path, ".."))
     {
-        return findNode(pNode->m_pParent, restOfPath);
+        return findNode(pNode->m_pParent, restOfPath, pbError, pSource);
     }
 
     Directory *pDir = Directory::fromFile(pNode);
     if(!pDir)
     {
         // Throw some error...
+        if (pbError)
+            *pbError = true;
         return 0;
     }
 
+    // This is the directory the result depends on, unless there's more to
+    // the path - note its generation before searching it.
+    if (pSource)
+    {
+        pSource->pDirectory = pDir;
+        pSource->generation = pDir->generation();
+    }
+
     // Cache lookup.
     File *pFile;
     if (pDir->m_bCachePopulated)
@@ -222,7 +252,7 @@ File *Filesystem::findNode(File *pNode, String path)
         if (pFile)
         {
             // Cache lookup succeeded, recurse and return.
-            return findNode(pFile, restOfPath);
+            return findNode(pFile, restOfPath, pbError, pSource);
         }
         else
         {
@@ -240,7 +270,7 @@ File *Filesystem::findNode(File *pNode, String path)
         if (pFile)
         {
             // Cache lookup succeeded, recurse and return.
-            return findNode(pFile, restOfPath);
+            return findNode(pFile, restOfPath, pbError, pSource);
         }
         else
         {
@@ -21,6 +21,7 @@
 #include <machine/Disk.h>
 #include <vfs/File.h>
 #include <utilities/RadixTree.h>
+#include <vfs/DentryCache.h>
 
 /** This class provides the abstract skeleton that all filesystems must implement.
  *
@@ -108,8 +109,12 @@ private:
 
     /** Internal function to find a node - Returns 0 on failure or the node.
         \param pNode The node to start parsing 'path' from.
-        \param path  The path from pNode to the destination node. */
-    File *findNode(File *pNode, String path);
+        \param path  The path from pNode to the destination node.
+        \param[out] pbError If non-null, set if the lookup failed because of
+                            an error rather than because the node doesn't exist.
+        \param[out] pSource If non-null, set to the last directory searched,
+                            for the DentryCache. */
+    File *findNode(File *pNode, String path, bool *pbError = 0, DentryCache::Source *pSource = 0);
 
     /** Internal function to find a node's parent directory.
         \param path The path from pStartNode to the original file.
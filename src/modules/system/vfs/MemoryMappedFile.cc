@@ -21,13 +21,15 @@
 
 MemoryMappedFileManager MemoryMappedFileManager::m_Instance;
 
+size_t MemoryMappedFile::m_nFaultAroundPages = MMFILE_FAULT_AROUND_PAGES;
+
 /// \todo number of CPUs
 static char g_TrapPage[256][4096] __attribute__((aligned(4096))) = {0};
 
 MemoryMappedFile::MemoryMappedFile(File *pFile, size_t extentOverride, bool bShared) :
     m_pFile(pFile), m_Mappings(), m_bMarkedForDeletion(false),
     m_Extent(extentOverride ? extentOverride : pFile->getSize() + 1), m_RefCount(0), m_Lock(),
-    m_bShared(bShared)
+    m_bShared(bShared), m_bSequential(false)
 {
     if (m_Extent & ~(PhysicalMemoryManager::getPageSize()-1))
     {
@@ -38,7 +40,7 @@ MemoryMappedFile::MemoryMappedFile(File *pFile, size_t extentOverride, bool bSha
 
 MemoryMappedFile::MemoryMappedFile(size_t anonMapSize) :
     m_pFile(0), m_Mappings(), m_bMarkedForDeletion(false), m_Extent(anonMapSize),
-    m_RefCount(1), m_Lock()
+    m_RefCount(1), m_Lock(), m_bShared(false), m_bSequential(false)
 {
 }
 
@@ -141,7 +143,9 @@ bool MemoryMappedFile::load(uintptr_t &address, Process *pProcess, size_t extent
             PhysicalMemoryManager::instance().freePage(phys);
         }
 
-        if (!va->map(p, reinterpret_cast<void*>(v), VirtualAddressSpace::Execute | (bMapWrite ? VirtualAddressSpace::Write : 0)))
+        if (!va->map(p, reinterpret_cast<void*>(v), VirtualAddressSpace::Execute |
+                                                    (bMapWrite ? VirtualAddressSpace::Write : 0) |
+                                                    (m_bShared ? VirtualAddressSpace::Shared : 0)))
         {
             WARNING("MemoryMappedFile: map() failed at " << v);
             return false;
@@ -189,7 +193,7 @@ void MemoryMappedFile::unload(uintptr_t address)
     m_Mappings.clear();
 }
 
-void MemoryMappedFile::trap(uintptr_t address, uintptr_t offset, uintptr_t fileoffset, bool bIsWrite)
+void MemoryMappedFile::trap(uintptr_t address, uintptr_t offset, uintptr_t fileoffset, size_t size, bool bIsWrite)
 {
     LockGuard<Mutex> guard(m_Lock);
     size_t pageSz = PhysicalMemoryManager::getPageSize();
@@ -260,6 +264,13 @@ void MemoryMappedFile::trap(uintptr_t address, uintptr_t offset, uintptr_t fileo
             WARNING_NOLOCK("MemoryMappedFile: read() didn't give us a physical address");
             return;
         }
+
+        // Someone reading in order will want the next few pages soon too.
+        if(m_bSequential)
+        {
+            MemoryMappedFileManager::instance().readahead(m_pFile, readloc + pageSz,
+                                                          m_nFaultAroundPages * pageSz);
+        }
     }
 
     // NOTICE_NOLOCK("  -> file page is p" << p);
@@ -272,7 +283,10 @@ void MemoryMappedFile::trap(uintptr_t address, uintptr_t offset, uintptr_t fileo
 
     // Map the page into the address space.
     // NOTICE_NOLOCK("trap: " << v << " -> " << mapPhys << " for " << m_pFile->getName());
-    if (!va.map(mapPhys, reinterpret_cast<void *>(v), ((bIsWrite || m_bShared) ? VirtualAddressSpace::Write : 0) | VirtualAddressSpace::Execute))
+    // Shared mappings must not become copy-on-write when the address space is cloned.
+    if (!va.map(mapPhys, reinterpret_cast<void *>(v), ((bIsWrite || m_bShared) ? VirtualAddressSpace::Write : 0) |
+                                                      (m_bShared ? VirtualAddressSpace::Shared : 0) |
+                                                      VirtualAddressSpace::Execute))
     {
         FATAL_NOLOCK("MemoryMappedFile: map() failed in trap()");
         return;
@@ -338,10 +352,82 @@ void MemoryMappedFile::trap(uintptr_t address, uintptr_t offset, uintptr_t fileo
     // Now that the file is read and memory written, change the mapping
     // to read only.
     // va.setFlags(reinterpret_cast<void*>(v), 0);
+
+    // Fault-around: map whatever else the file already has cached in the
+    // aligned window around the fault, so that walking through the mapping
+    // (e.g. the dynamic linker relocating a library) doesn't fault on
+    // every page. Writes need their own copy, so they don't get this.
+    if(!bIsWrite && m_nFaultAroundPages > 1)
+    {
+        size_t windowSize = m_nFaultAroundPages * pageSz;
+        uintptr_t windowStart = v & ~(windowSize - 1);
+        uintptr_t windowEnd = windowStart + windowSize;
+        if(windowStart < offset)
+            windowStart = offset;
+        if(windowEnd > offset + size)
+            windowEnd = offset + size;
+
+        for(uintptr_t page = windowStart; page < windowEnd; page += pageSz)
+        {
+            if(page != v)
+                mapCachedPage(va, page, (page - offset) + fileoffset);
+        }
+    }
+}
+
+void MemoryMappedFile::dropPages(uintptr_t start, uintptr_t end, uintptr_t offset, uintptr_t fileoffset)
+{
+    LockGuard<Mutex> guard(m_Lock);
+    size_t pageSz = PhysicalMemoryManager::getPageSize();
+
+    VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
+
+    for(uintptr_t v = start; v < end; v += pageSz)
+    {
+        if(!va.isMapped(reinterpret_cast<void *>(v)))
+            continue;
+
+        physical_uintptr_t phys = 0;
+        size_t flags = 0;
+        va.getMapping(reinterpret_cast<void *>(v), phys, flags);
+
+        // Only pages that are the file's own cached copy can go: anything
+        // else was copied on write and holds the only copy of its data.
+        physical_uintptr_t p = m_pFile->getPhysicalPage((v - offset) + fileoffset);
+        if(p == static_cast<physical_uintptr_t>(~0UL) || p != phys)
+            continue;
+
+        // The m_Mappings entry stays, as other address spaces may still
+        // have the page mapped, and trap() will map it here again.
+        va.unmap(reinterpret_cast<void *>(v));
+    }
+}
+
+void MemoryMappedFile::mapCachedPage(VirtualAddressSpace &va, uintptr_t v, uintptr_t readloc)
+{
+    size_t pageSz = PhysicalMemoryManager::getPageSize();
+
+    // The last page of a private map gets its tail zeroed, so needs a copy.
+    uintptr_t offsetIntoMap = readloc & ~(pageSz - 1);
+    if(!m_bShared && (offsetIntoMap + pageSz) >= m_Extent)
+        return;
+
+    if(va.isMapped(reinterpret_cast<void *>(v)))
+        return;
+
+    physical_uintptr_t p = m_pFile->getPhysicalPage(readloc);
+    if(p == static_cast<physical_uintptr_t>(~0UL))
+        return;
+
+    if (!va.map(p, reinterpret_cast<void *>(v), (m_bShared ? (VirtualAddressSpace::Write | VirtualAddressSpace::Shared) : 0) |
+                                               VirtualAddressSpace::Execute))
+        return;
+
+    m_Mappings.insert(readloc, static_cast<physical_uintptr_t>(~0UL));
 }
 
 MemoryMappedFileManager::MemoryMappedFileManager() :
-    m_MmFileLists(), m_Cache(), m_CacheLock()
+    m_MmFileLists(), m_MmFileListLock(), m_Cache(), m_CacheLock(), m_Readahead()
 {
     PageFaultHandler::instance().registerHandler(this);
 }
@@ -408,9 +494,11 @@ MemoryMappedFile *MemoryMappedFileManager::map(File *pFile, uintptr_t &address,
         sizeOverride &= ~(PhysicalMemoryManager::instance().getPageSize() - 1);
     }
 
+    MmFile *_pMmFile = new MmFile(address, sizeOverride, offset, pMmFile);
+
     {
         // This operation must appear atomic.
-        LockGuard<Mutex> guard(m_CacheLock);
+        lockMmFileLists();
 
         // Add to the MmFileList for this VA space (if it exists).
         MmFileList *pMmFileList = m_MmFileLists.lookup(&va);
@@ -420,8 +508,9 @@ MemoryMappedFile *MemoryMappedFileManager::map(File *pFile, uintptr_t &address,
             m_MmFileLists.insert(&va, pMmFileList);
         }
 
-        MmFile *_pMmFile = new MmFile(address, sizeOverride, offset, pMmFile);
-        pMmFileList->pushBack(_pMmFile);
+        pMmFileList->insert(_pMmFile);
+
+        m_MmFileListLock.release();
     }
 
     // Success.
@@ -430,48 +519,57 @@ MemoryMappedFile *MemoryMappedFileManager::map(File *pFile, uintptr_t &address,
 
 void MemoryMappedFileManager::unmap(MemoryMappedFile *pMmFile)
 {
-    LockGuard<Mutex> guard(m_CacheLock);
-
     VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
 
-    MmFileList *pMmFileList = m_MmFileLists.lookup(&va);
-    if (!pMmFileList) return;
+    // Take the mapping out of the list first; tearing it down can block, so
+    // is done without the list lock.
+    lockMmFileLists();
 
-    for (List<MmFile*>::Iterator it = pMmFileList->begin();
-         it != pMmFileList->end();
-         it++)
+    MmFileList *pMmFileList = m_MmFileLists.lookup(&va);
+    if (!pMmFileList)
     {
-        if ( (*it)->file == pMmFile )
-        {
-            (*it)->file->unload( (*it)->offset );
-            if ((*it)->file->decreaseRefCount())
-            {
-                delete (*it)->file;
-                m_Cache.remove( (*it)->file->getFile() );
-            }
-            delete *it;
-            pMmFileList->erase(it);
-            break;
-        }
+        m_MmFileListLock.release();
+        return;
     }
 
+    MmFile *pEntry = pMmFileList->remove(pMmFile);
+
     if (pMmFileList->count() == 0)
-    {
-        delete pMmFileList;
         m_MmFileLists.remove(&va);
+    else
+        pMmFileList = 0;
+
+    m_MmFileListLock.release();
+
+    delete pMmFileList;
+
+    if (!pEntry)
+        return;
+
+    pEntry->file->unload(pEntry->offset);
+    if (pEntry->file->decreaseRefCount())
+    {
+        LockGuard<Mutex> guard(m_CacheLock);
+        m_Cache.remove(pEntry->file->getFile());
+        delete pEntry->file;
     }
+    delete pEntry;
 }
 
 void MemoryMappedFileManager::clone(Process *pProcess)
 {
-    LockGuard<Mutex> guard(m_CacheLock);
-
     VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
 
     VirtualAddressSpace *pOtherVa = pProcess->getAddressSpace();
 
+    lockMmFileLists();
+
     MmFileList *pMmFileList = m_MmFileLists.lookup(&va);
-    if (!pMmFileList) return;
+    if (!pMmFileList)
+    {
+        m_MmFileListLock.release();
+        return;
+    }
 
     MmFileList *pMmFileList2 = m_MmFileLists.lookup(pOtherVa);
     if (!pMmFileList2)
@@ -480,42 +578,46 @@ void MemoryMappedFileManager::clone(Process *pProcess)
         m_MmFileLists.insert(pOtherVa, pMmFileList2);
     }
 
-    for (List<MmFile*>::Iterator it = pMmFileList->begin();
-         it != pMmFileList->end();
-         it++)
+    for (size_t i = 0; i < pMmFileList->count(); i++)
     {
-        MmFile *pMmFile = new MmFile( (*it)->offset, (*it)->size, (*it)->fileoffset, (*it)->file );
-        pMmFileList2->pushBack(pMmFile);
+        MmFile *pEntry = (*pMmFileList)[i];
+        MmFile *pMmFile = new MmFile(pEntry->offset, pEntry->size, pEntry->fileoffset, pEntry->file);
+        pMmFileList2->insert(pMmFile);
 
-        (*it)->file->increaseRefCount();
+        pEntry->file->increaseRefCount();
     }
+
+    m_MmFileListLock.release();
 }
 
 void MemoryMappedFileManager::unmapAll()
 {
-    LockGuard<Mutex> guard(m_CacheLock);
-
     VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
 
+    lockMmFileLists();
+
     MmFileList *pMmFileList = m_MmFileLists.lookup(&va);
+    if (pMmFileList)
+        m_MmFileLists.remove(&va);
+
+    m_MmFileListLock.release();
+
     if (!pMmFileList) return;
 
-    for (List<MmFile*>::Iterator it = pMmFileList->begin();
-         it != pMmFileList->end();
-         it = pMmFileList->begin())
+    for (size_t i = 0; i < pMmFileList->count(); i++)
     {
-        (*it)->file->unload( (*it)->offset );
-        if ((*it)->file->decreaseRefCount())
+        MmFile *pEntry = (*pMmFileList)[i];
+        pEntry->file->unload(pEntry->offset);
+        if (pEntry->file->decreaseRefCount())
         {
-            m_Cache.remove( (*it)->file->getFile() );
-            delete (*it)->file;
+            LockGuard<Mutex> guard(m_CacheLock);
+            m_Cache.remove(pEntry->file->getFile());
+            delete pEntry->file;
         }
-        delete *it;
-        pMmFileList->erase(it);
+        delete pEntry;
     }
 
     delete pMmFileList;
-    m_MmFileLists.remove(&va);
 }
 
 // #define MMFILE_DEBUG
@@ -534,60 +636,195 @@ bool MemoryMappedFileManager::trap(uintptr_t address, bool bIsWrite)
 
     VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
 
-    m_CacheLock.acquire();
-#ifdef MMFILE_DEBUG
-    NOTICE_NOLOCK("trap: got lock");
-#endif
+    // Faults don't exclude each other, only map/unmap.
+    while (!m_MmFileListLock.enter())
+        Scheduler::instance().yield();
 
     MmFileList *pMmFileList = m_MmFileLists.lookup(&va);
-    if (!pMmFileList)
+    MmFile *pMmFile = pMmFileList ? pMmFileList->lookup(address) : 0;
+    if (!pMmFile)
     {
-        m_CacheLock.release();
+#ifdef MMFILE_DEBUG
+        NOTICE_NOLOCK("trap: no mapping for " << address);
+#endif
+        m_MmFileListLock.leave();
         return false;
     }
 
+    // Take a copy, the entry can go away as soon as we leave.
+    MmFile mmFile = *pMmFile;
+    m_MmFileListLock.leave();
+
+    mmFile.file->trap(address, mmFile.offset, mmFile.fileoffset, mmFile.size, bIsWrite);
+
 #ifdef MMFILE_DEBUG
-    NOTICE_NOLOCK("trap: lookup complete " << reinterpret_cast<uintptr_t>(pMmFileList));
+    NOTICE_NOLOCK("trap: completed for " << address);
 #endif
 
-    for (List<MmFile*>::Iterator it = pMmFileList->begin();
-         it != pMmFileList->end();
-         it++)
+    return true;
+}
+
+bool MemoryMappedFileManager::advise(uintptr_t address, size_t length, Advice advice)
+{
+    VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
+
+    while (!m_MmFileListLock.enter())
+        Scheduler::instance().yield();
+
+    MmFileList *pMmFileList = m_MmFileLists.lookup(&va);
+    MmFile *pMmFile = pMmFileList ? pMmFileList->lookup(address) : 0;
+    if (!pMmFile)
     {
-        MmFile *pMmFile = *it;
-#ifdef MMFILE_DEBUG
-        NOTICE_NOLOCK("mmfile=" << reinterpret_cast<uintptr_t>(pMmFile));
-        if(!pMmFile)
-        {
-            NOTICE_NOLOCK("bad mmfile, should create a real #PF and backtrace");
+        m_MmFileListLock.leave();
+        return false;
+    }
+
+    MmFile mmFile = *pMmFile;
+    m_MmFileListLock.leave();
+
+    // Anonymous memory has nothing to read.
+    File *pFile = mmFile.file->getFile();
+    if (!pFile)
+        return true;
+
+    // Only the part of the range inside this mapping.
+    uintptr_t end = address + length;
+    if (end < address || end > mmFile.offset + mmFile.size)
+        end = mmFile.offset + mmFile.size;
+
+    switch (advice)
+    {
+        case Normal:
+        case Random:
+            mmFile.file->setSequential(false);
             break;
-        }
-#endif
 
-        uintptr_t endAddress = pMmFile->offset + pMmFile->size;
+        case Sequential:
+            mmFile.file->setSequential(true);
+            // Start reading straight away, too.
 
-        if ( (address >= pMmFile->offset) && (address < endAddress) )
+        case WillNeed:
         {
-#ifdef MMFILE_DEBUG
-            NOTICE_NOLOCK("trap: release lock B");
-#endif
-            m_CacheLock.release();
-            pMmFile->file->trap(address, pMmFile->offset, pMmFile->fileoffset, bIsWrite);
+            size_t pageSz = PhysicalMemoryManager::getPageSize();
+            uintptr_t start = address & ~(pageSz - 1);
+            readahead(pFile, (start - mmFile.offset) + mmFile.fileoffset, end - start);
+            break;
+        }
 
-#ifdef MMFILE_DEBUG
-            NOTICE_NOLOCK("trap: completed for " << address);
-#endif
-//            NOTICE_NOLOCK("Trap end: " << address << ", pid:tid " << Processor::information().getCurrentThread()->getParent()->getId() <<":" << Processor::information().getCurrentThread()->getId());
-            return true;
+        case DontNeed:
+        {
+            size_t pageSz = PhysicalMemoryManager::getPageSize();
+            uintptr_t start = address & ~(pageSz - 1);
+            mmFile.file->dropPages(start, end, mmFile.offset, mmFile.fileoffset);
+            break;
         }
     }
 
-#ifdef MMFILE_DEBUG
-    NOTICE_NOLOCK("trap: fell off end");
-#endif
-    m_CacheLock.release();
+    return true;
+}
 
-//    NOTICE_NOLOCK("Trap end (false): " << address << ", pid:tid " << Processor::information().getCurrentThread()->getParent()->getId() <<":" << Processor::information().getCurrentThread()->getId());
+void MemoryMappedFileManager::readahead(File *pFile, uint64_t location, size_t size)
+{
+    if (location >= pFile->getSize())
+        return;
+
+    m_Readahead.queue(pFile, location, size);
+}
+
+void MemoryMappedFileManager::lockMmFileLists()
+{
+    // acquire() only fails if someone else has it - wait for them.
+    while (!m_MmFileListLock.acquire())
+        Scheduler::instance().yield();
+}
+
+MemoryMappedFileManager::MmFile *MemoryMappedFileManager::MmFileList::lookup(uintptr_t address)
+{
+    // Find the first mapping starting after address.
+    size_t lo = 0, hi = m_nEntries;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (m_pEntries[mid]->offset <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    // Does the one before it contain address?
+    if (lo && address < m_pEntries[lo-1]->offset + m_pEntries[lo-1]->size)
+        return m_pEntries[lo-1];
+    return 0;
+}
+
+void MemoryMappedFileManager::MmFileList::insert(MmFile *pMmFile)
+{
+    if (m_nEntries == m_nSize)
+    {
+        m_nSize = m_nSize ? m_nSize * 2 : 8;
+        MmFile **pTmp = new MmFile*[m_nSize];
+        memcpy(pTmp, m_pEntries, m_nEntries * sizeof(MmFile*));
+        delete [] m_pEntries;
+        m_pEntries = pTmp;
+    }
+
+    size_t idx = m_nEntries;
+    while (idx && m_pEntries[idx-1]->offset > pMmFile->offset)
+        idx--;
+
+    memmove(&m_pEntries[idx+1], &m_pEntries[idx], (m_nEntries - idx) * sizeof(MmFile*));
+    m_pEntries[idx] = pMmFile;
+    m_nEntries++;
+}
+
+MemoryMappedFileManager::MmFile *MemoryMappedFileManager::MmFileList::remove(MemoryMappedFile *pFile)
+{
+    for (size_t i = 0; i < m_nEntries; i++)
+    {
+        if (m_pEntries[i]->file != pFile)
+            continue;
+
+        MmFile *pMmFile = m_pEntries[i];
+        memmove(&m_pEntries[i], &m_pEntries[i+1], (m_nEntries - i - 1) * sizeof(MmFile*));
+        m_nEntries--;
+        return pMmFile;
+    }
+
+    return 0;
+}
+
+void MemoryMappedFileManager::ReadaheadQueue::queue(File *pFile, uint64_t location, size_t size)
+{
+    m_InitialiseLock.acquire();
+    bool bInitialise = !m_bInitialised;
+    m_bInitialised = true;
+    m_InitialiseLock.release();
+
+    if (bInitialise)
+        initialise();
+
+    // Hold a reference until the read is done.
+    pFile->increaseRefCount(false);
+    addAsyncRequest(1, reinterpret_cast<uint64_t>(pFile), location, size);
+}
+
+uint64_t MemoryMappedFileManager::ReadaheadQueue::executeRequest(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4,
+                                                                  uint64_t p5, uint64_t p6, uint64_t p7, uint64_t p8)
+{
+    File *pFile = reinterpret_cast<File*>(p1);
+    uint64_t location = p2;
+    uint64_t size = p3;
+
+    // The file may have shrunk since the request was queued.
+    if (location < pFile->getSize())
+    {
+        if (location + size > pFile->getSize())
+            size = pFile->getSize() - location;
+
+        // A null buffer just fills the file's cache.
+        pFile->read(location, size, 0);
+    }
 
-    return false;
+    pFile->decreaseRefCount(false);
+    return 0;
 }
@@ -21,6 +21,8 @@
 #include <processor/PageFaultHandler.h>
 #include <utilities/Tree.h>
 #include <utilities/List.h>
+#include <utilities/RequestQueue.h>
+#include <utilities/UnlikelyLock.h>
 #include <process/Mutex.h>
 #include <process/Process.h>
 #include <LockGuard.h>
@@ -37,6 +39,11 @@
 
 class MemoryMappedFileManager;
 
+/// Default number of pages (including the one that faulted) that trap()
+/// maps in one go. Neighbouring pages are only mapped early if the file
+/// already has them cached, so this never causes extra I/O.
+#define MMFILE_FAULT_AROUND_PAGES   16
+
 /** This class allows a file to be mapped into memory at a specific or
     at a chosen location. It stores the V->P mappings so they can be
     reused across multiple address spaces.
@@ -65,8 +72,29 @@ public:
 
     /** Trap occurred. Should be called only from MemoryMappedFileManager!
         \param address The address of the fault.
-        \param offset The starting offset of this mmappedfile in memory. */
-    void trap(uintptr_t address, uintptr_t offset, uintptr_t fileoffset, bool bIsWrite);
+        \param offset The starting offset of this mmappedfile in memory.
+        \param fileoffset The offset into the file the mapping starts at.
+        \param size The size of the mapping in memory. */
+    void trap(uintptr_t address, uintptr_t offset, uintptr_t fileoffset, size_t size, bool bIsWrite);
+
+    /** Unmaps the pages from start to end, in this address space, that map
+        the file's cache directly, so that they're faulted back in the next
+        time they're used. Private copies are left as they are - the advice
+        mustn't change what the mapping reads.
+        \param offset The starting offset of this mmappedfile in memory.
+        \param fileoffset The offset into the file the mapping starts at. */
+    void dropPages(uintptr_t start, uintptr_t end, uintptr_t offset, uintptr_t fileoffset);
+
+    /** Sets whether the mapping is expected to be read in order
+        (MADV_SEQUENTIAL). A sequential mapping queues readahead of the pages
+        following each one it has to read from the file. */
+    void setSequential(bool bSequential)
+    {m_bSequential = bSequential;}
+
+    /** Sets the number of pages trap() tries to map at once.
+        \param nPages A power of two; 1 turns fault-around off. */
+    static void setFaultAround(size_t nPages)
+    {m_nFaultAroundPages = nPages ? nPages : 1;}
 
     /** Mark this map for deletion when its reference count drops to zero - i.e. the underlying File has changed. */
     void markForDeletion()
@@ -96,6 +124,12 @@ private:
     MemoryMappedFile(const MemoryMappedFile &);
     MemoryMappedFile &operator = (const MemoryMappedFile &);
 
+    /** Maps the page at v to the file's cached copy of readloc, if the file
+        has it cached and v isn't mapped already. Used for fault-around, so
+        it never reads from the file and never copies.
+        \note m_Lock must be held. */
+    void mapCachedPage(VirtualAddressSpace &va, uintptr_t v, uintptr_t readloc);
+
     /** The file to map. */
     File *m_pFile;
 
@@ -119,6 +153,12 @@ private:
      * other processes in the system).
      */
     bool m_bShared;
+
+    /** Whether the mapping has been advised as being read sequentially. */
+    bool m_bSequential;
+
+    /** Number of pages trap() maps at once. */
+    static size_t m_nFaultAroundPages;
 };
 
 /** This class is a multiplexing trap handler, to take traps pertaining to
@@ -148,6 +188,27 @@ public:
 
     /** Removes all mappings from this address space. */
     void unmapAll();
+
+    /** Usage hints for a range of a mapping, as given to madvise(). */
+    enum Advice
+    {
+        Normal,
+        Random,
+        Sequential,
+        WillNeed,
+        DontNeed
+    };
+
+    /** Applies a usage hint to the mapping containing address, in this
+        address space. WillNeed queues the range to be read into the file's
+        cache in the background, so that later faults only have to map it;
+        DontNeed unmaps the range's unmodified pages.
+        \return False if address isn't in a file mapping. */
+    bool advise(uintptr_t address, size_t length, Advice advice);
+
+    /** Queues size bytes of pFile from location to be read into the file's
+        cache in the background. */
+    void readahead(File *pFile, uint64_t location, size_t size);
     
     //
     // MemoryTrapHandler interface.
@@ -174,16 +235,82 @@ private:
         uintptr_t fileoffset;
         MemoryMappedFile *file;
     };
-    typedef List<MmFile*> MmFileList;
-    
+
+    /** The mappings in one address space, sorted by address, so that the
+        one containing a faulting address is found by binary search. */
+    class MmFileList
+    {
+    public:
+        MmFileList() : m_pEntries(0), m_nEntries(0), m_nSize(0)
+        {}
+        ~MmFileList()
+        {delete [] m_pEntries;}
+
+        /** Returns the mapping containing address, or null. */
+        MmFile *lookup(uintptr_t address);
+        /** Adds a mapping, keeping the list sorted. */
+        void insert(MmFile *pMmFile);
+        /** Removes and returns the (first) mapping of pFile, or null. */
+        MmFile *remove(MemoryMappedFile *pFile);
+
+        size_t count()
+        {return m_nEntries;}
+        MmFile *operator [](size_t n)
+        {return m_pEntries[n];}
+
+    private:
+        MmFileList(const MmFileList &);
+        MmFileList &operator = (const MmFileList &);
+
+        MmFile **m_pEntries;
+        size_t m_nEntries;
+        size_t m_nSize;
+    };
+
+    /** Reads ranges of files into their caches on behalf of advise() and
+        sequential mappings, off the faulting thread. */
+    class ReadaheadQueue : public RequestQueue
+    {
+    public:
+        ReadaheadQueue() : RequestQueue(), m_bInitialised(false)
+        {}
+        virtual ~ReadaheadQueue()
+        {}
+
+        /** Queues a read of size bytes of pFile from location. */
+        void queue(File *pFile, uint64_t location, size_t size);
+
+    protected:
+        virtual uint64_t executeRequest(uint64_t p1, uint64_t p2, uint64_t p3, uint64_t p4, uint64_t p5,
+                                        uint64_t p6, uint64_t p7, uint64_t p8);
+
+    private:
+        /** The worker thread is started on first use, by which time the
+            scheduler is certainly running. */
+        bool m_bInitialised;
+        Spinlock m_InitialiseLock;
+    };
+
+    /** Takes m_MmFileListLock exclusively. */
+    void lockMmFileLists();
+
     /** Cache of virtual address spaces -> MmFileLists. */
     Tree<VirtualAddressSpace*, MmFileList*> m_MmFileLists;
 
+    /** Protects m_MmFileLists and the lists in it. Page faults only read
+        them, so they enter() the lock and never wait for each other;
+        map/unmap take it exclusively, but only for as long as it takes to
+        change a list. */
+    UnlikelyLock m_MmFileListLock;
+
     /** Global cache of valid files. */
     Tree<File*,MemoryMappedFile*> m_Cache;
 
     /** Lock for the cache. */
     Mutex m_CacheLock;
+
+    /** Background reads for readahead(). */
+    ReadaheadQueue m_Readahead;
 };
 
 /** @} */
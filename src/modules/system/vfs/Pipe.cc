@@ -17,6 +17,7 @@
 #include "Pipe.h"
 #include "Filesystem.h"
 #include <utilities/ZombieQueue.h>
+#include <LockGuard.h>
 
 class ZombiePipe : public ZombieObject
 {
@@ -33,66 +34,85 @@ class ZombiePipe : public ZombieObject
 };
 
 Pipe::Pipe() :
-    File(), m_bIsAnonymous(true), m_bIsEOF(false), m_BufLen(0),
-    m_BufAvailable(PIPE_BUF_MAX), m_Front(0), m_Back(0)
+    File(), m_bIsAnonymous(true), m_bIsEOF(false), m_BufferLock(false),
+    m_DataReady(0), m_SpaceReady(0), m_nReadWaiters(0), m_nWriteWaiters(0),
+    m_pBuffer(new uint8_t[PIPE_DEFAULT_CAPACITY]), m_nCapacity(PIPE_DEFAULT_CAPACITY), m_Front(0), m_nUsed(0)
 {
 }
 
 Pipe::Pipe(String name, Time accessedTime, Time modifiedTime, Time creationTime,
            uintptr_t inode, Filesystem *pFs, size_t size, File *pParent,
-           bool bIsAnonymous) :
+           bool bIsAnonymous, size_t nCapacity) :
     File(name,accessedTime,modifiedTime,creationTime,inode,pFs,size,pParent),
-    m_bIsAnonymous(bIsAnonymous), m_bIsEOF(false), m_BufLen(0),
-    m_BufAvailable(PIPE_BUF_MAX), m_Front(0), m_Back(0)
+    m_bIsAnonymous(bIsAnonymous), m_bIsEOF(false), m_BufferLock(false),
+    m_DataReady(0), m_SpaceReady(0), m_nReadWaiters(0), m_nWriteWaiters(0),
+    m_pBuffer(0), m_nCapacity(nCapacity < PIPE_ATOMIC_MAX ? PIPE_ATOMIC_MAX : nCapacity), m_Front(0), m_nUsed(0)
 {
+    m_pBuffer = new uint8_t[m_nCapacity];
 }
 
 Pipe::~Pipe()
 {
+    delete [] m_pBuffer;
+}
+
+bool Pipe::wait(Semaphore &sem, size_t &nWaiters)
+{
+    nWaiters++;
+    m_BufferLock.release();
+    bool bWoken = sem.acquire();
+    m_BufferLock.acquire();
+
+    // If we were interrupted we may or may not have been counted in a wake.
+    // A stray release only causes a spurious wakeup, so that's harmless.
+    if (!bWoken && nWaiters)
+        nWaiters--;
+    return bWoken;
+}
+
+void Pipe::wake(Semaphore &sem, size_t &nWaiters)
+{
+    // One release per waiter, once per transfer rather than once per byte.
+    if (nWaiters)
+    {
+        sem.release(nWaiters);
+        nWaiters = 0;
+    }
 }
 
 uint64_t Pipe::read(uint64_t location, uint64_t size, uintptr_t buffer, bool bCanBlock)
 {
-    uint64_t n = 0;
     uint8_t *pBuf = reinterpret_cast<uint8_t*>(buffer);
-    while (size)
+    if (!size)
+        return 0;
+
+    LockGuard<Mutex> guard(m_BufferLock);
+
+    // Wait for some data. Once there is some, we don't block again - we
+    // return whatever is available.
+    while (!m_nUsed)
     {
-        if (m_bIsEOF || n > 0)
-        {
-            // If EOF has been signalled or we already have some data, we mustn't block, so tentatively attempt to tryAcquire until it fails.
-            if (!m_BufLen.tryAcquire())
-            {
-                // No data left and/or EOF given - END.
-                return n;
-            }
-            pBuf[n++] = m_Buffer[m_Front];
-            m_Front = (m_Front+1) % PIPE_BUF_MAX;
-            m_BufAvailable.release();
-            size --;
-        }
-        else
-        {
-            // EOF not signalled, so do a blocking wait on data, if we can.
-            if(bCanBlock)
-                m_BufLen.acquire();
-            else
-                if(!m_BufLen.tryAcquire())
-                    return n;
-
-            // However, *here*, we must check if EOF is now signalled. When EOF comes in and there is no data, m_BufLen will be posted to
-            // wake us up. We need to check if there was data available.
-            if (m_Front == m_Back)
-            {
-                // We were woken with no data available. This means we must return now.
-                return 0;
-            }
-
-            pBuf[n++] = m_Buffer[m_Front];
-            m_Front = (m_Front+1) % PIPE_BUF_MAX;
-            m_BufAvailable.release();
-            size --;
-        }
+        // No data left and EOF given, or we can't wait - END.
+        if (m_bIsEOF || !bCanBlock)
+            return 0;
+
+        if (!wait(m_DataReady, m_nReadWaiters))
+            return 0;
     }
+
+    size_t n = size < m_nUsed ? size : m_nUsed;
+
+    // Copy out in at most two spans, as the data may wrap around the end.
+    size_t first = m_nCapacity - m_Front;
+    if (first > n)
+        first = n;
+    memcpy(pBuf, &m_pBuffer[m_Front], first);
+    memcpy(&pBuf[first], m_pBuffer, n - first);
+
+    m_Front = (m_Front + n) % m_nCapacity;
+    m_nUsed -= n;
+
+    wake(m_SpaceReady, m_nWriteWaiters);
     return n;
 }
 
@@ -100,17 +120,68 @@ uint64_t Pipe::write(uint64_t location, uint64_t size, uintptr_t buffer, bool bC
 {
     uint64_t n = 0;
     uint8_t *pBuf = reinterpret_cast<uint8_t*>(buffer);
-    while (size)
+
+    // Small writes must not be interleaved with any other write, so they
+    // wait until there's room for the whole thing.
+    bool bAtomic = size <= PIPE_ATOMIC_MAX;
+
+    LockGuard<Mutex> guard(m_BufferLock);
+    while (n < size)
     {
-        m_BufAvailable.acquire();
-        m_Buffer[m_Back] = pBuf[n++];
-        m_Back = (m_Back+1) % PIPE_BUF_MAX;
-        m_BufLen.release();
-        size --;
+        size_t nFree = m_nCapacity - m_nUsed;
+        size_t nWanted = size - n;
+        if (!nFree || (bAtomic && nFree < nWanted))
+        {
+            if (!bCanBlock)
+                break;
+            if (!wait(m_SpaceReady, m_nWriteWaiters))
+                break;
+            continue;
+        }
+
+        size_t nChunk = nWanted < nFree ? nWanted : nFree;
+
+        // Copy in at most two spans, as the free space may wrap.
+        size_t back = (m_Front + m_nUsed) % m_nCapacity;
+        size_t first = m_nCapacity - back;
+        if (first > nChunk)
+            first = nChunk;
+        memcpy(&m_pBuffer[back], &pBuf[n], first);
+        memcpy(m_pBuffer, &pBuf[n + first], nChunk - first);
+
+        m_nUsed += nChunk;
+        n += nChunk;
+
+        wake(m_DataReady, m_nReadWaiters);
     }
     return n;
 }
 
+bool Pipe::setCapacity(size_t nCapacity)
+{
+    LockGuard<Mutex> guard(m_BufferLock);
+
+    if (nCapacity < PIPE_ATOMIC_MAX || nCapacity < m_nUsed)
+        return false;
+
+    // Move the data to the start of the new buffer.
+    uint8_t *pNewBuffer = new uint8_t[nCapacity];
+    size_t first = m_nCapacity - m_Front;
+    if (first > m_nUsed)
+        first = m_nUsed;
+    memcpy(pNewBuffer, &m_pBuffer[m_Front], first);
+    memcpy(&pNewBuffer[first], m_pBuffer, m_nUsed - first);
+
+    delete [] m_pBuffer;
+    m_pBuffer = pNewBuffer;
+    m_nCapacity = nCapacity;
+    m_Front = 0;
+
+    // There may be more room now.
+    wake(m_SpaceReady, m_nWriteWaiters);
+    return true;
+}
+
 void Pipe::increaseRefCount(bool bIsWriter)
 {
     if (bIsWriter)
@@ -118,9 +189,9 @@ void Pipe::increaseRefCount(bool bIsWriter)
         if (m_bIsEOF)
         {
             // Start the pipe again.
+            LockGuard<Mutex> guard(m_BufferLock);
             m_bIsEOF = false;
-            while (m_BufLen.tryAcquire()) ;
-            m_Front = m_Back = 0;
+            m_Front = m_nUsed = 0;
         }
         m_nWriters++;
     }
@@ -137,12 +208,10 @@ void Pipe::decreaseRefCount(bool bIsWriter)
         m_nWriters --;
         if (m_nWriters == 0)
         {
+            // Wake any readers up - if there's no data left they return EOF.
+            LockGuard<Mutex> guard(m_BufferLock);
             m_bIsEOF = true;
-            if (m_Front == m_Back)
-            {
-                // No data available - post the m_BufLen semaphore to wake any readers up.
-                m_BufLen.release();
-            }
+            wake(m_DataReady, m_nReadWaiters);
         }
     }
     else
@@ -21,9 +21,14 @@
 #include <utilities/String.h>
 #include <utilities/RadixTree.h>
 #include <process/Semaphore.h>
+#include <process/Mutex.h>
 #include "File.h"
 
-#define PIPE_BUF_MAX 2048
+/// Default capacity of a pipe, in bytes.
+#define PIPE_DEFAULT_CAPACITY 65536
+
+/// Writes of up to this many bytes are never interleaved with other writes (POSIX PIPE_BUF).
+#define PIPE_ATOMIC_MAX 512
 
 /** A first-in-first-out buffer node. */
 class Pipe : public File
@@ -48,15 +53,26 @@ private:
 public:
     /** Constructor, should be called only by a Filesystem. */
     Pipe(String name, Time accessedTime, Time modifiedTime, Time creationTime,
-         uintptr_t inode, class Filesystem *pFs, size_t size, File *pParent, bool bIsAnonymous = false);
-    /** Destructor - doesn't do anything. */
+         uintptr_t inode, class Filesystem *pFs, size_t size, File *pParent, bool bIsAnonymous = false,
+         size_t nCapacity = PIPE_DEFAULT_CAPACITY);
+    /** Destructor, frees the buffer. */
     virtual ~Pipe();
 
-    /** Reads from the file. */
+    /** Reads from the file. Blocks (if allowed) until there is some data,
+        then returns as much as is available, up to size. */
     virtual uint64_t read(uint64_t location, uint64_t size, uintptr_t buffer, bool bCanBlock = true);
-    /** Writes to the file. */
+    /** Writes to the file. Writes of up to PIPE_ATOMIC_MAX bytes go in all at
+        once; larger ones may be interleaved with other writers. */
     virtual uint64_t write(uint64_t location, uint64_t size, uintptr_t buffer, bool bCanBlock = true);
 
+    /** Returns the capacity of the pipe, in bytes. */
+    size_t getCapacity()
+    {return m_nCapacity;}
+
+    /** Changes the capacity of the pipe.
+        \return false if the pipe holds more data than would fit. */
+    bool setCapacity(size_t nCapacity);
+
     /** Returns true if the File is actually a pipe. */
     virtual bool isPipe()
     {return true;}
@@ -74,11 +90,29 @@ protected:
     /** Have we reached EOF? */
     volatile bool m_bIsEOF;
 
-    /** The implements needed to create a ring buffer. */
-    Semaphore m_BufLen;
-    Semaphore m_BufAvailable;
-    uint8_t m_Buffer[PIPE_BUF_MAX];
-    uintptr_t m_Front, m_Back;
+    /** Blocks until woken by a transfer in the other direction.
+        \note Called with m_BufferLock held, returns with it held.
+        \return false if the wait was interrupted. */
+    bool wait(Semaphore &sem, size_t &nWaiters);
+
+    /** Wakes everything blocked on the given semaphore.
+        \note Called with m_BufferLock held. */
+    void wake(Semaphore &sem, size_t &nWaiters);
+
+    /** Protects the ring buffer. */
+    Mutex m_BufferLock;
+
+    /** Readers wait on this for data, writers for space. */
+    Semaphore m_DataReady;
+    Semaphore m_SpaceReady;
+    size_t m_nReadWaiters;
+    size_t m_nWriteWaiters;
+
+    /** The ring buffer: m_nUsed bytes starting at m_Front. */
+    uint8_t *m_pBuffer;
+    size_t m_nCapacity;
+    size_t m_Front;
+    size_t m_nUsed;
 };
 
 #endif
@@ -15,6 +15,7 @@
  */
 
 #include "VFS.h"
+#include "DentryCache.h"
 #include <Log.h>
 #include <Module.h>
 #include <utilities/utility.h>
@@ -164,6 +165,9 @@ void VFS::removeAllAliases(Filesystem *pFs)
         
         m_Mounts.remove(pFs);
     }
+
+    // Cached lookups may point into this filesystem.
+    DentryCache::instance().invalidate();
     
     delete pFs;
 }
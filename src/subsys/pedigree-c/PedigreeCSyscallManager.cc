@@ -166,6 +166,10 @@ uintptr_t PedigreeCSyscallManager::syscall(SyscallState &state)
             return 0;
         case PEDIGREE_SYS_REQUEST_MEM:
             return reinterpret_cast<uintptr_t>(pedigree_sys_request_mem(static_cast<size_t>(p1)));
+        case PEDIGREE_SEM_STATISTICS:
+            return pedigree_sem_statistics(reinterpret_cast<size_t*>(p1));
+        case PEDIGREE_SEM_BENCHMARK:
+            return pedigree_sem_benchmark(static_cast<size_t>(p1), static_cast<size_t>(p2), static_cast<int>(p3), reinterpret_cast<size_t*>(p4));
         default: ERROR ("PedigreeCSyscallManager: invalid syscall received: " << Dec << state.getSyscallNumber()); return 0;
     }
 }
@@ -47,6 +47,16 @@ void *pedigree_sys_request_mem(size_t len) {
     return (void *) syscall1(PEDIGREE_SYS_REQUEST_MEM, (long) len);
 }
 
+int pedigree_sem_statistics(size_t *stats)
+{
+    return syscall1(PEDIGREE_SEM_STATISTICS, (long) stats);
+}
+
+int pedigree_sem_benchmark(size_t nThreads, size_t nPosts, int bHandoff, size_t *results)
+{
+    return syscall4(PEDIGREE_SEM_BENCHMARK, nThreads, nPosts, bHandoff, (long) results);
+}
+
 void pedigree_input_install_callback(void *p, uint32_t type, uintptr_t param)
 {
     syscall3(PEDIGREE_INPUT_INSTALL_CALLBACK, (long) p, type, param);
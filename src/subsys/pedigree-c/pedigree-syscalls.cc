@@ -20,6 +20,12 @@
 #include <vfs/Symlink.h>
 #include <vfs/VFS.h>
 #include <Log.h>
+#include <process/Semaphore.h>
+#include <process/Thread.h>
+#include <process/Scheduler.h>
+#include <processor/Processor.h>
+#include <machine/Machine.h>
+#include <machine/Timer.h>
 #include <syscallError.h>
 
 #include <machine/InputManager.h>
@@ -522,3 +528,97 @@ void *pedigree_sys_request_mem(size_t len) {
 
     return reinterpret_cast<void *>(mapAddress);
 }
+
+int pedigree_sem_statistics(size_t *stats)
+{
+    if(!stats)
+    {
+        SYSCALL_ERROR(InvalidArgument);
+        return -1;
+    }
+
+    // Wakeups, spurious wakeups and direct handoffs, in that order.
+    Semaphore::Statistics semStats = Semaphore::getStatistics();
+    stats[0] = semStats.nWakeups;
+    stats[1] = semStats.nSpuriousWakeups;
+    stats[2] = semStats.nHandoffs;
+
+    return 0;
+}
+
+/** A Semaphore shared by the threads of pedigree_sem_benchmark. */
+struct SemBenchmark
+{
+    SemBenchmark(bool bHandoff, size_t nAcquires) :
+        sem(0, bHandoff), done(0), nAcquires(nAcquires), nRunning(0)
+    {}
+
+    Semaphore sem;
+    /// Released by each thread once it has had all of its items.
+    Semaphore done;
+    size_t nAcquires;
+    /// Threads that may still touch this structure.
+    volatile size_t nRunning;
+};
+
+static int semBenchmarkThread(void *p)
+{
+    SemBenchmark *pBenchmark = reinterpret_cast<SemBenchmark*>(p);
+    for(size_t i = 0; i < pBenchmark->nAcquires; i++)
+        pBenchmark->sem.acquire();
+
+    pBenchmark->done.release();
+
+    // Last: the benchmark lives on the starting thread's stack.
+    __sync_fetch_and_sub(&pBenchmark->nRunning, 1);
+    return 0;
+}
+
+int pedigree_sem_benchmark(size_t nThreads, size_t nPosts, int bHandoff, size_t *results)
+{
+    if(!results || !nThreads || (nThreads > SEM_BENCHMARK_MAX_THREADS) || (nPosts < nThreads))
+    {
+        SYSCALL_ERROR(InvalidArgument);
+        return -1;
+    }
+
+    Timer *pTimer = Machine::instance().getTimer();
+    if(!pTimer)
+    {
+        SYSCALL_ERROR(Unimplemented);
+        return -1;
+    }
+
+    // Kernel threads sleep on a kernel Semaphore, and this thread posts to
+    // it an item at a time, so every post goes through the wake-one (or
+    // handoff) path.
+    SemBenchmark benchmark(bHandoff != 0, nPosts / nThreads);
+    nPosts = benchmark.nAcquires * nThreads;
+
+    Process *pProcess = Processor::information().getCurrentThread()->getParent();
+    benchmark.nRunning = nThreads;
+    for(size_t i = 0; i < nThreads; i++)
+        new Thread(pProcess, semBenchmarkThread, reinterpret_cast<void*>(&benchmark));
+
+    Semaphore::Statistics before = Semaphore::getStatistics();
+    uint64_t start = pTimer->getTickCount();
+
+    for(size_t i = 0; i < nPosts; i++)
+        benchmark.sem.release();
+    benchmark.done.acquire(nThreads);
+
+    uint64_t end = pTimer->getTickCount();
+    Semaphore::Statistics after = Semaphore::getStatistics();
+
+    // They may still be on their way out of done.release().
+    while(benchmark.nRunning)
+        Scheduler::instance().yield();
+
+    // Elapsed time, then the same counters as pedigree_sem_statistics.
+    results[0] = end - start;
+    results[1] = after.nWakeups - before.nWakeups;
+    results[2] = after.nSpuriousWakeups - before.nSpuriousWakeups;
+    results[3] = after.nHandoffs - before.nHandoffs;
+
+    return 0;
+}
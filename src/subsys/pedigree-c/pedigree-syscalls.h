@@ -77,6 +77,16 @@ int pedigree_get_mount(char* mount_buf, char* info_buf, size_t n);
 
 void *pedigree_sys_request_mem(size_t len);
 
+int pedigree_sem_statistics(size_t *stats);
+
+/** Most threads pedigree_sem_benchmark will start. */
+#define SEM_BENCHMARK_MAX_THREADS   64
+
+/** Times nPosts single-item releases of a kernel Semaphore that nThreads
+ *  kernel threads are sleeping on. results gets the elapsed time, then the
+ *  wakeup, spurious wakeup and handoff counts over the run. */
+int pedigree_sem_benchmark(size_t nThreads, size_t nPosts, int bHandoff, size_t *results);
+
 /** Pedigree graphics framework system calls */
 
 #ifdef __cplusplus
@@ -49,6 +49,9 @@
 
 #define PEDIGREE_SYS_REQUEST_MEM            27
 
+#define PEDIGREE_SEM_STATISTICS             28
+#define PEDIGREE_SEM_BENCHMARK              29
+
 #define PEDIGREE_EVENT_RETURN               60
 
 #define PEDIGREE_GFX_GET_PROVIDER           64
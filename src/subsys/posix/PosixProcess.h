@@ -77,8 +77,8 @@ class PosixProcess : public Process
         /** Copy constructor. Newly forked processes will call setpgid in order to set their
          *  affiliation, and if not, they're not given a process group.
          */
-        PosixProcess(Process *pParent) :
-            Process(pParent), m_pProcessGroup(0), m_GroupMembership(NoGroup)
+        PosixProcess(Process *pParent, bool bVfork = false) :
+            Process(pParent, bVfork), m_pProcessGroup(0), m_GroupMembership(NoGroup)
         {};
 
         virtual ~PosixProcess()
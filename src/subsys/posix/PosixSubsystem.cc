@@ -48,13 +48,13 @@ RadixTree<LockedFile*> g_PosixGlobalLockedFiles;
 
 /// Default constructor
 FileDescriptor::FileDescriptor() :
-    file(0), offset(0), fd(0xFFFFFFFF), fdflags(0), flflags(0), lockedFile(0)
+    file(0), offset(0), fd(0xFFFFFFFF), fdflags(0), flflags(0), lockedFile(0), dirCursor()
 {
 }
 
 /// Parameterised constructor
 FileDescriptor::FileDescriptor(File *newFile, uint64_t newOffset, size_t newFd, int fdFlags, int flFlags, LockedFile *lf) :
-    file(newFile), offset(newOffset), fd(newFd), fdflags(fdFlags), flflags(flFlags), lockedFile(lf)
+    file(newFile), offset(newOffset), fd(newFd), fdflags(fdFlags), flflags(flFlags), lockedFile(lf), dirCursor()
 {
     if(file)
     {
@@ -65,7 +65,7 @@ FileDescriptor::FileDescriptor(File *newFile, uint64_t newOffset, size_t newFd,
 
 /// Copy constructor
 FileDescriptor::FileDescriptor(FileDescriptor &desc) :
-    file(desc.file), offset(desc.offset), fd(desc.fd), fdflags(desc.fdflags), flflags(desc.flflags), lockedFile(0)
+    file(desc.file), offset(desc.offset), fd(desc.fd), fdflags(desc.fdflags), flflags(desc.flflags), lockedFile(0), dirCursor(desc.dirCursor)
 {
     if(file)
     {
@@ -76,7 +76,7 @@ FileDescriptor::FileDescriptor(FileDescriptor &desc) :
 
 /// Pointer copy constructor
 FileDescriptor::FileDescriptor(FileDescriptor *desc) :
-    file(0), offset(0), fd(0), fdflags(0), flflags(0), lockedFile(0)
+    file(0), offset(0), fd(0), fdflags(0), flflags(0), lockedFile(0), dirCursor()
 {
     if(!desc)
         return;
@@ -86,6 +86,7 @@ FileDescriptor::FileDescriptor(FileDescriptor *desc) :
     fd = desc->fd;
     fdflags = desc->fdflags;
     flflags = desc->flflags;
+    dirCursor = desc->dirCursor;
     if(file)
     {
         lockedFile = g_PosixGlobalLockedFiles.lookup(file->getFullPath());
@@ -101,6 +102,7 @@ FileDescriptor &FileDescriptor::operator = (FileDescriptor &desc)
     fd = desc.fd;
     fdflags = desc.fdflags;
     flflags = desc.flflags;
+    dirCursor = desc.dirCursor;
     if(file)
     {
         lockedFile = g_PosixGlobalLockedFiles.lookup(file->getFullPath());
@@ -27,6 +27,7 @@
 #include <utilities/UnlikelyLock.h>
 #include <utilities/ExtensibleBitmap.h>
 #include <LockGuard.h>
+#include <vfs/Directory.h>
 
 class File;
 class LockedFile;
@@ -102,6 +103,9 @@ class FileDescriptor
 
         /// Locked file, non-zero if there is an advisory lock on the file
         LockedFile *lockedFile;
+
+        /// Where readdir got to, so the next call doesn't count from the start
+        DirectoryCursor dirCursor;
 };
 
 /** Defines the compatibility layer for the POSIX Subsystem */
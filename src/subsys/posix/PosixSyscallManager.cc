@@ -31,6 +31,7 @@
 #include "pthread-syscalls.h"
 #include "select-syscalls.h"
 #include "poll-syscalls.h"
+#include "futex-syscalls.h"
 
 PosixSyscallManager::PosixSyscallManager()
 {
@@ -85,6 +86,8 @@ uintptr_t PosixSyscallManager::syscall(SyscallState &state)
             return posix_sbrk(p1);
         case POSIX_FORK:
             return posix_fork(state);
+        case POSIX_VFORK:
+            return posix_vfork(state);
         case POSIX_EXECVE:
             return posix_execve(reinterpret_cast<const char*>(p1), reinterpret_cast<const char**>(p2), reinterpret_cast<const char**>(p3), state);
         case POSIX_WAITPID:
@@ -311,6 +314,10 @@ uintptr_t PosixSyscallManager::syscall(SyscallState &state)
             return posix_pedigree_thrwakeup(static_cast<pthread_t>(p1));
         case POSIX_PEDIGREE_THRSLEEP:
             return posix_pedigree_thrsleep(static_cast<pthread_t>(p1));
+        case POSIX_FUTEX_WAIT:
+            return posix_futex_wait(reinterpret_cast<volatile int*>(p1), static_cast<int>(p2), reinterpret_cast<const timespec*>(p3));
+        case POSIX_FUTEX_WAKE:
+            return posix_futex_wake(reinterpret_cast<volatile int*>(p1), static_cast<int>(p2));
         
         case POSIX_NANOSLEEP:
             return posix_nanosleep(reinterpret_cast<struct timespec*>(p1), reinterpret_cast<struct timespec*>(p2));
@@ -352,6 +359,8 @@ uintptr_t PosixSyscallManager::syscall(SyscallState &state)
 
         case POSIX_MSYNC:
             return posix_msync(reinterpret_cast<void *>(p1), static_cast<size_t>(p2), static_cast<int>(p3));
+        case POSIX_MADVISE:
+            return posix_madvise(reinterpret_cast<void *>(p1), static_cast<size_t>(p2), static_cast<int>(p3));
         case POSIX_GETPEERNAME:
             return posix_getpeername(static_cast<int>(p1), reinterpret_cast<struct sockaddr*>(p2), reinterpret_cast<socklen_t*>(p3));
         
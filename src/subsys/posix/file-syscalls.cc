@@ -30,6 +30,7 @@
 #include <vfs/VFS.h>
 #include <console/Console.h>
 #include <network-stack/NetManager.h>
+#include <network-stack/NetworkStack.h>
 #include <network-stack/Tcp.h>
 #include <utilities/utility.h>
 #include <utilities/TimedTask.h>
@@ -843,7 +844,7 @@ int posix_readdir(int fd, dirent *ent)
         SYSCALL_ERROR(NotADirectory);
         return -1;
     }
-    File* file = Directory::fromFile(pFd->file)->getChild(pFd->offset);
+    File* file = Directory::fromFile(pFd->file)->getChild(pFd->offset, pFd->dirCursor);
     if (!file)
     {
         // Normal EOF condition.
@@ -951,6 +952,49 @@ int posix_ioctl(int fd, int command, void *buf)
 
             return 0;
         }
+
+        case FIBMAP:
+        {
+            // In: a block of the file. Out: the disk block it's stored in.
+            if (!buf)
+            {
+                SYSCALL_ERROR(InvalidArgument);
+                return -1;
+            }
+            unsigned int *pBlock = reinterpret_cast<unsigned int *>(buf);
+            *pBlock = static_cast<unsigned int>(f->file->getDiskBlock(*pBlock));
+            return 0;
+        }
+
+        case FIGETBSZ:
+        {
+            if (!buf)
+            {
+                SYSCALL_ERROR(InvalidArgument);
+                return -1;
+            }
+            *reinterpret_cast<int *>(buf) = static_cast<int>(f->file->getDiskBlockSize());
+            return 0;
+        }
+
+        case SIOCSLOSS:
+        {
+            // Loses packets on the loopback device, for testing.
+            if (!buf || !NetManager::instance().isEndpoint(f->file))
+            {
+                SYSCALL_ERROR(InvalidArgument);
+                return -1;
+            }
+            int nPerThousand = *reinterpret_cast<int *>(buf);
+            Network *pLoopback = NetworkStack::instance().getLoopback();
+            if (nPerThousand < 0 || !pLoopback || !pLoopback->setPacketLoss(nPerThousand))
+            {
+                SYSCALL_ERROR(InvalidArgument);
+                return -1;
+            }
+            return 0;
+        }
+
         default:
         {
             // Error - no such ioctl.
@@ -1482,6 +1526,28 @@ int posix_msync(void *p, size_t len, int flags) {
     return 0;
 }
 
+int posix_madvise(void *addr, size_t len, int advice)
+{
+    F_NOTICE("madvise(" << reinterpret_cast<uintptr_t>(addr) << ", " << Dec << len << ", " << advice << Hex << ")");
+
+    MemoryMappedFileManager::Advice mmAdvice;
+    switch (advice)
+    {
+        case MADV_NORMAL: mmAdvice = MemoryMappedFileManager::Normal; break;
+        case MADV_RANDOM: mmAdvice = MemoryMappedFileManager::Random; break;
+        case MADV_SEQUENTIAL: mmAdvice = MemoryMappedFileManager::Sequential; break;
+        case MADV_WILLNEED: mmAdvice = MemoryMappedFileManager::WillNeed; break;
+        case MADV_DONTNEED: mmAdvice = MemoryMappedFileManager::DontNeed; break;
+        default:
+            SYSCALL_ERROR(InvalidArgument);
+            return -1;
+    }
+
+    // Advice is only a hint, so memory that isn't file-backed is fine.
+    MemoryMappedFileManager::instance().advise(reinterpret_cast<uintptr_t>(addr), len, mmAdvice);
+    return 0;
+}
+
 int posix_munmap(void *addr, size_t len)
 {
     F_NOTICE("munmap(" << reinterpret_cast<uintptr_t>(addr) << ", " << Dec << len << Hex << ")");
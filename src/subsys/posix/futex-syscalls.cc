@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "futex-syscalls.h"
+#include <syscallError.h>
+#include "errors.h"
+
+#include <processor/Processor.h>
+#include <processor/VirtualAddressSpace.h>
+#include <processor/PhysicalMemoryManager.h>
+#include <process/Semaphore.h>
+#include <process/Mutex.h>
+#include <process/Thread.h>
+#include <utilities/List.h>
+#include <Log.h>
+
+#if 0
+#define FT_NOTICE(x) NOTICE("[" << Dec << Processor::information().getCurrentThread()->getParent()->getId() << "." << Processor::information().getCurrentThread()->getId() << "]\t" << Hex << x)
+#else
+#define FT_NOTICE(x)
+#endif
+
+/** Identifies a futex word. Private futexes are keyed on the address space
+ *  and virtual address of the word, shared ones on its physical address. */
+struct FutexKey
+{
+    FutexKey() : space(0), address(0)
+    {}
+
+    bool operator == (const FutexKey &other) const
+    {
+        return (space == other.space) && (address == other.address);
+    }
+
+    /// The address space the word is private to, or zero if shared.
+    uintptr_t space;
+    /// Virtual address of a private word, physical address of a shared one.
+    uintptr_t address;
+};
+
+/** A thread blocked in posix_futex_wait. Lives on the waiting thread's
+ *  kernel stack; wakers unlink it and set bWoken under the bucket lock. */
+struct FutexWaiter
+{
+    FutexWaiter(const FutexKey &key) : key(key), sem(0), bWoken(false)
+    {}
+
+    FutexKey key;
+    Semaphore sem;
+    bool bWoken;
+};
+
+/** One hash chain of futex waiters. */
+struct FutexBucket
+{
+    FutexBucket() : lock(false), waiters()
+    {}
+
+    Mutex lock;
+    List<FutexWaiter*> waiters;
+};
+
+static FutexBucket g_FutexBuckets[FUTEX_HASH_BUCKETS];
+
+/** Works out the key for a userspace futex word.
+ *
+ *  Words in MAP_SHARED memory may be waited on from several address spaces,
+ *  so they're keyed on the page that backs them. Everything else is keyed on
+ *  the address space and the virtual address: the physical page behind a
+ *  private word changes when a copy-on-write fault after fork() gives the
+ *  writer its own copy, and waiters must not be lost when that happens. */
+static FutexKey futexKey(volatile int *addr)
+{
+    // Fault the page in if it isn't yet. Only a read: a write here would
+    // break copy-on-write sharing for no reason.
+    (void) *addr;
+
+    size_t pageSize = PhysicalMemoryManager::getPageSize();
+    uintptr_t v = reinterpret_cast<uintptr_t>(addr);
+
+    physical_uintptr_t phys = 0;
+    size_t flags = 0;
+    VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
+    va.getMapping(reinterpret_cast<void*>(v & ~(pageSize - 1)), phys, flags);
+
+    FutexKey key;
+    if(flags & VirtualAddressSpace::Shared)
+        key.address = phys + (v & (pageSize - 1));
+    else
+    {
+        key.space = reinterpret_cast<uintptr_t>(&va);
+        key.address = v;
+    }
+    return key;
+}
+
+static FutexBucket &futexBucket(const FutexKey &key)
+{
+    uintptr_t h = key.address ^ key.space;
+    return g_FutexBuckets[((h >> 2) ^ (h >> 12)) % FUTEX_HASH_BUCKETS];
+}
+
+/** Checks that a buffer passed in lies wholly in userspace, as the kernel
+ *  is about to dereference it. */
+static bool isUserBuffer(const volatile void *p, size_t len)
+{
+    uintptr_t v = reinterpret_cast<uintptr_t>(p);
+    VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
+    return (v >= va.getUserStart()) && (v < va.getKernelStart()) &&
+           (len <= va.getKernelStart() - v);
+}
+
+static bool futexValid(volatile int *addr)
+{
+    return addr && !(reinterpret_cast<uintptr_t>(addr) & (sizeof(int) - 1));
+}
+
+FutexWaitResult futexWait(volatile int *addr, int val, const struct timespec *timeout)
+{
+    size_t timeoutSecs = 0, timeoutUsecs = 0;
+    if(timeout)
+    {
+        timeoutSecs = timeout->tv_sec;
+        timeoutUsecs = timeout->tv_nsec / 1000;
+    }
+
+    FutexKey key = futexKey(addr);
+    FutexBucket &bucket = futexBucket(key);
+    FutexWaiter waiter(key);
+
+    // The value check and the enqueue happen under the bucket lock, which
+    // every waker also takes, so a wake cannot slip in between them.
+    bucket.lock.acquire();
+    if(*addr != val)
+    {
+        bucket.lock.release();
+        return FutexValueChanged;
+    }
+
+    // Semaphore::acquire treats a zero timeout as "forever".
+    if(timeout && !timeoutSecs && !timeoutUsecs)
+    {
+        bucket.lock.release();
+        return FutexTimedOut;
+    }
+
+    bucket.waiters.pushBack(&waiter);
+    bucket.lock.release();
+
+    waiter.sem.acquire(1, timeoutSecs, timeoutUsecs);
+
+    // Wakers unlink the waiter and release the semaphore with the bucket lock
+    // held; taking it here guarantees they are done with our stack.
+    bucket.lock.acquire();
+    bool bWoken = waiter.bWoken;
+    if(!bWoken)
+    {
+        for(List<FutexWaiter*>::Iterator it = bucket.waiters.begin();
+            it != bucket.waiters.end();
+            it++)
+        {
+            if(*it == &waiter)
+            {
+                bucket.waiters.erase(it);
+                break;
+            }
+        }
+    }
+    bucket.lock.release();
+
+    if(bWoken)
+        return FutexWoken;
+    return timeout ? FutexTimedOut : FutexInterrupted;
+}
+
+int futexWake(volatile int *addr, int nWake)
+{
+    if(nWake <= 0)
+        return 0;
+
+    FutexKey key = futexKey(addr);
+    FutexBucket &bucket = futexBucket(key);
+
+    int nWoken = 0;
+    bucket.lock.acquire();
+    for(List<FutexWaiter*>::Iterator it = bucket.waiters.begin();
+        (it != bucket.waiters.end()) && (nWoken < nWake);
+        )
+    {
+        FutexWaiter *pWaiter = *it;
+        if(!(pWaiter->key == key))
+        {
+            it++;
+            continue;
+        }
+
+        it = bucket.waiters.erase(it);
+        pWaiter->bWoken = true;
+        pWaiter->sem.release();
+        nWoken++;
+    }
+    bucket.lock.release();
+
+    return nWoken;
+}
+
+int posix_futex_wait(volatile int *addr, int val, const struct timespec *timeout)
+{
+    FT_NOTICE("futex_wait(" << reinterpret_cast<uintptr_t>(addr) << ", " << Dec << val << Hex << ")");
+
+    if(!futexValid(addr))
+    {
+        SYSCALL_ERROR(InvalidArgument);
+        return -1;
+    }
+    if(!isUserBuffer(addr, sizeof(*addr)))
+    {
+        SYSCALL_ERROR(BadAddress);
+        return -1;
+    }
+
+    if(timeout && !isUserBuffer(timeout, sizeof(*timeout)))
+    {
+        SYSCALL_ERROR(BadAddress);
+        return -1;
+    }
+    if(timeout && ((timeout->tv_sec < 0) || (timeout->tv_nsec < 0) || (timeout->tv_nsec >= 1000000000)))
+    {
+        SYSCALL_ERROR(InvalidArgument);
+        return -1;
+    }
+
+    switch(futexWait(addr, val, timeout))
+    {
+        case FutexWoken:
+            return 0;
+        case FutexValueChanged:
+            SYSCALL_ERROR(NoMoreProcesses);
+            break;
+        case FutexTimedOut:
+            SYSCALL_ERROR(TimedOut);
+            break;
+        case FutexInterrupted:
+            SYSCALL_ERROR(Interrupted);
+            break;
+    }
+
+    return -1;
+}
+
+int posix_futex_wake(volatile int *addr, int nWake)
+{
+    FT_NOTICE("futex_wake(" << reinterpret_cast<uintptr_t>(addr) << ", " << Dec << nWake << Hex << ")");
+
+    if(!futexValid(addr))
+    {
+        SYSCALL_ERROR(InvalidArgument);
+        return -1;
+    }
+    if(!isUserBuffer(addr, sizeof(*addr)))
+    {
+        SYSCALL_ERROR(BadAddress);
+        return -1;
+    }
+
+    return futexWake(addr, nWake);
+}
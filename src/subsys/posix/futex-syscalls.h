@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef _FUTEX_SYSCALLS_H
+#define _FUTEX_SYSCALLS_H
+
+#include <processor/types.h>
+
+#include "newlib.h"
+
+/** Number of hash buckets the futex wait queues are spread over. */
+#define FUTEX_HASH_BUCKETS      64
+
+/** Outcome of a futex wait, for kernel-side callers of futexWait. */
+enum FutexWaitResult
+{
+    FutexWoken = 0,
+    FutexValueChanged,
+    FutexTimedOut,
+    FutexInterrupted
+};
+
+/** Kernel-side futex primitives, shared by the syscalls below and by other
+ *  primitives (e.g. semaphores) whose state lives in userspace. The address
+ *  must be a valid, 4-byte aligned word in the current address space. */
+FutexWaitResult futexWait(volatile int *addr, int val, const struct timespec *timeout);
+int futexWake(volatile int *addr, int nWake);
+
+/** Blocks the calling thread while *addr == val.
+ *
+ *  A futex in MAP_SHARED memory is keyed on the physical address of the
+ *  word, so waiters and wakers in different address spaces meet on it. Any
+ *  other futex is private to the calling address space.
+ *  \param addr The (4-byte aligned) userspace futex word.
+ *  \param val The value the caller last observed in the word.
+ *  \param timeout Optional relative timeout; null blocks indefinitely.
+ *  \return 0 when woken, -1 with EAGAIN if the word no longer held val,
+ *          ETIMEDOUT on timeout or EINTR if interrupted by a signal. */
+int posix_futex_wait(volatile int *addr, int val, const struct timespec *timeout);
+
+/** Wakes up to nWake threads blocked on addr.
+ *  \return The number of threads woken. */
+int posix_futex_wake(volatile int *addr, int nWake);
+
+#endif
@@ -35,14 +35,45 @@ int h_errno; // required by networking code
 typedef void (*pthread_once_func_t)(void);
 int onceFunctions[32] = {0};
 
-static int pedigree_thrwakeup(pthread_t t)
+/// Number of futex waiters to wake for "wake everyone".
+#define FUTEX_WAKE_ALL      0x7FFFFFFF
+
+/// Number of times a contended mutex is polled before sleeping in the kernel.
+#define MUTEX_SPIN_COUNT    100
+
+static int futex_wait(volatile int *addr, int val, const struct timespec *timeout)
 {
-    return syscall1(POSIX_PEDIGREE_THRWAKEUP, (long) t);
+    return syscall3(POSIX_FUTEX_WAIT, (long) addr, val, (long) timeout);
 }
 
-static int pedigree_thrsleep(pthread_t t)
+static int futex_wake(volatile int *addr, int n)
 {
-    return syscall1(POSIX_PEDIGREE_THRSLEEP, (long) t);
+    return syscall2(POSIX_FUTEX_WAKE, (long) addr, n);
+}
+
+/// Converts an absolute wall-clock deadline into the relative timeout the
+/// futex syscall takes. Returns null if there is no deadline.
+static struct timespec *futex_timeout(const struct timespec *abstime, struct timespec *rel)
+{
+    if(!abstime)
+        return 0;
+
+    struct timeval now;
+    gettimeofday(&now, 0);
+
+    rel->tv_sec = abstime->tv_sec - now.tv_sec;
+    rel->tv_nsec = abstime->tv_nsec - (now.tv_usec * 1000);
+    if(rel->tv_nsec < 0)
+    {
+        rel->tv_nsec += 1000000000;
+        rel->tv_sec--;
+    }
+
+    // An expired deadline becomes a zero timeout, which times out at once.
+    if(rel->tv_sec < 0)
+        rel->tv_sec = rel->tv_nsec = 0;
+
+    return rel;
 }
 
 int pthread_once(pthread_once_t *once_control, pthread_once_func_t init_routine)
@@ -212,11 +243,13 @@ int pthread_attr_setschedparam(pthread_attr_t *attr, const struct sched_param *p
     return 0;
 }
 
-/// Uses a pthread_mutex_t but really works for both semaphores and mutexes
-void __pedigree_init_lock(pthread_mutex_t *mutex, int startValue)
-{
-    mutex->value = startValue;
-}
+/**
+ * Mutexes are a single futex word, following Drepper's "Futexes Are Tricky":
+ * 0 is unlocked, 1 is locked, and 2 is locked with (possibly) sleeping
+ * waiters. Lock and unlock are a single atomic operation each unless the
+ * mutex is contended, and unlock only enters the kernel if the word says
+ * there is someone to wake.
+ */
 
 int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
 {
@@ -230,13 +263,7 @@ int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
         return -1;
     }
 
-    memset(mutex, 0, sizeof(pthread_mutex_t));
-
-    if(pthread_spin_init(&mutex->lock, 0) < 0)
-        return -1; // errno from the function
-
-    __pedigree_init_lock(mutex, 1);
-    mutex->q = mutex->back = mutex->front = 0;
+    mutex->value = 0;
 
     return 0;
 }
@@ -253,12 +280,11 @@ int pthread_mutex_destroy(pthread_mutex_t *mutex)
         return -1;
     }
 
-    mutex->value = 0;
-    mutex->q = mutex->back = mutex->front = 0;
-
-    pthread_spin_destroy(&mutex->lock);
-
-    memset(mutex, 0, sizeof(pthread_mutex_t));
+    if(mutex->value)
+    {
+        errno = EBUSY;
+        return -1;
+    }
 
     return 0;
 }
@@ -275,54 +301,30 @@ int pthread_mutex_lock(pthread_mutex_t *mutex)
         return -1;
     }
 
-    // Attempt a direct acquire
-    int32_t val = mutex->value;
-    if((val - 1) >= 0)
-    {
-        if(__sync_bool_compare_and_swap(&mutex->value, val, val - 1))
-            return 0;
-    }
-
-    // Couldn't acquire, lock
-    mutex_q_item *i = (mutex_q_item*) malloc(sizeof(mutex_q_item));
-    i->thr = pthread_self();
-    i->next = 0;
-
-    mutex_q_item *old_front = mutex->front;
-    mutex_q_item *old_back = mutex->back;
-    mutex_q_item *old_q = mutex->q;
+    // Uncontended: 0 -> 1 and we're done.
+    int c = __sync_val_compare_and_swap(&mutex->value, 0, 1);
+    if(!c)
+        return 0;
 
-    pthread_spin_lock(&mutex->lock);
-    if(!mutex->q)
-    {
-        mutex->back = mutex->front = i;
-        mutex->q = mutex->front;
-    }
-    else
+    // The holder may be about to let go, so poll briefly before sleeping.
+    int i;
+    for(i = 0; (i < MUTEX_SPIN_COUNT) && (c == 1); i++)
     {
-        mutex->back->next = i;
-        mutex->back = i;
+        c = __sync_val_compare_and_swap(&mutex->value, 0, 1);
+        if(!c)
+            return 0;
     }
 
-    pthread_spin_unlock(&mutex->lock);
-
-    // Check for mutex unlock while we've been manipulating the queue!
-    if(val == (mutex->value - 1))
+    // Mark the mutex contended and sleep until we manage to take it. Taking
+    // it with value 2 is conservative: we can't know if others still wait.
+    if(c != 2)
+        c = __sync_lock_test_and_set(&mutex->value, 2);
+    while(c)
     {
-        pthread_spin_lock(&mutex->lock);
-        mutex->back = old_back;
-        mutex->front = old_front;
-        mutex->q = old_q;
-        free(i);
-        pthread_spin_unlock(&mutex->lock);
-
-        return 0;
+        futex_wait(&mutex->value, 2, 0);
+        c = __sync_lock_test_and_set(&mutex->value, 2);
     }
-    pedigree_thrsleep(i->thr);
 
-    free(i);
-
-    // Locked
     return 0;
 }
 
@@ -338,12 +340,8 @@ int pthread_mutex_trylock(pthread_mutex_t *mutex)
         return -1;
     }
 
-    int32_t val = mutex->value;
-    if((val - 1) >= 0)
-    {
-        if(__sync_bool_compare_and_swap(&mutex->value, val, val - 1))
-            return 0;
-    }
+    if(__sync_bool_compare_and_swap(&mutex->value, 0, 1))
+        return 0;
 
     errno = EBUSY;
     return -1;
@@ -361,29 +359,19 @@ int pthread_mutex_unlock(pthread_mutex_t *mutex)
         return -1;
     }
 
-    // Mutexes are binary semaphores.
-    __sync_val_compare_and_swap(&mutex->value, 0, 1);
-
-    pthread_spin_lock(&mutex->lock);
-    if((!mutex->q) || (!mutex->front))
+    if(!mutex->value)
     {
-        pthread_spin_unlock(&mutex->lock);
-        return 0;
+        errno = EPERM;
+        return -1;
     }
 
-    // Wake up the next waiting thread.
-    mutex_q_item *front = mutex->front;
-    if(front)
+    // 1 -> 0 means nobody was waiting. Otherwise hand off to one sleeper.
+    if(__sync_fetch_and_sub(&mutex->value, 1) != 1)
     {
-        mutex->front = front->next;
-        mutex->q = mutex->front;
-
-        pthread_t thr = front->thr;
-        pedigree_thrwakeup(thr);
+        mutex->value = 0;
+        futex_wake(&mutex->value, 1);
     }
 
-    pthread_spin_unlock(&mutex->lock);
-
     return 0;
 }
 
@@ -398,16 +386,13 @@ int pthread_mutexattr_destroy(pthread_mutexattr_t *attr)
 }
 
 /**
- * Some background on how I've decided to handle condvars...
- *
- * Basically, waiting on a resource to reach a certain value, while keeping a
- * lock on it, is the idea of condvars. So I've decided to implement condvars
- * as mutexes, which will (hopefully!) work just as well.
+ * Condition variables are a sequence number that every signal and broadcast
+ * bumps. A waiter samples the sequence while still holding the mutex, and
+ * then sleeps on it only if it hasn't moved, so a signal between the unlock
+ * and the sleep can't be lost. Signallers only enter the kernel if someone
+ * is waiting.
  */
 
-/// \todo Eventually implement condvars properly rather than as a thin wrapper
-///       arround a pair of mutexes.
-
 int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
 {
 #if PTHREAD_DEBUG
@@ -420,12 +405,10 @@ int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
         return -1;
     }
 
-    int ret = pthread_mutex_init(cond, 0);
-#if PTHREAD_DEBUG
-    syslog(LOG_NOTICE, "pthread_cond_init: returning %d from mutex init [%s]\n", ret, strerror(errno));
-#endif
+    cond->seq = 0;
+    cond->waiters = 0;
 
-    return ret;
+    return 0;
 }
 
 int pthread_cond_destroy(pthread_cond_t *cond)
@@ -436,7 +419,13 @@ int pthread_cond_destroy(pthread_cond_t *cond)
         return -1;
     }
 
-    return pthread_mutex_destroy(cond);
+    if(cond->waiters)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    return 0;
 }
 
 int pthread_cond_broadcast(pthread_cond_t *cond)
@@ -447,31 +436,29 @@ int pthread_cond_broadcast(pthread_cond_t *cond)
         return -1;
     }
 
-    pthread_spin_lock(&cond->lock);
-    while(cond->front)
-    {
-        __sync_fetch_and_sub(&cond->value, 1);
-
-        pedigree_thrwakeup(cond->front->thr);
-        cond->front = cond->front->next;
-    }
-    pthread_spin_unlock(&cond->lock);
+    __sync_fetch_and_add(&cond->seq, 1);
+    if(cond->waiters)
+        futex_wake(&cond->seq, FUTEX_WAKE_ALL);
 
     return 0;
 }
 
 int pthread_cond_signal(pthread_cond_t *cond)
 {
-    return pthread_mutex_unlock(cond);
-}
+    if(!cond)
+    {
+        errno = EINVAL;
+        return -1;
+    }
 
-int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *tm)
-{
-    errno = ENOSYS;
-    return -1;
+    __sync_fetch_and_add(&cond->seq, 1);
+    if(cond->waiters)
+        futex_wake(&cond->seq, 1);
+
+    return 0;
 }
 
-int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *tm)
 {
     if((!cond) || (!mutex))
     {
@@ -479,14 +466,40 @@ int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
         return -1;
     }
 
-    int e = 0;
-    e = pthread_mutex_unlock(mutex);
+    int seq = cond->seq;
+    __sync_fetch_and_add(&cond->waiters, 1);
+
+    int e = pthread_mutex_unlock(mutex);
     if(e)
+    {
+        __sync_fetch_and_sub(&cond->waiters, 1);
         return e;
-    e = pthread_mutex_lock(cond);
-    pthread_mutex_lock(mutex);
+    }
+
+    struct timespec rel;
+    int ret = futex_wait(&cond->seq, seq, futex_timeout(tm, &rel));
+    int err = errno;
+
+    __sync_fetch_and_sub(&cond->waiters, 1);
+
+    // Other waiters may have been woken with us (broadcast), so take the
+    // mutex in the contended state to make sure our unlock wakes them.
+    while(__sync_lock_test_and_set(&mutex->value, 2))
+        futex_wait(&mutex->value, 2, 0);
+
+    // Spurious wakeups are allowed; only a timeout is reported.
+    if((ret < 0) && (err == ETIMEDOUT))
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
 
-    return e;
+    return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    return pthread_cond_timedwait(cond, mutex, 0);
 }
 
 int pthread_condattr_destroy(pthread_condattr_t *attr)
@@ -499,6 +512,266 @@ int pthread_condattr_init(pthread_condattr_t *attr)
     return 0;
 }
 
+/**
+ * Reader/writer locks keep the number of readers in the futex word, or -1
+ * while a writer holds the lock. Unlocking to zero wakes every sleeper and
+ * lets them race for the lock again.
+ */
+
+int pthread_rwlockattr_init(pthread_rwlockattr_t *attr)
+{
+    return 0;
+}
+
+int pthread_rwlockattr_destroy(pthread_rwlockattr_t *attr)
+{
+    return 0;
+}
+
+int pthread_rwlock_init(pthread_rwlock_t *lock, const pthread_rwlockattr_t *attr)
+{
+    if(!lock)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    lock->state = 0;
+    lock->waiters = 0;
+
+    return 0;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t *lock)
+{
+    if(!lock)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(lock->state || lock->waiters)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    return 0;
+}
+
+/// Sleeps until the lock word changes from state, or the deadline passes.
+static int rwlock_sleep(pthread_rwlock_t *lock, int state, const struct timespec *tm)
+{
+    struct timespec rel;
+
+    __sync_fetch_and_add(&lock->waiters, 1);
+    int ret = futex_wait(&lock->state, state, futex_timeout(tm, &rel));
+    int err = errno;
+    __sync_fetch_and_sub(&lock->waiters, 1);
+
+    if((ret < 0) && (err == ETIMEDOUT))
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    return 0;
+}
+
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *lock, const struct timespec *tm)
+{
+    if(!lock)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while(1)
+    {
+        int state = lock->state;
+        if(state >= 0)
+        {
+            if(__sync_bool_compare_and_swap(&lock->state, state, state + 1))
+                return 0;
+            continue;
+        }
+
+        if(rwlock_sleep(lock, state, tm) < 0)
+            return -1;
+    }
+}
+
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *lock, const struct timespec *tm)
+{
+    if(!lock)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while(1)
+    {
+        if(__sync_bool_compare_and_swap(&lock->state, 0, -1))
+            return 0;
+
+        int state = lock->state;
+        if(!state)
+            continue;
+
+        if(rwlock_sleep(lock, state, tm) < 0)
+            return -1;
+    }
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *lock)
+{
+    return pthread_rwlock_timedrdlock(lock, 0);
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *lock)
+{
+    return pthread_rwlock_timedwrlock(lock, 0);
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *lock)
+{
+    if(!lock)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int state = lock->state;
+    while(state >= 0)
+    {
+        int old = __sync_val_compare_and_swap(&lock->state, state, state + 1);
+        if(old == state)
+            return 0;
+        state = old;
+    }
+
+    errno = EBUSY;
+    return -1;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *lock)
+{
+    if(!lock)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(__sync_bool_compare_and_swap(&lock->state, 0, -1))
+        return 0;
+
+    errno = EBUSY;
+    return -1;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *lock)
+{
+    if(!lock)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int state = lock->state;
+    if(!state)
+    {
+        errno = EPERM;
+        return -1;
+    }
+
+    int released;
+    if(state < 0)
+    {
+        // A full barrier, so the load of waiters below can't be hoisted
+        // above the unlock and miss a reader that went to sleep meanwhile.
+        __sync_val_compare_and_swap(&lock->state, -1, 0);
+        released = 1;
+    }
+    else
+        released = (__sync_sub_and_fetch(&lock->state, 1) == 0);
+
+    if(released && lock->waiters)
+        futex_wake(&lock->state, FUTEX_WAKE_ALL);
+
+    return 0;
+}
+
+/**
+ * Barriers count arrivals down to zero; the last thread to arrive resets the
+ * count and bumps the cycle number, which everyone else is sleeping on.
+ */
+
+int pthread_barrierattr_init(pthread_barrierattr_t *attr)
+{
+    return 0;
+}
+
+int pthread_barrierattr_destroy(pthread_barrierattr_t *attr)
+{
+    return 0;
+}
+
+int pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr, unsigned count)
+{
+    if(!barrier || !count)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    barrier->count = barrier->total = count;
+    barrier->cycle = 0;
+
+    return 0;
+}
+
+int pthread_barrier_destroy(pthread_barrier_t *barrier)
+{
+    if(!barrier)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(barrier->count != barrier->total)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    return 0;
+}
+
+int pthread_barrier_wait(pthread_barrier_t *barrier)
+{
+    if(!barrier)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int cycle = barrier->cycle;
+    if(__sync_sub_and_fetch(&barrier->count, 1) == 0)
+    {
+        // Reset the count before opening the barrier, so that threads racing
+        // into the next cycle count against the right total.
+        barrier->count = barrier->total;
+        __sync_fetch_and_add(&barrier->cycle, 1);
+        futex_wake(&barrier->cycle, FUTEX_WAKE_ALL);
+        return PTHREAD_BARRIER_SERIAL_THREAD;
+    }
+
+    while(barrier->cycle == cycle)
+        futex_wait(&barrier->cycle, cycle, 0);
+
+    return 0;
+}
+
 void* pthread_getspecific(pthread_key_t key)
 {
     return (void*) syscall1(POSIX_PTHREAD_GETSPECIFIC, key);
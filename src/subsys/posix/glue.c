@@ -197,7 +197,8 @@ int fork(void)
 
 int vfork(void)
 {
-    return fork();
+    // No atfork handlers: the child must only exec or _exit.
+    return (long)syscall0(POSIX_VFORK);
 }
 
 int fstat(int file, struct stat *st)
@@ -1758,6 +1759,22 @@ int munmap(void *addr, size_t len)
     return (long) syscall2(POSIX_MUNMAP, (long) addr, (long) len);
 }
 
+int madvise(void *addr, size_t len, int advice)
+{
+    return (int) syscall3(POSIX_MADVISE, (long) addr, (long) len, advice);
+}
+
+int posix_madvise(void *addr, size_t len, int advice)
+{
+    // Unlike madvise, this returns the error number rather than setting errno.
+    int saved = errno;
+    int ret = 0;
+    if(madvise(addr, len, advice) < 0)
+        ret = errno;
+    errno = saved;
+    return ret;
+}
+
 int getgroups(int gidsetsize, gid_t grouplist[])
 {
     if(gidsetsize == 0)
@@ -1915,19 +1932,58 @@ sem_t *sem_open(const char *name, int mode, ...)
     return 0;
 }
 
+/// Takes one unit from a semaphore without entering the kernel.
+static int sem_trydecrement(sem_t *sem)
+{
+    int val = sem->value;
+    while(val > 0)
+    {
+        int old = __sync_val_compare_and_swap(&sem->value, val, val - 1);
+        if(old == val)
+            return 1;
+        val = old;
+    }
+
+    return 0;
+}
+
 int sem_post(sem_t *sem)
 {
-    return syscall1(POSIX_SEM_POST, (long) sem);
+    if(!sem)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Only bother the kernel if someone is asleep on the count.
+    __sync_fetch_and_add(&sem->value, 1);
+    if(sem->waiters)
+        syscall2(POSIX_FUTEX_WAKE, (long) &sem->value, 1);
+
+    return 0;
 }
 
 int sem_timedwait(sem_t *sem, const struct timespec *tm)
 {
+    if(sem && sem_trydecrement(sem))
+        return 0;
+
     return syscall2(POSIX_SEM_TIMEWAIT, (long) sem, (long) tm);
 }
 
 int sem_trywait(sem_t *sem)
 {
-    return syscall1(POSIX_SEM_TRYWAIT, (long) sem);
+    if(!sem)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(sem_trydecrement(sem))
+        return 0;
+
+    errno = EAGAIN;
+    return -1;
 }
 
 int sem_unlink(const char *name)
@@ -1938,6 +1994,9 @@ int sem_unlink(const char *name)
 
 int sem_wait(sem_t *sem)
 {
+    if(sem && sem_trydecrement(sem))
+        return 0;
+
     return syscall1(POSIX_SEM_WAIT, (long) sem);
 }
 
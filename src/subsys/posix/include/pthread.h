@@ -21,7 +21,7 @@
 // #define PTHREAD_CANCEL_DEFERRED
 #define PTHREAD_CANCEL_DISABLE          0
 #define PTHREAD_CANCELED
-#define PTHREAD_COND_INITIALIZER        PTHREAD_MUTEX_INITIALIZER
+#define PTHREAD_COND_INITIALIZER        {0, 0}
 
 #define PTHREAD_CREATE_DETACHED         1
 #define PTHREAD_CREATE_JOINABLE         0
@@ -29,10 +29,14 @@
 #define PTHREAD_EXPLICIT_SCHED
 #define PTHREAD_INHERIT_SCHED
 
-#define PTHREAD_MUTEX_INITIALIZER       {0, 0, 0}
+#define PTHREAD_MUTEX_INITIALIZER       {0}
 
 #define PTHREAD_ONCE_INIT               0
 
+#define PTHREAD_RWLOCK_INITIALIZER      {0, 0}
+
+#define PTHREAD_BARRIER_SERIAL_THREAD   1
+
 #define PTHREAD_PROCESS_SHARED          1
 #define PTHREAD_PROCESS_PRIVATE         2
 
@@ -99,13 +103,12 @@ int         _EXFUN(pthread_cond_init, (pthread_cond_t *, const pthread_condattr_
 int         _EXFUN(pthread_cond_destroy, (pthread_cond_t *));
 int         _EXFUN(pthread_cond_broadcast, (pthread_cond_t *));
 int         _EXFUN(pthread_cond_signal, (pthread_cond_t *));
-int NOTIMPL _EXFUN(pthread_cond_timedwait, (pthread_cond_t *, pthread_mutex_t *, const struct timespec *));
+int         _EXFUN(pthread_cond_timedwait, (pthread_cond_t *, pthread_mutex_t *, const struct timespec *));
 int         _EXFUN(pthread_cond_wait, (pthread_cond_t *, pthread_mutex_t *));
 int         _EXFUN(pthread_condattr_destroy, (pthread_condattr_t *));
 int         _EXFUN(pthread_condattr_init, (pthread_condattr_t *));
 
 // RW Locks
-/*
 int         _EXFUN(pthread_rwlockattr_init, (pthread_rwlockattr_t *));
 int         _EXFUN(pthread_rwlock_destroy, (pthread_rwlock_t *));
 int         _EXFUN(pthread_rwlock_init, (pthread_rwlock_t *, const pthread_rwlockattr_t *));
@@ -115,8 +118,17 @@ int         _EXFUN(pthread_rwlock_trywrlock, (pthread_rwlock_t *));
 int         _EXFUN(pthread_rwlock_unlock, (pthread_rwlock_t *));
 int         _EXFUN(pthread_rwlock_wrlock, (pthread_rwlock_t *));
 int         _EXFUN(pthread_rwlockattr_destroy, (pthread_rwlockattr_t *));
-*/
+int         _EXFUN(pthread_rwlock_timedrdlock, (pthread_rwlock_t *, const struct timespec *));
+int         _EXFUN(pthread_rwlock_timedwrlock, (pthread_rwlock_t *, const struct timespec *));
+
+// Barriers
+int         _EXFUN(pthread_barrier_init, (pthread_barrier_t *, const pthread_barrierattr_t *, unsigned));
+int         _EXFUN(pthread_barrier_destroy, (pthread_barrier_t *));
+int         _EXFUN(pthread_barrier_wait, (pthread_barrier_t *));
+int         _EXFUN(pthread_barrierattr_init, (pthread_barrierattr_t *));
+int         _EXFUN(pthread_barrierattr_destroy, (pthread_barrierattr_t *));
 
+// Spinlocks
 int         _EXFUN(pthread_spin_destroy, (pthread_spinlock_t*));
 int         _EXFUN(pthread_spin_init, (pthread_spinlock_t*, int));
 int         _EXFUN(pthread_spin_lock, (pthread_spinlock_t*));
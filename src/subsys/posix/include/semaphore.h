@@ -3,10 +3,16 @@
 
 #include <time.h>
 
-// Semaphores take up one file descriptor
-typedef int sem_t;
+// Semaphores live entirely in userspace: the count is a futex word, and the
+// kernel is only entered to sleep on it or to wake sleepers.
+typedef struct _sem_t
+{
+    volatile int value;
+    volatile int waiters;
+} sem_t;
 
-#define SEM_FAILED ((sem_t) -1)
+#define SEM_FAILED ((sem_t *) 0)
+#define SEM_VALUE_MAX 0x7FFFFFFF
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +19,7 @@ _BEGIN_STD_C
 #define FIONBIO     0x2001  /* Non-blocking? */
 
 #define SIOCATMARK  0x3000  /* Socket at the OOB mark? */
+#define SIOCSLOSS   0x3001  /* Packets per thousand the loopback drops (testing) */
 
 /* http://www.opengroup.org/onlinepubs/009695399/functions/ioctl.html */
 #define I_PUSH      0x4000
@@ -52,7 +53,10 @@ _BEGIN_STD_C
 #define I_PLINK     0x401B
 #define I_PUNLINK   0x401C
 
-#define __IOCTL_LAST  0x401C
+#define FIBMAP      0x5000  /* Disk block a block of a file is stored in */
+#define FIGETBSZ    0x5001  /* Size of the blocks FIBMAP counts in */
+
+#define __IOCTL_LAST  0x5001
 
 int _EXFUN(ioctl, (int fildes, int request, void *args));
 
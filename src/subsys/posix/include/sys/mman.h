@@ -21,12 +21,26 @@ _BEGIN_STD_C
 #define MS_SYNC         0x2
 #define MS_INVALIDATE   0x4
 
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
+
+#define POSIX_MADV_NORMAL       MADV_NORMAL
+#define POSIX_MADV_RANDOM       MADV_RANDOM
+#define POSIX_MADV_SEQUENTIAL   MADV_SEQUENTIAL
+#define POSIX_MADV_WILLNEED     MADV_WILLNEED
+#define POSIX_MADV_DONTNEED     MADV_DONTNEED
+
 #include <sys/types.h>
 
 void  *mmap(void *, size_t, int, int, int, off_t);
 int    munmap(void *, size_t);
 int    mprotect(void *addr, size_t len, int prot);
 int    msync(void *addr, size_t len, int flags);
+int    madvise(void *addr, size_t len, int advice);
+int    posix_madvise(void *addr, size_t len, int advice);
 
 _END_STD_C
 
@@ -385,14 +385,8 @@ typedef int pthread_condattr_t;
 typedef int pthread_key_t;
 typedef int pthread_mutexattr_t;
 typedef int pthread_once_t;
-typedef int pthread_rwlock_t;
 typedef int pthread_rwlockattr_t;
-
-typedef struct _mutex_q_item
-{
-    pthread_t thr;
-    struct _mutex_q_item *next;
-} mutex_q_item;
+typedef int pthread_barrierattr_t;
 
 typedef struct _pthread_spinlock_t
 {
@@ -401,15 +395,33 @@ typedef struct _pthread_spinlock_t
     pthread_t locker;
 } pthread_spinlock_t;
 
+// The synchronisation objects below are futex words: the uncontended paths
+// are plain atomic operations, and the kernel is only entered to sleep or to
+// wake sleepers.
+
 typedef struct _pthread_mutex_t
 {
-    int value;
-    mutex_q_item *q, *back, *front;
-    
-    pthread_spinlock_t lock;
+    volatile int value; // 0 = unlocked, 1 = locked, 2 = locked with waiters
 } pthread_mutex_t;
 
-#define pthread_cond_t pthread_mutex_t
+typedef struct _pthread_cond_t
+{
+    volatile int seq;     // bumped by every signal and broadcast
+    volatile int waiters; // threads blocked in pthread_cond_[timed]wait
+} pthread_cond_t;
+
+typedef struct _pthread_rwlock_t
+{
+    volatile int state;   // number of readers, or -1 when write-locked
+    volatile int waiters; // threads blocked on state
+} pthread_rwlock_t;
+
+typedef struct _pthread_barrier_t
+{
+    volatile int count;   // threads still to arrive in this cycle
+    volatile int cycle;   // bumped each time the barrier opens
+    int total;
+} pthread_barrier_t;
 
 typedef struct _pthread_attr_t
 {
@@ -126,10 +126,6 @@ int posix_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *errorfds,
         timeoutType = SpecificTimeout;
         timeoutSecs = timeout->tv_sec;
         timeoutUSecs = timeout->tv_usec;
-        /// \bug Unfortunately we don't sleep for under one second. So if we
-        ///      end up with secs < 1, we set ourselves to ReturnImmediately.
-        //if (timeoutSecs == 0)
-        //    timeoutType = ReturnImmediately;
     }
 
     F_NOTICE("select(" << Dec << nfds << ", ?, ?, ?, {" << static_cast<uintptr_t>(timeoutType) << ", " << timeoutSecs << "})" << Hex);
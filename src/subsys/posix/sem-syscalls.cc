@@ -16,12 +16,85 @@
 
 #include "sem-syscalls.h"
 #include "pthread-syscalls.h"
+#include "system-syscalls.h"
+#include "futex-syscalls.h"
 #include <syscallError.h>
 #include "errors.h"
 
 #include <process/Semaphore.h>
 #include <process/Mutex.h>
 
+/** Takes one unit from the count if there is one, without blocking. */
+static bool semTryDecrement(sem_t *sem)
+{
+    int val = sem->value;
+    while(val > 0)
+    {
+        int old = __sync_val_compare_and_swap(&sem->value, val, val - 1);
+        if(old == val)
+            return true;
+        val = old;
+    }
+
+    return false;
+}
+
+/** Blocks on the count's futex until a unit can be taken, or until the
+ *  absolute (CLOCK_REALTIME) deadline passes. */
+static int semWait(sem_t *sem, const struct timespec *abstime)
+{
+    if(semTryDecrement(sem))
+        return 0;
+
+    // Posters check waiters after bumping the count, and we check the count
+    // after bumping waiters, so one of us always sees the other.
+    __sync_fetch_and_add(&sem->waiters, 1);
+
+    int ret = 0;
+    while(!semTryDecrement(sem))
+    {
+        struct timespec remaining, *pTimeout = 0;
+        if(abstime)
+        {
+            struct timespec now;
+            posix_clock_gettime(CLOCK_REALTIME, &now);
+
+            remaining.tv_sec = abstime->tv_sec - now.tv_sec;
+            remaining.tv_nsec = abstime->tv_nsec - now.tv_nsec;
+            if(remaining.tv_nsec < 0)
+            {
+                remaining.tv_nsec += 1000000000;
+                remaining.tv_sec--;
+            }
+            if(remaining.tv_sec < 0)
+            {
+                SYSCALL_ERROR(TimedOut);
+                ret = -1;
+                break;
+            }
+
+            pTimeout = &remaining;
+        }
+
+        FutexWaitResult result = futexWait(&sem->value, 0, pTimeout);
+        if(result == FutexTimedOut)
+        {
+            SYSCALL_ERROR(TimedOut);
+            ret = -1;
+            break;
+        }
+        else if(result == FutexInterrupted)
+        {
+            SYSCALL_ERROR(Interrupted);
+            ret = -1;
+            break;
+        }
+    }
+
+    __sync_fetch_and_sub(&sem->waiters, 1);
+    return ret;
+}
+
 int posix_sem_close(sem_t *sem)
 {
     // Named semaphores...
@@ -39,16 +112,13 @@ int posix_sem_destroy(sem_t *sem)
         return -1;
     }
 
-    Process *pProcess = Processor::information().getCurrentThread()->getParent();
-    PosixSubsystem *pSubsystem = reinterpret_cast<PosixSubsystem*>(pProcess->getSubsystem());
-    if (!pSubsystem)
+    if(sem->waiters)
     {
-        ERROR("No subsystem for this process!");
+        SYSCALL_ERROR(DeviceBusy);
         return -1;
     }
 
-    pSubsystem->removeSyncObject(*sem);
-
+    sem->value = 0;
     return 0;
 }
 
@@ -56,77 +126,32 @@ int posix_sem_getvalue(sem_t *sem, int *val)
 {
     PT_NOTICE("sem_getvalue");
 
-    if(!sem)
+    if(!sem || !val)
     {
         SYSCALL_ERROR(InvalidArgument);
         return -1;
     }
 
-    Process *pProcess = Processor::information().getCurrentThread()->getParent();
-    PosixSubsystem *pSubsystem = reinterpret_cast<PosixSubsystem*>(pProcess->getSubsystem());
-    if (!pSubsystem)
-    {
-        ERROR("No subsystem for this process!");
-        return -1;
-    }
-
-    PosixSubsystem::PosixSyncObject *p = pSubsystem->getSyncObject(*sem);
-    if(p && p->pObject)
-    {
-        *val = reinterpret_cast<Semaphore*>(p->pObject)->getValue();
-        return 0;
-    }
-
-    SYSCALL_ERROR(InvalidArgument);
-    return -1;
+    *val = sem->value;
+    return 0;
 }
 
 int posix_sem_init(sem_t *sem, int pshared, unsigned value)
 {
     PT_NOTICE("sem_init");
 
-    if(!sem)
+    // A process-shared semaphore has to live in MAP_SHARED memory, and
+    // futexes there are keyed on physical addresses, so pshared needs no
+    // special handling here.
+    if(!sem || (value > static_cast<unsigned>(SEM_VALUE_MAX)))
     {
         SYSCALL_ERROR(InvalidArgument);
         return -1;
     }
 
-    Process *pProcess = Processor::information().getCurrentThread()->getParent();
-    PosixSubsystem *pSubsystem = reinterpret_cast<PosixSubsystem*>(pProcess->getSubsystem());
-    if (!pSubsystem)
-    {
-        ERROR("No subsystem for this process!");
-        return -1;
-    }
-
-    // Grab a descriptor for this semaphore
-    size_t fd = *sem = pSubsystem->getFd();
-
-    // Attempt to create it and then insert it
-    Semaphore *p = new Semaphore(value);
-    PosixSubsystem::PosixSyncObject *s = new PosixSubsystem::PosixSyncObject();
-    if(p)
-    {
-        if(s)
-        {
-            s->pObject = reinterpret_cast<void*>(p);
-            s->isMutex = false;
-        }
-        else
-        {
-            SYSCALL_ERROR(OutOfMemory);
-            return -1;
-        }
-
-        pSubsystem->insertSyncObject(fd, s);
-        return 0;
-    }
-
-    if(s)
-        delete s;
-
-    SYSCALL_ERROR(NoSpaceLeftOnDevice);
-    return -1;
+    sem->value = static_cast<int>(value);
+    sem->waiters = 0;
+    return 0;
 }
 
 int posix_sem_post(sem_t *sem)
@@ -139,70 +164,24 @@ int posix_sem_post(sem_t *sem)
         return -1;
     }
 
-    Process *pProcess = Processor::information().getCurrentThread()->getParent();
-    PosixSubsystem *pSubsystem = reinterpret_cast<PosixSubsystem*>(pProcess->getSubsystem());
-    if (!pSubsystem)
-    {
-        ERROR("No subsystem for this process!");
-        return -1;
-    }
-
-    PosixSubsystem::PosixSyncObject *p = pSubsystem->getSyncObject(*sem);
-    if(p && p->pObject)
-    {
-        if(p->isMutex)
-        {
-            SYSCALL_ERROR(InvalidArgument);
-            return -1;
-        }
+    __sync_fetch_and_add(&sem->value, 1);
+    if(sem->waiters)
+        futexWake(&sem->value, 1);
 
-        reinterpret_cast<Semaphore*>(p->pObject)->release();
-        return 0;
-    }
-
-    SYSCALL_ERROR(InvalidArgument);
-    return -1;
+    return 0;
 }
 
 int posix_sem_timedwait(sem_t *sem, const struct timespec *tm)
 {
     PT_NOTICE("sem_timedwait");
 
-    if(!sem)
+    if(!sem || !tm || (tm->tv_nsec < 0) || (tm->tv_nsec >= 1000000000))
     {
         SYSCALL_ERROR(InvalidArgument);
         return -1;
     }
 
-    Thread *pThread = Processor::information().getCurrentThread();
-    Process *pProcess = pThread->getParent();
-    PosixSubsystem *pSubsystem = reinterpret_cast<PosixSubsystem*>(pProcess->getSubsystem());
-    if (!pSubsystem)
-    {
-        ERROR("No subsystem for this process!");
-        return -1;
-    }
-
-    PosixSubsystem::PosixSyncObject *p = pSubsystem->getSyncObject(*sem);
-    if(p && p->pObject)
-    {
-        if(p->isMutex)
-        {
-            SYSCALL_ERROR(InvalidArgument);
-            return -1;
-        }
-
-        reinterpret_cast<Semaphore*>(p->pObject)->acquire(1, tm->tv_sec + (tm->tv_nsec /  1000000000));
-        if(pThread->wasInterrupted())
-        {
-            SYSCALL_ERROR(TimedOut);
-            return -1;
-        }
-        return 0;
-    }
-
-    SYSCALL_ERROR(InvalidArgument);
-    return -1;
+    return semWait(sem, tm);
 }
 
 int posix_sem_trywait(sem_t *sem)
@@ -215,32 +194,10 @@ int posix_sem_trywait(sem_t *sem)
         return -1;
     }
 
-    Thread *pThread = Processor::information().getCurrentThread();
-    Process *pProcess = pThread->getParent();
-    PosixSubsystem *pSubsystem = reinterpret_cast<PosixSubsystem*>(pProcess->getSubsystem());
-    if (!pSubsystem)
-    {
-        ERROR("No subsystem for this process!");
-        return -1;
-    }
-
-    PosixSubsystem::PosixSyncObject *p = pSubsystem->getSyncObject(*sem);
-    if(p && p->pObject)
-    {
-        if(p->isMutex)
-        {
-            SYSCALL_ERROR(InvalidArgument);
-            return -1;
-        }
-
-        if(reinterpret_cast<Semaphore*>(p->pObject)->tryAcquire())
-            return 0;
-
-        SYSCALL_ERROR(NoMoreProcesses);
-        return -1;
-    }
+    if(semTryDecrement(sem))
+        return 0;
 
-    SYSCALL_ERROR(InvalidArgument);
+    SYSCALL_ERROR(NoMoreProcesses);
     return -1;
 }
 
@@ -254,35 +211,7 @@ int posix_sem_wait(sem_t *sem)
         return -1;
     }
 
-    Thread *pThread = Processor::information().getCurrentThread();
-    Process *pProcess = pThread->getParent();
-    PosixSubsystem *pSubsystem = reinterpret_cast<PosixSubsystem*>(pProcess->getSubsystem());
-    if (!pSubsystem)
-    {
-        ERROR("No subsystem for this process!");
-        return -1;
-    }
-
-    PosixSubsystem::PosixSyncObject *p = pSubsystem->getSyncObject(*sem);
-    if(p && p->pObject)
-    {
-        if(p->isMutex)
-        {
-            SYSCALL_ERROR(InvalidArgument);
-            return -1;
-        }
-
-        reinterpret_cast<Semaphore*>(p->pObject)->acquire();
-        if(pThread->wasInterrupted())
-        {
-            SYSCALL_ERROR(TimedOut);
-            return -1;
-        }
-        return 0;
-    }
-
-    SYSCALL_ERROR(InvalidArgument);
-    return -1;
+    return semWait(sem, 0);
 }
 
 int posix_pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
@@ -527,10 +527,15 @@ int posix_nanosleep(const struct timespec *rqtp, struct timespec *rmtp)
 {
     SG_NOTICE("nanosleep(" << Dec << rqtp->tv_sec << ":" << rqtp->tv_nsec << Hex << ") - " << Machine::instance().getTimer()->getTickCount() << ".");
 
+    // Round up to the next microsecond; a zero timeout would sleep forever.
+    size_t usecs = (rqtp->tv_nsec + 999) / 1000;
+    if (!rqtp->tv_sec && !usecs)
+        return 0;
+
     Semaphore sem(0);
 
     uint64_t startTick = Machine::instance().getTimer()->getTickCount();
-    sem.acquire(1, rqtp->tv_sec, rqtp->tv_nsec / 1000);
+    sem.acquire(1, rqtp->tv_sec, usecs);
     if (Processor::information().getCurrentThread()->wasInterrupted())
     {
         uint64_t endTick = Machine::instance().getTimer()->getTickCount();
@@ -178,4 +178,11 @@
 
 #define POSIX_GETPEERNAME       123
 
+#define POSIX_VFORK             124
+
+#define POSIX_FUTEX_WAIT        125
+#define POSIX_FUTEX_WAKE        126
+
+#define POSIX_MADVISE           127
+
 #endif
@@ -113,10 +113,9 @@ long posix_sbrk(int delta)
         return ret;
 }
 
-int posix_fork(SyscallState &state)
+/** Common implementation of fork() and vfork(). */
+static int fork_process(SyscallState &state, bool bVfork)
 {
-    SC_NOTICE("fork()");
-
     Processor::setInterrupts(false);
 
     // Inhibit signals to the parent
@@ -125,7 +124,7 @@ int posix_fork(SyscallState &state)
 
     // Create a new process.
     Process *pParentProcess = Processor::information().getCurrentThread()->getParent();
-    PosixProcess *pProcess = new PosixProcess(pParentProcess);
+    PosixProcess *pProcess = new PosixProcess(pParentProcess, bVfork);
     if (!pProcess)
     {
         SYSCALL_ERROR(OutOfMemory);
@@ -194,13 +193,33 @@ int posix_fork(SyscallState &state)
         Processor::information().getCurrentThread()->inhibitEvent(sig, false);
 
     // Create a new thread for the new process.
+    int pid = pProcess->getId();
     new Thread(pProcess, state);
 
     // Kick off the new thread immediately.
     Scheduler::instance().yield();
 
+    // The vfork() child is still running with our memory - don't touch it until
+    // the child has exec'd or exited.
+    if (bVfork)
+        pProcess->waitForVforkChild();
+
     // Parent returns child ID.
-    return pProcess->getId();
+    return pid;
+}
+
+int posix_fork(SyscallState &state)
+{
+    SC_NOTICE("fork()");
+
+    return fork_process(state, false);
+}
+
+int posix_vfork(SyscallState &state)
+{
+    SC_NOTICE("vfork()");
+
+    return fork_process(state, true);
 }
 
 int posix_execve(const char *name, const char **argv, const char **env, SyscallState &state)
@@ -391,6 +410,9 @@ int posix_execve(const char *name, const char **argv, const char **env, SyscallS
 
     pProcess->getAddressSpace()->revertToKernelAddressSpace();
 
+    // The old image is gone, so a parent waiting in vfork() can carry on.
+    pProcess->releaseVforkParent();
+
     if(pLinker)
     {
         // Set the new linker now before we loadProgram, else we could trap and
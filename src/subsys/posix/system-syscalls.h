@@ -36,6 +36,7 @@
 
 long posix_sbrk(int delta);
 int posix_fork(SyscallState &state);
+int posix_vfork(SyscallState &state);
 int posix_execve(const char *name, const char **argv, const char **env, SyscallState &state);
 int posix_waitpid(int pid, int *status, int options);
 int posix_exit(int code);
@@ -30,98 +30,65 @@
 #define SHOW_FILE_IN_LOGS 0
 
 #if SHOW_FILE_IN_LOGS
-#define FILE_LOG(level) \
+#define FILE_LOG(buffer) \
   do \
   { \
-    Log::instance() << level << __FILE__ << ":" << Dec << __LINE__ << Hex << " " << __FUNCTION__ << " -- "; \
+    buffer << __FILE__ << ":" << Dec << __LINE__ << Hex << " " << __FUNCTION__ << " -- "; \
   } while(0)
 #else
-#define FILE_LOG(level)
+#define FILE_LOG(buffer)
 #endif
 
-/** Add a debug item to the log */
-#ifdef DEBUG_LOGGING
-#define DEBUG_LOG(text) \
+/** Formats an entry of the given severity into this processor's log buffer
+ *  and queues it for output. */
+#define LOG_ENTRY(level, text) \
   do \
   { \
-    Log::instance().m_Lock.acquire(); \
-    FILE_LOG(Log::Debug); \
-    Log::instance() << Log::Debug << text << Flush; \
-    Log::instance().m_Lock.release(); \
+    Log::Buffer &logBuffer = Log::instance().lockBuffer(); \
+    logBuffer << level; \
+    FILE_LOG(logBuffer); \
+    logBuffer << text << Flush; \
+    Log::instance().unlockBuffer(logBuffer); \
   } \
   while (0)
 
-#define DEBUG_LOG_NOLOCK(text) \
+/** As LOG_ENTRY, but without locking the buffer. */
+#define LOG_ENTRY_NOLOCK(level, text) \
   do \
   { \
-    FILE_LOG(Log::Debug); \
-    Log::instance() << Log::Debug << text << Flush; \
+    Log::Buffer &logBuffer = Log::instance().getBuffer(); \
+    logBuffer << level; \
+    FILE_LOG(logBuffer); \
+    logBuffer << text << Flush; \
   } \
   while (0)
+
+/** Add a debug item to the log */
+#ifdef DEBUG_LOGGING
+#define DEBUG_LOG(text) LOG_ENTRY(Log::Debug, text)
+#define DEBUG_LOG_NOLOCK(text) LOG_ENTRY_NOLOCK(Log::Debug, text)
 #else
 #define DEBUG_LOG(text)
 #define DEBUG_LOG_NOLOCK(text)
 #endif
 
 /** Add a notice to the log */
-#define NOTICE(text) \
-  do \
-  { \
-    Log::instance().m_Lock.acquire(); \
-    FILE_LOG(Log::Notice); \
-    Log::instance() << Log::Notice << text << Flush; \
-    Log::instance().m_Lock.release(); \
-  } \
-  while (0)
+#define NOTICE(text) LOG_ENTRY(Log::Notice, text)
 
 /// \note You use this in the wrong way, you die.
-#define NOTICE_NOLOCK(text) \
-  do \
-  { \
-    FILE_LOG(Log::Notice); \
-    Log::instance() << Log::Notice << text << Flush; \
-  } \
-  while (0)
+#define NOTICE_NOLOCK(text) LOG_ENTRY_NOLOCK(Log::Notice, text)
 
 /** Add a warning message to the log */
-#define WARNING(text) \
-  do \
-  { \
-    Log::instance().m_Lock.acquire(); \
-    FILE_LOG(Log::Warning); \
-    Log::instance() << Log::Warning << text << Flush; \
-    Log::instance().m_Lock.release(); \
-  } \
-  while (0)
+#define WARNING(text) LOG_ENTRY(Log::Warning, text)
 
 /// \note You use this in the wrong way, you die.
-#define WARNING_NOLOCK(text) \
-  do \
-  { \
-    FILE_LOG(Log::Warning); \
-    Log::instance() << Log::Warning << text << Flush; \
-  } \
-  while (0)
+#define WARNING_NOLOCK(text) LOG_ENTRY_NOLOCK(Log::Warning, text)
 
 /** Add a error message to the log */
-#define ERROR(text) \
-  do \
-  { \
-    Log::instance().m_Lock.acquire(); \
-    FILE_LOG(Log::Error); \
-    Log::instance() << Log::Error << text << Flush; \
-    Log::instance().m_Lock.release(); \
-  } \
-  while (0)
+#define ERROR(text) LOG_ENTRY(Log::Error, text)
 
 /// \note You use this in the wrong way, you die.
-#define ERROR_NOLOCK(text) \
-  do \
-  { \
-    FILE_LOG(Log::Error); \
-    Log::instance() << Log::Error << text << Flush; \
-  } \
-  while (0)
+#define ERROR_NOLOCK(text) LOG_ENTRY_NOLOCK(Log::Error, text)
 
 
 /** Add a fatal message to the log
@@ -131,11 +98,12 @@
 #define FATAL(text) \
   do \
   { \
-    Log::instance().m_Lock.acquire(); \
-    FILE_LOG(Log::Fatal); \
-    Log::instance() << Log::Fatal << text << Flush; \
-    const char *panicstr = static_cast<const char*>(Log::instance().getLatestEntry().str); \
-    Log::instance().m_Lock.release(); \
+    Log::Buffer &logBuffer = Log::instance().lockBuffer(); \
+    logBuffer << Log::Fatal; \
+    FILE_LOG(logBuffer); \
+    logBuffer << text << Flush; \
+    const char *panicstr = static_cast<const char*>(logBuffer.getEntry().str); \
+    Log::instance().unlockBuffer(logBuffer); \
     Processor::breakpoint(); \
     panic(panicstr); \
   } \
@@ -145,10 +113,12 @@
 #define FATAL_NOLOCK(text) \
   do \
   { \
-    FILE_LOG(Log::Fatal); \
-    Log::instance() << Log::Fatal << text << Flush; \
+    Log::Buffer &logBuffer = Log::instance().getBuffer(); \
+    logBuffer << Log::Fatal; \
+    FILE_LOG(logBuffer); \
+    logBuffer << text << Flush; \
     Processor::breakpoint(); \
-    panic(static_cast<const char*>(Log::instance().getLatestEntry().str)); \
+    panic(static_cast<const char*>(logBuffer.getEntry().str)); \
   } \
   while (0)
 
@@ -156,6 +126,16 @@
 #define LOG_LENGTH  128
 /** The maximum number of static entries in the log. */
 #define LOG_ENTRIES ((1<<21)/sizeof(LogEntry))
+/** The number of per-processor log buffers. Processors beyond this share. */
+#ifdef MULTIPROCESSOR
+#define LOG_BUFFERS 8
+#else
+#define LOG_BUFFERS 1
+#endif
+/** The number of entries each processor can queue before they're dropped. */
+#define LOG_RING_ENTRIES 256
+/** How often the drain thread empties the rings, in microseconds. */
+#define LOG_DRAIN_INTERVAL 10000
 
 /** Radix for Log's integer output */
 enum NumberType
@@ -187,7 +167,15 @@ extern BootProgressUpdateFn g_BootProgressUpdate;
  *\brief the kernel's log
  *\note You should use the NOTICE, WARNING, ERROR and FATAL macros to write something
  *      into the log. Direct access to the log should only be needed to retrieve
- *      the entries from the log (within the debugger's log viewer for example). */
+ *      the entries from the log (within the debugger's log viewer for example).
+ *
+ * Each processor formats entries into its own Buffer and queues the finished
+ * entries on that buffer's ring, so logging never waits for another
+ * processor or for a slow output device. A low-priority thread drains the
+ * rings, in order, into the static log and the output callbacks. Until that
+ * thread is running, and for fatal entries, the logging processor drains
+ * the rings itself. Entries that arrive while a ring is full are dropped and
+ * counted, and the count is logged once there is room again. */
 class Log
 {
 public:
@@ -213,9 +201,90 @@ public:
     Fatal
   };
 
-  /** The lock
-   *\note this should only be acquired by the NOTICE, WARNING, ERROR and FATAL macros */
-  Spinlock m_Lock;
+  /** Stores an entry in the log.
+   *\param[in] T type of the log's text */
+  struct LogEntry
+  {
+    /** Constructor does nothing */
+    inline LogEntry()
+     : timestamp(), type(), str(){}
+
+    /** The time (since boot) that this log entry was added, in ticks. */
+    unsigned int timestamp;
+    /** The severity level of this entry. */
+    SeverityLevel type;
+    /** The actual entry text. */
+    StaticString<LOG_LENGTH> str;
+  };
+
+  /** Type of a static log entry (no memory-management involved) */
+  typedef LogEntry StaticLogEntry;
+  /** Type of an entry still queued on a processor's ring */
+  typedef LogEntry DynamicLogEntry;
+
+  /** A processor's log buffer: the entry being formatted, and a ring of
+   *  finished entries waiting to be drained. The owning processor is the
+   *  only writer of the ring and the drainer the only reader, so neither
+   *  takes a lock to use it. */
+  class Buffer
+  {
+    friend class Log;
+  public:
+    /** Adds a string to the entry being formatted. */
+    Buffer &operator<< (const char *str);
+    Buffer &operator<< (String str);
+    inline Buffer &operator<< (char *str)
+      {return (*this) << (reinterpret_cast<const char*>(str));}
+    /** Adds a boolean value to the entry being formatted. */
+    Buffer &operator<< (bool b);
+    /** Adds a number to the entry being formatted. */
+    template<class T>
+    Buffer &operator << (T n);
+
+    /** Starts an entry. */
+    Buffer &operator<< (SeverityLevel level);
+    /** Changes the number type between hex and decimal. */
+    Buffer &operator<< (NumberType type);
+    /** Modifier */
+    Buffer &operator<< (Modifier type);
+
+    /** The entry being formatted (or last formatted). */
+    inline const LogEntry &getEntry() const
+      {return m_Entry;}
+
+  private:
+    Buffer();
+
+    /** A finished entry, tagged with its position in the global order. */
+    struct RingEntry
+    {
+      RingEntry() : seq(0), nDropped(0), entry() {}
+
+      size_t seq;
+      /** Entries dropped just before this one because the ring was full. */
+      size_t nDropped;
+      LogEntry entry;
+    };
+
+    /** Held while an entry is formatted. Only contended when processors
+     *  share a buffer. */
+    Spinlock m_Lock;
+    /** Interrupt state to restore when the buffer is unlocked. */
+    bool m_bInterrupts;
+    /** The entry being formatted. */
+    LogEntry m_Entry;
+    /** The number type mode that we are in. */
+    NumberType m_NumberType;
+
+    /** Finished entries. */
+    RingEntry m_Ring[LOG_RING_ENTRIES];
+    /** Number of entries ever queued. Written only by the producer. */
+    volatile size_t m_Head;
+    /** Number of entries ever drained. Written only by the drainer. */
+    volatile size_t m_Tail;
+    /** Entries dropped since the last one was queued. */
+    size_t m_nDropped;
+  };
 
   /** Retrieves the static Log instance.
    *\return instance of the log class */
@@ -228,77 +297,46 @@ public:
    /** Initialises the default Log callback (to a serial port) */
   void initialise2();
 
+  /** Starts the thread that drains the per-processor rings. Until this is
+   *  called, each entry is written out as soon as it is flushed. */
+  void initialise3();
+
   /** Installs an output callback */
   void installCallback(LogCallback *pCallback, bool bSkipBacklog=false);
 
   /** Removes an output callback */
   void removeCallback(LogCallback *pCallback);
 
-  /** Adds an entry to the log.
-   *\param[in] str the null-terminated ASCII string that should be added */
-  Log &operator<< (const char *str);
-  Log &operator<< (String str);
-  /** Adds an entry to the log
-   *\param[in] str the null-terminated ASCII string that should be added */
-  inline Log &operator<< (char *str)
-    {return (*this) << (reinterpret_cast<const char*>(str));}
-  /** Adds an entry to the log
-   *\param[in] b boolean value */
-  Log &operator<< (bool b);
-  /** Adds an entry to the log (integer type)
-   *\param[in] n the number */
-  template<class T>
-  Log &operator << (T n);
-
-  /** Starts an entry in the log. */
-  Log &operator<< (SeverityLevel level);
-  /** Changes the number type between hex and decimal. */
-  Log &operator<< (NumberType type);
-  /** Modifier */
-  Log &operator<< (Modifier type);
+  /** Gets this processor's buffer and locks it for formatting an entry.
+   *\note this should only be called by the NOTICE, WARNING, ERROR and FATAL macros */
+  Buffer &lockBuffer();
+  /** Unlocks a buffer locked by lockBuffer(). */
+  void unlockBuffer(Buffer &buffer);
+  /** Gets this processor's buffer without locking it. */
+  Buffer &getBuffer();
+
+  /** Writes out every queued entry before returning. */
+  void flush();
 
   /** Get the number of static entries in the log.
    *\return the number of static entries in the log */
   inline size_t getStaticEntryCount() const
     {return m_StaticEntries;}
-  /** Get the number of dynamic entries in the log
+  /** Get the number of entries still queued on the processors' rings. These
+   *  follow the static entries, and are what didn't make it out before a
+   *  crash.
    *\return the number of dynamic entries in the log */
-  inline size_t getDynamicEntryCount() const
-    {return 0;}
-
-  /** Stores an entry in the log.
-   *\param[in] T type of the log's text */
-  struct LogEntry
-  {
-    /** Constructor does nothing */
-    inline LogEntry()
-     : timestamp(), type(), str(){}
-
-    /** The time (since boot) that this log entry was added, in ticks. */
-    unsigned int timestamp;
-    /** The severity level of this entry. */
-    SeverityLevel type;
-    /** The actual entry text. */
-    StaticString<LOG_LENGTH> str;
-  };
-
-  /** Type of a static log entry (no memory-management involved) */
-  typedef LogEntry StaticLogEntry;
-  typedef LogEntry DynamicLogEntry;
+  size_t getDynamicEntryCount() const;
 
   /** Returns the n'th static log entry, counting from the start. */
   inline const StaticLogEntry &getStaticEntry(size_t n) const
     {return m_StaticLog[(m_StaticEntryStart+n) % LOG_ENTRIES];}
   /** Returns the (n - getStaticEntryCount())'th dynamic log entry */
-  inline const DynamicLogEntry &getDynamicEntry(size_t n) const
-    {return m_StaticLog[0];}
+  const DynamicLogEntry &getDynamicEntry(size_t n) const;
 
   bool echoToSerial()
     {return m_EchoToSerial;}
 
-  inline const LogEntry &getLatestEntry() const
-    {return m_StaticLog[m_StaticEntries - 1];}
-
 private:
   /** Default constructor - does nothing. */
   Log();
@@ -311,20 +349,53 @@ private:
    *\note NOT implemented */
   Log &operator = (const Log &);
 
+  /** Queues the entry just formatted in \p buffer. */
+  void commit(Buffer &buffer);
+
+  /** Writes out queued entries.
+   *\param bWait If another processor is draining, wait for it rather than
+   *             leaving it to write our entries out. */
+  void drain(bool bWait);
+  /** Moves the oldest queued entry into the static log and passes it to
+   *  the output callbacks.
+   *\note m_bDraining must be held.
+   *\return False if there was nothing queued. */
+  bool drainOne();
+  /** Adds an entry to the static log and passes it to the output callbacks.
+   *\note m_bDraining must be held. */
+  void output(const LogEntry &entry);
+
+  /** Takes m_bDraining, with interrupts disabled.
+   *\return False if it is held elsewhere. */
+  bool tryLockDrain(bool &bInterrupts);
+  /** Releases m_bDraining and restores the interrupt state. */
+  void unlockDrain(bool bInterrupts);
+
+  /** Entry point for the drain thread. */
+  static int drainThread(void *p);
+
   /** Static buffer of log messages. */
   StaticLogEntry m_StaticLog[LOG_ENTRIES];
-  /** Dynamic buffer of log messages */
-//  Vector<DynamicLogEntry*> m_DynamicLog;
   /** Number of entries in the static log */
   size_t m_StaticEntries;
 
   size_t m_StaticEntryStart, m_StaticEntryEnd;
 
-  /** Temporary buffer which gets filled by calls to operator<<, and flushed by << Flush. */
-  StaticLogEntry m_Buffer;
+  /** Per-processor buffers. */
+  Buffer m_Buffers[LOG_BUFFERS];
+
+  /** Source of the sequence numbers that order entries across buffers. */
+  Atomic<size_t> m_Sequence;
+
+  /** Held by whoever is draining, which also guards the static log and the
+   *  output callback list. */
+  Atomic<bool> m_bDraining;
+  /** The processor holding m_bDraining, so that an output callback that
+   *  logs doesn't wait on itself. */
+  volatile size_t m_DrainingProcessor;
 
-  /** The number type mode that we are in. */
-  NumberType m_NumberType;
+  /** Whether the drain thread is running. */
+  bool m_bAsynchronous;
 
   /** If we should output to serial */
   bool m_EchoToSerial;
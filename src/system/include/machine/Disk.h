@@ -67,15 +67,26 @@ public:
      *  within a page of memory mapping 4096 bytes of disk area.
      * \param location The offset from the start of the device, in bytes, to start the read, must be multiple of 512.
      * \return Pointer to writable area of memory containing the data. If the data
-     *         is written, the page is marked as dirty and may be written back
-     *         to disk at any time (or forced with write().). */
+     *         is written, call write() to have the page written back. */
     virtual uintptr_t read(uint64_t location)
     {
         return ~0;
     }
 
+    /** Releases the reference to the cache page containing \p location that
+     *  was taken by read(). Once every reader has done so, the page may be
+     *  evicted under memory pressure, after which the pointer returned by
+     *  read() is no longer valid. Callers that keep pointers around for the
+     *  lifetime of the disk simply never call this.
+     * \param location The same location that was passed to read(). */
+    virtual void unpin(uint64_t location)
+    {
+        return;
+    }
+
     /** This function schedules a cache writeback of the given location. The data to be written back is
-     * fetched from the cache (pointer returned by \c read() ).
+     * fetched from the cache (pointer returned by \c read() ) when the page is written back, which
+     * may be some time later; the page is not evicted before then.
      * \param location The offset from the start of the device, in bytes, to start the write. Must be 512byte aligned. */
     virtual void write(uint64_t location)
     {
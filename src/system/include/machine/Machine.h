@@ -106,6 +106,12 @@ class Machine
      * Stops all other cores. This is used during debugger initialisation.
      */
     virtual void stopAllOtherProcessors() =0;
+
+    /**
+     * Flushes the TLB of every other core, and waits for them all to have
+     * done so.
+     */
+    virtual void flushTlbOnAllOtherProcessors() =0;
 #endif
 
   protected:
@@ -30,6 +30,8 @@ extern BootIO bootIO;
 #include <network/MacAddress.h>
 #include <network/NetworkBlockTimeout.h>
 
+class NetworkRxQueue;
+
 /** Station information - basically information about this station, per NIC */
 class StationInfo
 {
@@ -80,13 +82,15 @@ class StationInfo
  */
 class Network : public Device
 {
+  /** The network stack keeps its receive queue for the device in m_pRxQueue */
+  friend class NetworkStack;
 public:
-  Network() : m_StationInfo()
+  Network() : m_StationInfo(), m_pRxQueue(0)
   {
     m_SpecificType = "Generic Network Device";
   }
   Network(Network *pDev) :
-    Device(pDev), m_StationInfo()
+    Device(pDev), m_StationInfo(), m_pRxQueue(0)
   {
   }
   virtual ~Network()
@@ -133,6 +137,51 @@ public:
       return true;
   }
 
+  /** Can the device be polled for received packets? If so, the network stack switches
+   *  off the receive interrupt when packets arrive faster than they can be handled,
+   *  and calls poll() from its receive thread until the device runs dry. */
+  virtual bool canPoll()
+  {
+      return false;
+  }
+
+  /** Hands up to nBudget received packets to NetworkStack::receive.
+   * \return The number of packets received. */
+  virtual size_t poll(size_t nBudget)
+  {
+      return 0;
+  }
+
+  /** Enables or disables the receive interrupt, for polling. */
+  virtual void setReceiveInterrupts(bool bEnabled)
+  {
+  }
+
+  /** Drops about nPerThousand in every thousand packets sent, to see how the
+   *  stack copes with loss.
+   * \return False if the device can't do this (only the loopback device can). */
+  virtual bool setPacketLoss(size_t nPerThousand)
+  {
+      return false;
+  }
+
+  /** Checksums a device can handle in hardware */
+  enum ChecksumOffload
+  {
+    TxIpv4Checksum = 0x1,   ///< Fills in IPv4 header checksums
+    TxL4Checksum = 0x2,     ///< Fills in TCP/UDP checksums (pseudo-header included)
+    RxIpv4Checksum = 0x4,   ///< Drops received packets with bad IPv4 header checksums
+    RxL4Checksum = 0x8      ///< Drops received packets with bad TCP/UDP checksums
+  };
+
+  /** Which checksums the device handles, as a mask of ChecksumOffload values.
+   *  The stack doesn't verify those checksums on packets from this device,
+   *  and leaves them zero in packets sent through it. */
+  virtual uint32_t getChecksumOffload()
+  {
+      return 0;
+  }
+
   /** Converts an IPv4 address into an integer */
   static uint32_t convertToIpv4(uint8_t a, uint8_t b, uint8_t c, uint8_t d);
 
@@ -151,6 +200,24 @@ public:
   /** Calculates a checksum */
   static uint16_t calculateChecksum(uintptr_t buffer, size_t nBytes);
 
+  /** Adds a buffer to a running one's complement sum, without folding or
+   *  inverting it, so a checksum can be built up from several pieces (such
+   *  as a pseudo-header and a packet) without copying them together. Every
+   *  piece but the last must be an even number of bytes long.
+   * \param sum The sum so far (zero to start a new one). */
+  static uint32_t checksumPartial(uintptr_t buffer, size_t nBytes, uint32_t sum = 0);
+
+  /** Folds and inverts a sum from checksumPartial into a checksum */
+  static uint16_t checksumFinish(uint32_t sum);
+
+  /** Updates a checksum for a 16-bit field changing from oldValue to newValue,
+   *  without summing the rest of the data again (RFC 1624). Values are in
+   *  the same byte order as they are in the packet. */
+  static uint16_t checksumUpdate(uint16_t checksum, uint16_t oldValue, uint16_t newValue);
+
+  /** Updates a checksum for a 32-bit field (such as an IPv4 address) changing. */
+  static uint16_t checksumUpdate(uint16_t checksum, uint32_t oldValue, uint32_t newValue);
+
   /** Packet statistics */
 
   /// Called when a packet is picked up by the system, regardless of if it's
@@ -176,6 +243,9 @@ public:
 protected:
   StationInfo m_StationInfo;
 
+private:
+  /** Receive queue in the network stack, or 0 if not registered */
+  NetworkRxQueue *m_pRxQueue;
 };
 
 #endif
@@ -19,6 +19,8 @@
 
 #include <processor/types.h>
 #include <machine/TimerHandler.h>
+#include <utilities/TimerWheel.h>
+#include <utilities/Tree.h>
 
 /** @addtogroup kernelmachine
  * @{ */
@@ -70,27 +72,45 @@ class Timer
     virtual bool registerHandler(TimerHandler *handler) = 0;
     virtual bool unregisterHandler(TimerHandler *handler) = 0;
 
+    /** Arms \p pAlarm to fire in \p alarmSecs seconds and \p alarmUsecs
+     *  microseconds. If it is already armed it is moved.
+     *\param pAlarm Alarm to arm. */
+    void addAlarm(Alarm *pAlarm, size_t alarmSecs, size_t alarmUsecs=0);
+    /** Disarms \p pAlarm. On return its fire() is not running and will not
+     *  run, so the alarm may be destroyed.
+     *\param pAlarm Alarm to disarm.
+     *\return True if the alarm was armed, false if it had already fired. */
+    bool removeAlarm(Alarm *pAlarm);
+
     /** Dispatches the Event \p pEvent to the current thread in \p alarmSecs time.
      *\param pEvent Event to dispatch.
      *\param alarmSecs Number of seconds to wait.
      */
-    virtual void addAlarm(class Event *pEvent, size_t alarmSecs, size_t alarmUsecs=0) = 0;
+    void addAlarm(class Event *pEvent, size_t alarmSecs, size_t alarmUsecs=0);
     /** Removes the event \p pEvent from the alarm queue.
      *\param pEvent Event to remove alarm for. */
-    virtual void removeAlarm(class Event *pEvent) = 0;
+    void removeAlarm(class Event *pEvent);
     /** Removes the event \p pEvent from the alarm queue.
      *\param pEvent Event to remove alarm for.
      *\param bRetZero If true, returns zero rather the time until firing
      *\return The number of seconds before the event would have fired,
      *        or zero if bRetZero is true. */
-    virtual size_t removeAlarm(class Event *pEvent, bool bRetZero) = 0;
+    size_t removeAlarm(class Event *pEvent, bool bRetZero);
 
   protected:
     /** The default constructor */
-    inline Timer(){}
+    inline Timer() : m_Alarms(), m_EventAlarms(), m_EventAlarmLock() {}
     /** The destructor */
     inline virtual ~Timer(){}
 
+    /** Fires every alarm that is due. Called by the implementation from its
+     *  tick interrupt.
+     *\param now The time elapsed since bootup, in microseconds. */
+    void dispatchAlarms(uint64_t now)
+    {
+      m_Alarms.advance(now);
+    }
+
   private:
     /** The copy-constructor
      *\note NOT implemented */
@@ -98,6 +118,20 @@ class Timer
     /** The assignment operator
      *\note NOT implemented */
     Timer &operator = (const Timer &);
+
+    /** Alarm that dispatches an Event to a thread, for the Event interface. */
+    class EventAlarm;
+
+    /** Removes the alarm for \p pEvent from the lookup tree.
+     *\return The alarm, or null if there is none. */
+    EventAlarm *takeEventAlarm(class Event *pEvent);
+
+    /** All pending alarms. */
+    TimerWheel m_Alarms;
+    /** Alarms armed through the Event interface, by Event. */
+    Tree<class Event*, EventAlarm*> m_EventAlarms;
+    /** Protects m_EventAlarms. */
+    Spinlock m_EventAlarmLock;
 };
 
 /**@}*/
@@ -27,8 +27,11 @@
 class Mutex : public Semaphore
 {
 public:
-  /** Constructor */
-  Mutex(bool bLocked = false);
+  /** Constructor
+   * \param bLocked Whether the mutex starts out locked.
+   * \param bHandoff Pass ownership directly to the longest waiter on release,
+   *        rather than letting the woken thread race newcomers for it. */
+  Mutex(bool bLocked = false, bool bHandoff = false);
   /** Destructor */
   ~Mutex();
 };
@@ -96,6 +96,48 @@ public:
 
     void threadStatusChanged(Thread *pThread);
 
+    /** Load balancing counters for this processor. */
+    struct Statistics
+    {
+        /** Threads waiting to run here right now. */
+        size_t nRunnable;
+        /** New threads placed here by the ThreadToCoreAllocationAlgorithm. */
+        size_t nPlaced;
+        /** Threads this processor took from others while idle. */
+        size_t nStolenIn;
+        /** Threads other processors took from this one. */
+        size_t nStolenOut;
+    };
+
+    Statistics getStatistics();
+
+    /** Whether initialise() has run, i.e. this processor can take threads. */
+    bool isInitialised()
+    {
+        return m_pSchedulingAlgorithm != 0;
+    }
+
+    /** The processor this scheduler runs on. Only valid once initialised. */
+    size_t getProcessorId()
+    {
+        return m_ProcessorId;
+    }
+
+    /** Number of threads waiting to run here. */
+    size_t getRunnableCount();
+
+    /** Called by the ThreadToCoreAllocationAlgorithm when it places a new
+        thread here. */
+    void threadPlaced()
+    {
+        m_nPlaced += 1;
+    }
+
+    /** Removes a ready thread that may be run on processor \p targetId, for
+        load balancing. The thread's lock is not taken.
+        \see SchedulingAlgorithm::stealThread */
+    Thread *stealThread(size_t targetId, uint64_t coldBefore);
+
 private:
     /** Copy-constructor
      *  \note Not implemented - singleton class. */
@@ -114,6 +156,17 @@ private:
 
     /** The current SchedulingAlgorithm */
     SchedulingAlgorithm *m_pSchedulingAlgorithm;
+
+    /** The processor we're running on. */
+    size_t m_ProcessorId;
+
+    /** This processor's idle thread (the one we were initialised with). */
+    Thread *m_pIdleThread;
+
+    /** Statistics counters. Updated from other processors too. */
+    Atomic<size_t> m_nPlaced;
+    Atomic<size_t> m_nStolenIn;
+    Atomic<size_t> m_nStolenOut;
     
     Mutex m_NewThreadDataLock;
     Semaphore m_NewThreadDataCount;
@@ -64,8 +64,11 @@ public:
     /** Constructor for creating a new Process. Creates a new Process as
      * a UNIX fork() would, from the given parent process. This constructor
      * does not create any threads.
-     * \param pParent The parent process. */
-    Process(Process *pParent);
+     * \param pParent The parent process.
+     * \param bVfork If true, create the Process as a UNIX vfork() would: the
+     *               parent's memory is left writable and the parent must wait
+     *               in waitForVforkChild() before it runs again. */
+    Process(Process *pParent, bool bVfork = false);
 
     /** Destructor. */
     virtual ~Process();
@@ -212,6 +215,12 @@ public:
         return m_pSubsystem;
     }
 
+    /** Blocks the caller (the parent after a vfork()) until this process has
+     *  exec'd or exited, and so stopped looking at the parent's memory. */
+    void waitForVforkChild();
+    /** Lets our parent run again after a vfork(). Called on exec and exit. */
+    void releaseVforkParent();
+
     /** Gets the type of the Process (subsystems may override) */
     virtual ProcessType getType()
     {
@@ -277,6 +286,11 @@ private:
     /** The subsystem for this process */
     Subsystem *m_pSubsystem;
 
+    /** Were we created by vfork(), and is our parent still waiting on us? */
+    bool m_bVforked;
+    /** The parent waits on this after a vfork(). */
+    Semaphore m_VforkRelease;
+
 public:
     Semaphore m_DeadThreads;
 };
@@ -46,6 +46,11 @@ class ProcessorThreadAllocator
         /// rebalance operation or something similar to take place.
         void threadRemoved(Thread *pThread);
         
+        /// Called by an idle PerProcessorScheduler to find a ready thread on
+        /// another processor to run instead. Returns 0 if there isn't one
+        /// worth moving.
+        Thread *stealThread(PerProcessorScheduler *pThief);
+        
         /// Sets the algorithm to use for allocating threads to cores.
         inline void setAlgorithm(ThreadToCoreAllocationAlgorithm *pAlgorithm)
         {
@@ -18,7 +18,6 @@
 #define ROUND_ROBIN_H
 
 #include <process/SchedulingAlgorithm.h>
-#include <utilities/List.h>
 #include <Spinlock.h>
 
 class RoundRobin : public SchedulingAlgorithm
@@ -37,10 +36,33 @@ public:
   virtual Thread *getNext(Thread *pCurrentThread);
   
   virtual void threadStatusChanged(Thread *pThread);
+
+  virtual size_t getRunnableCount()
+  {
+    return m_nRunnable;
+  }
+
+  virtual Thread *stealThread(size_t targetId, uint64_t coldBefore);
   
 private:
-  typedef List<Thread*> ThreadList;
-  ThreadList m_pReadyQueues[MAX_PRIORITIES];
+  /** Links \p pThread onto the tail of its priority's ready queue. */
+  void enqueue(Thread *pThread);
+  /** Unlinks \p pThread from whichever ready queue it's on. */
+  void dequeue(Thread *pThread);
+
+  /** A ready queue, linked through the threads themselves. */
+  struct ReadyQueue
+  {
+    Thread *pHead;
+    Thread *pTail;
+  };
+  ReadyQueue m_ReadyQueues[MAX_PRIORITIES];
+
+  /** Bit N is set when ready queue N is non-empty. */
+  uint32_t m_ReadyBitmap;
+
+  /** Total number of threads in the ready queues. */
+  volatile size_t m_nRunnable;
 
   Spinlock m_Lock;
 };
@@ -17,6 +17,8 @@
 #ifndef SCHEDULING_ALGORITHM_H
 #define SCHEDULING_ALGORITHM_H
 
+#include <processor/types.h>
+
 class Thread;
 class Processor;
 
@@ -47,6 +49,21 @@ public:
   
   /** Notifies us that the status of a thread has changed, and that we may need to take action. */
   virtual void threadStatusChanged(Thread *pThread) =0;
+
+  /** Returns the number of threads waiting to run (not counting the one running now). */
+  virtual size_t getRunnableCount()
+  {
+    return 0;
+  }
+
+  /** Removes a ready thread so another processor can run it, or returns 0 if
+   * there is nothing suitable. The thread's lock is not taken.
+   * \param targetId The processor the thread will move to - it must be allowed to run there.
+   * \param coldBefore Only threads that stopped running before this tick count may be taken. */
+  virtual Thread *stealThread(size_t targetId, uint64_t coldBefore)
+  {
+    return 0;
+  }
 };
 
 #endif
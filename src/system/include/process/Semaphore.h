@@ -24,15 +24,37 @@
 #include <Spinlock.h>
 #include <utilities/List.h>
 
+/// Lower bound on the number of times an acquire polls before sleeping (SMP only).
+#define SEMAPHORE_MIN_SPINS     4
+/// Upper bound on the adaptive spin count.
+#define SEMAPHORE_MAX_SPINS     200
+
 /**
  * A counting semaphore.
+ *
+ * A release of n items wakes only as many sleepers as are needed to consume
+ * them. In handoff mode the released items are given directly to the waiters
+ * at the head of the queue (in FIFO order) instead of going back into the
+ * counter, so a woken thread never has to compete for what it was given.
  */
 class Semaphore
 {
 public:
+    /** Wakeup counters, summed over every Semaphore in the system. */
+    struct Statistics
+    {
+        /** Threads woken by a release. */
+        size_t nWakeups;
+        /** Woken threads that then failed to acquire and went back to sleep. */
+        size_t nSpuriousWakeups;
+        /** Releases handed directly to a waiter. */
+        size_t nHandoffs;
+    };
+
     /** Constructor
-     * \param nInitialValue The initial value of the semaphore. */
-    Semaphore(size_t nInitialValue);
+     * \param nInitialValue The initial value of the semaphore.
+     * \param bHandoff Pass released items directly to waiters in FIFO order. */
+    Semaphore(size_t nInitialValue, bool bHandoff = false);
     /** Destructor */
     virtual ~Semaphore();
 
@@ -55,6 +77,9 @@ public:
     /** Gets the current value of the semaphore */
     ssize_t getValue();
 
+    /** Gets the system-wide wakeup counters. */
+    static Statistics getStatistics();
+
 private:
     /** Private copy constructor
         \note NOT implemented. */
@@ -63,32 +88,50 @@ private:
         \note NOT implemented. */
     void operator =(const Semaphore&);
 
-    /** Removes the given pointer from the thread queue. */
-    void removeThread(class Thread *pThread);
-
-    /** Internal event class - just interrupts the calling thread
-        (sets wasInterrupted and sets the thread status to Ready). */
-    class SemaphoreEvent : public Event
+    /** A thread sleeping in acquire(). Lives on the sleeping thread's stack. */
+    struct Waiter
     {
-    public:
-        SemaphoreEvent();
-        virtual ~SemaphoreEvent()
-        {}
-
-        virtual size_t serialize(uint8_t *pBuffer)
-        {return 0;}
-        static bool unserialize(uint8_t *pBuffer, SemaphoreEvent &event)
-        {return true;}
-
-        virtual size_t getNumber()
-        {return EventNumbers::Interrupt;}
+        class Thread *pThread;
+        /** Number of items the thread is waiting for. */
+        size_t nWanted;
+        /** Set by release() in handoff mode: the items now belong to the waiter. */
+        bool bGranted;
+        /** Set by the timeout alarm. */
+        bool bTimedOut;
     };
 
+    /** Removes the given waiter from the queue.
+     *  \note m_BeingModified must be held.
+     *  \return True if it was still queued. */
+    bool removeWaiter(Waiter *pWaiter);
+
+    /** Wakes queued waiters, oldest first, until n items are accounted for.
+     *  In handoff mode the items are granted to the woken waiters.
+     *  \note m_BeingModified must be held.
+     *  \return The number of items not handed to a waiter. */
+    size_t wakeWaiters(size_t n);
+
+    /** Polls the counter for a while before the caller goes to sleep, adapting
+     *  the number of polls to how often polling has paid off recently. */
+    bool spin(size_t n);
+
+    /** Timeout alarm for acquire(). Lives on the sleeping thread's stack. */
+    class SemaphoreAlarm;
+
     size_t magic;
 
     Atomic<ssize_t> m_Counter;
     Spinlock m_BeingModified;
-    List<class Thread*> m_Queue;
+    List<Waiter*> m_Queue;
+
+    /** Whether release() hands items straight to waiters. */
+    bool m_bHandoff;
+    /** Moving average of the polls a successful spin() needed. */
+    size_t m_nSpins;
+
+    static Atomic<size_t> m_nWakeups;
+    static Atomic<size_t> m_nSpuriousWakeups;
+    static Atomic<size_t> m_nHandoffs;
 };
 
 #endif
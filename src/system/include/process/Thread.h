@@ -54,6 +54,7 @@ class Process;
  */
 class Thread
 {
+    friend class RoundRobin;
 public:
     /** The state that a thread can possibly have. */
     enum Status
@@ -373,6 +374,48 @@ public:
         m_ProcId = id;
     }
 
+    /** Gets the PerProcessorScheduler this thread is scheduled on. */
+    class PerProcessorScheduler *getScheduler()
+    {
+        return m_pScheduler;
+    }
+
+    /** Moves this thread to another PerProcessorScheduler.
+        \note Only to be called by PerProcessorScheduler, with the thread's lock held. */
+    void setScheduler(class PerProcessorScheduler *pScheduler)
+    {
+        m_pScheduler = pScheduler;
+    }
+
+    /** Restricts the processors this thread may run on. Bit N set means
+        processor N is allowed; processors past the width of the mask are
+        always allowed. */
+    void setAffinity(uint64_t mask)
+    {
+        m_AffinityMask = mask;
+    }
+    uint64_t getAffinity()
+    {
+        return m_AffinityMask;
+    }
+
+    /** Whether this thread's affinity allows it to run on processor \p id. */
+    bool canRunOn(size_t id)
+    {
+        return (id >= 64) || (m_AffinityMask & (1ULL << id));
+    }
+
+    /** The Timer::getTickCount() at which this thread last stopped running, used
+        to guess whether its cache footprint is still warm. */
+    uint64_t getLastRunTime()
+    {
+        return m_LastRunTime;
+    }
+    void setLastRunTime(uint64_t t)
+    {
+        m_LastRunTime = t;
+    }
+
     /**
      * Sets the exit code of the Thread and sets the state to Zombie, if it is being waited on;
      * if it is not being waited on the Thread is destroyed.
@@ -476,6 +519,20 @@ private:
     /** Thread priority: 0..MAX_PRIORITIES-1, 0 being highest. */
     size_t m_Priority;
 
+    /** Processors this thread may run on. */
+    uint64_t m_AffinityMask;
+
+    /** When this thread last stopped running. */
+    uint64_t m_LastRunTime;
+
+    /** Ready queue links, owned by the RoundRobin we're scheduled by. */
+    Thread *m_pNextReady;
+    Thread *m_pPrevReady;
+    /** The priority we were queued at - setPriority() may have changed it since. */
+    size_t m_ReadyPriority;
+    /** Whether we're on a ready queue. */
+    bool m_bOnReadyQueue;
+
     /** List of requests pending on this Thread */
     List<RequestQueue::Request*> m_PendingRequests;
     
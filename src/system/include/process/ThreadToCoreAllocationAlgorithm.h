@@ -37,6 +37,14 @@ class ThreadToCoreAllocationAlgorithm
         
         virtual void threadRemoved(Thread *pThread)
         {}
+        
+        /** Finds a ready thread on another processor for the idle processor
+            \p pThief to run, removing it from its old processor's queue.
+            The thread's lock is not taken. */
+        virtual Thread *stealThread(PerProcessorScheduler *pThief)
+        {
+            return 0;
+        }
 };
 
 #endif
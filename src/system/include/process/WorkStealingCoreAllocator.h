@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2010 Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WORK_STEALING_CORE_ALLOCATOR_H
+#define WORK_STEALING_CORE_ALLOCATOR_H
+
+#include <process/ThreadToCoreAllocationAlgorithm.h>
+#include <utilities/Vector.h>
+
+/// A thread that stopped running less than this long ago is assumed to still
+/// have a warm cache on its processor. In Timer::getTickCount() units, which
+/// are microseconds on x86: 5ms.
+#define THREAD_CACHE_HOT_TIME       5000
+/// Cache-hot threads are only stolen from processors with at least this many
+/// threads waiting to run.
+#define WORKSTEAL_HOT_IMBALANCE     4
+
+/** Places new threads on the processor with the shortest run queue, and lets
+    idle processors steal ready threads from the busiest one. */
+class WorkStealingCoreAllocator : public ThreadToCoreAllocationAlgorithm
+{
+    public:
+        WorkStealingCoreAllocator();
+        
+        virtual ~WorkStealingCoreAllocator();
+        
+        virtual bool initialise(List<PerProcessorScheduler*> &procList);
+        
+        virtual PerProcessorScheduler* allocateThread(Thread *pThread);
+        
+        virtual Thread *stealThread(PerProcessorScheduler *pThief);
+    
+    private:
+    
+        Vector<PerProcessorScheduler*> m_Schedulers;
+};
+
+#endif
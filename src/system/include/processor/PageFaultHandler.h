@@ -18,6 +18,7 @@
 #define KERNEL_CORE_PROCESSOR_PAGEFAULTHANDLER_H_
 
 #include <processor/InterruptManager.h>
+#include <Spinlock.h>
 
 /** @addtogroup kernelprocessor
  * @{ */
@@ -65,6 +66,9 @@ private:
 
     List<MemoryTrapHandler *> m_Handlers;
 
+    /** Serialises the resolution of copy-on-write faults. */
+    Spinlock m_CopyOnWriteLock;
+
     /** The PageFaultHandler instance */
     static PageFaultHandler m_Instance;
 };
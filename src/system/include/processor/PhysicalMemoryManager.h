@@ -76,6 +76,19 @@ class PhysicalMemoryManager
      *\param[in] page physical address of the page */
     virtual void freePage(physical_uintptr_t page) = 0;
 
+    /** Take an additional reference to a page allocated with allocatePage(), so that it can
+     *  be mapped into more than one address space at once (copy-on-write). Every reference
+     *  is dropped by a call to freePage(); the page only returns to the pool with the last.
+     *\param[in] page physical address of the page
+     *\return true, if the reference was taken, false if the page can not be shared */
+    virtual bool pin(physical_uintptr_t page)
+      {return false;}
+    /** Is more than one reference to the page held?
+     *\param[in] page physical address of the page
+     *\return true, if freePage() on the page would only drop a reference */
+    virtual bool isShared(physical_uintptr_t page)
+      {return false;}
+
     /** Allocate a memory-region with specific constraints the pages need to fullfill.
      *\param[in] Region reference to the MemoryRegion object
      *\param[in] cPages the number of pages to allocate for the MemoryRegion object
@@ -82,6 +82,10 @@ class Processor
      *        successfully, 2, if initialise2() has been executed successfully */
     inline static size_t isInitialised(){return m_Initialised;}
 
+    /** Get the number of processors in the system
+     *\return the number of processors */
+    inline static size_t getCount(){return m_nProcessors;}
+
     /** Get the base-pointer of the calling function
      *\return base-pointer of the calling function */
     static uintptr_t getBasePointer();
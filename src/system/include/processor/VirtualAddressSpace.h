@@ -54,6 +54,9 @@ class VirtualAddressSpace
     static const size_t MemoryCoherent= 0x80;
     /** If this flag is set, the page is guarded - only applicable to PPC */
     static const size_t Guarded       = 0x100;
+    /** If this flag is set, the page is shared between address spaces and must stay
+     *  shared when the address space is cloned (e.g. MAP_SHARED mappings). */
+    static const size_t Shared        = 0x200;
 
     /** Get the kernel virtual address space
      *\return reference to the kernel virtual address space */
@@ -128,8 +131,13 @@ class VirtualAddressSpace
     static VirtualAddressSpace *create();
 
     /** Clone this VirtualAddressSpace. That means that we copy-on-write-map the application
-     *  image. */
-    virtual VirtualAddressSpace *clone() =0;
+     *  image.
+     *\param[in] copyOnWrite if false, only the clone's mappings are made copy-on-write and
+     *           ours are left writable. This is only safe if this address space doesn't
+     *           write to its memory until the clone has been reverted or destroyed, as
+     *           with vfork().
+     *\return pointer to the new VirtualAddressSpace, 0 otherwise */
+    virtual VirtualAddressSpace *clone(bool copyOnWrite = true) =0;
 
     /** Undo a clone() - this happens when an application is Exec()'d - we destroy all mappings
         not in the kernel address space so the space is 'clean'.*/
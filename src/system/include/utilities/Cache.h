@@ -20,23 +20,34 @@
 #include <processor/Processor.h>
 #include <utilities/MemoryAllocator.h>
 #include <utilities/UnlikelyLock.h>
+#include <process/Semaphore.h>
 #include <utilities/Tree.h>
+#include <utilities/List.h>
 #include <Spinlock.h>
+#include <Atomic.h>
 
 #include <processor/PhysicalMemoryManager.h>
 
-/// The age at which a cache page is considered "old" and can be evicted
-/// This is expressed in seconds.
-#define CACHE_AGE_THRESHOLD 10
+/// Number of free physical pages below which the PMM asks the caches to
+/// give memory back.
+#define CACHE_LOW_WATERMARK 2048
 
-/// In the case where no pages are old enough, this is the number of pages that
-/// will be force-freed.
-#define CACHE_NUM_THRESHOLD 2
+/// Number of pages a low-watermark reclaim tries to free in one go.
+#define CACHE_RECLAIM_TARGET 256
+
+/// Interval, in seconds, at which dirty pages are written back.
+#define CACHE_WRITEBACK_PERIOD 30
+
+class Thread;
 
 // Forward declaration of Cache so CacheManager can be defined first
 class Cache;
 
-/** Provides a clean abstraction to a set of data caches. */
+/** Provides a clean abstraction to a set of data caches.
+ *
+ *  The manager also owns a thread which trims the caches and writes dirty
+ *  pages back. The PMM flags it when free memory drops below
+ *  CACHE_LOW_WATERMARK, as it often cannot do either itself. */
 class CacheManager
 {
     public:
@@ -48,28 +59,94 @@ class CacheManager
             return m_Instance;
         }
 
+        /** Spawns the trim thread. */
+        void initialise();
+
         void registerCache(Cache *pCache);
         void unregisterCache(Cache *pCache);
 
-        void compactAll();
+        /** Evicts up to \p nPages clean, unpinned pages across all caches.
+         *  Never blocks: caches that are busy are skipped, and reentrant
+         *  calls return immediately.
+         *  \param[out] bDirtySkipped Set if dirty pages were in the way.
+         *  \return The number of pages freed. */
+        size_t compactAll(size_t nPages, bool &bDirtySkipped);
+
+        /** Writes back all dirty pages. May block. */
+        void syncAll();
+
+        /** Asks the trim thread to reclaim memory. Only sets a flag - it
+         *  doesn't allocate, block or wake threads - so it may be called from
+         *  the PMM with any locks held. */
+        void trim();
+
     private:
+        static int trimThread(void *p);
+
         static CacheManager m_Instance;
 
         List<Cache*> m_Caches;
+
+        /** Guards m_Caches. Walking the list enters it; registering and
+         *  unregistering acquire it, so they wait for any walk to finish. */
+        UnlikelyLock m_CachesLock;
+
+        /** Set while a compaction is running, to stop reentrancy. */
+        Atomic<bool> m_bCompacting;
+
+        /** Set while the trim thread has a reclaim pending. */
+        Atomic<bool> m_bTrimPending;
+
+        /** The trim thread sleeps on this (with a timeout) between passes. */
+        Semaphore m_TrimSemaphore;
+
+        /** The trim thread, if started. */
+        Thread *m_pThread;
+};
+
+/** Per-cache statistics. */
+struct CacheStatistics
+{
+    /// Number of lookups that found the page.
+    size_t hits;
+    /// Number of lookups that did not.
+    size_t misses;
+    /// Number of pages evicted by compact().
+    size_t evictions;
+    /// Number of dirty pages written back.
+    size_t writebacks;
+    /// Number of pages currently in the cache.
+    size_t pages;
 };
 
-/** Provides an abstraction of a data cache. */
+/** Provides an abstraction of a data cache.
+ *
+ *  Pages are pinned while their reference count is non-zero: lookup() and
+ *  insert() take a reference, release() drops it. Only unpinned pages are
+ *  ever evicted. Eviction uses the CLOCK algorithm: lookup() sets a page's
+ *  reference bit, and the clock hand clears it once before evicting. */
 class Cache
 {
 public:
 
+    /** Callback used to write a dirty page back to its backing store.
+     *  \param key The key of the page.
+     *  \param location The address of the page's data.
+     *  \param meta The pointer passed to setCallback. */
+    typedef void (*writeback_t)(uintptr_t key, uintptr_t location, void *meta);
+
     Cache();
     virtual ~Cache();
 
     /** Looks for \p key , increasing \c refcnt by one if returned. */
     uintptr_t lookup (uintptr_t key);
 
-    /** Creates a cache entry with the given key. */
+    /** Determines whether any page in [key, key + length) is in the cache,
+     *  without affecting reference counts or statistics. */
+    bool exists (uintptr_t key, size_t length = 1);
+
+    /** Creates a cache entry with the given key, increasing \c refcnt by
+     *  one. */
     uintptr_t insert (uintptr_t key);
     
     /** Creates a bunch of cache entries to fill a specific size. Note that
@@ -81,17 +158,37 @@ public:
     /** Decreases \p key 's \c refcnt by one. */
     void release(uintptr_t key);
 
-    /** Attempts to "compact" the cache - (hopefully) reduces
-     *  resource usage by throwing away items in a
-     *  least-recently-used fashion. This is called in an
-     *  emergency "physical memory getting full" situation by the
-     *  PMM. */
-    void compact ();
+    /** Marks \p key as modified, so it is written back before eviction. */
+    void markDirty(uintptr_t key);
+
+    /** Sets the writeback callback. Without one, dirty pages are never
+     *  evicted. */
+    void setCallback(writeback_t newCallback, void *meta);
+
+    /** Attempts to "compact" the cache - reduces resource usage by
+     *  evicting up to \p nPages clean, unpinned pages that have not been
+     *  referenced since the clock hand last passed. Never blocks: if the
+     *  cache is busy, nothing is done.
+     *  \param nPages Maximum number of pages to evict.
+     *  \param[out] bDirtySkipped Set if a dirty page could have been
+     *               evicted had it been written back.
+     *  \return The number of pages freed. */
+    size_t compact (size_t nPages, bool &bDirtySkipped);
+
+    /** Writes back all dirty pages using the callback, pinned or not -
+     *  pinning only stops eviction. May block. */
+    void sync();
+
+    /** Retrieves the statistics for this cache. */
+    void getStatistics(CacheStatistics &stats);
 
 private:
 
     struct CachePage
     {
+        /// The key of this page.
+        uintptr_t key;
+
         /// The location of this page in memory
         uintptr_t location;
 
@@ -99,14 +196,40 @@ private:
         /// threads having access to the page.
         size_t refcnt;
 
-        /// The time at which this page was allocated. This is used by
-        /// compact() to determine the best pages to evict.
-        uint32_t timeAllocated;
+        /// CLOCK reference bit, set on lookup.
+        bool accessed;
+
+        /// Set if the page must be written back before it is evicted.
+        bool dirty;
+
+        /// Links in the CLOCK ring.
+        CachePage *next;
+        CachePage *prev;
     };
 
+    /** Creates a page for \p key at \p location, backed by \p phys.
+     *  Must be called with the lock held. */
+    void addPage(uintptr_t key, uintptr_t location, physical_uintptr_t phys);
+
+    /** Unlinks and frees a page. Must be called with the lock held. */
+    void evictPage(CachePage *pPage);
+
     /** Key-item pairs. */
     Tree<uintptr_t, CachePage*> m_Pages;
 
+    /** The CLOCK hand; pages form a circular list through it. */
+    CachePage *m_pClockHand;
+
+    /** Writeback callback and its parameter. */
+    writeback_t m_Callback;
+    void *m_CallbackMeta;
+
+    /** Statistics. Updated without the write lock, so approximate. */
+    size_t m_nHits;
+    size_t m_nMisses;
+    size_t m_nEvictions;
+    size_t m_nWritebacks;
+
     /** Static MemoryAllocator to allocate virtual address space for all caches. */
     static MemoryAllocator m_Allocator;
 
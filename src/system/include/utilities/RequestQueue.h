@@ -53,6 +53,9 @@ public:
     uint64_t addAsyncRequest(size_t priority, uint64_t p1=0, uint64_t p2=0, uint64_t p3=0, uint64_t p4=0, uint64_t p5=0,
                              uint64_t p6=0, uint64_t p7=0, uint64_t p8=0);
 
+    /** Returns the number of requests waiting to be executed. */
+    size_t getQueueDepth();
+
 protected:
     /** Callback - classes are expected to inherit and override this function. It's called when a
         request needs to be executed (by the worker thread). */
@@ -86,6 +89,27 @@ protected:
         void operator =(const Request&);
     };
 
+    /** Elevator hook: returns true if the new request pA should be executed
+        before pB, which is already queued at the same priority. Requests are
+        inserted before the first queued request this returns true for; the
+        default keeps them in the order they arrive.
+        \note Called with the queue locked - must not block. */
+    virtual bool compareRequests(Request *pA, Request *pB)
+    {return false;}
+
+    /** Merge hook: called for a new asynchronous request with each
+        asynchronous request already queued at the same priority. Returns true
+        if pQueued has been changed to do pNew's work as well, in which case
+        pNew is dropped.
+        \note Called with the queue locked - must not block. */
+    virtual bool mergeRequests(Request *pQueued, Request *pNew)
+    {return false;}
+
+    /** Inserts a request into the queue for the given priority, in the
+        order given by compareRequests.
+        \note m_RequestQueueMutex must be held. */
+    void insertRequest(size_t priority, Request *pReq);
+
     /** Thread trampoline */
     static int trampoline(void *p);
 
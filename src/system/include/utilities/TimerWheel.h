@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/**\file  TimerWheel.h
+ *\brief  Implements the class TimerWheel, a hierarchical timing wheel that
+          holds every pending alarm in the system. */
+
+#include <processor/types.h>
+#include <Spinlock.h>
+
+/// log2 of the width of a level 0 slot, in microseconds (1.024ms).
+#define TIMERWHEEL_RESOLUTION_SHIFT     10
+/// log2 of the number of slots in each level.
+#define TIMERWHEEL_LEVEL_BITS           6
+/// Number of slots in each level.
+#define TIMERWHEEL_LEVEL_SIZE           (1 << TIMERWHEEL_LEVEL_BITS)
+/// Number of levels. Four levels of 64 slots cover a little over 4.5 hours;
+/// anything further out waits in the last slot and is re-filed when it comes
+/// round.
+#define TIMERWHEEL_LEVELS               4
+
+/** An alarm that can be armed on a TimerWheel (usually via Timer::addAlarm).
+
+    The wheel links the alarm in place, so arming and cancelling never
+    allocate and an Alarm can live on the stack or inside another object,
+    as long as it is cancelled before it goes away. */
+class Alarm
+{
+    friend class TimerWheel;
+public:
+    Alarm() : m_Deadline(0), m_pNext(0), m_pPrev(0), m_pSlot(0)
+    {}
+    virtual ~Alarm()
+    {}
+
+    /** Called when the deadline passes. This runs in interrupt context, with
+        no wheel lock held, so it may re-arm the alarm but must not block. */
+    virtual void fire() = 0;
+
+    /** Whether the alarm is waiting to fire. */
+    bool isArmed()
+    {return m_pSlot != 0;}
+
+    /** Returns the time (in microseconds since boot) the alarm fires at. */
+    uint64_t getDeadline()
+    {return m_Deadline;}
+
+private:
+    /** Private copy constructor
+        \note NOT implemented. */
+    Alarm(const Alarm &);
+    /** Private operator=
+        \note NOT implemented. */
+    Alarm &operator = (const Alarm &);
+
+    /** Time, in microseconds since boot, at which the alarm fires. */
+    uint64_t m_Deadline;
+    /** Neighbours in the slot the alarm is filed in. */
+    Alarm *m_pNext;
+    Alarm *m_pPrev;
+    /** Head of the slot the alarm is filed in, or null if not armed. */
+    Alarm **m_pSlot;
+};
+
+/** A hierarchical timing wheel, after Varghese and Lauck.
+
+    Level 0 has one slot per ~1ms tick; each level above it has slots 64
+    times wider than the level below. An alarm is filed in the lowest level
+    that can tell its deadline apart from the present, and is moved down a
+    level (cascaded) when the lower level wraps round to it. Arming and
+    cancelling are O(1), and alarms due in the same tick share a slot, so
+    they fire together off a single interrupt.
+
+    The owner drives the wheel by calling advance() from its timer interrupt. */
+class TimerWheel
+{
+public:
+    TimerWheel();
+    ~TimerWheel();
+
+    /** Arms pAlarm to fire usecs microseconds from now, moving it if it is
+        already armed. */
+    void arm(Alarm *pAlarm, uint64_t usecs);
+
+    /** Disarms pAlarm. If its fire() is running on another processor, waits
+        for it to finish, so the caller is free to destroy the alarm.
+        \return True if the alarm was armed (and so will now never fire). */
+    bool cancel(Alarm *pAlarm);
+
+    /** Moves the wheel's clock forward and fires every alarm that is due.
+        \param now The current time, in microseconds since boot. */
+    void advance(uint64_t now);
+
+    /** Returns the wheel's idea of the current time, in microseconds since
+        boot, as of the last advance(). */
+    uint64_t now()
+    {return m_Now;}
+
+private:
+    /** Private copy constructor
+        \note NOT implemented. */
+    TimerWheel(const TimerWheel &);
+    /** Private operator=
+        \note NOT implemented. */
+    TimerWheel &operator = (const TimerWheel &);
+
+    /** Files pAlarm in the slot for its deadline.
+        \note m_Lock must be held. */
+    void insert(Alarm *pAlarm);
+    /** Unlinks pAlarm from whichever slot it is in.
+        \note m_Lock must be held. */
+    void unlink(Alarm *pAlarm);
+    /** Re-files the alarms in the given slot of the given level, which are
+        now close enough to be told apart by the levels below.
+        \return The slot index, so that the caller knows whether this level
+                has wrapped too. */
+    size_t cascade(size_t level, size_t index);
+
+    /** Protects the slots and everything filed in them. */
+    Spinlock m_Lock;
+    /** Time of the last advance(), in microseconds since boot. */
+    uint64_t m_Now;
+    /** The next level 0 tick (units of 1 << TIMERWHEEL_RESOLUTION_SHIFT us)
+        that has yet to be processed. */
+    uint64_t m_Tick;
+    /** Number of armed alarms. */
+    size_t m_nAlarms;
+    /** The slots. */
+    Alarm *m_Slots[TIMERWHEEL_LEVELS][TIMERWHEEL_LEVEL_SIZE];
+    /** Alarms taken off the wheel by advance() that are yet to fire. */
+    Alarm *m_pExpired;
+    /** The alarm whose fire() is running, if any, and where. */
+    Alarm * volatile m_pRunning;
+    size_t m_RunningProcessor;
+    /** Set while an advance() is under way, so only one processor fires. */
+    bool m_bAdvancing;
+};
+
+#endif
@@ -97,6 +97,25 @@ public:
 
         return true;
     }
+    /** Locks the lock only if no other thread is in, or has locked, the
+        critical region. Never waits.
+        \return True if the lock was acquired. */
+    inline bool tryAcquire()
+    {
+        bool bOldInterrupts = Processor::getInterrupts();
+        if(bOldInterrupts)
+            Processor::setInterrupts(false);
+
+        if (!m_Atomic.compareAndSwap(0, 100000))
+        {
+            Processor::setInterrupts(bOldInterrupts);
+            return false;
+        }
+
+        m_bInterrupts = bOldInterrupts;
+
+        return true;
+    }
     /** Releases the lock. */
     inline void release()
     {
@@ -22,6 +22,11 @@
 #include <utilities/utility.h>
 #include <processor/Processor.h>
 #include <LockGuard.h>
+#ifdef THREADS
+#include <process/Thread.h>
+#include <process/Semaphore.h>
+#include <process/SchedulingAlgorithm.h>
+#endif
 
 extern BootstrapStruct_t *g_pBootstrapInfo;
 
@@ -56,13 +61,53 @@ class SerialLogger : public Log::LogCallback
 
 static SerialLogger g_SerialCallback;
 
+/** Formats an entry the way the output callbacks expect it. */
+static void formatEntry(const Log::LogEntry &entry, HugeStaticString &str)
+{
+    switch(entry.type)
+    {
+        case Log::Debug:
+            str = "(DD) ";
+            break;
+        case Log::Notice:
+            str = "(NN) ";
+            break;
+        case Log::Warning:
+            str = "(WW) ";
+            break;
+        case Log::Error:
+            str = "(EE) ";
+            break;
+        case Log::Fatal:
+            str = "(FF) ";
+            break;
+        default:
+            str = "(XX) ";
+            break;
+    }
+    str += entry.str;
+#ifndef SERIAL_IS_FILE
+    str += "\r\n"; // Handle carriage return
+#else
+    str += "\n";
+#endif
+}
+
+Log::Buffer::Buffer() :
+    m_Lock(), m_bInterrupts(false), m_Entry(), m_NumberType(Dec), m_Ring(),
+    m_Head(0), m_Tail(0), m_nDropped(0)
+{
+}
+
 Log::Log () :
-    m_Lock(),
     m_StaticEntries(0),
     m_StaticEntryStart(0),
     m_StaticEntryEnd(0),
-    m_Buffer(),
-    m_NumberType(Dec),
+    m_Buffers(),
+    m_Sequence(0),
+    m_bDraining(false),
+    m_DrainingProcessor(~0UL),
+    m_bAsynchronous(false),
     #ifdef DONT_LOG_TO_SERIAL
     m_EchoToSerial(false)
     #else
@@ -108,12 +153,42 @@ void Log::initialise2()
         installCallback(&g_SerialCallback, false);
 }
 
-void Log::installCallback(LogCallback *pCallback, bool bSkipBacklog)
+void Log::initialise3()
+{
+#ifdef THREADS
+    new Thread(Processor::information().getCurrentThread()->getParent(),
+               reinterpret_cast<Thread::ThreadStartFunc> (&drainThread),
+               reinterpret_cast<void*> (this));
+#endif
+}
+
+int Log::drainThread(void *p)
 {
+#ifdef THREADS
+    Log *pLog = reinterpret_cast<Log*>(p);
+
+    // Logging shouldn't compete with real work.
+    Processor::information().getCurrentThread()->setPriority(MAX_PRIORITIES - 2);
+
+    pLog->m_bAsynchronous = true;
+
+    Semaphore sleeper(0);
+    while(true)
     {
-        LockGuard<Spinlock> guard(m_Lock);
-        m_OutputCallbacks.pushBack(pCallback);
+        sleeper.acquire(1, 0, LOG_DRAIN_INTERVAL);
+        pLog->drain(false);
     }
+#endif
+    return 0;
+}
+
+void Log::installCallback(LogCallback *pCallback, bool bSkipBacklog)
+{
+    bool bInterrupts;
+    while(!tryLockDrain(bInterrupts))
+        ;
+    m_OutputCallbacks.pushBack(pCallback);
+    unlockDrain(bInterrupts);
 
     // Some callbacks want to skip a (potentially) massive backlog
     if(bSkipBacklog)
@@ -128,33 +203,7 @@ void Log::installCallback(LogCallback *pCallback, bool bSkipBacklog)
         else
         {
             HugeStaticString str;
-            switch(m_StaticLog[entry].type)
-            {
-                case Debug:
-                    str = "(DD) ";
-                    break;
-                case Notice:
-                    str = "(NN) ";
-                    break;
-                case Warning:
-                    str = "(WW) ";
-                    break;
-                case Error:
-                    str = "(EE) ";
-                    break;
-                case Fatal:
-                    str = "(FF) ";
-                    break;
-                default:
-                    str = "(XX) ";
-                    break;
-            }
-            str += m_StaticLog[entry].str;
-#ifndef SERIAL_IS_FILE
-            str += "\r\n"; // Handle carriage return
-#else
-            str += "\n";
-#endif
+            formatEntry(m_StaticLog[entry], str);
 
             /// \note This could send a massive batch of log entries on the
             ///       callback. If the callback isn't designed to handle big
@@ -167,7 +216,9 @@ void Log::installCallback(LogCallback *pCallback, bool bSkipBacklog)
 }
 void Log::removeCallback(LogCallback *pCallback)
 {
-    LockGuard<Spinlock> guard(m_Lock);
+    bool bInterrupts;
+    while(!tryLockDrain(bInterrupts))
+        ;
     for(List<LogCallback*>::Iterator it = m_OutputCallbacks.begin();
         it != m_OutputCallbacks.end();
         it++)
@@ -175,24 +226,247 @@ void Log::removeCallback(LogCallback *pCallback)
         if(*it == pCallback)
         {
             m_OutputCallbacks.erase(it);
+            break;
+        }
+    }
+    unlockDrain(bInterrupts);
+}
+
+Log::Buffer &Log::lockBuffer()
+{
+    // Don't let the thread move to another processor between picking a
+    // buffer and locking it.
+    bool bInterrupts = Processor::getInterrupts();
+    Processor::setInterrupts(false);
+
+    Buffer &buffer = getBuffer();
+    buffer.m_Lock.acquire();
+    buffer.m_bInterrupts = bInterrupts;
+    return buffer;
+}
+
+void Log::unlockBuffer(Buffer &buffer)
+{
+    bool bInterrupts = buffer.m_bInterrupts;
+    buffer.m_Lock.release();
+    Processor::setInterrupts(bInterrupts);
+}
+
+Log::Buffer &Log::getBuffer()
+{
+    return m_Buffers[Processor::id() % LOG_BUFFERS];
+}
+
+void Log::flush()
+{
+    drain(true);
+}
+
+void Log::commit(Buffer &buffer)
+{
+    // Fatal entries have to get out before the panic, and until the drain
+    // thread is up everything is written out straight away.
+    bool bNow = !m_bAsynchronous || (buffer.m_Entry.type == Fatal);
+
+    if((buffer.m_Head - buffer.m_Tail) >= LOG_RING_ENTRIES)
+    {
+        if(bNow)
+            drain(true);
+
+        if((buffer.m_Head - buffer.m_Tail) >= LOG_RING_ENTRIES)
+        {
+            buffer.m_nDropped++;
             return;
         }
     }
+
+    // The next entry to get through reports what was lost before it.
+    Buffer::RingEntry &slot = buffer.m_Ring[buffer.m_Head % LOG_RING_ENTRIES];
+    slot.seq = (m_Sequence += 1);
+    slot.nDropped = buffer.m_nDropped;
+    slot.entry = buffer.m_Entry;
+    buffer.m_nDropped = 0;
+
+    // Publish the entry only once it's all there.
+    __sync_synchronize();
+    buffer.m_Head = buffer.m_Head + 1;
+
+    if(bNow)
+        drain(true);
 }
 
-Log &Log::operator<< (const char *str)
+void Log::drain(bool bWait)
 {
-    m_Buffer.str.append(str);
+    while(true)
+    {
+        bool bInterrupts;
+        if(!tryLockDrain(bInterrupts))
+        {
+            // An output callback that logs ends up back here; the drain
+            // further up the stack will get to its entries.
+            if(!bWait || (m_DrainingProcessor == Processor::id()))
+                return;
+            continue;
+        }
+
+        m_DrainingProcessor = Processor::id();
+        bool bMore = drainOne();
+        m_DrainingProcessor = ~0UL;
+
+        unlockDrain(bInterrupts);
+
+        if(!bMore)
+            return;
+    }
+}
+
+bool Log::drainOne()
+{
+    // Find the oldest queued entry.
+    Buffer *pOldest = 0;
+    for(size_t i = 0; i < LOG_BUFFERS; i++)
+    {
+        Buffer &buffer = m_Buffers[i];
+
+        if(buffer.m_Tail == buffer.m_Head)
+            continue;
+
+        if(!pOldest ||
+           (buffer.m_Ring[buffer.m_Tail % LOG_RING_ENTRIES].seq <
+            pOldest->m_Ring[pOldest->m_Tail % LOG_RING_ENTRIES].seq))
+            pOldest = &buffer;
+    }
+
+    if(!pOldest)
+        return false;
+
+    __sync_synchronize();
+    Buffer::RingEntry &slot = pOldest->m_Ring[pOldest->m_Tail % LOG_RING_ENTRIES];
+
+    if(slot.nDropped)
+    {
+        LogEntry entry;
+        entry.timestamp = slot.entry.timestamp;
+        entry.type = Warning;
+        entry.str.append("Log: ring full, dropped ");
+        entry.str.append(slot.nDropped, 10);
+        entry.str.append(" entries");
+        output(entry);
+    }
+
+    output(slot.entry);
+
+    // Only now can the producer reuse the slot.
+    __sync_synchronize();
+    pOldest->m_Tail = pOldest->m_Tail + 1;
+
+    return true;
+}
+
+void Log::output(const LogEntry &entry)
+{
+    if (m_StaticEntries >= LOG_ENTRIES)
+    {
+        m_StaticEntryStart = (m_StaticEntryStart+1) % LOG_ENTRIES;
+    }
+    else
+        m_StaticEntries ++;
+
+    m_StaticLog[m_StaticEntryEnd] = entry;
+    m_StaticEntryEnd = (m_StaticEntryEnd+1) % LOG_ENTRIES;
+
+    if(m_OutputCallbacks.count())
+    {
+        // We have output callbacks installed. Build the string we'll pass
+        // to each callback *now* and then send it.
+        HugeStaticString str;
+        formatEntry(entry, str);
+
+        for(List<LogCallback*>::Iterator it = m_OutputCallbacks.begin();
+            it != m_OutputCallbacks.end();
+            it++)
+        {
+            if(*it)
+                (*it)->callback(static_cast<const char*>(str));
+        }
+    }
+}
+
+bool Log::tryLockDrain(bool &bInterrupts)
+{
+    bInterrupts = Processor::getInterrupts();
+    Processor::setInterrupts(false);
+
+    if(m_bDraining.compareAndSwap(false, true))
+        return true;
+
+    Processor::setInterrupts(bInterrupts);
+    return false;
+}
+
+void Log::unlockDrain(bool bInterrupts)
+{
+    m_bDraining = false;
+    Processor::setInterrupts(bInterrupts);
+}
+
+size_t Log::getDynamicEntryCount() const
+{
+    size_t nEntries = 0;
+    for(size_t i = 0; i < LOG_BUFFERS; i++)
+        nEntries += m_Buffers[i].m_Head - m_Buffers[i].m_Tail;
+    return nEntries;
+}
+
+const Log::DynamicLogEntry &Log::getDynamicEntry(size_t n) const
+{
+    // Walk the rings in order without draining them: this is for looking
+    // at what was still queued when the system stopped.
+    n -= m_StaticEntries;
+
+    size_t cursor[LOG_BUFFERS];
+    for(size_t i = 0; i < LOG_BUFFERS; i++)
+        cursor[i] = m_Buffers[i].m_Tail;
+
+    const Buffer::RingEntry *pEntry = 0;
+    do
+    {
+        size_t oldest = LOG_BUFFERS;
+        for(size_t i = 0; i < LOG_BUFFERS; i++)
+        {
+            if(cursor[i] == m_Buffers[i].m_Head)
+                continue;
+            if((oldest == LOG_BUFFERS) ||
+               (m_Buffers[i].m_Ring[cursor[i] % LOG_RING_ENTRIES].seq <
+                m_Buffers[oldest].m_Ring[cursor[oldest] % LOG_RING_ENTRIES].seq))
+                oldest = i;
+        }
+
+        if(oldest == LOG_BUFFERS)
+            break;
+
+        pEntry = &m_Buffers[oldest].m_Ring[cursor[oldest] % LOG_RING_ENTRIES];
+        cursor[oldest]++;
+    } while(n--);
+
+    if(!pEntry)
+        return m_StaticLog[0];
+    return pEntry->entry;
+}
+
+Log::Buffer &Log::Buffer::operator<< (const char *str)
+{
+    m_Entry.str.append(str);
     return *this;
 }
 
-Log &Log::operator<< (String str)
+Log::Buffer &Log::Buffer::operator<< (String str)
 {
-    m_Buffer.str.append(str);
+    m_Entry.str.append(str);
     return *this;
 }
 
-Log &Log::operator<< (bool b)
+Log::Buffer &Log::Buffer::operator<< (bool b)
 {
     if (b)
         return *this << "true";
@@ -201,122 +475,70 @@ Log &Log::operator<< (bool b)
 }
 
 template<class T>
-Log &Log::operator << (T n)
+Log::Buffer &Log::Buffer::operator << (T n)
 {
     size_t radix = 10;
     if (m_NumberType == Hex)
     {
         radix = 16;
-        m_Buffer.str.append("0x");
+        m_Entry.str.append("0x");
     }
     else if (m_NumberType == Oct)
     {
         radix = 8;
-        m_Buffer.str.append("0");
+        m_Entry.str.append("0");
     }
-    m_Buffer.str.append(n, radix);
+    m_Entry.str.append(n, radix);
     return *this;
 }
 
 // NOTE: Make sure that the templated << operator gets only instantiated for
 //       integer types.
-template Log &Log::operator << (char);
-template Log &Log::operator << (unsigned char);
-template Log &Log::operator << (short);
-template Log &Log::operator << (unsigned short);
-template Log &Log::operator << (int);
-template Log &Log::operator << (unsigned int);
-template Log &Log::operator << (long);
-template Log &Log::operator << (unsigned long);
+template Log::Buffer &Log::Buffer::operator << (char);
+template Log::Buffer &Log::Buffer::operator << (unsigned char);
+template Log::Buffer &Log::Buffer::operator << (short);
+template Log::Buffer &Log::Buffer::operator << (unsigned short);
+template Log::Buffer &Log::Buffer::operator << (int);
+template Log::Buffer &Log::Buffer::operator << (unsigned int);
+template Log::Buffer &Log::Buffer::operator << (long);
+template Log::Buffer &Log::Buffer::operator << (unsigned long);
 // NOTE: Instantiating these for MIPS32 requires __udiv3di, but we only have
 //       __udiv3ti (??) in libgcc.a for mips.
 #ifndef MIPS32
-template Log &Log::operator << (long long);
-template Log &Log::operator << (unsigned long long);
+template Log::Buffer &Log::Buffer::operator << (long long);
+template Log::Buffer &Log::Buffer::operator << (unsigned long long);
 #endif
 
-Log &Log::operator<< (Modifier type)
+Log::Buffer &Log::Buffer::operator<< (Modifier type)
 {
-    // Flush the buffer.
+    // Queue the entry.
     if (type == Flush)
-    {
-        if (m_StaticEntries >= LOG_ENTRIES)
-        {
-            m_StaticEntryStart = (m_StaticEntryStart+1) % LOG_ENTRIES;
-        }
-        else
-            m_StaticEntries ++;
-
-        m_StaticLog[m_StaticEntryEnd] = m_Buffer;
-        m_StaticEntryEnd = (m_StaticEntryEnd+1) % LOG_ENTRIES;
-
-        if(m_OutputCallbacks.count())
-        {
-            // We have output callbacks installed. Build the string we'll pass
-            // to each callback *now* and then send it.
-            HugeStaticString str;
-            switch(m_Buffer.type)
-            {
-                case Debug:
-                    str = "(DD) ";
-                    break;
-                case Notice:
-                    str = "(NN) ";
-                    break;
-                case Warning:
-                    str = "(WW) ";
-                    break;
-                case Error:
-                    str = "(EE) ";
-                    break;
-                case Fatal:
-                    str = "(FF) ";
-                    break;
-                default:
-                    str = "(XX) ";
-                    break;
-            }
-            str += m_Buffer.str;
-#ifndef SERIAL_IS_FILE
-            str += "\r\n"; // Handle carriage return
-#else
-            str += "\n";
-#endif
-
-            for(List<LogCallback*>::Iterator it = m_OutputCallbacks.begin();
-                it != m_OutputCallbacks.end();
-                it++)
-            {
-                if(*it)
-                    (*it)->callback(static_cast<const char*>(str));
-            }
-        }
-    }
+        Log::instance().commit(*this);
 
     return *this;
 }
 
-Log &Log::operator<< (NumberType type)
+Log::Buffer &Log::Buffer::operator<< (NumberType type)
 {
     m_NumberType = type;
     return *this;
 }
 
-Log &Log::operator<< (SeverityLevel level)
+Log::Buffer &Log::Buffer::operator<< (SeverityLevel level)
 {
     // Zero the buffer.
-    m_Buffer.str.clear();
-    m_Buffer.type = level;
+    m_Entry.str.clear();
+    m_Entry.type = level;
 
     Machine &machine = Machine::instance();
     if (machine.isInitialised() == true &&
         machine.getTimer() != 0)
     {
         Timer &timer = *machine.getTimer();
-        m_Buffer.timestamp = timer.getTickCount();
+        m_Entry.timestamp = timer.getTickCount();
     }
     else
-        m_Buffer.timestamp = 0;
+        m_Entry.timestamp = 0;
 
     return *this;
 }
@@ -29,8 +29,16 @@
 
 SlamAllocator SlamAllocator::m_Instance;
 
+/// Protects heap expansion.
+Spinlock s;
+
 SlamCache::SlamCache() :
     m_ObjectSize(0), m_SlabSize(0)
+#if USING_MAGAZINES
+    , m_MagazineRounds(0), m_DepotLock(), m_pFullMagazines(0),
+    m_pEmptyMagazines(0), m_nFullMagazines(0), m_nEmptyMagazines(0),
+    m_nDepotExchanges(0)
+#endif
 #if CRIPPLINGLY_VIGILANT
     ,m_FirstSlab()
 #endif
@@ -52,18 +60,50 @@ void SlamCache::initialise(size_t objectSize)
     else
         m_SlabSize = SLAB_MINIMUM_SIZE;
 
-    size_t maxCpu = 1;
-#ifdef MULTIPROCESSOR
-    maxCpu = 255;
-#endif
-    for (size_t i = 0; i < maxCpu; i++)
+    for (size_t i = 0; i < SLAM_MAX_CPUS; i++)
         m_PartialLists[i] = 0;
 
+#if USING_MAGAZINES
+    for (size_t i = 0; i < SLAM_MAX_CPUS; i++)
+    {
+        m_CpuMagazines[i].loaded = 0;
+        m_CpuMagazines[i].previous = 0;
+        m_CpuMagazines[i].allocHits = 0;
+        m_CpuMagazines[i].allocMisses = 0;
+        m_CpuMagazines[i].freeHits = 0;
+        m_CpuMagazines[i].freeMisses = 0;
+    }
+
+    m_MagazineRounds = SLAM_MAGAZINE_MAX_BYTES / m_ObjectSize;
+    if (m_MagazineRounds > SLAM_MAGAZINE_ROUNDS)
+        m_MagazineRounds = SLAM_MAGAZINE_ROUNDS;
+
+    m_pFullMagazines = m_pEmptyMagazines = 0;
+    m_nFullMagazines = m_nEmptyMagazines = 0;
+    m_nDepotExchanges = 0;
+#endif
+
     assert( (m_SlabSize % m_ObjectSize) == 0 );
 }
 
 uintptr_t SlamCache::allocate()
 {
+#if USING_MAGAZINES
+    uintptr_t object = allocateFromMagazine();
+    if (object)
+    {
+#if USING_MAGIC
+        reinterpret_cast<Node*>(object)->magic = TEMP_MAGIC;
+#endif
+        return object;
+    }
+#endif
+
+    return allocateFromSlab();
+}
+
+uintptr_t SlamCache::allocateFromSlab()
+{
 #ifdef MULTIPROCESSOR
     size_t thisCpu = Processor::id();
 #else
@@ -123,12 +163,6 @@ uintptr_t SlamCache::allocate()
 
 void SlamCache::free(uintptr_t object)
 {
-#ifdef MULTIPROCESSOR
-    size_t thisCpu = Processor::id();
-#else
-    size_t thisCpu = 0;
-#endif
-
     Node *N = reinterpret_cast<Node*> (object);
 #if OVERRUN_CHECK
     // Grab the footer and check it.
@@ -144,6 +178,27 @@ void SlamCache::free(uintptr_t object)
     // Possible double free?
     assert(N->magic != MAGIC_VALUE);
     N->magic = MAGIC_VALUE;
+#endif
+
+#if USING_MAGAZINES
+    if (freeToMagazine(object))
+        return;
+#endif
+
+    freeToSlab(object);
+}
+
+void SlamCache::freeToSlab(uintptr_t object)
+{
+#ifdef MULTIPROCESSOR
+    size_t thisCpu = Processor::id();
+#else
+    size_t thisCpu = 0;
+#endif
+
+    Node *N = reinterpret_cast<Node*> (object);
+#if USING_MAGIC
+    N->magic = MAGIC_VALUE;
     N->prev = 0;
 #endif
 
@@ -160,6 +215,241 @@ void SlamCache::free(uintptr_t object)
 #endif
 }
 
+#if USING_MAGAZINES
+uintptr_t SlamCache::allocateFromMagazine()
+{
+    if (!m_MagazineRounds)
+        return 0;
+
+    // The per-CPU magazines are only consistent if nothing else on this CPU
+    // can touch them while we do, so keep interrupts off for the duration.
+    bool bInterrupts = Processor::getInterrupts();
+    if (bInterrupts)
+        Processor::setInterrupts(false);
+
+#ifdef MULTIPROCESSOR
+    CpuMagazines &cpu = m_CpuMagazines[Processor::id()];
+#else
+    CpuMagazines &cpu = m_CpuMagazines[0];
+#endif
+
+    uintptr_t object = 0;
+    if (cpu.loaded && cpu.loaded->nRounds)
+    {
+        object = cpu.loaded->rounds[--cpu.loaded->nRounds];
+        cpu.allocHits++;
+    }
+    else if (cpu.previous && cpu.previous->nRounds)
+    {
+        // The loaded magazine is empty and the previous one is full: swap.
+        Magazine *pTemp = cpu.loaded;
+        cpu.loaded = cpu.previous;
+        cpu.previous = pTemp;
+
+        object = cpu.loaded->rounds[--cpu.loaded->nRounds];
+        cpu.allocHits++;
+    }
+    else
+    {
+        cpu.allocMisses++;
+
+        // Both magazines are empty (or missing), try and get a full
+        // magazine from the depot, giving back the previous empty one.
+        m_DepotLock.acquire();
+        Magazine *pFull = m_pFullMagazines;
+        if (pFull)
+        {
+            m_pFullMagazines = pFull->next;
+            m_nFullMagazines--;
+
+            if (cpu.previous)
+            {
+                cpu.previous->next = m_pEmptyMagazines;
+                m_pEmptyMagazines = cpu.previous;
+                m_nEmptyMagazines++;
+            }
+            m_nDepotExchanges++;
+        }
+        m_DepotLock.release();
+
+        if (pFull)
+        {
+            cpu.previous = cpu.loaded;
+            cpu.loaded = pFull;
+
+            object = cpu.loaded->rounds[--cpu.loaded->nRounds];
+        }
+    }
+
+    if (bInterrupts)
+        Processor::setInterrupts(true);
+
+    return object;
+}
+
+bool SlamCache::freeToMagazine(uintptr_t object)
+{
+    if (!m_MagazineRounds)
+        return false;
+
+    bool bInterrupts = Processor::getInterrupts();
+    if (bInterrupts)
+        Processor::setInterrupts(false);
+
+#ifdef MULTIPROCESSOR
+    CpuMagazines &cpu = m_CpuMagazines[Processor::id()];
+#else
+    CpuMagazines &cpu = m_CpuMagazines[0];
+#endif
+
+    bool bStored = true;
+    if (cpu.loaded && cpu.loaded->nRounds < m_MagazineRounds)
+    {
+        cpu.loaded->rounds[cpu.loaded->nRounds++] = object;
+        cpu.freeHits++;
+    }
+    else if (cpu.previous && !cpu.previous->nRounds)
+    {
+        // The loaded magazine is full and the previous one is empty: swap.
+        Magazine *pTemp = cpu.loaded;
+        cpu.loaded = cpu.previous;
+        cpu.previous = pTemp;
+
+        cpu.loaded->rounds[cpu.loaded->nRounds++] = object;
+        cpu.freeHits++;
+    }
+    else
+    {
+        cpu.freeMisses++;
+
+        // Both magazines are full (or missing): hand the previous full one
+        // to the depot and load an empty one in its place.
+        Magazine *pEmpty = 0, *pOverflow = 0;
+        while (!pEmpty)
+        {
+            m_DepotLock.acquire();
+            pEmpty = m_pEmptyMagazines;
+            if (pEmpty)
+            {
+                m_pEmptyMagazines = pEmpty->next;
+                m_nEmptyMagazines--;
+
+                if (cpu.previous)
+                {
+                    if (m_nFullMagazines < SLAM_DEPOT_MAX_FULL)
+                    {
+                        cpu.previous->next = m_pFullMagazines;
+                        m_pFullMagazines = cpu.previous;
+                        m_nFullMagazines++;
+                    }
+                    else
+                        pOverflow = cpu.previous;
+                }
+                m_nDepotExchanges++;
+            }
+            m_DepotLock.release();
+
+            // Growing the depot may re-enter the allocator on this CPU, so
+            // it's done without holding the depot lock. The re-entrant call
+            // may change our magazines, in which case it's simplest to let
+            // the slab layer have this object. The same goes for frees made
+            // while the heap is being expanded (e.g. by the PMM).
+            if (!pEmpty)
+            {
+                Magazine *pLoaded = cpu.loaded, *pPrevious = cpu.previous;
+                if (s.acquired() || !growDepot() ||
+                    (pLoaded != cpu.loaded) || (pPrevious != cpu.previous))
+                {
+                    bStored = false;
+                    break;
+                }
+            }
+        }
+
+        if (pEmpty)
+        {
+            cpu.previous = cpu.loaded;
+            cpu.loaded = pEmpty;
+
+            cpu.loaded->rounds[cpu.loaded->nRounds++] = object;
+        }
+
+        // The depot already holds enough full magazines; the objects in
+        // this one go back to the slab layer and the magazine is recycled.
+        if (pOverflow)
+        {
+            for (size_t i = 0; i < pOverflow->nRounds; i++)
+                freeToSlab(pOverflow->rounds[i]);
+            pOverflow->nRounds = 0;
+
+            m_DepotLock.acquire();
+            pOverflow->next = m_pEmptyMagazines;
+            m_pEmptyMagazines = pOverflow;
+            m_nEmptyMagazines++;
+            m_DepotLock.release();
+        }
+    }
+
+    if (bInterrupts)
+        Processor::setInterrupts(true);
+
+    return bStored;
+}
+
+bool SlamCache::growDepot()
+{
+    // Magazines are small, so don't waste a whole slab of a large-object
+    // cache on them.
+    s.acquire();
+    uintptr_t slab = reinterpret_cast<uintptr_t>(dlmallocSbrk(SLAB_MINIMUM_SIZE));
+    s.release();
+    if (!slab)
+        return false;
+
+    size_t nMagazines = SLAB_MINIMUM_SIZE / sizeof(Magazine);
+
+    Magazine *pFirst = 0, *pLast = 0;
+    for (size_t i = 0; i < nMagazines; i++)
+    {
+        Magazine *pMagazine = reinterpret_cast<Magazine*>(slab + (i * sizeof(Magazine)));
+        pMagazine->nRounds = 0;
+        pMagazine->next = pFirst;
+        pFirst = pMagazine;
+        if (!pLast)
+            pLast = pMagazine;
+    }
+
+    m_DepotLock.acquire();
+    pLast->next = m_pEmptyMagazines;
+    m_pEmptyMagazines = pFirst;
+    m_nEmptyMagazines += nMagazines;
+    m_DepotLock.release();
+
+    return true;
+}
+#endif
+
+void SlamCache::getStatistics(SlamCacheStatistics &stats)
+{
+    stats.allocHits = stats.allocMisses = 0;
+    stats.freeHits = stats.freeMisses = 0;
+    stats.depotExchanges = stats.depotFull = stats.depotEmpty = 0;
+
+#if USING_MAGAZINES
+    for (size_t i = 0; i < SLAM_MAX_CPUS; i++)
+    {
+        stats.allocHits += m_CpuMagazines[i].allocHits;
+        stats.allocMisses += m_CpuMagazines[i].allocMisses;
+        stats.freeHits += m_CpuMagazines[i].freeHits;
+        stats.freeMisses += m_CpuMagazines[i].freeMisses;
+    }
+
+    stats.depotExchanges = m_nDepotExchanges;
+    stats.depotFull = m_nFullMagazines;
+    stats.depotEmpty = m_nEmptyMagazines;
+#endif
+}
+
 bool SlamCache::isPointerValid(uintptr_t object)
 {
     Node *N = reinterpret_cast<Node*> (object);
@@ -183,7 +473,6 @@ bool SlamCache::isPointerValid(uintptr_t object)
     return true;
 }
 
-Spinlock s;
 uintptr_t SlamCache::getSlab()
 {
     s.acquire();
@@ -459,6 +748,12 @@ uintptr_t SlamAllocator::allocate(size_t nBytes)
     return ret;
 }
 
+void SlamAllocator::getStatistics(size_t n, SlamCacheStatistics &stats)
+{
+    assert(n < cacheCount());
+    m_Caches[n].getStatistics(stats);
+}
+
 size_t SlamAllocator::allocSize(uintptr_t mem)
 {
     if(!mem)
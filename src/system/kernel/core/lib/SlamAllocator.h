@@ -25,6 +25,7 @@
 #include <processor/types.h>
 #include <processor/PhysicalMemoryManager.h>
 #include <Log.h>
+#include <Spinlock.h>
 
 #ifdef DEBUGGER
 #include <SlamCommand.h>
@@ -81,6 +82,51 @@ extern void *dlmallocSbrk(ssize_t incr);
 /// overrun occurs (EIP and all) rather than guessing.
 #define BOCHS_MAGIC_WATCHPOINTS         0
 
+/// Define to place a per-CPU magazine layer (Bonwick01) in front of each
+/// cache. Allocations and frees that hit the magazines touch neither a lock
+/// nor a cache line shared with another CPU.
+#define USING_MAGAZINES                 1
+
+/// Maximum number of objects (rounds) held by one magazine.
+#define SLAM_MAGAZINE_ROUNDS            14
+
+/// Upper bound on the number of bytes a single magazine may hold. Caches of
+/// large objects get smaller magazines, or none at all, so that the per-CPU
+/// layer doesn't hoard memory.
+#define SLAM_MAGAZINE_MAX_BYTES         0x10000
+
+/// Number of full magazines the depot keeps before returning objects to the
+/// slab layer.
+#define SLAM_DEPOT_MAX_FULL             8
+
+/// Size of a cache line, used to keep per-CPU state apart.
+#define SLAM_CACHE_LINE_SIZE            64
+
+#ifdef MULTIPROCESSOR
+///\todo MAX_CPUS
+#define SLAM_MAX_CPUS                   255
+#else
+#define SLAM_MAX_CPUS                   1
+#endif
+
+/** Allocation statistics for a single cache (size class). */
+struct SlamCacheStatistics
+{
+    /// Allocations satisfied from a per-CPU magazine.
+    size_t allocHits;
+    /// Allocations that had to go to the depot or the slab layer.
+    size_t allocMisses;
+    /// Frees that went into a per-CPU magazine.
+    size_t freeHits;
+    /// Frees that had to go to the depot or the slab layer.
+    size_t freeMisses;
+    /// Number of magazines exchanged with the depot.
+    size_t depotExchanges;
+    /// Full and empty magazines currently in the depot.
+    size_t depotFull;
+    size_t depotEmpty;
+};
+
 /** A cache allocates objects of a constant size. */
 class SlamCache
 {
@@ -118,6 +164,9 @@ public:
         return m_ObjectSize;
     }
 
+    /** Fills in the statistics for this cache, summed over all CPUs. */
+    void getStatistics(SlamCacheStatistics &stats);
+
 #if CRIPPLINGLY_VIGILANT
     void trackSlab(uintptr_t slab);
     void check();
@@ -128,22 +177,73 @@ private:
     const SlamCache& operator = (const SlamCache &);
 
 #ifdef MULTIPROCESSOR
-    ///\todo MAX_CPUS
     typedef Node *partialListType;
-    partialListType m_PartialLists[255];
 #else
     typedef volatile Node *partialListType;
-    partialListType m_PartialLists[1];
 #endif
+    partialListType m_PartialLists[SLAM_MAX_CPUS];
 
     uintptr_t getSlab();
     void freeSlab(uintptr_t slab);
 
     Node *initialiseSlab(uintptr_t slab);
 
+    /** Slab layer: pops an object from this CPU's partial list, creating a
+        new slab if needed. */
+    uintptr_t allocateFromSlab();
+    /** Slab layer: pushes an object onto this CPU's partial list. */
+    void freeToSlab(uintptr_t object);
+
     size_t m_ObjectSize;
     size_t m_SlabSize;
 
+#if USING_MAGAZINES
+    /** A bounded stack of free objects. */
+    struct Magazine
+    {
+        size_t nRounds;
+        Magazine *next;
+        uintptr_t rounds[SLAM_MAGAZINE_ROUNDS];
+    };
+
+    /** The per-CPU layer: a loaded magazine and the previously loaded one,
+        which is always either full or empty. Only ever touched by its own
+        CPU with interrupts disabled, and padded so no two CPUs share a line. */
+    struct CpuMagazines
+    {
+        Magazine *loaded;
+        Magazine *previous;
+        size_t allocHits;
+        size_t allocMisses;
+        size_t freeHits;
+        size_t freeMisses;
+    } __attribute__((aligned(SLAM_CACHE_LINE_SIZE)));
+
+    /** Magazine layer: returns an object, or zero if both this CPU's
+        magazines and the depot are empty. */
+    uintptr_t allocateFromMagazine();
+    /** Magazine layer: returns false if the object could not be stored and
+        must go back to the slab layer. */
+    bool freeToMagazine(uintptr_t object);
+
+    /** Carves a fresh slab into empty magazines and hands them to the depot. */
+    bool growDepot();
+
+    CpuMagazines m_CpuMagazines[SLAM_MAX_CPUS];
+
+    /// Number of rounds each magazine of this cache holds; zero disables
+    /// the magazine layer for this cache.
+    size_t m_MagazineRounds;
+
+    /// The depot: lists of full and empty magazines shared by all CPUs.
+    Spinlock m_DepotLock;
+    Magazine *m_pFullMagazines;
+    Magazine *m_pEmptyMagazines;
+    size_t m_nFullMagazines;
+    size_t m_nEmptyMagazines;
+    size_t m_nDepotExchanges;
+#endif
+
     // This version of the allocator doesn't have a free list, instead
     // the reap() function returns memory directly to the VMM. This
     // avoids needing to lock the free list on MP systems.
@@ -168,6 +268,17 @@ class SlamAllocator
 
         size_t allocSize(uintptr_t mem);
 
+        /** Number of size classes (caches) managed by the allocator. */
+        inline size_t cacheCount()
+        {
+            return 32;
+        }
+
+        /** Retrieves the statistics of the size class with index n; objects
+            in that class are (1 << n) bytes including the allocation header
+            and footer. */
+        void getStatistics(size_t n, SlamCacheStatistics &stats);
+
         static SlamAllocator &instance()
         {
             return m_Instance;
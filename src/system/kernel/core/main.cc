@@ -58,6 +58,7 @@
 
 #ifdef THREADS
 #include <utilities/ZombieQueue.h>
+#include <utilities/Cache.h>
 #endif
 
 #include <Module.h>
@@ -225,6 +226,12 @@ extern "C" void _main(BootstrapStruct_t &bsInf)
 
 #ifdef THREADS
   ZombieQueue::instance().initialise();
+
+  // Hand log output over to a background thread.
+  Log::instance().initialise3();
+
+  // Start reclaiming and writing back cache pages.
+  CacheManager::instance().initialise();
 #endif
 
   // Initialise the boot output.
@@ -19,8 +19,8 @@
 #ifdef THREADS
 
 // NOTE, this is in its own file purely so that a vtable can be generated.
-Mutex::Mutex(bool bLocked) :
-    Semaphore(bLocked ? 0 : 1)
+Mutex::Mutex(bool bLocked, bool bHandoff) :
+    Semaphore(bLocked ? 0 : 1, bHandoff)
 {
 }
 
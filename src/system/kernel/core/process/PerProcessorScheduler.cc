@@ -20,6 +20,7 @@
 #include <process/Thread.h>
 #include <process/SchedulingAlgorithm.h>
 #include <process/RoundRobin.h>
+#include <process/ProcessorThreadAllocator.h>
 
 #include <processor/Processor.h>
 #include <processor/PhysicalMemoryManager.h>
@@ -39,7 +40,8 @@
 #endif
 
 PerProcessorScheduler::PerProcessorScheduler() :
-    m_pSchedulingAlgorithm(0), m_NewThreadDataLock(false), m_NewThreadDataCount(0),
+    m_pSchedulingAlgorithm(0), m_ProcessorId(0), m_pIdleThread(0), m_nPlaced(0),
+    m_nStolenIn(0), m_nStolenOut(0), m_NewThreadDataLock(false), m_NewThreadDataCount(0),
     m_NewThreadData()
 #ifdef ARM_BEAGLE
     , m_TickCount(0)
@@ -83,6 +85,14 @@ int PerProcessorScheduler::processorAddThread(void *instance)
 
 void PerProcessorScheduler::initialise(Thread *pThread)
 {
+    m_ProcessorId = Processor::id();
+    m_pIdleThread = pThread;
+
+    // The idle thread never migrates.
+    if (m_ProcessorId < 64)
+        pThread->setAffinity(1ULL << m_ProcessorId);
+    pThread->setScheduler(this);
+
     m_pSchedulingAlgorithm = new RoundRobin();
 
     pThread->setStatus(Thread::Running);
@@ -114,6 +124,22 @@ void PerProcessorScheduler::schedule(Thread::Status nextStatus, Thread *pNewThre
     if(!pNewThread)
     {
         pNextThread = m_pSchedulingAlgorithm->getNext(pCurrentThread);
+
+        // Nothing else to do here - rather than idle, see if another
+        // processor has work to spare.
+        if (pNextThread == 0 && (nextStatus != Thread::Ready || pCurrentThread == m_pIdleThread))
+        {
+            pNextThread = ProcessorThreadAllocator::instance().stealThread(this);
+            if (pNextThread)
+            {
+                // Its old processor may still be switching away from it.
+                pNextThread->getLock().acquire();
+                pNextThread->setScheduler(this);
+                pNextThread->setCpuId(Processor::id());
+                m_nStolenIn += 1;
+            }
+        }
+
         if (pNextThread == 0)
         {
             // If we're supposed to be sleeping, this isn't a good place to be
@@ -134,6 +160,7 @@ void PerProcessorScheduler::schedule(Thread::Status nextStatus, Thread *pNewThre
     }
 
     // Now neither thread can be moved, we're safe to switch.
+    pCurrentThread->setLastRunTime(Machine::instance().getTimer()->getTickCount());
     pCurrentThread->setStatus(nextStatus);
     pNextThread->setStatus(Thread::Running);
     Processor::information().setCurrentThread(pNextThread);
@@ -334,6 +361,7 @@ void PerProcessorScheduler::addThread(Thread *pThread, Thread::ThreadStartFunc p
     }
     
     pThread->setCpuId(Processor::id());
+    pThread->setScheduler(this);
 
     bool bWasInterrupts = Processor::getInterrupts();
     Processor::setInterrupts(false);
@@ -386,6 +414,7 @@ void PerProcessorScheduler::addThread(Thread *pThread, Thread::ThreadStartFunc p
 void PerProcessorScheduler::addThread(Thread *pThread, SyscallState &state)
 {
     pThread->setCpuId(Processor::id());
+    pThread->setScheduler(this);
     
     bool bWasInterrupts = Processor::getInterrupts();
     Processor::setInterrupts(false);
@@ -496,4 +525,32 @@ void PerProcessorScheduler::threadStatusChanged(Thread *pThread)
     m_pSchedulingAlgorithm->threadStatusChanged(pThread);
 }
 
+size_t PerProcessorScheduler::getRunnableCount()
+{
+    if (!m_pSchedulingAlgorithm)
+        return 0;
+    return m_pSchedulingAlgorithm->getRunnableCount();
+}
+
+Thread *PerProcessorScheduler::stealThread(size_t targetId, uint64_t coldBefore)
+{
+    if (!m_pSchedulingAlgorithm)
+        return 0;
+
+    Thread *pThread = m_pSchedulingAlgorithm->stealThread(targetId, coldBefore);
+    if (pThread)
+        m_nStolenOut += 1;
+    return pThread;
+}
+
+PerProcessorScheduler::Statistics PerProcessorScheduler::getStatistics()
+{
+    Statistics stats;
+    stats.nRunnable = getRunnableCount();
+    stats.nPlaced = m_nPlaced;
+    stats.nStolenIn = m_nStolenIn;
+    stats.nStolenOut = m_nStolenOut;
+    return stats;
+}
+
 #endif
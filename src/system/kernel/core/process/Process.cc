@@ -35,19 +35,22 @@
 Process::Process() :
   m_Threads(), m_NextTid(0), m_Id(0), str(), m_pParent(0), m_pAddressSpace(&VirtualAddressSpace::getKernelAddressSpace()),
   m_ExitStatus(0), m_Cwd(0), m_Ctty(0), m_SpaceAllocator(true), m_pUser(0), m_pGroup(0), m_pEffectiveUser(0), m_pEffectiveGroup(0),
-  m_pDynamicLinker(0), m_pSubsystem(0), m_DeadThreads(0)
+  m_pDynamicLinker(0), m_pSubsystem(0), m_bVforked(false), m_VforkRelease(0), m_DeadThreads(0)
 {
   m_Id = Scheduler::instance().addProcess(this);
   m_SpaceAllocator.free(m_pAddressSpace->getUserStart(), m_pAddressSpace->getUserReservedStart());
 }
 
-Process::Process(Process *pParent) :
+Process::Process(Process *pParent, bool bVfork) :
   m_Threads(), m_NextTid(0), m_Id(0), str(), m_pParent(pParent), m_pAddressSpace(0),
   m_ExitStatus(0), m_Cwd(pParent->m_Cwd), m_Ctty(pParent->m_Ctty), m_SpaceAllocator(pParent->m_SpaceAllocator),
   m_pUser(pParent->m_pUser), m_pGroup(pParent->m_pGroup), m_pEffectiveUser(pParent->m_pEffectiveUser), m_pEffectiveGroup(pParent->m_pEffectiveGroup),
-  m_pDynamicLinker(pParent->m_pDynamicLinker), m_pSubsystem(0), m_DeadThreads(0)
+  m_pDynamicLinker(pParent->m_pDynamicLinker), m_pSubsystem(0), m_bVforked(bVfork),
+  m_VforkRelease(0), m_DeadThreads(0)
 {
-   m_pAddressSpace = pParent->m_pAddressSpace->clone();
+   // The parent of a vfork() won't touch its memory until we're gone, so it can
+   // keep its pages writable.
+   m_pAddressSpace = pParent->m_pAddressSpace->clone(!bVfork);
    // Copy the heap, but only if it's not the kernel heap (which is static)
   uintptr_t parentHeap = reinterpret_cast<uintptr_t>(pParent->m_pAddressSpace->m_Heap); // 0xc0000000
   if(parentHeap < m_pAddressSpace->getKernelStart()) /// \todo A better way would be nice.
@@ -129,6 +132,9 @@ void Process::kill()
   /// \todo Grab the scheduler lock!
   Processor::setInterrupts(false);
 
+  // Our parent can't wait on a vfork() child that is going away.
+  releaseVforkParent();
+
   if(m_pParent)
 	NOTICE("Kill: " << m_Id << " (parent: " << m_pParent->getId() << ")");
   else
@@ -190,6 +196,20 @@ void Process::kill()
   FATAL("Should never get here");
 }
 
+void Process::waitForVforkChild()
+{
+  m_VforkRelease.acquire();
+}
+
+void Process::releaseVforkParent()
+{
+  if (!m_bVforked)
+    return;
+
+  m_bVforked = false;
+  m_VforkRelease.release();
+}
+
 uintptr_t Process::create(uint8_t *elf, size_t elfSize, const char *name)
 {
     FATAL("This function isn't implemented correctly - registration with the dynamic linker is required!");
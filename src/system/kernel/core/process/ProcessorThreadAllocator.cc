@@ -45,5 +45,14 @@ void ProcessorThreadAllocator::addThread(Thread *pThread, Thread::ThreadStartFun
 
 void ProcessorThreadAllocator::threadRemoved(Thread *pThread)
 {
+    if (m_pAlgorithm)
+        m_pAlgorithm->threadRemoved(pThread);
+}
+
+Thread *ProcessorThreadAllocator::stealThread(PerProcessorScheduler *pThief)
+{
+    if (!m_pAlgorithm)
+        return 0;
+    return m_pAlgorithm->stealThread(pThief);
 }
 
@@ -23,8 +23,13 @@
 #include <utilities/assert.h>
 
 RoundRobin::RoundRobin() :
-  m_Lock(false)
+  m_ReadyBitmap(0), m_nRunnable(0), m_Lock(false)
 {
+  for (size_t i = 0; i < MAX_PRIORITIES; i++)
+  {
+      m_ReadyQueues[i].pHead = 0;
+      m_ReadyQueues[i].pTail = 0;
+  }
 }
 
 RoundRobin::~RoundRobin()
@@ -39,41 +44,48 @@ void RoundRobin::removeThread(Thread *pThread)
 {
   LockGuard<Spinlock> guard(m_Lock);
 
-  for (size_t i = 0; i < MAX_PRIORITIES; i++)
-  {
-      for(ThreadList::Iterator it = m_pReadyQueues[i].begin();
-          it != m_pReadyQueues[i].end();
-          it++)
-      {
-          if (*it == pThread)
-          {
-              m_pReadyQueues[i].erase (it);
-              return;
-          }
-      }
-  }
+  if (pThread->m_bOnReadyQueue)
+      dequeue(pThread);
 }
 
 Thread *RoundRobin::getNext(Thread *pCurrentThread)
 {
     LockGuard<Spinlock> guard(m_Lock);
 
-    Thread *pThread = 0;
-    for (size_t i = 0; i < MAX_PRIORITIES; i++)
+    while (m_ReadyBitmap)
+    {
+        // Highest priority is the lowest number.
+        size_t priority = __builtin_ctz(m_ReadyBitmap);
+        Thread *pThread = m_ReadyQueues[priority].pHead;
+        dequeue(pThread);
+
+        if (pThread == pCurrentThread)
+            continue;
+
+        pThread->getLock().acquire();
+        return pThread;
+    }
+    return 0;
+}
+
+Thread *RoundRobin::stealThread(size_t targetId, uint64_t coldBefore)
+{
+    LockGuard<Spinlock> guard(m_Lock);
+
+    // Most urgent first, and within a priority the thread that has been
+    // waiting longest - it's the least likely to still be in this cache.
+    for (uint32_t bitmap = m_ReadyBitmap; bitmap; bitmap &= bitmap - 1)
     {
-        if (m_pReadyQueues[i].size())
+        size_t priority = __builtin_ctz(bitmap);
+        for (Thread *pThread = m_ReadyQueues[priority].pHead; pThread; pThread = pThread->m_pNextReady)
         {
-            pThread = m_pReadyQueues[i].popFront();
-            if(pThread == pCurrentThread)
+            if (pThread->getStatus() != Thread::Ready || !pThread->canRunOn(targetId))
+                continue;
+            if (pThread->getLastRunTime() >= coldBefore)
                 continue;
 
-            if (pThread)
-            {
-                // Sanity check
-                if(pThread != pCurrentThread)
-                    pThread->getLock().acquire();
-                return pThread;
-            }
+            dequeue(pThread);
+            return pThread;
         }
     }
     return 0;
@@ -84,18 +96,54 @@ void RoundRobin::threadStatusChanged(Thread *pThread)
     if (pThread->getStatus() == Thread::Ready)
     {
         assert (pThread->getPriority() < MAX_PRIORITIES);
-        
-        for(List<Thread*>::Iterator it = m_pReadyQueues[pThread->getPriority()].begin(); it != m_pReadyQueues[pThread->getPriority()].end(); ++it)
-        {
-            if((*it) == pThread)
-            {
-                // WARNING("RoundRobin: A thread was already in this priority queue");
-                return;
-            }
-        }
 
-        m_pReadyQueues[pThread->getPriority()].pushBack(pThread);
+        LockGuard<Spinlock> guard(m_Lock);
+
+        // Already queued - nothing to do.
+        if (pThread->m_bOnReadyQueue)
+            return;
+
+        enqueue(pThread);
     }
 }
 
+void RoundRobin::enqueue(Thread *pThread)
+{
+    size_t priority = pThread->getPriority();
+    ReadyQueue &queue = m_ReadyQueues[priority];
+
+    pThread->m_pNextReady = 0;
+    pThread->m_pPrevReady = queue.pTail;
+    if (queue.pTail)
+        queue.pTail->m_pNextReady = pThread;
+    else
+        queue.pHead = pThread;
+    queue.pTail = pThread;
+
+    pThread->m_ReadyPriority = priority;
+    pThread->m_bOnReadyQueue = true;
+    m_ReadyBitmap |= 1U << priority;
+    m_nRunnable++;
+}
+
+void RoundRobin::dequeue(Thread *pThread)
+{
+    ReadyQueue &queue = m_ReadyQueues[pThread->m_ReadyPriority];
+
+    if (pThread->m_pPrevReady)
+        pThread->m_pPrevReady->m_pNextReady = pThread->m_pNextReady;
+    else
+        queue.pHead = pThread->m_pNextReady;
+    if (pThread->m_pNextReady)
+        pThread->m_pNextReady->m_pPrevReady = pThread->m_pPrevReady;
+    else
+        queue.pTail = pThread->m_pPrevReady;
+
+    pThread->m_pNextReady = pThread->m_pPrevReady = 0;
+    pThread->m_bOnReadyQueue = false;
+    if (!queue.pHead)
+        m_ReadyBitmap &= ~(1U << pThread->m_ReadyPriority);
+    m_nRunnable--;
+}
+
 #endif
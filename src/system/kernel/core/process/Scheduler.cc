@@ -31,7 +31,7 @@
 #include <machine/x86_common/LocalApic.h>
 #include <utilities/assert.h>
 #include <process/PerProcessorScheduler.h>
-#include <process/RoundRobinCoreAllocator.h>
+#include <process/WorkStealingCoreAllocator.h>
 #include <process/ProcessorThreadAllocator.h>
 
 Scheduler Scheduler::m_Instance;
@@ -47,8 +47,8 @@ Scheduler::~Scheduler()
 
 bool Scheduler::initialise()
 {
-  RoundRobinCoreAllocator *pRoundRobin = new RoundRobinCoreAllocator();
-  ProcessorThreadAllocator::instance().setAlgorithm(pRoundRobin);
+  WorkStealingCoreAllocator *pAllocator = new WorkStealingCoreAllocator();
+  ProcessorThreadAllocator::instance().setAlgorithm(pAllocator);
   
   List<PerProcessorScheduler*> procList;
   
@@ -64,7 +64,7 @@ bool Scheduler::initialise()
   procList.pushBack(&Processor::information().getScheduler());
 #endif
   
-  pRoundRobin->initialise(procList);
+  pAllocator->initialise(procList);
 
   return true;
 }
@@ -76,11 +76,13 @@ void Scheduler::addThread(Thread *pThread, PerProcessorScheduler &PPSched)
 
 void Scheduler::removeThread(Thread *pThread)
 {
-    PerProcessorScheduler *pPpSched = m_TPMap.lookup(pThread);
-    if (pPpSched)
+    // Threads can migrate, so the map only says whether it's scheduled at
+    // all - the thread itself knows where it is now.
+    if (m_TPMap.lookup(pThread))
     {
-        pPpSched->removeThread(pThread);
+        pThread->getScheduler()->removeThread(pThread);
         m_TPMap.remove(pThread);
+        ProcessorThreadAllocator::instance().threadRemoved(pThread);
     }
 }
 
@@ -142,9 +144,8 @@ Process *Scheduler::getProcess(size_t n)
 
 void Scheduler::threadStatusChanged(Thread *pThread)
 {
-    PerProcessorScheduler *pSched = m_TPMap.lookup(pThread);
-    assert(pSched);
-    pSched->threadStatusChanged(pThread);
+    assert(m_TPMap.lookup(pThread));
+    pThread->getScheduler()->threadStatusChanged(pThread);
 }
 
 #endif
@@ -29,18 +29,54 @@
 
 #include <utilities/assert.h>
 
-void interruptSemaphore(uint8_t *pBuffer)
+class Semaphore::SemaphoreAlarm : public Alarm
 {
-    Processor::information().getCurrentThread()->setInterrupted(true);
-}
+public:
+    SemaphoreAlarm(Semaphore *pSemaphore, Waiter *pWaiter) :
+        Alarm(), m_pSemaphore(pSemaphore), m_pWaiter(pWaiter)
+    {}
+    virtual ~SemaphoreAlarm()
+    {}
 
-Semaphore::SemaphoreEvent::SemaphoreEvent() :
-    Event(reinterpret_cast<uintptr_t>(&interruptSemaphore), false /* Not deletable */)
-{
-}
+    /** Times the waiter out, waking it if it is asleep in the queue. It
+        dequeues itself once it is running again. */
+    virtual void fire()
+    {
+        m_pSemaphore->m_BeingModified.acquire();
+
+        Thread *pThread = m_pWaiter->pThread;
+        m_pWaiter->bTimedOut = true;
+
+        for(List<Waiter*>::Iterator it = m_pSemaphore->m_Queue.begin();
+            it != m_pSemaphore->m_Queue.end();
+            ++it)
+        {
+            if((*it) != m_pWaiter)
+                continue;
+
+            pThread->setInterrupted(true);
+            pThread->getLock().acquire();
+            if(pThread->getStatus() == Thread::Sleeping)
+                pThread->setStatus(Thread::Ready);
+            pThread->getLock().release();
+            break;
+        }
+
+        m_pSemaphore->m_BeingModified.release();
+    }
+
+private:
+    Semaphore *m_pSemaphore;
+    Waiter *m_pWaiter;
+};
 
-Semaphore::Semaphore(size_t nInitialValue)
-    : magic(0xdeadbaba), m_Counter(nInitialValue), m_BeingModified(false), m_Queue()
+Atomic<size_t> Semaphore::m_nWakeups(0);
+Atomic<size_t> Semaphore::m_nSpuriousWakeups(0);
+Atomic<size_t> Semaphore::m_nHandoffs(0);
+
+Semaphore::Semaphore(size_t nInitialValue, bool bHandoff)
+    : magic(0xdeadbaba), m_Counter(nInitialValue), m_BeingModified(false), m_Queue(),
+      m_bHandoff(bHandoff), m_nSpins(SEMAPHORE_MIN_SPINS)
 {
     assert(magic == 0xdeadbaba);
 }
@@ -50,18 +86,51 @@ Semaphore::~Semaphore()
     assert(magic == 0xdeadbaba);
 }
 
-void Semaphore::removeThread(Thread *pThread)
+bool Semaphore::removeWaiter(Waiter *pWaiter)
 {
-    m_BeingModified.acquire();
-    for(List<Thread*>::Iterator it = m_Queue.begin(); it != m_Queue.end(); ++it)
+    for(List<Waiter*>::Iterator it = m_Queue.begin(); it != m_Queue.end(); ++it)
     {
-        if((*it) == pThread)
+        if((*it) == pWaiter)
         {
             m_Queue.erase(it);
-            break; /// \note Assume no other pointers that match
+            return true;
         }
     }
-    m_BeingModified.release();
+    return false;
+}
+
+bool Semaphore::spin(size_t n)
+{
+#ifdef MULTIPROCESSOR
+  // Spinning only pays off if the holder is running on another CPU and is
+  // about to release. Poll for up to twice what recently worked, and track
+  // how many polls a success took (the same scheme as glibc's adaptive
+  // mutexes) so that hopeless spinning dies down quickly.
+  size_t nMax = m_nSpins * 2 + SEMAPHORE_MIN_SPINS;
+  if (nMax > SEMAPHORE_MAX_SPINS)
+    nMax = SEMAPHORE_MAX_SPINS;
+
+  size_t i;
+  for (i = 0; i < nMax; i++)
+  {
+    // Don't spin past threads that are already queued.
+    if (m_Queue.count())
+      break;
+
+    if (tryAcquire(n))
+    {
+      m_nSpins += (static_cast<ssize_t>(i) - static_cast<ssize_t>(m_nSpins)) / 8;
+      return true;
+    }
+  }
+
+  m_nSpins += (static_cast<ssize_t>(i) - static_cast<ssize_t>(m_nSpins)) / 8;
+  if (m_nSpins < SEMAPHORE_MIN_SPINS)
+    m_nSpins = SEMAPHORE_MIN_SPINS;
+  return false;
+#else
+  return tryAcquire(n);
+#endif
 }
 
 bool Semaphore::acquire(size_t n, size_t timeoutSecs, size_t timeoutUsecs)
@@ -71,39 +140,29 @@ bool Semaphore::acquire(size_t n, size_t timeoutSecs, size_t timeoutUsecs)
         NOTICE(magic);
         assert(false);
     }
-  // Spin 10 times in the case that the lock is about to be released on
-  // multiprocessor systems, and just once for uniprocessor systems, so we don't
-  // go through the rigmarole of creating a timeout event if the lock is
-  // available.
-#ifdef MULTIPROCESSOR
-  for (int i = 0; i < 10; i++)
-#endif
-    if (tryAcquire(n))
-      return true;
 
-  // If we have a timeout, create the event and register it.
-  Event *pEvent = 0;
-  if (timeoutSecs || timeoutUsecs)
-  {
-      pEvent = new SemaphoreEvent();
-      Machine::instance().getTimer()->addAlarm(pEvent, timeoutSecs, timeoutUsecs);
-  }
+  // Check once, then spin on multiprocessor systems in case the lock is about
+  // to be released, so we don't go through the rigmarole of arming a timeout
+  // if it's available.
+  if (tryAcquire(n) || spin(n))
+    return true;
 
-  while (true)
-  {
-    Thread *pThread = Processor::information().getCurrentThread();
-    if (tryAcquire(n))
-    {
-      if (pEvent)
-      {
-          Machine::instance().getTimer()->removeAlarm(pEvent);
-          delete pEvent;
-      }
+  Thread *pThread = Processor::information().getCurrentThread();
+  Waiter waiter;
+  waiter.pThread = pThread;
+  waiter.nWanted = n;
+  waiter.bGranted = false;
+  waiter.bTimedOut = false;
 
-      removeThread(pThread);
-      return true;
-    }
+  // If we have a timeout, arm it.
+  SemaphoreAlarm alarm(this, &waiter);
+  bool bTimeout = timeoutSecs || timeoutUsecs;
+  if (bTimeout)
+    Machine::instance().getTimer()->addAlarm(&alarm, timeoutSecs, timeoutUsecs);
 
+  bool bAcquired = false;
+  while (true)
+  {
     m_BeingModified.acquire();
     bool bWasInterrupts = m_BeingModified.interrupts();
 
@@ -112,34 +171,51 @@ bool Semaphore::acquire(size_t n, size_t timeoutSecs, size_t timeoutUsecs)
     // but before we grab the "being modified" lock, which means the lock could be released by this point!
     if (tryAcquire(n))
     {
-      if (pEvent)
-      {
-        Machine::instance().getTimer()->removeAlarm(pEvent);
-        delete pEvent;
-      }
       m_BeingModified.release();
-      removeThread(pThread);
-      return true;
+      bAcquired = true;
+      break;
+    }
+
+    // The timeout may have passed while we weren't queued.
+    if (waiter.bTimedOut)
+    {
+      pThread->setInterrupted(true);
+      m_BeingModified.release();
+      Processor::setInterrupts(bWasInterrupts);
+      break;
     }
 
-    m_Queue.pushBack(pThread);
+    m_Queue.pushBack(&waiter);
 
     pThread->setInterrupted(false);
     pThread->setDebugState(Thread::SemWait, reinterpret_cast<uintptr_t>(__builtin_return_address(0)));
     Processor::information().getScheduler().sleep(&m_BeingModified);
     pThread->setDebugState(Thread::None, 0);
 
-    // Either acquired or interrupted, either way, we don't need to be woken again
-    removeThread(pThread);
+    // release() dequeues the waiters it wakes; if we're still queued we were
+    // woken for some other reason.
+    m_BeingModified.acquire();
+    bool bWokenByRelease = !removeWaiter(&waiter);
+    m_BeingModified.release();
+
+    // In handoff mode the items are already ours, even if we also timed out.
+    if (waiter.bGranted)
+    {
+      bAcquired = true;
+      break;
+    }
 
     // Why were we woken?
-    if (pThread->wasInterrupted() || pThread->getUnwindState() != Thread::Continue)
+    if (waiter.bTimedOut || pThread->wasInterrupted() || pThread->getUnwindState() != Thread::Continue)
     {
         // We were deliberately interrupted - most likely because of a timeout.
-        if (pEvent)
+        // If a release picked us to consume its items at the same time, pass
+        // that wakeup on so the items don't sit unclaimed behind sleepers.
+        if (bWokenByRelease)
         {
-          Machine::instance().getTimer()->removeAlarm(pEvent);
-          delete pEvent;
+          m_BeingModified.acquire();
+          wakeWaiters(n);
+          m_BeingModified.release();
         }
 
         // Restore interrupt state. It turns out that we can sometimes come
@@ -147,10 +223,25 @@ bool Semaphore::acquire(size_t n, size_t timeoutSecs, size_t timeoutUsecs)
         // enabled previously, which is a terrible side-effect for a timed-out
         // Semaphore acquire to have.
         Processor::setInterrupts(bWasInterrupts);
-        return false;
+        break;
     }
+
+    if (tryAcquire(n))
+    {
+      bAcquired = true;
+      break;
+    }
+
+    // Someone else took what we were woken for.
+    if (bWokenByRelease)
+      m_nSpuriousWakeups += 1;
   }
 
+  // The alarm takes m_BeingModified, so this must be done without it held.
+  if (bTimeout)
+    Machine::instance().getTimer()->removeAlarm(&alarm);
+
+  return bAcquired;
 }
 
 bool Semaphore::tryAcquire(size_t n)
@@ -171,40 +262,88 @@ bool Semaphore::tryAcquire(size_t n)
 void Semaphore::release(size_t n)
 {
     assert(magic == 0xdeadbaba);
-  m_Counter += n;
+
+  // Outside of handoff mode the items go straight back into the counter, and
+  // anyone (woken or not) may take them.
+  if (!m_bHandoff)
+    m_Counter += n;
 
   m_BeingModified.acquire();
+  size_t nAvailable = wakeWaiters(n);
+
+  // Whatever wasn't handed over is left for the next acquirer.
+  if (m_bHandoff && nAvailable)
+    m_Counter += nAvailable;
+
+  m_BeingModified.release();
+
+  #ifdef STRICT_LOCK_ORDERING
+    // TODO LockManager::released(*this);
+  #endif
+}
 
-  while(m_Queue.count() != 0)
+size_t Semaphore::wakeWaiters(size_t n)
+{
+  // Wake waiters, oldest first, until the released items are spoken for.
+  size_t nAvailable = n;
+  List<Waiter*>::Iterator it = m_Queue.begin();
+  while((it != m_Queue.end()) && nAvailable)
   {
-    Thread *pThread = m_Queue.popFront();
+    Waiter *pWaiter = *it;
+    Thread *pThread = pWaiter->pThread;
     if(!pThread)
     {
         WARNING("Null thread in a Semaphore thread queue");
+        it = m_Queue.erase(it);
         continue;
     }
     else if(!Scheduler::instance().threadInSchedule(pThread))
     {
         WARNING("A thread that was to be woken by a Semaphore is no longer in the scheduler");
+        it = m_Queue.erase(it);
         continue;
     }
     else if(pThread->getStatus() != Thread::Sleeping)
     {
         if(pThread->getStatus() == Thread::Zombie)
+        {
             WARNING("Semaphore has a zombie thread in its thread queue");
+            it = m_Queue.erase(it);
+        }
+        else
+        {
+            // Already woken (e.g. by its timeout); it will dequeue itself.
+            ++it;
+        }
         continue;
     }
 
+    if (m_bHandoff)
+    {
+      // Strict FIFO: top up from the counter if the head wants more than was
+      // released, otherwise leave it (and everyone behind it) asleep.
+      if (pWaiter->nWanted > nAvailable)
+      {
+        if (!tryAcquire(pWaiter->nWanted - nAvailable))
+          break;
+        nAvailable = pWaiter->nWanted;
+      }
+      nAvailable -= pWaiter->nWanted;
+      pWaiter->bGranted = true;
+      m_nHandoffs += 1;
+    }
+    else
+      nAvailable -= (pWaiter->nWanted < nAvailable) ? pWaiter->nWanted : nAvailable;
+
+    it = m_Queue.erase(it);
+
     pThread->getLock().acquire();
     pThread->setStatus(Thread::Ready);
     pThread->getLock().release();
+    m_nWakeups += 1;
   }
 
-  m_BeingModified.release();
-
-  #ifdef STRICT_LOCK_ORDERING
-    // TODO LockManager::released(*this);
-  #endif
+  return nAvailable;
 }
 
 ssize_t Semaphore::getValue()
@@ -212,4 +351,13 @@ ssize_t Semaphore::getValue()
     return static_cast<ssize_t>(m_Counter);
 }
 
+Semaphore::Statistics Semaphore::getStatistics()
+{
+    Statistics stats;
+    stats.nWakeups = m_nWakeups;
+    stats.nSpuriousWakeups = m_nSpuriousWakeups;
+    stats.nHandoffs = m_nHandoffs;
+    return stats;
+}
+
 #endif
@@ -37,7 +37,8 @@ Thread::Thread(Process *pParent, ThreadStartFunc pStartFunction, void *pParam,
     m_nStateLevel(0), m_pParent(pParent), m_Status(Ready), m_ExitCode(0), /* m_pKernelStack(0), */ m_pAllocatedStack(0), m_Id(0),
     m_Errno(0), m_bInterrupted(false), m_Lock(), m_EventQueue(), m_DebugState(None), m_DebugStateAddress(0),
     m_UnwindState(Continue), m_pScheduler(&Processor::information().getScheduler()), m_Priority(DEFAULT_PRIORITY),
-    m_PendingRequests(), m_pTlsBase(0)
+    m_AffinityMask(~0ULL), m_LastRunTime(0), m_pNextReady(0), m_pPrevReady(0),
+    m_ReadyPriority(0), m_bOnReadyQueue(false), m_PendingRequests(), m_pTlsBase(0)
 {
   if (pParent == 0)
   {
@@ -77,6 +78,10 @@ Thread::Thread(Process *pParent, ThreadStartFunc pStartFunction, void *pParam,
       ProcessorThreadAllocator::instance().addThread(this, pStartFunction, pParam, bUserMode, pStack);
   else
   {
+      // Stay on this core for good - the load balancer mustn't move us either.
+      if (Processor::id() < 64)
+          m_AffinityMask = 1ULL << Processor::id();
+
       Scheduler::instance().addThread(this, Processor::information().getScheduler());
       Processor::information().getScheduler().addThread(this, pStartFunction, pParam,
                                                         bUserMode, pStack);
@@ -87,7 +92,8 @@ Thread::Thread(Process *pParent) :
     m_nStateLevel(0), m_pParent(pParent), m_Status(Running), m_ExitCode(0), /* m_pKernelStack(0), */ m_pAllocatedStack(0), m_Id(0),
     m_Errno(0), m_bInterrupted(false), m_Lock(), m_EventQueue(), m_DebugState(None), m_DebugStateAddress(0),
     m_UnwindState(Continue), m_pScheduler(&Processor::information().getScheduler()), m_Priority(DEFAULT_PRIORITY),
-    m_PendingRequests(), m_pTlsBase(0)
+    m_AffinityMask(~0ULL), m_LastRunTime(0), m_pNextReady(0), m_pPrevReady(0),
+    m_ReadyPriority(0), m_bOnReadyQueue(false), m_PendingRequests(), m_pTlsBase(0)
 {
   if (pParent == 0)
   {
@@ -104,7 +110,8 @@ Thread::Thread(Process *pParent, SyscallState &state) :
     m_nStateLevel(0), m_pParent(pParent), m_Status(Ready), m_ExitCode(0), /* m_pKernelStack(0), */ m_pAllocatedStack(0), m_Id(0),
     m_Errno(0), m_bInterrupted(false), m_Lock(), m_EventQueue(), m_DebugState(None), m_DebugStateAddress(0),
     m_UnwindState(Continue), m_pScheduler(&Processor::information().getScheduler()), m_Priority(DEFAULT_PRIORITY),
-    m_PendingRequests(), m_pTlsBase(0)
+    m_AffinityMask(~0ULL), m_LastRunTime(0), m_pNextReady(0), m_pPrevReady(0),
+    m_ReadyPriority(0), m_bOnReadyQueue(false), m_PendingRequests(), m_pTlsBase(0)
 {
   if (pParent == 0)
   {
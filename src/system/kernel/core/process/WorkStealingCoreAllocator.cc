@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2010 Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <process/WorkStealingCoreAllocator.h>
+#include <processor/Processor.h>
+#include <machine/Machine.h>
+#include <Log.h>
+
+WorkStealingCoreAllocator::WorkStealingCoreAllocator() : m_Schedulers()
+{
+}
+
+WorkStealingCoreAllocator::~WorkStealingCoreAllocator()
+{
+}
+
+bool WorkStealingCoreAllocator::initialise(List<PerProcessorScheduler*> &procList)
+{
+    for(List<PerProcessorScheduler*>::Iterator it = procList.begin();
+        it != procList.end();
+        it++)
+    {
+        m_Schedulers.pushBack(*it);
+    }
+
+    NOTICE("WorkStealingCoreAllocator: balancing across " << Dec << m_Schedulers.count() << Hex << " processors.");
+    return true;
+}
+
+PerProcessorScheduler* WorkStealingCoreAllocator::allocateThread(Thread *pThread)
+{
+    PerProcessorScheduler *pLocal = &Processor::information().getScheduler();
+
+    // Shortest run queue wins. On a tie, stay here - the creating thread's
+    // working set is in this processor's cache.
+    PerProcessorScheduler *pBest = 0;
+    size_t bestLoad = ~0UL;
+    for (size_t i = 0; i < m_Schedulers.count(); i++)
+    {
+        PerProcessorScheduler *pSched = m_Schedulers[i];
+        if (!pSched->isInitialised() || !pThread->canRunOn(pSched->getProcessorId()))
+            continue;
+
+        size_t load = pSched->getRunnableCount();
+        if (load < bestLoad || (load == bestLoad && pSched == pLocal))
+        {
+            pBest = pSched;
+            bestLoad = load;
+        }
+    }
+
+    // Nowhere suitable has come up yet.
+    if (!pBest)
+        pBest = pLocal;
+
+    pBest->threadPlaced();
+    return pBest;
+}
+
+Thread *WorkStealingCoreAllocator::stealThread(PerProcessorScheduler *pThief)
+{
+    // Find the busiest processor.
+    PerProcessorScheduler *pVictim = 0;
+    size_t maxLoad = 0;
+    for (size_t i = 0; i < m_Schedulers.count(); i++)
+    {
+        PerProcessorScheduler *pSched = m_Schedulers[i];
+        if (pSched == pThief)
+            continue;
+
+        size_t load = pSched->getRunnableCount();
+        if (load > maxLoad)
+        {
+            pVictim = pSched;
+            maxLoad = load;
+        }
+    }
+
+    if (!pVictim)
+        return 0;
+
+    // Moving a thread that has only just stopped running throws away its
+    // cache footprint, so only do so when the victim is properly backed up.
+    uint64_t coldBefore = ~0ULL;
+    if (maxLoad < WORKSTEAL_HOT_IMBALANCE)
+    {
+        uint64_t now = Machine::instance().getTimer()->getTickCount();
+        coldBefore = (now > THREAD_CACHE_HOT_TIME) ? now - THREAD_CACHE_HOT_TIME : 0;
+    }
+
+    return pVictim->stealThread(pThief->getProcessorId(), coldBefore);
+}
@@ -23,7 +23,7 @@
 #include <process/Process.h>
 #include <processor/Processor.h>
 #include <process/PerProcessorScheduler.h>
-#include <process/RoundRobinCoreAllocator.h>
+#include <process/WorkStealingCoreAllocator.h>
 #include <process/ProcessorThreadAllocator.h>
 
 void initialiseMultitasking()
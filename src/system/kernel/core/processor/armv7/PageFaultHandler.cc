@@ -35,6 +35,6 @@ void PageFaultHandler::interrupt(size_t interruptNumber, InterruptState &state)
 }
 
 PageFaultHandler::PageFaultHandler() :
-    m_Handlers()
+    m_Handlers(), m_CopyOnWriteLock()
 {
 }
@@ -74,7 +74,7 @@ class ArmV7VirtualAddressSpace : public VirtualAddressSpace
 
     /** Clone this VirtualAddressSpace. That means that we copy-on-write-map the application
      *  image. */
-    virtual VirtualAddressSpace *clone() {return 0;};
+    virtual VirtualAddressSpace *clone(bool copyOnWrite = true) {return 0;};
 
     /** Undo a clone() - this happens when an application is Exec()'d - we destroy all mappings
         not in the kernel address space so the space is 'clean'.*/
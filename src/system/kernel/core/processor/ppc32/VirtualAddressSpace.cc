@@ -280,7 +280,7 @@ void PPC32VirtualAddressSpace::freeStack(void *pStack)
   // TODO
 }
 
-VirtualAddressSpace *PPC32VirtualAddressSpace::clone()
+VirtualAddressSpace *PPC32VirtualAddressSpace::clone(bool copyOnWrite)
 {
   PPC32VirtualAddressSpace *newAS = reinterpret_cast<PPC32VirtualAddressSpace*>(VirtualAddressSpace::create());
   for (uint64_t i = 0; i < 1024; i++)
@@ -67,7 +67,7 @@ public:
   virtual void *allocateStack();
   virtual void freeStack(void *pStack);
 
-  virtual VirtualAddressSpace *clone();
+  virtual VirtualAddressSpace *clone(bool copyOnWrite = true);
   virtual void revertToKernelAddressSpace();
 
 protected:
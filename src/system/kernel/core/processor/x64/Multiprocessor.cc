@@ -19,6 +19,7 @@
 #include "gdt.h"
 #include "SyscallManager.h"
 #include "InterruptManager.h"
+#include "utils.h"
 #include "../x86_common/Multiprocessor.h"
 #include "../../../machine/x86_common/Pc.h"
 
@@ -30,6 +31,11 @@ void Multiprocessor::applicationProcessorStartup()
   // Initialise this processor's syscall handling
   X64SyscallManager::initialiseProcessor();
 
+  // Kernel-mode writes must fault on copy-on-write pages (see Processor::initialise1)
+  uint64_t cr0;
+  asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+  asm volatile ("mov %0, %%cr0" :: "r" (cr0 | CR0_WP));
+
   // Signal the Bootstrap processor that this processor is started and the BSP can continue
   // to boot up other processors
   m_ProcessorLock1.release();
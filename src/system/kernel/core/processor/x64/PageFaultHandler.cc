@@ -20,6 +20,8 @@
 #include <process/Scheduler.h>
 #include <panic.h>
 #include <processor/PhysicalMemoryManager.h>
+#include <LockGuard.h>
+#include "utils.h"
 
 PageFaultHandler PageFaultHandler::m_Instance;
 
@@ -47,34 +49,52 @@ void PageFaultHandler::interrupt(size_t interruptNumber, InterruptState &state)
 
   // Check for copy-on-write.
   VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
-  if (va.isMapped(reinterpret_cast<void*>(page)))
+  if ((code & PFE_ATTEMPTED_WRITE) && va.isMapped(reinterpret_cast<void*>(page)))
   {
+    // Two threads may fault on the same page at once - only one may copy it.
+    LockGuard<Spinlock> guard(m_CopyOnWriteLock);
+
     physical_uintptr_t phys;
     size_t flags;
     va.getMapping(reinterpret_cast<void*>(page), phys, flags);
     if (flags & VirtualAddressSpace::CopyOnWrite)
     {
-        FATAL("Copy on write");
-#if 0
-      static uint8_t buffer[/*PhysicalMemoryManager::instance().getPageSize()*/4096];
-      memcpy(buffer, reinterpret_cast<uint8_t*>(page), PhysicalMemoryManager::instance().getPageSize());
+      flags = (flags & ~VirtualAddressSpace::CopyOnWrite) | VirtualAddressSpace::Write;
+
+      // If every other address space has let go of the frame it's ours to write to.
+      if (!PhysicalMemoryManager::instance().isShared(phys))
+      {
+        va.setFlags(reinterpret_cast<void*>(page), flags);
+        Processor::invalidate(reinterpret_cast<void*>(page));
+        return;
+      }
 
-      // Now that we've saved the page content, we can make a new physical page and map it.
+      // Otherwise make a private copy, and drop our reference to the shared frame.
       physical_uintptr_t p = PhysicalMemoryManager::instance().allocatePage();
       if (!p)
       {
         FATAL("PageFaultHandler: Out of memory!");
         return;
       }
+      memcpy(reinterpret_cast<void*>(physicalAddress(p)),
+             reinterpret_cast<void*>(page),
+             PhysicalMemoryManager::getPageSize());
+
       va.unmap(reinterpret_cast<void*>(page));
-      if (!va.map(p, reinterpret_cast<void*>(page), VirtualAddressSpace::Write))
+      if (!va.map(p, reinterpret_cast<void*>(page), flags))
       {
         FATAL("PageFaultHandler: map() failed.");
         return;
       }
-      memcpy(reinterpret_cast<uint8_t*>(page), buffer, PhysicalMemoryManager::instance().getPageSize());
+      PhysicalMemoryManager::instance().freePage(phys);
+      return;
+    }
+    else if ((flags & VirtualAddressSpace::Write) &&
+             (!(flags & VirtualAddressSpace::KernelMode) || !(code & PFE_USER_MODE)))
+    {
+      // Another thread beat us to the copy. A user-mode write to a kernel
+      // page is a real fault, though, and goes on to the handlers below.
       return;
-#endif
     }
   }
 
@@ -146,6 +166,6 @@ void PageFaultHandler::interrupt(size_t interruptNumber, InterruptState &state)
 }
 
 PageFaultHandler::PageFaultHandler() :
-    m_Handlers()
+    m_Handlers(), m_CopyOnWriteLock()
 {
 }
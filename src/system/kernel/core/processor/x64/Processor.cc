@@ -22,6 +22,7 @@
 #include "SyscallManager.h"
 #include "InterruptManager.h"
 #include "VirtualAddressSpace.h"
+#include "utils.h"
 #include "../x86_common/PhysicalMemoryManager.h"
 
 // Multiprocessor headers
@@ -59,6 +60,12 @@ void Processor::initialise1(const BootstrapStruct_t &Info)
 
   PageFaultHandler::instance().initialise();
 
+  // Honour read-only pages in kernel-mode too, so that the kernel writing to a
+  // copy-on-write user page faults rather than scribbling over a shared frame.
+  uint64_t cr0;
+  asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+  asm volatile ("mov %0, %%cr0" :: "r" (cr0 | CR0_WP));
+
   // Initialise the physical memory-management
   X86CommonPhysicalMemoryManager &physicalMemoryManager = X86CommonPhysicalMemoryManager::instance();
   physicalMemoryManager.initialise(Info);
@@ -72,20 +79,20 @@ void Processor::initialise1(const BootstrapStruct_t &Info)
 
 void Processor::initialise2(const BootstrapStruct_t &Info)
 {
-  size_t nProcessors = 1;
+  m_nProcessors = 1;
 
   #if defined(MULTIPROCESSOR)
-    nProcessors = Multiprocessor::initialise1();
+    m_nProcessors = Multiprocessor::initialise1();
   #endif
 
   // Initialise the GDT
-  X64GdtManager::instance().initialise(nProcessors);
+  X64GdtManager::instance().initialise(m_nProcessors);
   X64GdtManager::initialiseProcessor();
 
   initialiseMultitasking();
 
   #if defined(MULTIPROCESSOR)
-    if (nProcessors != 1)
+    if (m_nProcessors != 1)
       Multiprocessor::initialise2();
   #endif
 
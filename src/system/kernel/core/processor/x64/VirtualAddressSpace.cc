@@ -23,6 +23,7 @@
 #include <process/Scheduler.h>
 #include <process/Process.h>
 #include <LockGuard.h>
+#include <machine/Machine.h>
 
 //
 // Page Table/Directory entry flags
@@ -36,6 +37,7 @@
 #define PAGE_GLOBAL                 0x100
 #define PAGE_SWAPPED                0x200
 #define PAGE_COPY_ON_WRITE          0x400
+#define PAGE_SHARED                 0x800
 #define PAGE_NX                     0x8000000000000000
 
 //
@@ -250,7 +252,7 @@ void X64VirtualAddressSpace::unmap(void *virtualAddress)
   *pageTableEntry = 0;
 }
 
-VirtualAddressSpace *X64VirtualAddressSpace::clone()
+VirtualAddressSpace *X64VirtualAddressSpace::clone(bool copyOnWrite)
 {
     // No lock guard in here - we assume that if we're cloning, nothing will be trying
     // to map/unmap memory.
@@ -266,6 +268,9 @@ VirtualAddressSpace *X64VirtualAddressSpace::clone()
         return 0;
     }
 
+    // Set if any of our pages were made read-only for copy-on-write.
+    bool bDowngraded = false;
+
     // The userspace area is only the bottom half of the address space - the top 256 PML4 entries are for
     // the kernel, and these should be mapped anyway.
     for (uint64_t i = 0; i < 256; i++)
@@ -306,7 +311,30 @@ VirtualAddressSpace *X64VirtualAddressSpace::clone()
                         continue;
 
                     // Page mapped in source address space, but not in kernel.
-                    /// \todo Copy on write.
+                    // Share the frame if we can: writable private pages become
+                    // copy-on-write, everything else is simply mapped twice.
+                    physical_uintptr_t frame = PAGE_GET_PHYSICAL_ADDRESS(ptEntry);
+                    if (PhysicalMemoryManager::instance().pin(frame))
+                    {
+                        if ((flags & (PAGE_WRITE | PAGE_SHARED)) == PAGE_WRITE)
+                        {
+                            flags = (flags & ~PAGE_WRITE) | PAGE_COPY_ON_WRITE;
+
+                            // For vfork() we stay writable - we won't run until
+                            // the clone has gone away.
+                            if (copyOnWrite)
+                            {
+                                PAGE_SET_FLAGS(ptEntry, flags);
+                                Processor::invalidate(virtualAddress);
+                                bDowngraded = true;
+                            }
+                        }
+
+                        pClone->map(frame, virtualAddress, fromFlags(flags));
+                        continue;
+                    }
+
+                    // Can't share this frame, so copy it.
                     physical_uintptr_t newFrame = PhysicalMemoryManager::instance().allocatePage();
 
                     // Copy.
@@ -319,6 +347,14 @@ VirtualAddressSpace *X64VirtualAddressSpace::clone()
         }
     }
 
+#ifdef MULTIPROCESSOR
+    // Other processors running our threads may still hold writable TLB
+    // entries for the pages we just made copy-on-write, and would carry on
+    // writing through them into frames the clone now shares.
+    if (bDowngraded)
+        Machine::instance().flushTlbOnAllOtherProcessors();
+#endif
+
     return pClone;
 }
 
@@ -369,8 +405,8 @@ void X64VirtualAddressSpace::revertToKernelAddressSpace()
                     
                     NOTICE_NOLOCK("Blowing away " << reinterpret_cast<uintptr_t>(virtualAddress));
 
-                    // Free the page.
-                    /// \todo There's going to be a caveat with CoW here...
+                    // Free the page. If it's shared with another address space
+                    // (copy-on-write) this only drops our reference to it.
                     unmap(virtualAddress);
                     PhysicalMemoryManager::instance().freePage(PAGE_GET_PHYSICAL_ADDRESS(ptEntry));
 
@@ -622,6 +658,8 @@ uint64_t X64VirtualAddressSpace::toFlags(size_t flags)
     Flags |= PAGE_PRESENT;
   if ((flags & CopyOnWrite) == CopyOnWrite)
     Flags |= PAGE_COPY_ON_WRITE;
+  if ((flags & Shared) == Shared)
+    Flags |= PAGE_SHARED;
   return Flags;
 }
 size_t X64VirtualAddressSpace::fromFlags(uint64_t Flags)
@@ -641,6 +679,8 @@ size_t X64VirtualAddressSpace::fromFlags(uint64_t Flags)
     flags |= Swapped;
   if ((Flags & PAGE_COPY_ON_WRITE) == PAGE_COPY_ON_WRITE)
     flags |= CopyOnWrite;
+  if ((Flags & PAGE_SHARED) == PAGE_SHARED)
+    flags |= Shared;
   return flags;
 }
 
@@ -656,7 +696,7 @@ bool X64VirtualAddressSpace::conditionalTableEntryAllocation(uint64_t *tableEntr
 
     // Map the page. Add the WRITE and USER flags so that these can be controlled
     // on a page-granularity level.
-    *tableEntry = page | ((flags & ~(PAGE_GLOBAL | PAGE_NX | PAGE_SWAPPED | PAGE_COPY_ON_WRITE)) | PAGE_WRITE | PAGE_USER);
+    *tableEntry = page | ((flags & ~(PAGE_GLOBAL | PAGE_NX | PAGE_SWAPPED | PAGE_COPY_ON_WRITE | PAGE_SHARED)) | PAGE_WRITE | PAGE_USER);
 
     // Zero the page directory pointer table
     memset(physicalAddress(reinterpret_cast<void*>(page)),
@@ -675,7 +715,7 @@ bool X64VirtualAddressSpace::conditionalTableEntryMapping(uint64_t *tableEntry,
   {
     // Map the page. Add the WRITE and USER flags so that these can be controlled
     // on a page-granularity level.
-    *tableEntry = physAddress | ((flags & ~(PAGE_GLOBAL | PAGE_NX | PAGE_SWAPPED | PAGE_COPY_ON_WRITE)) | PAGE_WRITE | PAGE_USER);
+    *tableEntry = physAddress | ((flags & ~(PAGE_GLOBAL | PAGE_NX | PAGE_SWAPPED | PAGE_COPY_ON_WRITE | PAGE_SHARED)) | PAGE_WRITE | PAGE_USER);
 
     // Zero the page directory pointer table
     memset(physicalAddress(reinterpret_cast<void*>(physAddress)),
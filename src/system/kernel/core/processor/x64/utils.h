@@ -22,6 +22,9 @@
 /** @addtogroup kernelprocessorx64
  * @{ */
 
+/// CR0 write-protect bit: read-only pages are read-only in kernel-mode too
+#define CR0_WP (1 << 16)
+
 /** Get the virtual address from the physical address. This is possible on x64
  *  because the whole physical memory is mapped into the virtual address space
  *\param[in] address the physical address
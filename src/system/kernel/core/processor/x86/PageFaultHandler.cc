@@ -184,6 +184,6 @@ void PageFaultHandler::interrupt(size_t interruptNumber, InterruptState &state)
 }
 
 PageFaultHandler::PageFaultHandler() :
-    m_Handlers()
+    m_Handlers(), m_CopyOnWriteLock()
 {
 }
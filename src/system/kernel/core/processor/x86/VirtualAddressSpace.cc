@@ -554,7 +554,7 @@ size_t X86VirtualAddressSpace::fromFlags(uint32_t Flags)
   return flags;
 }
 
-VirtualAddressSpace *X86VirtualAddressSpace::clone()
+VirtualAddressSpace *X86VirtualAddressSpace::clone(bool copyOnWrite)
 {
     // No lock guard in here - we assume that if we're cloning, nothing will be trying
     // to map/unmap memory.
@@ -83,7 +83,7 @@ class X86VirtualAddressSpace : public VirtualAddressSpace
     virtual bool memIsInHeap(void *pMem);
     virtual void *getEndOfHeap();
 
-    virtual VirtualAddressSpace *clone();
+    virtual VirtualAddressSpace *clone(bool copyOnWrite = true);
     virtual void revertToKernelAddressSpace();
 
     //
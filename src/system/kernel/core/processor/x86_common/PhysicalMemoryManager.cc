@@ -36,6 +36,9 @@
 
 X86CommonPhysicalMemoryManager X86CommonPhysicalMemoryManager::m_Instance;
 
+/** Backing store for the per-frame reference counts. */
+static MemoryRegion g_RefCountRegion("Page reference counts");
+
 PhysicalMemoryManager &PhysicalMemoryManager::instance()
 {
     return X86CommonPhysicalMemoryManager::instance();
@@ -43,29 +46,38 @@ PhysicalMemoryManager &PhysicalMemoryManager::instance()
 
 physical_uintptr_t X86CommonPhysicalMemoryManager::allocatePage()
 {
+    // If interrupts are enabled, the caller holds no spinlocks (in
+    // particular no address space lock), so it's safe to evict cache pages
+    // right here if we run out.
+    bool bCanReclaim = Processor::getInterrupts();
+
     m_Lock.acquire();
 
     physical_uintptr_t ptr;
 
     ptr = m_PageStack.allocate(0);
+    size_t nFreePages = m_PageStack.freePages();
+
+    m_Lock.release();
+
     if(!ptr)
     {
-    /// \bug If caches are compacted, we end up with a massive deadlock somewhere
-#if 0
-        CacheManager::instance().compactAll();
-
-        ptr = m_PageStack.allocate(0);
-        if(!ptr)
+        bool bDirty = false;
+        if (bCanReclaim && CacheManager::instance().compactAll(CACHE_RECLAIM_TARGET, bDirty))
         {
-#endif
+            m_Lock.acquire();
+            ptr = m_PageStack.allocate(0);
             m_Lock.release();
-            FATAL_NOLOCK("Out of physical memory!");
-#if 0
         }
-#endif
+
+        if(!ptr)
+            FATAL_NOLOCK("Out of physical memory!");
+    }
+    else if (nFreePages < CACHE_LOW_WATERMARK)
+    {
+        // Let the cache manager's thread reclaim memory before we run out.
+        CacheManager::instance().trim();
     }
-    
-    m_Lock.release();
 
 #if defined(TRACK_PAGE_ALLOCATIONS)             
     if (Processor::m_Initialised == 2)
@@ -83,6 +95,14 @@ void X86CommonPhysicalMemoryManager::freePage(physical_uintptr_t page)
 {
     LockGuard<Spinlock> guard(m_Lock);
 
+    // Only drop a reference if the page is still mapped elsewhere.
+    uint16_t *pCount = refCount(page);
+    if (pCount && *pCount)
+    {
+        (*pCount)--;
+        return;
+    }
+
     m_PageStack.free(page);
 
 #if defined(TRACK_PAGE_ALLOCATIONS)             
@@ -102,6 +122,13 @@ void X86CommonPhysicalMemoryManager::freePageUnlocked(physical_uintptr_t page)
     if(!m_Lock.acquired())
         FATAL("X86CommonPhysicalMemoryManager::freePageUnlocked called without an acquired lock");
 
+    uint16_t *pCount = refCount(page);
+    if (pCount && *pCount)
+    {
+        (*pCount)--;
+        return;
+    }
+
     m_PageStack.free(page);
 
     // g_AllocationCommand.freePage uses our lock.
@@ -116,6 +143,24 @@ void X86CommonPhysicalMemoryManager::freePageUnlocked(physical_uintptr_t page)
     }
 #endif
 }
+bool X86CommonPhysicalMemoryManager::pin(physical_uintptr_t page)
+{
+    LockGuard<Spinlock> guard(m_Lock);
+
+    uint16_t *pCount = refCount(page);
+    if (!pCount || *pCount == (NotRefCounted - 1))
+        return false;
+
+    (*pCount)++;
+    return true;
+}
+bool X86CommonPhysicalMemoryManager::isShared(physical_uintptr_t page)
+{
+    LockGuard<Spinlock> guard(m_Lock);
+
+    uint16_t *pCount = refCount(page);
+    return pCount && *pCount;
+}
 bool X86CommonPhysicalMemoryManager::allocateRegion(MemoryRegion &Region,
                                                     size_t cPages,
                                                     size_t pageConstraints,
@@ -400,6 +445,10 @@ void X86CommonPhysicalMemoryManager::initialise(const BootstrapStruct_t &Info)
     // Initialise the range of virtual space for MemoryRegions
     m_MemoryRegions.free(reinterpret_cast<uintptr_t>(KERNEL_VIRTUAL_MEMORYREGION_ADDRESS),
                          KERNEL_VIRTUAL_MEMORYREGION_SIZE);
+
+#if defined(X86)
+    initialiseRefCounts(Info);
+#endif
 }
 #ifdef X64
 void X86CommonPhysicalMemoryManager::initialise64(const BootstrapStruct_t &Info)
@@ -474,9 +523,71 @@ void X86CommonPhysicalMemoryManager::initialise64(const BootstrapStruct_t &Info)
         NOTICE(" " << Hex << m_PhysicalRanges.getRange(i).address << " - " << (m_PhysicalRanges.getRange(i).address + m_PhysicalRanges.getRange(i).length));
     }
 #endif
+
+    // Now that all of memory is known, the reference counts can cover it.
+    initialiseRefCounts(Info);
 }
 #endif
 
+void X86CommonPhysicalMemoryManager::initialiseRefCounts(const BootstrapStruct_t &Info)
+{
+    // Only pages handed out by the page stack (usable memory above 16MB) are
+    // ever shared, so the table needs to reach the top of usable memory.
+    uint64_t top = 0;
+    MemoryMapEntry_t *MemoryMap = reinterpret_cast<MemoryMapEntry_t*>(Info.mmap_addr);
+    while (reinterpret_cast<uintptr_t>(MemoryMap) < (Info.mmap_addr + Info.mmap_length))
+    {
+        if (MemoryMap->type == 1 && (MemoryMap->address + MemoryMap->length) > top)
+            top = MemoryMap->address + MemoryMap->length;
+
+        MemoryMap = adjust_pointer(MemoryMap, MemoryMap->size + 4);
+    }
+#if defined(X86)
+    // The page stack doesn't hold anything above 4GB on x86.
+    if (top > 0x100000000ULL)
+        top = 0x100000000ULL;
+#endif
+
+    size_t nEntries = top / getPageSize();
+    size_t cPages = (nEntries * sizeof(uint16_t) + getPageSize() - 1) / getPageSize();
+    if (allocateRegion(g_RefCountRegion,
+                       cPages,
+                       0,
+                       VirtualAddressSpace::KernelMode | VirtualAddressSpace::Write)
+        == false)
+    {
+        WARNING("PhysicalMemoryManager: no page reference counts, pages will not be shared");
+        return;
+    }
+
+    uint16_t *pRefCounts = reinterpret_cast<uint16_t*>(g_RefCountRegion.virtualAddress());
+    memset(pRefCounts, 0xFF, nEntries * sizeof(uint16_t));
+
+    MemoryMap = reinterpret_cast<MemoryMapEntry_t*>(Info.mmap_addr);
+    while (reinterpret_cast<uintptr_t>(MemoryMap) < (Info.mmap_addr + Info.mmap_length))
+    {
+        if (MemoryMap->type == 1)
+        {
+            uint64_t start = MemoryMap->address;
+            uint64_t end = MemoryMap->address + MemoryMap->length;
+            if (start < 0x1000000)
+                start = 0x1000000;
+            if (end > top)
+                end = top;
+
+            for (uint64_t i = start; i < end; i += getPageSize())
+                pRefCounts[i / getPageSize()] = 0;
+        }
+
+        MemoryMap = adjust_pointer(MemoryMap, MemoryMap->size + 4);
+    }
+
+    m_nRefCounts = nEntries;
+    m_pRefCounts = pRefCounts;
+
+    NOTICE("PhysicalMemoryManager: reference counting " << Dec << nEntries << Hex << " frames");
+}
+
 void X86CommonPhysicalMemoryManager::initialisationDone()
 {
     extern void *init;
@@ -506,7 +617,7 @@ void X86CommonPhysicalMemoryManager::initialisationDone()
 }
 
 X86CommonPhysicalMemoryManager::X86CommonPhysicalMemoryManager()
-    : m_PageStack(), m_RangeBelow1MB(), m_RangeBelow16MB(), m_PhysicalRanges(),
+    : m_PageStack(), m_pRefCounts(0), m_nRefCounts(0), m_RangeBelow1MB(), m_RangeBelow16MB(), m_PhysicalRanges(),
 #if defined(ACPI)                               
       m_AcpiRanges(),
 #endif                                              
@@ -619,6 +730,13 @@ physical_uintptr_t X86CommonPhysicalMemoryManager::PageStack::allocate(size_t co
     }
     return result;
 }
+size_t X86CommonPhysicalMemoryManager::PageStack::freePages()
+{
+    size_t nPages = m_StackSize[0] / 4;
+    for (size_t i = 1; i < StackCount; i++)
+        nPages += m_StackSize[i] / 8;
+    return nPages;
+}
 void X86CommonPhysicalMemoryManager::PageStack::free(uint64_t physicalAddress)
 {
     // Select the right stack
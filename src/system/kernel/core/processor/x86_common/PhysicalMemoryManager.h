@@ -42,6 +42,8 @@ class X86CommonPhysicalMemoryManager : public PhysicalMemoryManager
     //
     virtual physical_uintptr_t allocatePage();
     virtual void freePage(physical_uintptr_t page);
+    virtual bool pin(physical_uintptr_t page);
+    virtual bool isShared(physical_uintptr_t page);
     virtual bool allocateRegion(MemoryRegion &Region,
                                 size_t cPages,
                                 size_t pageConstraints,
@@ -87,6 +89,19 @@ class X86CommonPhysicalMemoryManager : public PhysicalMemoryManager
       * \note Use in the wrong place and you die. */
     virtual void freePageUnlocked(physical_uintptr_t page);
 
+    /** Set up the per-frame reference counts used by pin() once the memory map is known
+     *\param[in] Info reference to the multiboot information structure */
+    void initialiseRefCounts(const BootstrapStruct_t &Info) INITIALISATION_ONLY;
+    /** Get the reference count of a page
+     *\return pointer to the count, or 0 if the page isn't reference counted */
+    inline uint16_t *refCount(physical_uintptr_t page)
+    {
+      size_t index = page / getPageSize();
+      if (index >= m_nRefCounts || m_pRefCounts[index] == NotRefCounted)
+        return 0;
+      return &m_pRefCounts[index];
+    }
+
     /** The actual page stack contains is a Stack of the pages with the constraints
      *  below4GB and below64GB and those pages without address size constraints.
      *\brief The Stack of pages (below4GB, below64GB, no constraint). */
@@ -102,6 +117,9 @@ class X86CommonPhysicalMemoryManager : public PhysicalMemoryManager
         /** Free a physical page
          *\param[in] physicalAddress physical address of the page */
         void free(uint64_t physicalAddress);
+        /** Get the number of free pages on all stacks
+         *\return the number of free pages */
+        size_t freePages();
         /** The destructor does nothing */
         inline ~PageStack(){}
 
@@ -131,6 +149,13 @@ class X86CommonPhysicalMemoryManager : public PhysicalMemoryManager
     /** The page stack */
     PageStack m_PageStack;
 
+    /** Marks a frame that doesn't come from the page stack and is never shared */
+    static const uint16_t NotRefCounted = 0xFFFF;
+    /** Number of additional references (see pin()) to every frame, indexed by frame number */
+    uint16_t *m_pRefCounts;
+    /** Number of entries in m_pRefCounts */
+    size_t m_nRefCounts;
+
     /** RangeList for the usable memory below 1MB */
     RangeList<uint32_t> m_RangeBelow1MB;
     /** RangeList for the usable memory below 16MB */
@@ -42,6 +42,7 @@
 #include <HelpCommand.h>
 #include <LocksCommand.h>
 #include <MappingCommand.h>
+#include <BenchmarkCommand.h>
 #include <process/Thread.h>
 #include <process/initialiseMultitasking.h>
 #include <machine/Machine.h>
@@ -101,7 +102,8 @@ void Debugger::initialise()
 /// \todo OZMFGBARBIE, this needs major cleanup. Look at the state of it!! :O
 void Debugger::start(InterruptState &state, LargeStaticString &description)
 {
-  Log::instance() << " << Flushing log content >>" << Flush;
+  NOTICE_NOLOCK(" << Flushing log content >>");
+  Log::instance().flush();
   
   // Drop out of whatever graphics mode we were in
   GraphicsService::GraphicsProvider provider;
@@ -189,6 +191,7 @@ void Debugger::start(InterruptState &state, LargeStaticString &description)
   static LookupCommand lookup;
   static HelpCommand help;
   static MappingCommand mapping;
+  static BenchmarkCommand benchmark;
 
 #if defined(THREADS)
   static ThreadsCommand threads;
@@ -197,9 +200,9 @@ void Debugger::start(InterruptState &state, LargeStaticString &description)
 #endif
 
 #if defined(THREADS)
-  size_t nCommands = 21;
+  size_t nCommands = 22;
 #else
-  size_t nCommands = 20;
+  size_t nCommands = 21;
 #endif
   DebuggerCommand *pCommands[] = {&syscallTracer,
                                   &disassembler,
@@ -223,7 +226,8 @@ void Debugger::start(InterruptState &state, LargeStaticString &description)
                                   &lookup,
                                   &help,
                                   &g_LocksCommand,
-                                  &mapping};
+                                  &mapping,
+                                  &benchmark};
 
   // Are we going to jump directly into the tracer? In which case bypass device detection.
   int n = g_Trace.execTrace();
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "BenchmarkCommand.h"
+#include <utilities/List.h>
+#include <utilities/Vector.h>
+#include <utilities/Tree.h>
+#include <utilities/RadixTree.h>
+#include <utilities/ExtensibleBitmap.h>
+#include <utilities/RangeList.h>
+#include <utilities/String.h>
+#include <Log.h>
+
+BenchmarkCommand::BenchmarkCommand()
+    : DebuggerCommand()
+{
+}
+
+BenchmarkCommand::~BenchmarkCommand()
+{
+}
+
+void BenchmarkCommand::autocomplete(const HugeStaticString &input, HugeStaticString &output)
+{
+}
+
+bool BenchmarkCommand::execute(const HugeStaticString &input, HugeStaticString &output, InterruptState &state, DebuggerIO *pScreen)
+{
+    // "benchmark" on its own uses the default count.
+    size_t nOps = BENCHMARK_DEFAULT_OPS;
+    if (input != "benchmark")
+    {
+        int n = input.intValue();
+        if (n <= 0)
+        {
+            output = "Usage: benchmark [number of operations]\n";
+            return true;
+        }
+        nOps = n;
+    }
+
+    output = "";
+    list(nOps, output);
+    vector(nOps, output);
+    tree(nOps, output);
+    radixTree(nOps, output);
+    bitmap(nOps, output);
+    rangeList(nOps, output);
+    heap(nOps, output);
+
+    return true;
+}
+
+void BenchmarkCommand::list(size_t nOps, HugeStaticString &output)
+{
+    List<void*> list;
+
+    uint64_t start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        list.pushBack(reinterpret_cast<void*>(i));
+    report("list-push", nOps, cycles() - start, list.count() == nOps, output);
+
+    size_t sum = 0;
+    start = cycles();
+    for (List<void*>::Iterator it = list.begin(); it != list.end(); it++)
+        sum += reinterpret_cast<size_t>(*it);
+    report("list-iterate", nOps, cycles() - start, sum == (nOps * (nOps - 1)) / 2, output);
+
+    bool bOk = true;
+    start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        bOk = (reinterpret_cast<size_t>(list.popFront()) == i) && bOk;
+    report("list-pop", nOps, cycles() - start, bOk && !list.count(), output);
+}
+
+void BenchmarkCommand::vector(size_t nOps, HugeStaticString &output)
+{
+    Vector<size_t> vector;
+
+    uint64_t start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        vector.pushBack(i);
+    report("vector-push", nOps, cycles() - start, vector.count() == nOps, output);
+
+    bool bOk = true;
+    start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        bOk = (vector[i] == i) && bOk;
+    report("vector-index", nOps, cycles() - start, bOk, output);
+
+    start = cycles();
+    for (size_t i = nOps; i; i--)
+        bOk = (vector.popBack() == i - 1) && bOk;
+    report("vector-pop", nOps, cycles() - start, bOk && !vector.count(), output);
+}
+
+void BenchmarkCommand::tree(size_t nOps, HugeStaticString &output)
+{
+    Tree<size_t, size_t> tree;
+
+    // Spread the keys out so that the tree has balancing to do.
+    uint64_t start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        tree.insert((i * 2654435761U) % nOps + 1, i + 1);
+    report("tree-insert", nOps, cycles() - start, tree.count() == nOps, output);
+
+    bool bOk = true;
+    start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        bOk = (tree.lookup((i * 2654435761U) % nOps + 1) == i + 1) && bOk;
+    report("tree-lookup", nOps, cycles() - start, bOk, output);
+
+    start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        tree.remove(i + 1);
+    report("tree-remove", nOps, cycles() - start, !tree.count(), output);
+}
+
+void BenchmarkCommand::radixTree(size_t nOps, HugeStaticString &output)
+{
+    RadixTree<void*> tree;
+
+    // Build the keys up front so only the tree is timed.
+    String *pKeys = new String[nOps];
+    for (size_t i = 0; i < nOps; i++)
+        pKeys[i].sprintf("bench/key/%d", static_cast<int>(i));
+
+    uint64_t start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        tree.insert(pKeys[i], reinterpret_cast<void*>(i + 1));
+    report("radix-insert", nOps, cycles() - start, tree.count() == nOps, output);
+
+    bool bOk = true;
+    start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        bOk = (tree.lookup(pKeys[i]) == reinterpret_cast<void*>(i + 1)) && bOk;
+    report("radix-lookup", nOps, cycles() - start, bOk, output);
+
+    start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        tree.remove(pKeys[i]);
+    report("radix-remove", nOps, cycles() - start, !tree.count(), output);
+
+    delete [] pKeys;
+}
+
+void BenchmarkCommand::bitmap(size_t nOps, HugeStaticString &output)
+{
+    ExtensibleBitmap bitmap;
+
+    uint64_t start = cycles();
+    for (size_t i = 0; i < nOps; i += 2)
+        bitmap.set(i);
+    report("bitmap-set", (nOps + 1) / 2, cycles() - start, bitmap.getFirstClear() == 1, output);
+
+    bool bOk = true;
+    start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        bOk = (bitmap.test(i) == !(i & 1)) && bOk;
+    report("bitmap-test", nOps, cycles() - start, bOk, output);
+
+    start = cycles();
+    for (size_t i = 0; i < nOps; i += 2)
+        bitmap.clear(i);
+    report("bitmap-clear", (nOps + 1) / 2, cycles() - start, !bitmap.test(0), output);
+}
+
+void BenchmarkCommand::rangeList(size_t nOps, HugeStaticString &output)
+{
+    RangeList<uintptr_t> list(0, nOps * 0x1000);
+    uintptr_t *pAddresses = new uintptr_t[nOps];
+
+    bool bOk = true;
+    uint64_t start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        bOk = list.allocate(0x1000, pAddresses[i]) && bOk;
+    uintptr_t dummy;
+    report("rangelist-allocate", nOps, cycles() - start, bOk && !list.allocate(0x1000, dummy), output);
+
+    // Give them back out of order, so there's merging to do.
+    start = cycles();
+    for (size_t i = 0; i < nOps; i += 2)
+        list.free(pAddresses[i], 0x1000);
+    for (size_t i = 1; i < nOps; i += 2)
+        list.free(pAddresses[i], 0x1000);
+    report("rangelist-free", nOps, cycles() - start, list.size() == 1, output);
+
+    delete [] pAddresses;
+}
+
+void BenchmarkCommand::heap(size_t nOps, HugeStaticString &output)
+{
+    static const size_t sizes[] = {16, 64, 200, 1024, 4000};
+    static const size_t nSizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    uint8_t **pBlocks = new uint8_t*[nOps];
+
+    bool bOk = true;
+    uint64_t start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+    {
+        pBlocks[i] = new uint8_t[sizes[i % nSizes]];
+        bOk = (pBlocks[i] != 0) && bOk;
+    }
+    report("heap-alloc", nOps, cycles() - start, bOk, output);
+
+    // Free every other block first to fragment the heap a little.
+    start = cycles();
+    for (size_t i = 0; i < nOps; i += 2)
+        delete [] pBlocks[i];
+    for (size_t i = 1; i < nOps; i += 2)
+        delete [] pBlocks[i];
+    report("heap-free", nOps, cycles() - start, true, output);
+
+    // Allocation straight after a free, the common case in the kernel.
+    start = cycles();
+    for (size_t i = 0; i < nOps; i++)
+        delete [] new uint8_t[sizes[i % nSizes]];
+    report("heap-alloc-free", nOps, cycles() - start, true, output);
+
+    delete [] pBlocks;
+}
+
+void BenchmarkCommand::report(const char *name, size_t nOps, uint64_t cycles, bool bOk, HugeStaticString &output)
+{
+    uint64_t perOp = nOps ? cycles / nOps : 0;
+
+    // The full result goes to the log, where a script can pick it up.
+    NOTICE("bench " << name << " ops=" << Dec << nOps << " cycles=" << cycles << " per-op=" << perOp << Hex << (bOk ? " ok" : " FAIL"));
+
+    // The screen only has room for the summary.
+    output += name;
+    output += ' ';
+    output.append(perOp);
+    output += bOk ? " ok\n" : " FAIL\n";
+}
+
+uint64_t BenchmarkCommand::cycles()
+{
+#if defined(X86_COMMON)
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef BENCHMARKCOMMAND_H
+#define BENCHMARKCOMMAND_H
+
+#include <DebuggerCommand.h>
+
+/** @addtogroup kerneldebuggercommands
+ * @{ */
+
+/** Default number of operations each benchmark performs. */
+#define BENCHMARK_DEFAULT_OPS   4096
+
+/**
+ * Checks and times the kernel's containers and heap allocator.
+ *
+ * Each benchmark runs a number of operations on a fresh container, checks
+ * the results and logs one line of the form
+ *   bench <name> ops=<n> cycles=<total> per-op=<cycles> <ok|FAIL>
+ * so that runs before and after a change can be compared by a script reading
+ * the serial log. The screen shows just the cycles per operation. Cycles are
+ * only counted on x86, where the time stamp counter is read; elsewhere
+ * they're reported as zero.
+ *
+ * The debugger runs with interrupts disabled on one processor, so this
+ * measures single-threaded behaviour only. It allocates from the kernel heap,
+ * so it must not be run if the debugger was entered with the heap locked.
+ */
+class BenchmarkCommand : public DebuggerCommand
+{
+public:
+    /**
+     * Default constructor - does nothing.
+     */
+    BenchmarkCommand();
+
+    /**
+     * Default destructor - does nothing.
+     */
+    ~BenchmarkCommand();
+
+    /**
+     * Return an autocomplete string, given an input string.
+     */
+    void autocomplete(const HugeStaticString &input, HugeStaticString &output);
+
+    /**
+     * Execute the command with the given screen.
+     */
+    bool execute(const HugeStaticString &input, HugeStaticString &output, InterruptState &state, DebuggerIO *screen);
+
+    /**
+     * Returns the string representation of this command.
+     */
+    const NormalStaticString getString()
+    {
+        return NormalStaticString("benchmark");
+    }
+
+private:
+    void list(size_t nOps, HugeStaticString &output);
+    void vector(size_t nOps, HugeStaticString &output);
+    void tree(size_t nOps, HugeStaticString &output);
+    void radixTree(size_t nOps, HugeStaticString &output);
+    void bitmap(size_t nOps, HugeStaticString &output);
+    void rangeList(size_t nOps, HugeStaticString &output);
+    void heap(size_t nOps, HugeStaticString &output);
+
+    /** Appends a result line for a benchmark. */
+    static void report(const char *name, size_t nOps, uint64_t cycles, bool bOk, HugeStaticString &output);
+
+    /** Reads the cycle counter, or returns zero if there isn't one. */
+    static uint64_t cycles();
+};
+
+/** @} */
+#endif
@@ -35,6 +35,7 @@ bool HelpCommand::execute(const HugeStaticString &input, HugeStaticString &outpu
 {
     output += "page-allocations - Inspect page allocations.\n";
     output += "backtrace        - Obtain a backtrace.\n";
+    output += "benchmark        - Check and time the kernel containers and heap.\n";
     output += "cpuinfo          - Obtain CPUINFO details (stubbed)\n";
     output += "devices          - Inspect detected devices.\n";
     output += "disassemble      - Disassemble contents at given address.\n";
@@ -24,6 +24,7 @@
 #include <utilities/demangle.h>
 #include <processor/Processor.h>
 #include <machine/Machine.h>
+#include <SlamAllocator.h>
 
 SlamCommand g_SlamCommand;
 
@@ -87,12 +88,13 @@ bool SlamCommand::execute(const HugeStaticString &input, HugeStaticString &outpu
 
   // Write some helper text in the lower status line.
   // TODO FIXME: Drawing this might screw the top status bar
-  pScreen->drawString("q: Quit. c: Clean. d: Dump to serial. enter: Next allocation.",
+  pScreen->drawString("q: Quit. c: Clean. d: Dump to serial. s: Stats to serial. enter: Next allocation.",
                       pScreen->getHeight()-1, 0, DebuggerIO::White, DebuggerIO::Green);
   pScreen->drawString("q", pScreen->getHeight()-1, 0, DebuggerIO::Yellow, DebuggerIO::Green);
   pScreen->drawString("c", pScreen->getHeight()-1, 9, DebuggerIO::Yellow, DebuggerIO::Green);
   pScreen->drawString("d", pScreen->getHeight()-1, 19, DebuggerIO::Yellow, DebuggerIO::Green);
-  pScreen->drawString("enter", pScreen->getHeight()-1, 38, DebuggerIO::Yellow, DebuggerIO::Green);
+  pScreen->drawString("s", pScreen->getHeight()-1, 38, DebuggerIO::Yellow, DebuggerIO::Green);
+  pScreen->drawString("enter", pScreen->getHeight()-1, 58, DebuggerIO::Yellow, DebuggerIO::Green);
 
   // Main loop.
   bool bStop = false;
@@ -175,6 +177,38 @@ bool SlamCommand::execute(const HugeStaticString &input, HugeStaticString &outpu
         }
         Machine::instance().getSerial(0)->write ("}\n");
     }
+    else if (c == 's')
+    {
+        Machine::instance().getSerial(0)->write ("SlamStats {\n");
+        for (size_t i = 0; i < SlamAllocator::instance().cacheCount(); i++)
+        {
+            SlamCacheStatistics stats;
+            SlamAllocator::instance().getStatistics(i, stats);
+            if (!(stats.allocHits + stats.allocMisses + stats.freeHits + stats.freeMisses))
+                continue;
+
+            NormalStaticString str;
+            str += "Size ";
+            str += (1ULL << i);
+            str += ": alloc ";
+            str += stats.allocHits;
+            str += "/";
+            str += stats.allocMisses;
+            str += " free ";
+            str += stats.freeHits;
+            str += "/";
+            str += stats.freeMisses;
+            str += " (hit/miss) depot ";
+            str += stats.depotExchanges;
+            str += " exchanges, ";
+            str += stats.depotFull;
+            str += " full, ";
+            str += stats.depotEmpty;
+            str += " empty\n";
+            Machine::instance().getSerial(0)->write (str);
+        }
+        Machine::instance().getSerial(0)->write ("}\n");
+    }
     else if (c == 'q')
       bStop = true;
   }
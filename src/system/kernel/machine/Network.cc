@@ -53,23 +53,89 @@ IpAddress Network::convertToIpv6(
 
 uint16_t Network::calculateChecksum(uintptr_t buffer, size_t nBytes)
 {
-  uint32_t sum = 0;
-  uint16_t* data = reinterpret_cast<uint16_t*>(buffer);
+  return checksumFinish(checksumPartial(buffer, nBytes));
+}
 
-  while(nBytes > 1)
+/** Adds a 64-bit word into a one's complement sum, wrapping the carry around */
+#define CSUM_ADD64(sum, w) do { uint64_t w_ = (w); sum += w_; sum += (sum < w_); } while(0)
+
+uint32_t Network::checksumPartial(uintptr_t buffer, size_t nBytes, uint32_t initial)
+{
+  // The one's complement sum of 16-bit words is the same whichever word size
+  // it's computed with, so sum 64 bits at a time and fold at the end.
+  uint64_t sum = initial;
+  const uint16_t *data = reinterpret_cast<const uint16_t*>(buffer);
+
+  // Get the main loop aligned
+  while(nBytes > 1 && (reinterpret_cast<uintptr_t>(data) & 7))
   {
     sum += *data++;
-    nBytes -= sizeof( uint16_t );
+    nBytes -= sizeof(uint16_t);
+  }
+
+  const uint64_t *wide = reinterpret_cast<const uint64_t*>(data);
+  while(nBytes >= 32)
+  {
+    CSUM_ADD64(sum, wide[0]);
+    CSUM_ADD64(sum, wide[1]);
+    CSUM_ADD64(sum, wide[2]);
+    CSUM_ADD64(sum, wide[3]);
+    wide += 4;
+    nBytes -= 32;
+  }
+  while(nBytes >= 8)
+  {
+    CSUM_ADD64(sum, *wide++);
+    nBytes -= 8;
+  }
+
+  // The sum can be anywhere up to 2^64 now, so the tail has to carry too
+  data = reinterpret_cast<const uint16_t*>(wide);
+  while(nBytes > 1)
+  {
+    CSUM_ADD64(sum, *data++);
+    nBytes -= sizeof(uint16_t);
   }
 
-  // odd bytes
+  // odd byte, padded with zero
   if(nBytes > 0)
-    sum += (*data++) & 0xFF;
+  {
+    uint8_t last = *reinterpret_cast<const uint8_t*>(data);
+#ifdef LITTLE_ENDIAN
+    CSUM_ADD64(sum, last);
+#else
+    CSUM_ADD64(sum, static_cast<uint16_t>(last) << 8);
+#endif
+  }
 
+  // fold to 32 bits
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+  return static_cast<uint32_t>(sum);
+}
+
+#undef CSUM_ADD64
+
+uint16_t Network::checksumFinish(uint32_t sum)
+{
   // fold to 16 bits
-  while( sum >> 16 )
-    sum = ( sum & 0xFFFF ) + ( sum >> 16 );
+  while(sum >> 16)
+    sum = (sum & 0xFFFF) + (sum >> 16);
 
-  uint16_t ret = static_cast<uint16_t>(~sum);
-  return ret;
+  return static_cast<uint16_t>(~sum);
+}
+
+uint16_t Network::checksumUpdate(uint16_t checksum, uint16_t oldValue, uint16_t newValue)
+{
+  // HC' = ~(~HC + ~m + m')
+  uint32_t sum = static_cast<uint16_t>(~checksum);
+  sum += static_cast<uint16_t>(~oldValue);
+  sum += newValue;
+  return checksumFinish(sum);
+}
+
+uint16_t Network::checksumUpdate(uint16_t checksum, uint32_t oldValue, uint32_t newValue)
+{
+  checksum = checksumUpdate(checksum, static_cast<uint16_t>(oldValue & 0xFFFF), static_cast<uint16_t>(newValue & 0xFFFF));
+  return checksumUpdate(checksum, static_cast<uint16_t>(oldValue >> 16), static_cast<uint16_t>(newValue >> 16));
 }
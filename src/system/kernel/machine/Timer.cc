@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <machine/Timer.h>
+#include <processor/Processor.h>
+#include <process/Event.h>
+#ifdef THREADS
+#include <process/Thread.h>
+#endif
+
+class Timer::EventAlarm : public Alarm
+{
+public:
+    EventAlarm(Timer *pTimer, Event *pEvent, Thread *pThread) :
+        Alarm(), m_pTimer(pTimer), m_pEvent(pEvent), m_pThread(pThread)
+    {}
+    virtual ~EventAlarm()
+    {}
+
+    virtual void fire()
+    {
+#ifdef THREADS
+        // If the alarm is no longer in the tree, whoever took it out owns it
+        // and is about to cancel it; stay out of their way.
+        if (m_pTimer->takeEventAlarm(m_pEvent) != this)
+            return;
+
+        m_pThread->sendEvent(m_pEvent);
+        delete this;
+#endif
+    }
+
+    Timer *m_pTimer;
+    Event *m_pEvent;
+    Thread *m_pThread;
+};
+
+void Timer::addAlarm(Alarm *pAlarm, size_t alarmSecs, size_t alarmUsecs)
+{
+    m_Alarms.arm(pAlarm, static_cast<uint64_t>(alarmSecs) * 1000000ULL + alarmUsecs);
+}
+
+bool Timer::removeAlarm(Alarm *pAlarm)
+{
+    return m_Alarms.cancel(pAlarm);
+}
+
+void Timer::addAlarm(Event *pEvent, size_t alarmSecs, size_t alarmUsecs)
+{
+#ifdef THREADS
+    // An Event only has one alarm at a time.
+    removeAlarm(pEvent);
+
+    EventAlarm *pAlarm = new EventAlarm(this, pEvent,
+                                        Processor::information().getCurrentThread());
+
+    m_EventAlarmLock.acquire();
+    m_EventAlarms.insert(pEvent, pAlarm);
+    m_EventAlarmLock.release();
+
+    addAlarm(pAlarm, alarmSecs, alarmUsecs);
+#endif
+}
+
+void Timer::removeAlarm(Event *pEvent)
+{
+    removeAlarm(pEvent, true);
+}
+
+size_t Timer::removeAlarm(Event *pEvent, bool bRetZero)
+{
+    EventAlarm *pAlarm = takeEventAlarm(pEvent);
+    if (!pAlarm)
+        return 0;
+
+    // Once out of the tree the alarm is ours. If it is firing right now,
+    // this waits for it to see that and back off.
+    removeAlarm(pAlarm);
+
+    size_t ret = 0;
+    if (!bRetZero)
+    {
+        uint64_t currTime = m_Alarms.now();
+        uint64_t alarmEndTime = pAlarm->getDeadline();
+
+        // Round up, so a pending alarm never reports zero seconds left.
+        if (alarmEndTime > currTime)
+            ret = (alarmEndTime - currTime + 999999ULL) / 1000000ULL;
+    }
+
+    delete pAlarm;
+    return ret;
+}
+
+Timer::EventAlarm *Timer::takeEventAlarm(Event *pEvent)
+{
+    m_EventAlarmLock.acquire();
+    EventAlarm *pAlarm = m_EventAlarms.lookup(pEvent);
+    if (pAlarm)
+        m_EventAlarms.remove(pEvent);
+    m_EventAlarmLock.release();
+
+    return pAlarm;
+}
@@ -159,69 +159,6 @@ bool GPTimer::unregisterHandler(TimerHandler *handler)
     return false;
 }
 
-void GPTimer::addAlarm(class Event *pEvent, size_t alarmSecs, size_t alarmUsecs)
-{
-#ifdef THREADS
-    size_t time = (alarmSecs * 1000) + (alarmUsecs / 1000) + m_TickCount;
-    Alarm *pAlarm = new Alarm(pEvent, time,
-                              Processor::information().getCurrentThread());
-    m_Alarms.pushBack(pAlarm);
-#endif
-}
-
-void GPTimer::removeAlarm(class Event *pEvent)
-{
-#ifdef THREADS
-    for (List<Alarm*>::Iterator it = m_Alarms.begin();
-         it != m_Alarms.end();
-         it++)
-    {
-        if ( (*it)->m_pEvent == pEvent )
-        {
-            m_Alarms.erase(it);
-            return;
-        }
-    }
-#endif
-}
-
-size_t GPTimer::removeAlarm(class Event *pEvent, bool bRetZero)
-{
-#ifdef THREADS
-    size_t currTime = getTickCount();
-
-    for (List<Alarm*>::Iterator it = m_Alarms.begin();
-         it != m_Alarms.end();
-         it++)
-    {
-        if ( (*it)->m_pEvent == pEvent )
-        {
-            size_t ret = 0;
-            if(!bRetZero)
-            {
-                size_t alarmEndTime = (*it)->m_Time;
-
-                // Is it later than the end of the alarm?
-                if(alarmEndTime < currTime)
-                    ret = 0;
-                else
-                {
-                    size_t diff = alarmEndTime - currTime;
-                    ret = (diff / 1000) + 1;
-                }
-            }
-
-            m_Alarms.erase(it);
-            return ret;
-        }
-    }
-
-    return 0;
-#else
-    return 0;
-#endif
-}
-
 void GPTimer::interrupt(size_t nInterruptnumber, InterruptState &state)
 {
     m_TickCount++;
@@ -235,26 +172,8 @@ void GPTimer::interrupt(size_t nInterruptnumber, InterruptState &state)
             m_Handlers[nHandler]->timer(1000000, state);
     }
 
-    // Check for alarms.
-    while (true)
-    {
-        bool bDispatched = false;
-        for (List<Alarm*>::Iterator it = m_Alarms.begin();
-        it != m_Alarms.end();
-        it++)
-        {
-            Alarm *pA = *it;
-            if ( pA->m_Time <= m_TickCount )
-            {
-                pA->m_pThread->sendEvent(pA->m_pEvent);
-                m_Alarms.erase(it);
-                bDispatched = true;
-                break;
-            }
-        }
-        if (!bDispatched)
-            break;
-    }
+    // Fire any alarms that are now due.
+    dispatchAlarms(m_TickCount * 1000);
 
     // Ack the interrupt source
     volatile uint32_t *registers = reinterpret_cast<volatile uint32_t*>(m_MmioBase.virtualAddress());
@@ -54,7 +54,7 @@ class GPTimer : public Timer, public SchedulerTimer, public InterruptHandler
     /** The default constructor */
     inline GPTimer() :
         m_MmioBase("GPTimer"), m_bIrqInstalled(false), m_Irq(0),
-        m_Handlers(), m_Alarms(), m_TickCount(0)
+        m_Handlers(), m_TickCount(0)
     {
         for(int i = 0; i < MAX_TIMER_HANDLERS; i++)
             m_Handlers[i] = 0;
@@ -119,21 +119,6 @@ class GPTimer : public Timer, public SchedulerTimer, public InterruptHandler
     virtual bool registerHandler(TimerHandler *handler);
     virtual bool unregisterHandler(TimerHandler *handler);
 
-    /** Dispatches the Event \p pEvent to the current thread in \p alarmSecs time.
-     *\param pEvent Event to dispatch.
-     *\param alarmSecs Number of seconds to wait.
-     */
-    virtual void addAlarm(class Event *pEvent, size_t alarmSecs, size_t alarmUsecs=0);
-    /** Removes the event \p pEvent from the alarm queue.
-     *\param pEvent Event to remove alarm for. */
-    virtual void removeAlarm(class Event *pEvent);
-    /** Removes the event \p pEvent from the alarm queue.
-     *\param pEvent Event to remove alarm for.
-     *\param bRetZero If true, returns zero rather the time until firing
-     *\return The number of seconds before the event would have fired,
-     *        or zero if bRetZero is true. */
-    virtual size_t removeAlarm(class Event *pEvent, bool bRetZero);
-
   private:
     /** The copy-constructor
      *\note NOT implemented */
@@ -159,24 +144,6 @@ class GPTimer : public Timer, public SchedulerTimer, public InterruptHandler
     /** All timer handlers installed */
     TimerHandler* m_Handlers[MAX_TIMER_HANDLERS];
 
-    /** Alarm structure. */
-    class Alarm
-    {
-    public:
-        Alarm(class Event *pEvent, size_t time, class Thread *pThread) :
-            m_pEvent(pEvent), m_Time(time), m_pThread(pThread)
-        {}
-        class Event *m_pEvent;
-        size_t m_Time;
-        class Thread *m_pThread;
-    private:
-        Alarm(const Alarm &);
-        Alarm &operator = (const Alarm &);
-    };
-
-    /** List of alarms. */
-    List<Alarm*> m_Alarms;
-
     /** Internal tick count - milliseconds, used for alarms and things */
     uint64_t m_TickCount;
 
@@ -87,6 +87,10 @@ bool LocalApic::initialise(uint64_t physicalAddress)
   if (!InterruptManager::instance().registerInterruptHandler(TIMER_VECTOR, this))
     return false;
 
+  // Register the TLB shootdown vector.
+  if (!InterruptManager::instance().registerInterruptHandler(IPI_TLB_SHOOTDOWN_VECTOR, this))
+    return false;
+
   // Register the IPI halt vector.
   if (!InterruptManager::instance().registerInterruptHandler(IPI_HALT_VECTOR, this))
     return false;
@@ -146,6 +150,42 @@ void LocalApic::interProcessorInterruptAllExcludingThis(uint8_t vector,
   m_IoSpace.write32(vector | (deliveryMode << 8) | (1 << 14) | (0x3 << 18), LAPIC_REG_INT_CMD_LOW);
 }
 
+void LocalApic::tlbShootdown()
+{
+  size_t nProcessors = Processor::getCount();
+  if (nProcessors < 2)
+    return;
+
+  // Only one shootdown can be in flight. Whoever has it may be waiting on
+  // us, and we may have interrupts off, so answer it while we wait.
+  while (!m_bShootdownBusy.compareAndSwap(false, true))
+  {
+    tlbShootdownAck();
+    asm volatile("pause");
+  }
+
+  size_t all = (nProcessors >= sizeof(size_t) * 8) ? ~0UL : ((1UL << nProcessors) - 1);
+  m_ShootdownTargets = all & ~(1UL << Processor::id());
+  interProcessorInterruptAllExcludingThis(IPI_TLB_SHOOTDOWN_VECTOR, deliveryModeFixed);
+
+  while (m_ShootdownTargets)
+    asm volatile("pause");
+
+  m_bShootdownBusy = false;
+}
+
+void LocalApic::tlbShootdownAck()
+{
+  size_t bit = 1UL << Processor::id();
+  if (!(m_ShootdownTargets & bit))
+    return;
+
+  // Reloading CR3 drops every non-global TLB entry.
+  uintptr_t cr3;
+  asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r" (cr3) : : "memory");
+
+  __sync_fetch_and_and(&m_ShootdownTargets, ~bit);
+}
 
 uint8_t LocalApic::getId()
 {
@@ -184,6 +224,12 @@ void LocalApic::interrupt(size_t nInterruptNumber, InterruptState &state)
     ack();
   }
 
+  if (nInterruptNumber == IPI_TLB_SHOOTDOWN_VECTOR)
+  {
+    tlbShootdownAck();
+    ack();
+  }
+
   // The halt IPI is used in the debugger to stop all other cores.
   if (nInterruptNumber == IPI_HALT_VECTOR)
   {
@@ -25,7 +25,9 @@
 #include <machine/SchedulerTimer.h>
 #include <processor/state.h>
 #include <processor/InterruptHandler.h>
+#include <Atomic.h>
 
+#define IPI_TLB_SHOOTDOWN_VECTOR                        0xFA
 #define IPI_HALT_VECTOR                                 0xFB
 #define ERROR_VECTOR                                    0xFC
 #define SPURIOUS_VECTOR                                 0xFD
@@ -42,7 +44,8 @@ class LocalApic : public SchedulerTimer,
   public:
     /** The default constructor */
     inline LocalApic()
-      : m_IoSpace("Local APIC"), m_Handler(0) {}
+      : m_IoSpace("Local APIC"), m_Handler(0), m_bShootdownBusy(false),
+        m_ShootdownTargets(0) {}
     /** The destructor */
     inline virtual ~LocalApic(){}
 
@@ -88,6 +91,11 @@ class LocalApic : public SchedulerTimer,
     void interProcessorInterruptAllExcludingThis(uint8_t vector,
                                                  size_t deliveryMode);
 
+    /** Flushes the TLB on all other processors, and waits until they all
+     *  have. May be called with interrupts disabled: while waiting we do
+     *  any flush another processor has asked of us. */
+    void tlbShootdown();
+
     /** Get the Local APIC Id for this processor
      *\return the Local APIC Id of this processor */
     uint8_t getId();
@@ -124,6 +132,15 @@ class LocalApic : public SchedulerTimer,
 
     /** The scheduler. */
     TimerHandler *m_Handler;
+
+    /** Flushes this processor's TLB if the shootdown in progress wants it
+     *  to, and tells the sender. */
+    void tlbShootdownAck();
+
+    /** Set while a TLB shootdown is in progress - one runs at a time. */
+    Atomic<bool> m_bShootdownBusy;
+    /** One bit per processor (by id) yet to flush its TLB for it. */
+    volatile size_t m_ShootdownTargets;
 };
 
 /** @} */
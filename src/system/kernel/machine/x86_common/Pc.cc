@@ -234,6 +234,11 @@ void Pc::setKeyboard(Keyboard *kb)
     m_LocalApic.interProcessorInterruptAllExcludingThis(IPI_HALT_VECTOR,
                                                         0 /* Fixed delivery mode */);
   }
+
+  void Pc::flushTlbOnAllOtherProcessors()
+  {
+    m_LocalApic.tlbShootdown();
+  }
 #endif
 
 Pc::Pc()
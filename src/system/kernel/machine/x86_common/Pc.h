@@ -64,6 +64,7 @@ class Pc : public Machine
 
     #ifdef MULTIPROCESSOR
       virtual void stopAllOtherProcessors();
+      virtual void flushTlbOnAllOtherProcessors();
     #endif
 
 
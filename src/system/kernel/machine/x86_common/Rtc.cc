@@ -38,60 +38,6 @@ uint8_t daysPerMonth[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
 
 Rtc Rtc::m_Instance;
 
-void Rtc::addAlarm(Event *pEvent, size_t alarmSecs, size_t alarmUsecs)
-{
-    Alarm *pAlarm = new Alarm(pEvent, alarmSecs*1000000+alarmUsecs+getTickCount(),
-                              Processor::information().getCurrentThread());
-    m_Alarms.pushBack(pAlarm);
-}
-
-void Rtc::removeAlarm(Event *pEvent)
-{
-    for (List<Alarm*>::Iterator it = m_Alarms.begin();
-         it != m_Alarms.end();
-         it++)
-    {
-        if ( (*it)->m_pEvent == pEvent )
-        {
-            m_Alarms.erase(it);
-            return;
-        }
-    }
-}
-
-size_t Rtc::removeAlarm(class Event *pEvent, bool bRetZero)
-{
-    size_t currTime = getTickCount();
-
-    for (List<Alarm*>::Iterator it = m_Alarms.begin();
-         it != m_Alarms.end();
-         it++)
-    {
-        if ( (*it)->m_pEvent == pEvent )
-        {
-            size_t ret = 0;
-            if(!bRetZero)
-            {
-                size_t alarmEndTime = (*it)->m_Time;
-
-                // Is it later than the end of the alarm?
-                if(alarmEndTime < currTime)
-                    ret = 0;
-                else
-                {
-                    size_t diff = alarmEndTime - currTime;
-                    ret = (diff / 1000) + 1;
-                }
-            }
-
-            m_Alarms.erase(it);
-            return ret;
-        }
-    }
-
-    return 0;
-}
-
 bool Rtc::registerHandler(TimerHandler *handler)
 {
   // find a spare spot and install
@@ -273,7 +219,7 @@ void Rtc::uninitialise()
 
 Rtc::Rtc()
   : m_IoPort("CMOS"), m_IrqId(0), m_PeriodicIrqInfoIndex(0), m_bBCD(true), m_Year(0), m_Month(0),
-    m_DayOfMonth(0), m_Hour(0), m_Minute(0), m_Second(0), m_Nanosecond(0), m_TickCount(0), m_Alarms()
+    m_DayOfMonth(0), m_Hour(0), m_Minute(0), m_Second(0), m_Nanosecond(0), m_TickCount(0)
 {
 }
 extern size_t g_FreePages;
@@ -289,26 +235,8 @@ bool Rtc::irq(irq_id_t number, InterruptState &state)
   // Calculate the new time/date
   m_Nanosecond += delta;
 
-  // Check for alarms.
-  while (true)
-  {
-      bool bDispatched = false;
-      for (List<Alarm*>::Iterator it = m_Alarms.begin();
-           it != m_Alarms.end();
-           it++)
-      {
-          Alarm *pA = *it;
-          if ( pA->m_Time <= getTickCount() )
-          {
-              pA->m_pThread->sendEvent(pA->m_pEvent);
-              m_Alarms.erase(it);
-              bDispatched = true;
-              break;
-          }
-      }
-      if (!bDispatched)
-          break;
-  }
+  // Fire any alarms that are now due.
+  dispatchAlarms(getTickCount());
 
   if (UNLIKELY(m_Nanosecond >= 1000000ULL))
   {
@@ -16,6 +16,8 @@
 
 #include <Log.h>
 #include <processor/VirtualAddressSpace.h>
+#include <process/Scheduler.h>
+#include <process/Thread.h>
 #include <utilities/Cache.h>
 #include <utilities/assert.h>
 #include <utilities/utility.h>
@@ -28,7 +30,22 @@ static bool g_AllocatorInited = false;
 
 CacheManager CacheManager::m_Instance;
 
-CacheManager::CacheManager() : m_Caches()
+/// UnlikelyLock::enter and acquire fail rather than wait if the lock is held
+/// (for example, by compact()); these wait for it instead.
+static inline void enterLock(UnlikelyLock &lock)
+{
+    while (!lock.enter())
+        Scheduler::instance().yield();
+}
+static inline void acquireLock(UnlikelyLock &lock)
+{
+    while (!lock.acquire())
+        Scheduler::instance().yield();
+}
+
+CacheManager::CacheManager() :
+    m_Caches(), m_CachesLock(), m_bCompacting(false), m_bTrimPending(false), m_TrimSemaphore(0),
+    m_pThread(0)
 {
 }
 
@@ -36,12 +53,28 @@ CacheManager::~CacheManager()
 {
 }
 
+void CacheManager::initialise()
+{
+#ifdef THREADS
+    if (m_pThread)
+        return;
+
+    m_pThread = new Thread(Processor::information().getCurrentThread()->getParent(),
+                           &trimThread, reinterpret_cast<void*>(this));
+#endif
+}
+
 void CacheManager::registerCache(Cache *pCache)
 {
+    acquireLock(m_CachesLock);
     m_Caches.pushBack(pCache);
+    m_CachesLock.release();
 }
 void CacheManager::unregisterCache(Cache *pCache)
 {
+    // Once we have the lock nobody is part way through the list, so the
+    // cache can't be in use by compactAll or syncAll when we return.
+    acquireLock(m_CachesLock);
     for(List<Cache*>::Iterator it = m_Caches.begin();
         it != m_Caches.end();
         it++)
@@ -49,23 +82,106 @@ void CacheManager::unregisterCache(Cache *pCache)
         if((*it) == pCache)
         {
             m_Caches.erase(it);
-            return;
+            break;
         }
     }
+    m_CachesLock.release();
+}
+
+size_t CacheManager::compactAll(size_t nPages, bool &bDirtySkipped)
+{
+    bDirtySkipped = false;
+
+    // Evicting pages frees memory, which may in turn want to allocate.
+    if (!m_bCompacting.compareAndSwap(false, true))
+        return 0;
+
+    // Never wait: a cache is being (un)registered, so try again later.
+    if (!m_CachesLock.enter())
+    {
+        m_bCompacting = false;
+        return 0;
+    }
+
+    size_t nFreed = 0;
+    for(List<Cache*>::Iterator it = m_Caches.begin();
+        (it != m_Caches.end()) && (nFreed < nPages);
+        it++)
+    {
+        bool bDirty = false;
+        nFreed += (*it)->compact(nPages - nFreed, bDirty);
+        if (bDirty)
+            bDirtySkipped = true;
+    }
+
+    m_CachesLock.leave();
+    m_bCompacting = false;
+
+    return nFreed;
 }
 
-void CacheManager::compactAll()
+void CacheManager::syncAll()
 {
+    enterLock(m_CachesLock);
     for(List<Cache*>::Iterator it = m_Caches.begin();
         it != m_Caches.end();
         it++)
     {
-        (*it)->compact();
+        (*it)->sync();
+    }
+    m_CachesLock.leave();
+}
+
+void CacheManager::trim()
+{
+    m_bTrimPending = true;
+}
+
+int CacheManager::trimThread(void *p)
+{
+#ifdef THREADS
+    CacheManager *pManager = reinterpret_cast<CacheManager*>(p);
+
+    size_t nSecondsSinceSync = 0;
+    while (true)
+    {
+        // Nothing releases this semaphore; it just puts us to sleep for a
+        // second, as the PMM can't safely wake threads.
+        pManager->m_TrimSemaphore.acquire(1, 1);
+
+        if (pManager->m_bTrimPending)
+        {
+            bool bDirty = false;
+            size_t nFreed = pManager->compactAll(CACHE_RECLAIM_TARGET, bDirty);
+
+            // Clean pages weren't enough, so write back the dirty ones and
+            // have another go.
+            if ((nFreed < CACHE_RECLAIM_TARGET) && bDirty)
+            {
+                pManager->syncAll();
+                nSecondsSinceSync = 0;
+                nFreed += pManager->compactAll(CACHE_RECLAIM_TARGET - nFreed, bDirty);
+            }
+
+            if (nFreed)
+                NOTICE("CacheManager: reclaimed " << Dec << nFreed << Hex << " pages.");
+
+            pManager->m_bTrimPending = false;
+        }
+
+        if (++nSecondsSinceSync >= CACHE_WRITEBACK_PERIOD)
+        {
+            pManager->syncAll();
+            nSecondsSinceSync = 0;
+        }
     }
+#endif
+    return 0;
 }
 
 Cache::Cache() :
-    m_Pages(), m_Lock()
+    m_Pages(), m_pClockHand(0), m_Callback(0), m_CallbackMeta(0), m_nHits(0),
+    m_nMisses(0), m_nEvictions(0), m_nWritebacks(0), m_Lock()
 {
     if (!g_AllocatorInited)
     {
@@ -86,57 +202,125 @@ Cache::Cache() :
 
 Cache::~Cache()
 {
-    m_Lock.acquire();
+    // Stop compaction from finding us before tearing the pages down.
+    CacheManager::instance().unregisterCache(this);
 
-    // Clean up existing cache pages
-    for(Tree<uintptr_t, CachePage*>::Iterator it = m_Pages.begin();
-        it != m_Pages.end();
-        it++)
-    {
-        CachePage *page = reinterpret_cast<CachePage*>(it.value());
-        VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
-        if(va.isMapped(reinterpret_cast<void*>(page->location)))
-        {
-            physical_uintptr_t phys;
-            size_t flags;
-            va.getMapping(reinterpret_cast<void*>(page->location), phys, flags);
-            PhysicalMemoryManager::instance().freePage(phys);
-        }
+    acquireLock(m_Lock);
 
-        m_Allocator.free(reinterpret_cast<uintptr_t>(page), 4096);
-    }
+    // Clean up existing cache pages
+    while (m_pClockHand)
+        evictPage(m_pClockHand);
 
     m_Lock.release();
-
-    CacheManager::instance().unregisterCache(this);
 }
 
 uintptr_t Cache::lookup (uintptr_t key)
 {
-    m_Lock.enter();
+    enterLock(m_Lock);
 
     CachePage *pPage = m_Pages.lookup(key);
     if (!pPage)
     {
+        m_nMisses++;
         m_Lock.leave();
         return 0;
     }
 
     uintptr_t ptr = pPage->location;
-    pPage->refcnt ++;
+    __sync_fetch_and_add(&pPage->refcnt, 1);
+    pPage->accessed = true;
+    m_nHits++;
 
     m_Lock.leave();
     return ptr;
 }
 
+bool Cache::exists (uintptr_t key, size_t length)
+{
+    enterLock(m_Lock);
+
+    bool bExists = false;
+    for (size_t offset = 0; offset < length; offset += 4096)
+    {
+        if (m_Pages.lookup(key + offset))
+        {
+            bExists = true;
+            break;
+        }
+    }
+
+    m_Lock.leave();
+    return bExists;
+}
+
+void Cache::addPage(uintptr_t key, uintptr_t location, physical_uintptr_t phys)
+{
+    CachePage *pPage = new CachePage;
+    pPage->key = key;
+    pPage->location = location;
+    pPage->refcnt = 1;
+    pPage->accessed = true;
+    pPage->dirty = false;
+
+    // New pages go just behind the clock hand, so they get a full sweep
+    // before they're considered for eviction.
+    if (m_pClockHand)
+    {
+        pPage->next = m_pClockHand;
+        pPage->prev = m_pClockHand->prev;
+        m_pClockHand->prev->next = pPage;
+        m_pClockHand->prev = pPage;
+    }
+    else
+    {
+        pPage->next = pPage->prev = pPage;
+        m_pClockHand = pPage;
+    }
+
+    m_Pages.insert(key, pPage);
+}
+
+void Cache::evictPage(CachePage *pPage)
+{
+    if (pPage->next == pPage)
+        m_pClockHand = 0;
+    else
+    {
+        pPage->prev->next = pPage->next;
+        pPage->next->prev = pPage->prev;
+        if (m_pClockHand == pPage)
+            m_pClockHand = pPage->next;
+    }
+
+    m_Pages.remove(pPage->key);
+
+    void *pLocation = reinterpret_cast<void*>(pPage->location);
+    VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
+    if(va.isMapped(pLocation))
+    {
+        physical_uintptr_t phys;
+        size_t flags;
+        va.getMapping(pLocation, phys, flags);
+        va.unmap(pLocation);
+        PhysicalMemoryManager::instance().freePage(phys);
+    }
+
+    m_AllocatorLock.acquire();
+    m_Allocator.free(pPage->location, 4096);
+    m_AllocatorLock.release();
+
+    delete pPage;
+}
+
 uintptr_t Cache::insert (uintptr_t key)
 {
-    m_Lock.acquire();
+    acquireLock(m_Lock);
 
     CachePage *pPage = m_Pages.lookup(key);
 
     if (pPage)
     {
+        pPage->refcnt++;
         m_Lock.release();
         return pPage->location;
     }
@@ -159,13 +343,7 @@ uintptr_t Cache::insert (uintptr_t key)
         FATAL("Map failed in Cache::insert())");
     }
 
-    Timer &timer = *Machine::instance().getTimer();
-
-    pPage = new CachePage;
-    pPage->location = location;
-    pPage->refcnt = 1;
-    pPage->timeAllocated = timer.getUnixTimestamp();
-    m_Pages.insert(key, pPage);
+    addPage(key, location, phys);
 
     m_Lock.release();
 
@@ -174,7 +352,7 @@ uintptr_t Cache::insert (uintptr_t key)
 
 uintptr_t Cache::insert (uintptr_t key, size_t size)
 {
-    m_Lock.acquire();
+    acquireLock(m_Lock);
 
     if(size % 4096)
     {
@@ -188,6 +366,7 @@ uintptr_t Cache::insert (uintptr_t key, size_t size)
     CachePage *pPage = m_Pages.lookup(key);
     if (pPage)
     {
+        pPage->refcnt++;
         m_Lock.release();
         return pPage->location;
     }
@@ -207,13 +386,18 @@ uintptr_t Cache::insert (uintptr_t key, size_t size)
 
     uintptr_t returnLocation = location;
     bool bOverlap = false;
-    for(size_t page = 0; page < nPages; page++)
+    for(size_t page = 0; page < nPages; page++, location += 4096)
     {
         pPage = m_Pages.lookup(key + (page * 4096));
         if(pPage)
         {
+            // Don't overwrite existing buffers, and give back the address
+            // space we would have used.
             bOverlap = true;
-            continue; // Don't overwrite existing buffers
+            m_AllocatorLock.acquire();
+            m_Allocator.free(location, 4096);
+            m_AllocatorLock.release();
+            continue;
         }
 
         uintptr_t phys = PhysicalMemoryManager::instance().allocatePage();
@@ -222,15 +406,7 @@ uintptr_t Cache::insert (uintptr_t key, size_t size)
             FATAL("Map failed in Cache::insert())");
         }
 
-        Timer &timer = *Machine::instance().getTimer();
-
-        pPage = new CachePage;
-        pPage->location = location;
-        pPage->refcnt = 1;
-        pPage->timeAllocated = timer.getUnixTimestamp();
-        m_Pages.insert(key + (page * 4096), pPage);
-
-        location += 4096;
+        addPage(key + (page * 4096), location, phys);
     }
 
     m_Lock.release();
@@ -243,7 +419,7 @@ uintptr_t Cache::insert (uintptr_t key, size_t size)
 
 void Cache::release (uintptr_t key)
 {
-    m_Lock.enter();
+    enterLock(m_Lock);
 
     CachePage *pPage = m_Pages.lookup(key);
     if (!pPage)
@@ -253,66 +429,117 @@ void Cache::release (uintptr_t key)
     }
 
     assert (pPage->refcnt);
-    pPage->refcnt --;
+    __sync_fetch_and_sub(&pPage->refcnt, 1);
 
     m_Lock.leave();
 }
 
-void Cache::compact()
+void Cache::markDirty (uintptr_t key)
 {
-    m_Lock.acquire();
+    enterLock(m_Lock);
 
-    Timer &timer = *Machine::instance().getTimer();
-    uint32_t now = timer.getUnixTimestamp();
+    CachePage *pPage = m_Pages.lookup(key);
+    if (pPage)
+        pPage->dirty = true;
 
-    // For erasing later
-    List<void*> m_PagesToErase;
+    m_Lock.leave();
+}
 
-    // Iterate through all pages, checking if any are over the time threshold
-    bool bPagesFreed = false;
-    for(Tree<uintptr_t, CachePage*>::Iterator it = m_Pages.begin();
-        it != m_Pages.end();
-        it++)
-    {
-        CachePage *page = reinterpret_cast<CachePage*>(it.value());
-        if((page->timeAllocated + CACHE_AGE_THRESHOLD) <= now)
-            m_PagesToErase.pushBack(reinterpret_cast<void*>(page->location));
-    }
+void Cache::setCallback(writeback_t newCallback, void *meta)
+{
+    m_Callback = newCallback;
+    m_CallbackMeta = meta;
+}
+
+size_t Cache::compact(size_t nPages, bool &bDirtySkipped)
+{
+    bDirtySkipped = false;
 
-    // If no pages were added to the free list, we need to use a count threshold
-    if(!m_PagesToErase.count())
+    // We may be called with the PMM, or even this cache, mid-operation -
+    // if anyone is using the cache, leave it alone.
+    if (!m_Lock.tryAcquire())
+        return 0;
+
+    // Sweep the clock at most twice: the first pass may do nothing but
+    // clear reference bits.
+    size_t nSteps = m_Pages.count() * 2;
+    size_t nFreed = 0;
+    while (m_pClockHand && nSteps-- && (nFreed < nPages))
     {
-        int i = 0;
-        for(Tree<uintptr_t, CachePage*>::Iterator it = m_Pages.begin();
-            it != m_Pages.end();
-            it++)
+        CachePage *pPage = m_pClockHand;
+        m_pClockHand = pPage->next;
+
+        if (pPage->refcnt)
+            continue;
+
+        if (pPage->accessed)
         {
-            CachePage *page = reinterpret_cast<CachePage*>(it.value());
-            m_PagesToErase.pushBack(reinterpret_cast<void*>(page->location));
+            pPage->accessed = false;
+            continue;
+        }
 
-            if(i++ >= CACHE_NUM_THRESHOLD)
-                break;
+        if (pPage->dirty)
+        {
+            bDirtySkipped = true;
+            continue;
         }
+
+        evictPage(pPage);
+        nFreed++;
     }
 
-    // We should have pages to erase now...
-    while(m_PagesToErase.count())
-    {
-        void *page = m_PagesToErase.popFront();
-        if(!page)
-            break;
+    m_nEvictions += nFreed;
 
-        VirtualAddressSpace &va = Processor::information().getVirtualAddressSpace();
-        if(va.isMapped(page))
-        {
-            physical_uintptr_t phys;
-            size_t flags;
-            va.getMapping(page, phys, flags);
-            PhysicalMemoryManager::instance().freePageUnlocked(phys);
-        }
+    m_Lock.release();
 
-        m_Allocator.free(reinterpret_cast<uintptr_t>(page), 4096);
+    return nFreed;
+}
+
+void Cache::sync()
+{
+    if (!m_Callback)
+        return;
+
+    // Pin the dirty pages so they can be written back without the lock
+    // held - the callback will most likely call back into the cache.
+    // Pages someone else has pinned are written too: metadata can stay
+    // pinned for as long as the filesystem is mounted. Whoever changes a
+    // page marks it dirty again afterwards, so clearing the flag before the
+    // write can't lose a change made while it's in progress.
+    List<CachePage*> dirtyPages;
+
+    acquireLock(m_Lock);
+    CachePage *pPage = m_pClockHand;
+    if (pPage)
+    {
+        do
+        {
+            if (pPage->dirty)
+            {
+                pPage->dirty = false;
+                pPage->refcnt++;
+                dirtyPages.pushBack(pPage);
+            }
+            pPage = pPage->next;
+        } while (pPage != m_pClockHand);
     }
-    
     m_Lock.release();
+
+    for(List<CachePage*>::Iterator it = dirtyPages.begin();
+        it != dirtyPages.end();
+        it++)
+    {
+        m_Callback((*it)->key, (*it)->location, m_CallbackMeta);
+        m_nWritebacks++;
+        release((*it)->key);
+    }
+}
+
+void Cache::getStatistics(CacheStatistics &stats)
+{
+    stats.hits = m_nHits;
+    stats.misses = m_nMisses;
+    stats.evictions = m_nEvictions;
+    stats.writebacks = m_nWritebacks;
+    stats.pages = m_Pages.count();
 }
@@ -97,7 +97,7 @@ void ExtensibleBitmap::set(size_t n)
 
     if(n < sizeof(uintptr_t)*8)
     {
-        m_StaticMap |= (1 << n);
+        m_StaticMap |= (static_cast<uintptr_t>(1) << n);
         return;
     }
 
@@ -158,7 +158,7 @@ void ExtensibleBitmap::clear(size_t n)
 
     if(n < sizeof(uintptr_t)*8)
     {
-        m_StaticMap &= ~(1 << n);
+        m_StaticMap &= ~(static_cast<uintptr_t>(1) << n);
         return;
     }
 
@@ -173,7 +173,7 @@ void ExtensibleBitmap::clear(size_t n)
 bool ExtensibleBitmap::test(size_t n)
 {
     if(n < sizeof(uintptr_t)*8)
-        return (m_StaticMap & (1 << n));
+        return (m_StaticMap & (static_cast<uintptr_t>(1) << n));
 
     n -= sizeof(uintptr_t)*8;
 
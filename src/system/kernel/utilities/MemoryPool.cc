@@ -55,7 +55,7 @@ bool MemoryPool::initialise(size_t poolSize, size_t bufferSize)
         return false;
 
     // Find the next power of two for bufferSize, if it isn't already one
-    if(!(bufferSize & (bufferSize - 1)))
+    if(bufferSize & (bufferSize - 1))
     {
         size_t powerOf2 = 1;
         size_t lg2 = 0;
@@ -141,7 +141,7 @@ uintptr_t MemoryPool::allocateDoer()
         return 0;
     }
     
-    return poolBase + (n * 0x1000);
+    return poolBase + (n * m_BufferSize);
 }
 
 void MemoryPool::free(uintptr_t buffer)
@@ -29,7 +29,7 @@ RadixTree<void*>::RadixTree() :
 
 RadixTree<void*>::~RadixTree()
 {
-    clear();
+    delete m_pRoot;
 }
 
 RadixTree<void*>::RadixTree(const RadixTree &x) :
@@ -75,6 +75,10 @@ void RadixTree<void*>::insert(String key, void *value)
         {
             case Node::ExactMatch:
             {
+                // The node may have been made by splitting two other keys
+                // apart, in which case it's new as a key of its own.
+                if (!pNode->getValue())
+                    m_nItems ++;
                 pNode->setValue(value);
                 return;
             }
@@ -235,6 +239,10 @@ void RadixTree<void*>::remove(String key)
         {
             case Node::ExactMatch:
             {
+                // A node that only joins other keys together isn't a key itself.
+                if (!pNode->getValue())
+                    return;
+
                 // Delete this node. If we set the value to zero, it is effectively removed from the map.
                 // There are only certain cases in which we can delete the node completely, however.
                 pNode->setValue(0);
@@ -78,15 +78,7 @@ uint64_t RequestQueue::addRequest(size_t priority, uint64_t p1, uint64_t p2, uin
   // Add to the request queue.
   m_RequestQueueMutex.acquire();
 
-  if (m_pRequestQueue[priority] == 0)
-    m_pRequestQueue[priority] = pReq;
-  else
-  {
-    Request *p = m_pRequestQueue[priority];
-    while (p->next != 0)
-      p = p->next;
-    p->next = pReq;
-  }
+  insertRequest(priority, pReq);
 
   // Increment the number of items on the request queue.
   m_RequestQueueSize.release();
@@ -158,27 +150,27 @@ uint64_t RequestQueue::addAsyncRequest(size_t priority, uint64_t p1, uint64_t p2
   // Add to the request queue.
   m_RequestQueueMutex.acquire();
 
-  if (m_pRequestQueue[priority] == 0)
-    m_pRequestQueue[priority] = pReq;
-  else
+  // Can a request that's already waiting do this one's work too?
+  for (Request *p = m_pRequestQueue[priority]; p; p = p->next)
   {
-    Request *p = m_pRequestQueue[priority];
-    while (p->next != 0)
+    if (p == pReq)
     {
-      if(p == pReq)
-      {
-        return 0;
-      }
-      p = p->next;
+      m_RequestQueueMutex.release();
+      return 0;
     }
-    if(p != pReq)
-      p->next = pReq;
-    else
+
+    if (p->isAsync && !p->bReject && mergeRequests(p, pReq))
     {
+      m_RequestQueueMutex.release();
+
+      pReq->pThread->removeRequest(pReq);
+      delete pReq;
       return 0;
     }
   }
 
+  insertRequest(priority, pReq);
+
   assert_heap_ptr_valid(pReq);
 
   // Increment the number of items on the request queue.
@@ -224,6 +216,26 @@ uint64_t RequestQueue::addAsyncRequest(size_t priority, uint64_t p1, uint64_t p2
 #endif
 }
 
+size_t RequestQueue::getQueueDepth()
+{
+#ifdef THREADS
+  ssize_t depth = m_RequestQueueSize.getValue();
+  return depth > 0 ? depth : 0;
+#else
+  return 0;
+#endif
+}
+
+void RequestQueue::insertRequest(size_t priority, Request *pReq)
+{
+  Request **pp = &m_pRequestQueue[priority];
+  while (*pp && !compareRequests(pReq, *pp))
+    pp = &(*pp)->next;
+
+  pReq->next = *pp;
+  *pp = pReq;
+}
+
 int RequestQueue::trampoline(void *p)
 {
   RequestQueue *pRQ = reinterpret_cast<RequestQueue*> (p);
@@ -159,6 +159,6 @@ void String::sprintf(const char *fmt, ...)
     reserve(256);
     va_list vl;
     va_start(vl, fmt);
-    vsprintf(m_Data, fmt, vl);
+    m_Length = vsprintf(m_Data, fmt, vl);
     va_end(vl);
 }
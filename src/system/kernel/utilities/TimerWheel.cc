@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <utilities/TimerWheel.h>
+#include <processor/Processor.h>
+
+#define LEVEL_MASK  (TIMERWHEEL_LEVEL_SIZE - 1)
+
+TimerWheel::TimerWheel() :
+    m_Lock(), m_Now(0), m_Tick(0), m_nAlarms(0), m_pExpired(0),
+    m_pRunning(0), m_RunningProcessor(0), m_bAdvancing(false)
+{
+    for (size_t i = 0; i < TIMERWHEEL_LEVELS; i++)
+        for (size_t j = 0; j < TIMERWHEEL_LEVEL_SIZE; j++)
+            m_Slots[i][j] = 0;
+}
+
+TimerWheel::~TimerWheel()
+{
+}
+
+void TimerWheel::arm(Alarm *pAlarm, uint64_t usecs)
+{
+    m_Lock.acquire();
+
+    if (pAlarm->m_pSlot)
+        unlink(pAlarm);
+    else
+        m_nAlarms++;
+
+    pAlarm->m_Deadline = m_Now + usecs;
+    insert(pAlarm);
+
+    m_Lock.release();
+}
+
+bool TimerWheel::cancel(Alarm *pAlarm)
+{
+    while (true)
+    {
+        m_Lock.acquire();
+
+        // The caller may free the alarm as soon as we return, so wait out a
+        // fire() that is running elsewhere. An alarm cancelling itself from
+        // within fire() is fine.
+        if (m_pRunning != pAlarm || m_RunningProcessor == Processor::id())
+            break;
+
+        m_Lock.release();
+    }
+
+    bool bArmed = (pAlarm->m_pSlot != 0);
+    if (bArmed)
+    {
+        unlink(pAlarm);
+        m_nAlarms--;
+    }
+
+    m_Lock.release();
+    return bArmed;
+}
+
+void TimerWheel::advance(uint64_t now)
+{
+    m_Lock.acquire();
+    m_Now = now;
+
+    if (m_bAdvancing)
+    {
+        m_Lock.release();
+        return;
+    }
+
+    uint64_t target = now >> TIMERWHEEL_RESOLUTION_SHIFT;
+    m_bAdvancing = true;
+
+    while (m_Tick <= target)
+    {
+        // Don't turn empty slots one at a time after a long idle stretch.
+        if (!m_nAlarms)
+        {
+            m_Tick = target + 1;
+            break;
+        }
+
+        size_t index = m_Tick & LEVEL_MASK;
+
+        // When a level wraps, the next slot of the level above it becomes
+        // close enough to be sorted into the levels below.
+        if (!index &&
+            !cascade(1, (m_Tick >> TIMERWHEEL_LEVEL_BITS) & LEVEL_MASK) &&
+            !cascade(2, (m_Tick >> (TIMERWHEEL_LEVEL_BITS * 2)) & LEVEL_MASK))
+            cascade(3, (m_Tick >> (TIMERWHEEL_LEVEL_BITS * 3)) & LEVEL_MASK);
+
+        // Take the whole slot off the wheel before firing anything, so that
+        // alarms re-armed from fire() land in a later slot.
+        m_pExpired = m_Slots[0][index];
+        m_Slots[0][index] = 0;
+        for (Alarm *pAlarm = m_pExpired; pAlarm; pAlarm = pAlarm->m_pNext)
+            pAlarm->m_pSlot = &m_pExpired;
+
+        m_Tick++;
+
+        while (m_pExpired)
+        {
+            Alarm *pAlarm = m_pExpired;
+            unlink(pAlarm);
+            m_nAlarms--;
+
+            m_pRunning = pAlarm;
+            m_RunningProcessor = Processor::id();
+            m_Lock.release();
+
+            pAlarm->fire();
+
+            m_Lock.acquire();
+            m_pRunning = 0;
+        }
+    }
+
+    m_bAdvancing = false;
+    m_Lock.release();
+}
+
+void TimerWheel::insert(Alarm *pAlarm)
+{
+    // Round up to the next slot boundary so that an alarm never fires early.
+    uint64_t expires = (pAlarm->m_Deadline + (1 << TIMERWHEEL_RESOLUTION_SHIFT) - 1) >> TIMERWHEEL_RESOLUTION_SHIFT;
+    if (expires < m_Tick)
+        expires = m_Tick;
+
+    // Past the end of the wheel: park it in the furthest slot, and it will be
+    // re-filed from there.
+    uint64_t range = 1ULL << (TIMERWHEEL_LEVEL_BITS * TIMERWHEEL_LEVELS);
+    if (expires - m_Tick >= range)
+        expires = m_Tick + range - 1;
+
+    uint64_t delta = expires - m_Tick;
+    size_t level;
+    for (level = 0; level < TIMERWHEEL_LEVELS - 1; level++)
+        if (delta < (1ULL << (TIMERWHEEL_LEVEL_BITS * (level + 1))))
+            break;
+
+    Alarm **ppSlot = &m_Slots[level][(expires >> (TIMERWHEEL_LEVEL_BITS * level)) & LEVEL_MASK];
+
+    pAlarm->m_pPrev = 0;
+    pAlarm->m_pNext = *ppSlot;
+    if (*ppSlot)
+        (*ppSlot)->m_pPrev = pAlarm;
+    *ppSlot = pAlarm;
+    pAlarm->m_pSlot = ppSlot;
+}
+
+void TimerWheel::unlink(Alarm *pAlarm)
+{
+    if (pAlarm->m_pPrev)
+        pAlarm->m_pPrev->m_pNext = pAlarm->m_pNext;
+    else
+        *pAlarm->m_pSlot = pAlarm->m_pNext;
+    if (pAlarm->m_pNext)
+        pAlarm->m_pNext->m_pPrev = pAlarm->m_pPrev;
+
+    pAlarm->m_pNext = pAlarm->m_pPrev = 0;
+    pAlarm->m_pSlot = 0;
+}
+
+size_t TimerWheel::cascade(size_t level, size_t index)
+{
+    Alarm *pAlarm = m_Slots[level][index];
+    m_Slots[level][index] = 0;
+
+    while (pAlarm)
+    {
+        Alarm *pNext = pAlarm->m_pNext;
+        insert(pAlarm);
+        pAlarm = pNext;
+    }
+
+    return index;
+}
@@ -0,0 +1,158 @@
+// fs-bench: measures block allocation on a filesystem.
+//
+// Grows several files at once, a chunk at a time each in turn - the pattern
+// that scatters files over the disk when the allocator doesn't keep each one
+// together - timing every write. Then it asks for the disk blocks each file
+// ended up in (FIBMAP) and counts how many contiguous runs they make.
+//
+// Run it on a directory of the filesystem to test, such as one on a
+// loopback-mounted image, so that every run starts from the same layout.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+
+#define DEFAULT_FILES   8
+#define DEFAULT_SIZE    (1024 * 1024)
+#define MAX_FILES       64
+#define CHUNK_SIZE      4096
+
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void file_name(char *buf, size_t len, const char *dir, int n)
+{
+    snprintf(buf, len, "%s/fs-bench.%d", dir, n);
+}
+
+// Counts the runs of consecutive disk blocks the file is stored in.
+// Returns -1 if the filesystem can't say.
+static int count_runs(int fd, size_t size, int *nBlocksOut)
+{
+    int blockSize = 0;
+    if (ioctl(fd, FIGETBSZ, &blockSize) < 0 || blockSize <= 0)
+        return -1;
+
+    int nBlocks = (size + blockSize - 1) / blockSize;
+    int nRuns = 0;
+    unsigned int prev = 0;
+    int i;
+    for (i = 0; i < nBlocks; i++)
+    {
+        unsigned int block = i;
+        if (ioctl(fd, FIBMAP, &block) < 0)
+            return -1;
+
+        if (!block || block != prev + 1)
+            nRuns++;
+        prev = block;
+    }
+
+    *nBlocksOut = nBlocks;
+    return nRuns;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: %s directory [files] [bytes-per-file]\n", argv[0]);
+        return 1;
+    }
+
+    const char *dir = argv[1];
+    int nFiles = (argc > 2) ? atoi(argv[2]) : DEFAULT_FILES;
+    size_t size = (argc > 3) ? (size_t) atoi(argv[3]) : DEFAULT_SIZE;
+    if (nFiles < 1 || nFiles > MAX_FILES || size < CHUNK_SIZE)
+    {
+        printf("fs-bench: between 1 and %d files, of at least %d bytes\n", MAX_FILES, CHUNK_SIZE);
+        return 1;
+    }
+
+    int fds[MAX_FILES];
+    char name[256];
+    int i;
+    for (i = 0; i < nFiles; i++)
+    {
+        file_name(name, sizeof name, dir, i);
+        fds[i] = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fds[i] < 0)
+        {
+            printf("fs-bench: can't create %s: %s\n", name, strerror(errno));
+            return 1;
+        }
+    }
+
+    char *buf = (char *) malloc(CHUNK_SIZE);
+    memset(buf, 0xAB, CHUNK_SIZE);
+
+    // Grow them all together.
+    long long total = 0, worst = 0;
+    int nWrites = 0;
+    long long start = now_us();
+    size_t offset;
+    for (offset = 0; offset < size; offset += CHUNK_SIZE)
+    {
+        for (i = 0; i < nFiles; i++)
+        {
+            long long t = now_us();
+            if (write(fds[i], buf, CHUNK_SIZE) != CHUNK_SIZE)
+            {
+                printf("fs-bench: write failed: %s\n", strerror(errno));
+                return 1;
+            }
+            t = now_us() - t;
+
+            total += t;
+            if (t > worst)
+                worst = t;
+            nWrites++;
+        }
+    }
+    long long elapsed = now_us() - start;
+
+    printf("fs-bench write files=%d bytes=%lu writes=%d usec=%lld per-write=%lld max-write=%lld\n",
+           nFiles, (unsigned long) size, nWrites, elapsed, total / nWrites, worst);
+
+    // Now see how they were laid out.
+    int nTotalBlocks = 0, nTotalRuns = 0, nWorstRuns = 0;
+    for (i = 0; i < nFiles; i++)
+    {
+        int nBlocks = 0;
+        int nRuns = count_runs(fds[i], size, &nBlocks);
+        if (nRuns < 0)
+        {
+            printf("fs-bench layout unavailable (no FIBMAP)\n");
+            nTotalRuns = -1;
+            break;
+        }
+
+        nTotalBlocks += nBlocks;
+        nTotalRuns += nRuns;
+        if (nRuns > nWorstRuns)
+            nWorstRuns = nRuns;
+    }
+
+    if (nTotalRuns >= 0)
+        printf("fs-bench layout files=%d blocks=%d runs=%d per-file=%d max-per-file=%d\n",
+               nFiles, nTotalBlocks, nTotalRuns, nTotalRuns / nFiles, nWorstRuns);
+
+    for (i = 0; i < nFiles; i++)
+    {
+        close(fds[i]);
+        file_name(name, sizeof name, dir, i);
+        unlink(name);
+    }
+
+    free(buf);
+    return 0;
+}
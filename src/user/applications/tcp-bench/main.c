@@ -0,0 +1,361 @@
+// tcp-bench: TCP benchmarks over the loopback device.
+//
+//   tcp-bench loss [bytes [per-thousand ...]]
+//     Sends the given number of bytes through one connection at each loss
+//     rate in turn - the loopback device drops that many packets in every
+//     thousand - and reports the throughput. This shows how well the
+//     retransmission and congestion control recover.
+//
+//   tcp-bench conns [connections [workers [rounds]]]
+//     Opens thousands of connections at once, split between a number of
+//     client processes with as many server processes on the other end, and
+//     has each client exchange a small message over every one of its
+//     connections a number of times. More workers should mean more round
+//     trips a second if connections can be handled in parallel.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define BASE_PORT       5100
+#define DEFAULT_BYTES   (4 * 1024 * 1024)
+#define CHUNK_SIZE      8192
+
+#define CONNS_PORT      5000
+#define DEFAULT_CONNS   2000
+#define DEFAULT_WORKERS 4
+#define DEFAULT_ROUNDS  10
+#define MESSAGE_SIZE    64
+
+static const int default_loss[] = {0, 5, 10, 20, 50};
+
+static long long now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return (long long) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void loopback_addr(struct sockaddr_in *addr, int port)
+{
+    memset(addr, 0, sizeof *addr);
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+    addr->sin_addr.s_addr = inet_addr("127.0.0.1");
+}
+
+// Sets the share of packets the loopback device drops.
+static int set_loss(int sock, int per_thousand)
+{
+    if (ioctl(sock, SIOCSLOSS, &per_thousand) < 0)
+    {
+        printf("tcp-bench: can't set loopback loss: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Listens on the given port, and forks a server that reads from the first
+// connection until it closes. Returns the server's pid.
+static pid_t sink_server(int port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    loopback_addr(&addr, port);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof addr) < 0 || listen(listener, 1) < 0)
+    {
+        printf("tcp-bench: can't listen on port %d: %s\n", port, strerror(errno));
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        close(listener);
+        return pid;
+    }
+
+    int conn = accept(listener, 0, 0);
+    if (conn < 0)
+        exit(1);
+
+    char *buf = (char *) malloc(CHUNK_SIZE);
+    while (read(conn, buf, CHUNK_SIZE) > 0)
+        ;
+
+    close(conn);
+    close(listener);
+    exit(0);
+}
+
+static int loss_run(int ctl, size_t bytes, int per_thousand, int port)
+{
+    pid_t server = sink_server(port);
+    if (server < 0)
+        return -1;
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    loopback_addr(&addr, port);
+    if (sock < 0 || connect(sock, (struct sockaddr *) &addr, sizeof addr) < 0)
+    {
+        printf("tcp-bench: can't connect to port %d: %s\n", port, strerror(errno));
+        kill(server, SIGKILL);
+        return -1;
+    }
+
+    // Lose packets only once connected, so it's the transfer that's measured
+    if (set_loss(ctl, per_thousand) < 0)
+    {
+        close(sock);
+        kill(server, SIGKILL);
+        return -1;
+    }
+
+    char *buf = (char *) malloc(CHUNK_SIZE);
+    memset(buf, 0x5A, CHUNK_SIZE);
+
+    long long start = now_us();
+    size_t sent = 0;
+    while (sent < bytes)
+    {
+        size_t n = bytes - sent;
+        if (n > CHUNK_SIZE)
+            n = CHUNK_SIZE;
+
+        ssize_t r = write(sock, buf, n);
+        if (r <= 0)
+        {
+            printf("tcp-bench: write failed after %lu bytes: %s\n", (unsigned long) sent, strerror(errno));
+            break;
+        }
+        sent += r;
+    }
+    close(sock);
+
+    // Done when the server has read everything
+    int status;
+    waitpid(server, &status, 0);
+    long long elapsed = now_us() - start;
+
+    set_loss(ctl, 0);
+    free(buf);
+
+    if (elapsed <= 0)
+        elapsed = 1;
+    printf("tcp-bench loss per-thousand=%d bytes=%lu usec=%lld kbytes-per-sec=%lld\n",
+           per_thousand, (unsigned long) sent, elapsed, ((long long) sent * 1000000 / elapsed) / 1024);
+    return 0;
+}
+
+static int loss_bench(int argc, char *argv[])
+{
+    size_t bytes = (argc > 2) ? (size_t) atoi(argv[2]) : DEFAULT_BYTES;
+    int port = BASE_PORT;
+    int i;
+
+    // The loss rate is set through a socket, but not one being measured
+    int ctl = socket(AF_INET, SOCK_STREAM, 0);
+    if (ctl < 0)
+    {
+        printf("tcp-bench: can't get a socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (argc > 3)
+    {
+        for (i = 3; i < argc; i++)
+            loss_run(ctl, bytes, atoi(argv[i]), port++);
+    }
+    else
+    {
+        for (i = 0; i < (int) (sizeof default_loss / sizeof default_loss[0]); i++)
+            loss_run(ctl, bytes, default_loss[i], port++);
+    }
+
+    close(ctl);
+    return 0;
+}
+
+// Reads or writes exactly len bytes.
+static int transfer(int fd, char *buf, size_t len, int bWrite)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t r = bWrite ? write(fd, buf + done, len - done) : read(fd, buf + done, len - done);
+        if (r <= 0)
+            return -1;
+        done += r;
+    }
+    return 0;
+}
+
+// Waits for every child process to exit. Returns how many failed.
+static int wait_all(int n)
+{
+    int failed = 0;
+    while (n--)
+    {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+            failed++;
+    }
+    return failed;
+}
+
+// Server worker: echoes every message on its share of the connections.
+static int conns_server_worker(int *fds, int nconns, int worker, int nworkers, int rounds)
+{
+    char buf[MESSAGE_SIZE];
+    int r, i;
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = worker; i < nconns; i += nworkers)
+        {
+            if (transfer(fds[i], buf, MESSAGE_SIZE, 0) < 0 || transfer(fds[i], buf, MESSAGE_SIZE, 1) < 0)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+// Accepts every connection, then splits them between the server workers.
+static int conns_server(int listener, int nconns, int nworkers, int rounds)
+{
+    int *fds = (int *) malloc(nconns * sizeof(int));
+    int i;
+    for (i = 0; i < nconns; i++)
+    {
+        fds[i] = accept(listener, 0, 0);
+        if (fds[i] < 0)
+        {
+            printf("tcp-bench: accept failed after %d connections: %s\n", i, strerror(errno));
+            return 1;
+        }
+    }
+    close(listener);
+
+    for (i = 0; i < nworkers; i++)
+    {
+        if (fork() == 0)
+            exit(conns_server_worker(fds, nconns, i, nworkers, rounds));
+    }
+    return wait_all(nworkers) ? 1 : 0;
+}
+
+// Client worker: connects its share of the connections, then does a number
+// of rounds of sending a message down each and reading the reply.
+static int conns_client(int worker, int nconns, int rounds)
+{
+    int *fds = (int *) malloc(nconns * sizeof(int));
+    char buf[MESSAGE_SIZE];
+    struct sockaddr_in addr;
+    int r, i;
+
+    memset(buf, worker, sizeof buf);
+    loopback_addr(&addr, CONNS_PORT);
+
+    long long start = now_us();
+    for (i = 0; i < nconns; i++)
+    {
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (fds[i] < 0 || connect(fds[i], (struct sockaddr *) &addr, sizeof addr) < 0)
+        {
+            printf("tcp-bench: worker %d: connect failed after %d connections: %s\n", worker, i, strerror(errno));
+            return 1;
+        }
+    }
+    long long connected = now_us();
+
+    // Everything is sent before any reply is read, so every connection has
+    // a message in flight at once.
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < nconns; i++)
+            if (transfer(fds[i], buf, MESSAGE_SIZE, 1) < 0)
+                return 1;
+        for (i = 0; i < nconns; i++)
+            if (transfer(fds[i], buf, MESSAGE_SIZE, 0) < 0)
+                return 1;
+    }
+    long long done = now_us();
+
+    for (i = 0; i < nconns; i++)
+        close(fds[i]);
+
+    printf("tcp-bench conns-worker worker=%d connections=%d connect-usec=%lld exchange-usec=%lld\n",
+           worker, nconns, connected - start, done - connected);
+    return 0;
+}
+
+static int conns_bench(int argc, char *argv[])
+{
+    int nconns = (argc > 2) ? atoi(argv[2]) : DEFAULT_CONNS;
+    int nworkers = (argc > 3) ? atoi(argv[3]) : DEFAULT_WORKERS;
+    int rounds = (argc > 4) ? atoi(argv[4]) : DEFAULT_ROUNDS;
+    if (nworkers < 1 || nconns < nworkers || rounds < 1)
+    {
+        printf("tcp-bench: need at least one connection per worker, and a round\n");
+        return 1;
+    }
+
+    // Each client gets an equal share of the connections.
+    int per_worker = nconns / nworkers;
+    nconns = per_worker * nworkers;
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    loopback_addr(&addr, CONNS_PORT);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof addr) < 0 || listen(listener, nconns) < 0)
+    {
+        printf("tcp-bench: can't listen on port %d: %s\n", CONNS_PORT, strerror(errno));
+        return 1;
+    }
+
+    pid_t server = fork();
+    if (server == 0)
+        exit(conns_server(listener, nconns, nworkers, rounds));
+    close(listener);
+
+    long long start = now_us();
+    int i;
+    for (i = 0; i < nworkers; i++)
+    {
+        if (fork() == 0)
+            exit(conns_client(i, per_worker, rounds));
+    }
+
+    // The clients and the server
+    int failed = wait_all(nworkers + 1);
+    long long elapsed = now_us() - start;
+    if (elapsed <= 0)
+        elapsed = 1;
+
+    long long exchanges = (long long) nconns * rounds;
+    printf("tcp-bench conns connections=%d workers=%d rounds=%d failed=%d usec=%lld round-trips-per-sec=%lld\n",
+           nconns, nworkers, rounds, failed, elapsed, exchanges * 1000000 / elapsed);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "loss"))
+        return loss_bench(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "conns"))
+        return conns_bench(argc, argv);
+
+    printf("usage: %s loss [bytes [per-thousand ...]]\n", argv[0]);
+    printf("       %s conns [connections [workers [rounds]]]\n", argv[0]);
+    return 1;
+}
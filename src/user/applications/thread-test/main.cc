@@ -2,12 +2,24 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <errno.h>
+#include <semaphore.h>
 #include <sys/time.h>
 
 #include <list>
 
 #define LOOPS 1024 // 10000000
 
+// Round trips for the context switch benchmark.
+#define PINGPONG_LOOPS 10000
+
+// Threads and per-thread waits for the contention benchmark.
+#define CONTENTION_THREADS 8
+#define CONTENTION_LOOPS 2000
+
+// Runs the contention benchmark on a kernel Semaphore. Fills in the time
+// taken (us), then wakeups, spurious wakeups and handoffs.
+extern "C" int pedigree_sem_benchmark(size_t nThreads, size_t nPosts, int bHandoff, size_t *results);
+
 // Modified from http://www.alexonlinux.com/do-you-need-mutex-to-protect-int
 // Uses mutexes or spinlocks
 
@@ -60,6 +72,75 @@ void *consumer(void *ptr)
     return NULL;
 }
 
+// Context switch benchmark: two threads hand control back and forth over a
+// pair of semaphores, so every round trip is two sleeps and two wakeups.
+sem_t ping, pong;
+
+void *ponger(void *ptr)
+{
+    for (int i = 0; i < PINGPONG_LOOPS; i++)
+    {
+        sem_wait(&ping);
+        sem_post(&pong);
+    }
+
+    return NULL;
+}
+
+void pingpong()
+{
+    pthread_t thr;
+    struct timeval tv1, tv2;
+
+    sem_init(&ping, 0, 0);
+    sem_init(&pong, 0, 0);
+
+    pthread_create(&thr, NULL, ponger, NULL);
+
+    gettimeofday(&tv1, NULL);
+    for (int i = 0; i < PINGPONG_LOOPS; i++)
+    {
+        sem_post(&ping);
+        sem_wait(&pong);
+    }
+    gettimeofday(&tv2, NULL);
+
+    pthread_join(thr, NULL);
+
+    long usecs = (tv2.tv_sec - tv1.tv_sec) * 1000000L + (tv2.tv_usec - tv1.tv_usec);
+    printf("Ping-pong - %d round trips in %ld us (%ld ns per switch)\n",
+        PINGPONG_LOOPS, usecs, (usecs * 1000L) / (PINGPONG_LOOPS * 2));
+
+    sem_destroy(&ping);
+    sem_destroy(&pong);
+}
+
+// Contention benchmark: a crowd of kernel threads sleeps on one kernel
+// Semaphore, which is posted one item at a time. sem_t is a futex, so this
+// has to happen in the kernel to go through Semaphore's wake-one and handoff
+// paths. Each post should wake exactly one thread; the spurious wakeup count
+// says how many were woken for nothing.
+void contention(int bHandoff)
+{
+    size_t results[4];
+
+    if (pedigree_sem_benchmark(CONTENTION_THREADS, CONTENTION_THREADS * CONTENTION_LOOPS, bHandoff, results) < 0)
+    {
+        printf("Contention - benchmark failed\n");
+        return;
+    }
+
+    printf("Contention (%s) - %d threads, %d posts in %lu us\n",
+        bHandoff ? "handoff" : "wake-one",
+        CONTENTION_THREADS, CONTENTION_THREADS * CONTENTION_LOOPS,
+        (unsigned long) results[0]);
+    printf("Contention (%s) - %lu wakeups, %lu spurious, %lu handed off\n",
+        bHandoff ? "handoff" : "wake-one",
+        (unsigned long) results[1],
+        (unsigned long) results[2],
+        (unsigned long) results[3]);
+}
+
 int main()
 {
     int i;
@@ -103,5 +184,9 @@ int main()
     pthread_mutex_destroy(&mutex);
 #endif
 
+    pingpong();
+    contention(0);
+    contention(1);
+
     return 0;
 }
@@ -0,0 +1,605 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <pthread.h>
+#include <sched.h>
+
+#include <SlamAllocator.h>
+#include <utilities/MemoryPool.h>
+#include <utilities/String.h>
+#include <processor/Processor.h>
+#include <processor/VirtualAddressSpace.h>
+#include "Harness.h"
+
+/** Most threads the threaded benchmarks can be asked for. Every thread the
+ *  harness starts takes a processor ID for good, as in the kernel, and the
+ *  benchmarks start several threads for every thread count. */
+#define ALLOCATORS_MAX_THREADS  16
+
+/** Objects in flight between a producer and its consumer. */
+#define RING_SIZE               1024
+
+static SlamAllocator &slam()
+{
+    return SlamAllocator::instance();
+}
+
+static uintptr_t heapEnd()
+{
+    return reinterpret_cast<uintptr_t>(VirtualAddressSpace::getKernelAddressSpace().getEndOfHeap());
+}
+
+/** Fills an object with a pattern made from a tag, which stamped() can then
+ *  look for - two live objects that overlap spoil each other's patterns. */
+static void stamp(uintptr_t object, size_t size, size_t tag)
+{
+    uint8_t *p = reinterpret_cast<uint8_t*>(object);
+    for (size_t i = 0; i < size; i++)
+        p[i] = static_cast<uint8_t>(tag + i);
+}
+
+static bool stamped(uintptr_t object, size_t size, size_t tag)
+{
+    uint8_t *p = reinterpret_cast<uint8_t*>(object);
+    for (size_t i = 0; i < size; i++)
+        if (p[i] != static_cast<uint8_t>(tag + i))
+            return false;
+    return true;
+}
+
+/** Runs each function on its own thread and waits for them all. */
+static void runThreads(size_t nThreads, void *(*pFunction)(void *), void **pArgs)
+{
+    pthread_t threads[ALLOCATORS_MAX_THREADS * 2];
+    for (size_t i = 0; i < nThreads; i++)
+        pthread_create(&threads[i], 0, pFunction, pArgs[i]);
+    for (size_t i = 0; i < nThreads; i++)
+        pthread_join(threads[i], 0);
+}
+
+/** A single-producer, single-consumer queue of objects passed from the
+ *  thread that allocates them to the one that frees them. */
+struct Ring
+{
+    volatile size_t head;
+    volatile size_t tail;
+    uintptr_t objects[RING_SIZE];
+};
+
+static void ringPush(Ring *pRing, uintptr_t object)
+{
+    while (pRing->head - pRing->tail == RING_SIZE)
+        sched_yield();
+    pRing->objects[pRing->head % RING_SIZE] = object;
+    __sync_synchronize();
+    pRing->head = pRing->head + 1;
+}
+
+static uintptr_t ringPop(Ring *pRing)
+{
+    while (pRing->head == pRing->tail)
+        sched_yield();
+    __sync_synchronize();
+    uintptr_t object = pRing->objects[pRing->tail % RING_SIZE];
+    __sync_synchronize();
+    pRing->tail = pRing->tail + 1;
+    return object;
+}
+
+/** One side of a cross-thread run: the producer allocates objects of a size
+ *  and tags them with their sequence number; the consumer checks the tag and
+ *  frees them. */
+struct CrossThreadArgs
+{
+    Ring *pRing;
+    size_t nObjects;
+    size_t size;
+    bool bOk;
+    uint64_t ns;
+};
+
+static void *producer(void *p)
+{
+    CrossThreadArgs *pArgs = static_cast<CrossThreadArgs*>(p);
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < pArgs->nObjects; i++)
+    {
+        uintptr_t object = slam().allocate(pArgs->size);
+        if (!object)
+            pArgs->bOk = false;
+        else
+            stamp(object, pArgs->size, i);
+        ringPush(pArgs->pRing, object);
+    }
+    pArgs->ns = nanoseconds() - start;
+    return 0;
+}
+
+static void *consumer(void *p)
+{
+    CrossThreadArgs *pArgs = static_cast<CrossThreadArgs*>(p);
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < pArgs->nObjects; i++)
+    {
+        uintptr_t object = ringPop(pArgs->pRing);
+        if (!object)
+            continue;
+        if (!stamped(object, pArgs->size, i))
+            pArgs->bOk = false;
+        slam().free(object);
+    }
+    pArgs->ns = nanoseconds() - start;
+    return 0;
+}
+
+/** Runs nPairs producer/consumer pairs at once. Returns whether every object
+ *  arrived intact, and the time the slowest thread took. */
+static bool crossThread(size_t nPairs, size_t nObjects, size_t size, uint64_t &ns)
+{
+    Ring *pRings = new Ring[nPairs];
+    CrossThreadArgs *pArgs = new CrossThreadArgs[nPairs * 2];
+    void *pThreadArgs[ALLOCATORS_MAX_THREADS * 2];
+    for (size_t i = 0; i < nPairs; i++)
+    {
+        pRings[i].head = pRings[i].tail = 0;
+        for (size_t j = 0; j < 2; j++)
+        {
+            CrossThreadArgs &args = pArgs[i * 2 + j];
+            args.pRing = &pRings[i];
+            args.nObjects = nObjects;
+            args.size = size;
+            args.bOk = true;
+            args.ns = 0;
+            pThreadArgs[i * 2 + j] = &args;
+        }
+    }
+
+    // Producers and consumers alternate.
+    uint64_t start = nanoseconds();
+    pthread_t threads[ALLOCATORS_MAX_THREADS * 2];
+    for (size_t i = 0; i < nPairs * 2; i++)
+        pthread_create(&threads[i], 0, (i & 1) ? consumer : producer, pThreadArgs[i]);
+    for (size_t i = 0; i < nPairs * 2; i++)
+        pthread_join(threads[i], 0);
+    ns = nanoseconds() - start;
+
+    bool bOk = true;
+    for (size_t i = 0; i < nPairs * 2; i++)
+        bOk = pArgs[i].bOk && bOk;
+
+    delete [] pArgs;
+    delete [] pRings;
+    return bOk;
+}
+
+/** Allocates and frees on one thread: a batch allocated and then freed, so
+ *  the magazines empty and refill, for a number of rounds. */
+struct LocalArgs
+{
+    size_t nRounds;
+    size_t nBatch;
+    size_t size;
+    bool bOk;
+};
+
+static void *local(void *p)
+{
+    LocalArgs *pArgs = static_cast<LocalArgs*>(p);
+    uintptr_t *pObjects = new uintptr_t[pArgs->nBatch];
+    for (size_t r = 0; r < pArgs->nRounds; r++)
+    {
+        for (size_t i = 0; i < pArgs->nBatch; i++)
+        {
+            pObjects[i] = slam().allocate(pArgs->size);
+            *reinterpret_cast<size_t*>(pObjects[i]) = i;
+        }
+        for (size_t i = 0; i < pArgs->nBatch; i++)
+        {
+            if (*reinterpret_cast<size_t*>(pObjects[i]) != i)
+                pArgs->bOk = false;
+            slam().free(pObjects[i]);
+        }
+    }
+    delete [] pObjects;
+    return 0;
+}
+
+//
+// Correctness
+//
+
+static void testSlamSizes()
+{
+    static const size_t sizes[] = {1, 7, 8, 16, 24, 100, 128, 1000, 2000, 4000, 5000, 16384, 100000};
+    static const size_t nSizes = sizeof(sizes) / sizeof(sizes[0]);
+    uintptr_t objects[nSizes];
+
+    bool bOk = true, bSizes = true, bAligned = true, bValid = true;
+    for (size_t i = 0; i < nSizes; i++)
+    {
+        objects[i] = slam().allocate(sizes[i]);
+        if (!objects[i])
+        {
+            bOk = false;
+            continue;
+        }
+
+        bSizes = (slam().allocSize(objects[i]) >= sizes[i]) && bSizes;
+        bAligned = !(objects[i] & (sizeof(SlamAllocator::AllocHeader) - 1)) && bAligned;
+        bValid = slam().isPointerValid(objects[i]) && bValid;
+        stamp(objects[i], sizes[i], i);
+    }
+    for (size_t i = 0; bOk && i < nSizes; i++)
+    {
+        bOk = stamped(objects[i], sizes[i], i);
+        slam().free(objects[i]);
+    }
+    check("slam-allocate", bOk);
+    check("slam-alloc-size", bSizes);
+    check("slam-alignment", bAligned);
+    check("slam-pointer-valid", bValid);
+
+    size_t notHeap = 0;
+    check("slam-pointer-invalid", !slam().isPointerValid(reinterpret_cast<uintptr_t>(&notHeap)) &&
+                                  slam().isPointerValid(0));
+}
+
+static void testSlamDistinct()
+{
+    // Many live objects of one size, none of which may overlap.
+    const size_t nObjects = 10000, size = 48;
+    uintptr_t *pObjects = new uintptr_t[nObjects];
+    for (size_t i = 0; i < nObjects; i++)
+    {
+        pObjects[i] = slam().allocate(size);
+        stamp(pObjects[i], size, i);
+    }
+
+    bool bOk = true;
+    for (size_t i = 0; i < nObjects; i++)
+        bOk = stamped(pObjects[i], size, i) && bOk;
+    check("slam-distinct", bOk);
+
+    // Free every other one, then allocate them again: the freed objects
+    // should be handed back out, not overlap the live ones.
+    for (size_t i = 0; i < nObjects; i += 2)
+        slam().free(pObjects[i]);
+    for (size_t i = 0; i < nObjects; i += 2)
+    {
+        pObjects[i] = slam().allocate(size);
+        stamp(pObjects[i], size, i);
+    }
+    bOk = true;
+    for (size_t i = 0; i < nObjects; i++)
+    {
+        bOk = stamped(pObjects[i], size, i) && bOk;
+        slam().free(pObjects[i]);
+    }
+    check("slam-reuse-distinct", bOk);
+
+    delete [] pObjects;
+}
+
+static void testSlamRecycle()
+{
+    // Allocating and freeing in a loop has to keep reusing the same memory
+    // rather than growing the heap.
+    slam().free(slam().allocate(200));
+    uintptr_t end = heapEnd();
+    for (size_t i = 0; i < 100000; i++)
+        slam().free(slam().allocate(200));
+    check("slam-recycle", heapEnd() == end);
+
+    SlamCacheStatistics before, after;
+    size_t n = 0;
+    while ((1UL << n) < 256 + sizeof(SlamAllocator::AllocHeader) + sizeof(SlamAllocator::AllocFooter))
+        n++;
+    slam().getStatistics(n, before);
+    for (size_t i = 0; i < 1000; i++)
+        slam().free(slam().allocate(256));
+    slam().getStatistics(n, after);
+    check("slam-statistics", after.allocHits + after.allocMisses >= before.allocHits + before.allocMisses + 1000 &&
+                             after.freeHits + after.freeMisses >= before.freeHits + before.freeMisses + 1000);
+}
+
+static void testSlamThreads()
+{
+    // Objects allocated on one thread and freed on another.
+    uint64_t ns;
+    check("slam-cross-thread", crossThread(2, 100000, 64, ns));
+
+    // Threads allocating and freeing their own objects at once.
+    LocalArgs args[4];
+    void *pArgs[4];
+    for (size_t i = 0; i < 4; i++)
+    {
+        args[i].nRounds = 100;
+        args[i].nBatch = 500;
+        args[i].size = 32 << i;
+        args[i].bOk = true;
+        pArgs[i] = &args[i];
+    }
+    runThreads(4, local, pArgs);
+    bool bOk = true;
+    for (size_t i = 0; i < 4; i++)
+        bOk = args[i].bOk && bOk;
+    check("slam-threads", bOk);
+}
+
+static void testMemoryPool()
+{
+    const size_t nPages = 16;
+    MemoryPool pool("test-pool");
+    check("mempool-initialise", pool.initialise(nPages, 1024));
+
+    // Every buffer lies within the pool, and no two overlap.
+    const size_t nBuffers = (nPages * PhysicalMemoryManager::getPageSize()) / 1024;
+    uintptr_t buffers[nBuffers + 1];
+    bool bOk = true;
+    for (size_t i = 0; i < nBuffers; i++)
+    {
+        buffers[i] = pool.allocateNow();
+        if (!buffers[i])
+        {
+            bOk = false;
+            break;
+        }
+        stamp(buffers[i], 1024, i);
+    }
+    check("mempool-allocate-all", bOk);
+
+    uintptr_t base = 0, end = 0;
+    if (bOk)
+    {
+        base = buffers[0];
+        end = base;
+        for (size_t i = 0; i < nBuffers; i++)
+        {
+            if (buffers[i] < base)
+                base = buffers[i];
+            if (buffers[i] + 1024 > end)
+                end = buffers[i] + 1024;
+        }
+        for (size_t i = 0; i < nBuffers; i++)
+            bOk = stamped(buffers[i], 1024, i) && bOk;
+    }
+    check("mempool-distinct", bOk && end - base == nPages * PhysicalMemoryManager::getPageSize());
+
+    check("mempool-exhausted", !pool.allocateNow());
+
+    if (bOk)
+    {
+        pool.free(buffers[5]);
+        buffers[5] = pool.allocateNow();
+        check("mempool-reuse", buffers[5] && stamped(buffers[0], 1024, 0) && stamped(buffers[6], 1024, 6));
+    }
+    else
+        check("mempool-reuse", false);
+
+    // Buffers that aren't a power of two in size get rounded up to one, so
+    // none crosses a page boundary.
+    MemoryPool odd("odd-pool");
+    bOk = odd.initialise(4, 1600);
+    size_t nOdd = 0;
+    uintptr_t buffer;
+    while (bOk && (buffer = odd.allocateNow()))
+    {
+        bOk = ((buffer & (PhysicalMemoryManager::getPageSize() - 1)) + 1600) <= PhysicalMemoryManager::getPageSize();
+        nOdd++;
+    }
+    check("mempool-round-up", bOk && nOdd == 8);
+}
+
+/** Threads taking buffers from one pool, holding them for a while, and
+ *  giving them back; with more buffers wanted than there are, allocate()
+ *  has to wait for others' frees. */
+struct PoolArgs
+{
+    MemoryPool *pPool;
+    size_t nRounds;
+    size_t nHeld;
+    size_t bufferSize;
+    bool bOk;
+};
+
+static void *poolUser(void *p)
+{
+    PoolArgs *pArgs = static_cast<PoolArgs*>(p);
+    uintptr_t held[64];
+    for (size_t r = 0; r < pArgs->nRounds; r++)
+    {
+        for (size_t i = 0; i < pArgs->nHeld; i++)
+        {
+            held[i] = pArgs->pPool->allocate();
+            if (!held[i])
+            {
+                pArgs->bOk = false;
+                return 0;
+            }
+            stamp(held[i], pArgs->bufferSize, r + i);
+        }
+        for (size_t i = 0; i < pArgs->nHeld; i++)
+        {
+            if (!stamped(held[i], pArgs->bufferSize, r + i))
+                pArgs->bOk = false;
+            pArgs->pPool->free(held[i]);
+        }
+    }
+    return 0;
+}
+
+static bool poolThreads(MemoryPool &pool, size_t nThreads, size_t nRounds, size_t nHeld, size_t bufferSize)
+{
+    PoolArgs args[ALLOCATORS_MAX_THREADS];
+    void *pArgs[ALLOCATORS_MAX_THREADS];
+    for (size_t i = 0; i < nThreads; i++)
+    {
+        args[i].pPool = &pool;
+        args[i].nRounds = nRounds;
+        args[i].nHeld = nHeld;
+        args[i].bufferSize = bufferSize;
+        args[i].bOk = true;
+        pArgs[i] = &args[i];
+    }
+    runThreads(nThreads, poolUser, pArgs);
+
+    bool bOk = true;
+    for (size_t i = 0; i < nThreads; i++)
+        bOk = args[i].bOk && bOk;
+    return bOk;
+}
+
+static void testMemoryPoolThreads()
+{
+    // 64 buffers, 4 threads holding 16 each. Any fewer and the threads can
+    // each hold part of what they want and wait on the others forever.
+    MemoryPool pool("thread-pool");
+    pool.initialise(16, 1024);
+    check("mempool-threads", poolThreads(pool, 4, 200, 16, 1024));
+}
+
+void testAllocators()
+{
+    testSlamSizes();
+    testSlamDistinct();
+    testSlamRecycle();
+    testSlamThreads();
+    testMemoryPool();
+    testMemoryPoolThreads();
+}
+
+//
+// Benchmarks
+//
+
+static void benchSlamLocal(size_t nOps, size_t size)
+{
+    // The common case: an object freed straight after it's allocated.
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        slam().free(slam().allocate(size));
+    String s;
+    s.sprintf("slam-alloc-free-%d", static_cast<int>(size));
+    bench(s, nOps, nanoseconds() - start);
+
+    // The latency of each allocation and free, with a batch live at once so
+    // the magazines have to go back to the depot and the slabs.
+    const size_t nBatch = 1000;
+    size_t nSamples = (nOps / nBatch) * nBatch;
+    if (!nSamples)
+        return;
+    uint64_t *pAlloc = new uint64_t[nSamples];
+    uint64_t *pFree = new uint64_t[nSamples];
+    uintptr_t *pObjects = new uintptr_t[nBatch];
+    for (size_t r = 0; r < nSamples; r += nBatch)
+    {
+        for (size_t i = 0; i < nBatch; i++)
+        {
+            uint64_t t = nanoseconds();
+            pObjects[i] = slam().allocate(size);
+            pAlloc[r + i] = nanoseconds() - t;
+        }
+        for (size_t i = 0; i < nBatch; i++)
+        {
+            uint64_t t = nanoseconds();
+            slam().free(pObjects[i]);
+            pFree[r + i] = nanoseconds() - t;
+        }
+    }
+    s.sprintf("slam-alloc-%d", static_cast<int>(size));
+    latency(s, pAlloc, nSamples);
+    s.sprintf("slam-free-%d", static_cast<int>(size));
+    latency(s, pFree, nSamples);
+
+    delete [] pObjects;
+    delete [] pFree;
+    delete [] pAlloc;
+}
+
+static void benchSlamThreads(size_t nOps, size_t nThreads)
+{
+    String s;
+
+    // Each thread allocating and freeing its own objects.
+    LocalArgs args[ALLOCATORS_MAX_THREADS];
+    void *pArgs[ALLOCATORS_MAX_THREADS];
+    const size_t nBatch = 100;
+    size_t nRounds = nOps / nBatch ? nOps / nBatch : 1;
+    for (size_t i = 0; i < nThreads; i++)
+    {
+        args[i].nRounds = nRounds;
+        args[i].nBatch = nBatch;
+        args[i].size = 64;
+        args[i].bOk = true;
+        pArgs[i] = &args[i];
+    }
+    uint64_t start = nanoseconds();
+    runThreads(nThreads, local, pArgs);
+    s.sprintf("slam-threads-%d", static_cast<int>(nThreads));
+    bench(s, nThreads * nRounds * nBatch * 2, nanoseconds() - start);
+
+    // Objects passed from allocating threads to freeing threads. Frees go to
+    // the freeing thread's magazines, so this also shows how much the heap
+    // grows to keep the allocating threads supplied.
+    uintptr_t end = heapEnd();
+    uint64_t ns = 0;
+    crossThread(nThreads, nOps, 64, ns);
+    s.sprintf("slam-cross-thread-%d", static_cast<int>(nThreads));
+    bench(s, nThreads * nOps * 2, ns);
+    s.sprintf("slam-cross-thread-%d-heap-growth", static_cast<int>(nThreads));
+    memory(s, heapEnd() - end);
+}
+
+static void benchMemoryPool(size_t nOps, size_t nThreads)
+{
+    String s;
+
+    MemoryPool pool("bench-pool");
+    pool.initialise(64, 2048);
+
+    if (nThreads == 1)
+    {
+        uint64_t start = nanoseconds();
+        for (size_t i = 0; i < nOps; i++)
+            pool.free(pool.allocate());
+        bench("mempool-alloc-free", nOps, nanoseconds() - start);
+    }
+
+    // Threads holding a few buffers each; there are enough to go round.
+    const size_t nHeld = 8;
+    size_t nRounds = nOps / nHeld ? nOps / nHeld : 1;
+    uint64_t start = nanoseconds();
+    poolThreads(pool, nThreads, nRounds, nHeld, 64);
+    s.sprintf("mempool-threads-%d", static_cast<int>(nThreads));
+    bench(s, nThreads * nRounds * nHeld * 2, nanoseconds() - start);
+}
+
+void benchAllocators()
+{
+    size_t nOps = g_Options.nOps;
+
+    benchSlamLocal(nOps, 32);
+    benchSlamLocal(nOps, 256);
+    benchSlamLocal(nOps, 2000);
+
+    size_t nMaxThreads = g_Options.nThreads;
+    if (nMaxThreads > ALLOCATORS_MAX_THREADS)
+        nMaxThreads = ALLOCATORS_MAX_THREADS;
+    for (size_t nThreads = 1; nThreads <= nMaxThreads; nThreads <<= 1)
+    {
+        benchSlamThreads(nOps, nThreads);
+        benchMemoryPool(nOps, nThreads);
+    }
+}
@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <utilities/List.h>
+#include <utilities/Vector.h>
+#include <utilities/Tree.h>
+#include <utilities/RadixTree.h>
+#include <utilities/String.h>
+#include <utilities/ExtensibleBitmap.h>
+#include <utilities/RangeList.h>
+#include "Harness.h"
+
+/** Spreads the keys 1..n out over their range, so trees get balancing to do
+ *  rather than being fed in order. Needs n to be prime to 2654435761, which
+ *  only fails for multiples of that. */
+static size_t scatter(size_t i, size_t n)
+{
+    return (i * 2654435761UL) % n + 1;
+}
+
+//
+// Correctness
+//
+
+static void testList()
+{
+    List<void*> list;
+    for (size_t i = 1; i <= 4; i++)
+        list.pushBack(reinterpret_cast<void*>(i));
+    list.pushFront(reinterpret_cast<void*>(0));
+
+    size_t n = 0;
+    bool bOk = true;
+    for (List<void*>::Iterator it = list.begin(); it != list.end(); it++)
+        bOk = (*it == reinterpret_cast<void*>(n++)) && bOk;
+    check("list-order", bOk && n == 5 && list.count() == 5);
+
+    n = 5;
+    bOk = true;
+    for (List<void*>::ReverseIterator it = list.rbegin(); it != list.rend(); it++)
+        bOk = (*it == reinterpret_cast<void*>(--n)) && bOk;
+    check("list-reverse-order", bOk && !n);
+
+    // Take out 2, from the middle.
+    List<void*>::Iterator it = list.begin();
+    it++;
+    it++;
+    it = list.erase(it);
+    check("list-erase-middle", list.count() == 4 && *it == reinterpret_cast<void*>(3));
+
+    check("list-pop", list.popFront() == reinterpret_cast<void*>(0) &&
+                      list.popBack() == reinterpret_cast<void*>(4) &&
+                      list.popFront() == reinterpret_cast<void*>(1) &&
+                      list.popBack() == reinterpret_cast<void*>(3) &&
+                      !list.count() && list.begin() == list.end());
+
+    List<void*> copy;
+    for (size_t i = 0; i < 100; i++)
+        list.pushBack(reinterpret_cast<void*>(i));
+    copy = list;
+    list.clear();
+    n = 0;
+    bOk = true;
+    for (List<void*>::Iterator it2 = copy.begin(); it2 != copy.end(); it2++)
+        bOk = (*it2 == reinterpret_cast<void*>(n++)) && bOk;
+    check("list-copy", bOk && n == 100 && !list.count());
+}
+
+static void testVector()
+{
+    Vector<size_t> vector;
+    for (size_t i = 0; i < 1000; i++)
+        vector.pushBack(i);
+
+    bool bOk = true;
+    for (size_t i = 0; i < 1000; i++)
+        bOk = (vector[i] == i) && bOk;
+    check("vector-grow", bOk && vector.count() == 1000);
+
+    Vector<size_t> copy(vector);
+    bOk = copy.count() == 1000;
+    for (size_t i = 0; bOk && i < 1000; i++)
+        bOk = copy[i] == i;
+    check("vector-copy", bOk);
+
+    // Erase the first element; the rest move down.
+    Vector<size_t>::Iterator it = vector.begin();
+    it = vector.erase(it);
+    check("vector-erase", vector.count() == 999 && *it == 1 && vector[0] == 1 && vector[998] == 999);
+
+    bOk = true;
+    for (size_t i = 999; i > 1; i--)
+        bOk = (vector.popBack() == i) && bOk;
+    check("vector-pop", bOk && vector.count() == 1 && vector[0] == 1);
+
+    vector.clear();
+    check("vector-clear", !vector.count() && vector.begin() == vector.end());
+}
+
+static void testTree()
+{
+    const size_t n = 1009;
+    Tree<size_t, size_t> tree;
+    for (size_t i = 0; i < n; i++)
+        tree.insert(scatter(i, n), scatter(i, n) * 10);
+
+    bool bOk = tree.count() == n;
+    for (size_t k = 1; bOk && k <= n; k++)
+        bOk = tree.lookup(k) == k * 10;
+    check("tree-lookup", bOk);
+    check("tree-lookup-missing", !tree.lookup(0) && !tree.lookup(n + 1));
+
+    // Iteration visits every key once, in order.
+    size_t prev = 0, nVisited = 0;
+    bOk = true;
+    for (Tree<size_t, size_t>::Iterator it = tree.begin(); it != tree.end(); it++)
+    {
+        bOk = (it.key() > prev && it.value() == it.key() * 10) && bOk;
+        prev = it.key();
+        nVisited++;
+    }
+    check("tree-iterate-in-order", bOk && nVisited == n);
+
+    // Remove the odd keys.
+    for (size_t k = 1; k <= n; k += 2)
+        tree.remove(k);
+    bOk = tree.count() == n / 2;
+    for (size_t k = 1; bOk && k <= n; k++)
+        bOk = tree.lookup(k) == ((k & 1) ? 0 : k * 10);
+    check("tree-remove", bOk);
+
+    tree.clear();
+    check("tree-clear", !tree.count() && !tree.lookup(2) && tree.begin() == tree.end());
+}
+
+static void testRadixTree()
+{
+    static const char *keys[] = {"abc", "abd", "ab", "a", "abcdef", "b", "bcd", "x"};
+    static const size_t nKeys = sizeof(keys) / sizeof(keys[0]);
+
+    RadixTree<void*> tree;
+    for (size_t i = 0; i < nKeys; i++)
+        tree.insert(String(keys[i]), reinterpret_cast<void*>(i + 1));
+
+    bool bOk = tree.count() == nKeys;
+    for (size_t i = 0; bOk && i < nKeys; i++)
+        bOk = tree.lookup(String(keys[i])) == reinterpret_cast<void*>(i + 1);
+    check("radix-lookup", bOk);
+
+    // Prefixes and extensions of keys that were never inserted themselves.
+    check("radix-lookup-missing", !tree.lookup(String("abcd")) && !tree.lookup(String("bc")) &&
+                                  !tree.lookup(String("abcdefg")) && !tree.lookup(String("y")));
+
+    // Inserting an existing key replaces its value.
+    tree.insert(String("ab"), reinterpret_cast<void*>(100));
+    check("radix-replace", tree.count() == nKeys && tree.lookup(String("ab")) == reinterpret_cast<void*>(100));
+
+    size_t nVisited = 0;
+    for (RadixTree<void*>::Iterator it = tree.begin(); it != tree.end(); it++)
+        nVisited++;
+    check("radix-iterate", nVisited == nKeys);
+
+    // Removing a key that's a prefix of others leaves them be.
+    tree.remove(String("ab"));
+    tree.remove(String("b"));
+    check("radix-remove", tree.count() == nKeys - 2 && !tree.lookup(String("ab")) && !tree.lookup(String("b")) &&
+                          tree.lookup(String("abc")) == reinterpret_cast<void*>(1) &&
+                          tree.lookup(String("abcdef")) == reinterpret_cast<void*>(5) &&
+                          tree.lookup(String("bcd")) == reinterpret_cast<void*>(7));
+
+    RadixTree<void*> copy(tree);
+    tree.clear();
+    check("radix-copy", !tree.count() && copy.count() == nKeys - 2 &&
+                        copy.lookup(String("abd")) == reinterpret_cast<void*>(2));
+}
+
+static void testString()
+{
+    String s("  hello world   ");
+    s.strip();
+    check("string-strip", s == "hello world" && s.length() == 11);
+
+    String back = s.split(5);
+    check("string-split", s == "hello" && back == " world");
+
+    s += back;
+    s += "!";
+    check("string-append", s == "hello world!" && s.length() == 12);
+
+    s.sprintf("%d-%s", 42, "x");
+    check("string-sprintf", s == "42-x" && s.length() == 4);
+
+    String path("a/bb//ccc");
+    List<String*> tokens = path.tokenise('/');
+    bool bOk = tokens.count() == 3;
+    static const char *expected[] = {"a", "bb", "ccc"};
+    size_t n = 0;
+    for (List<String*>::Iterator it = tokens.begin(); bOk && it != tokens.end(); it++)
+        bOk = **it == expected[n++];
+    for (List<String*>::Iterator it = tokens.begin(); it != tokens.end(); it++)
+        delete *it;
+    check("string-tokenise", bOk);
+
+    String a("same"), b(a);
+    a = "changed";
+    check("string-copy", b == "same" && a == "changed");
+}
+
+static void testBitmap()
+{
+    ExtensibleBitmap bitmap;
+
+    // Straddle the statically allocated word and the dynamic map.
+    static const size_t bits[] = {0, 1, 31, 32, 63, 64, 65, 1000, 100000};
+    static const size_t nBits = sizeof(bits) / sizeof(bits[0]);
+    for (size_t i = 0; i < nBits; i++)
+        bitmap.set(bits[i]);
+
+    bool bOk = true;
+    for (size_t i = 0; i < nBits; i++)
+        bOk = bitmap.test(bits[i]) && bOk;
+    check("bitmap-set", bOk);
+
+    bOk = !bitmap.test(2) && !bitmap.test(62) && !bitmap.test(999) && !bitmap.test(100001) && !bitmap.test(1000000);
+    check("bitmap-unset", bOk);
+
+    check("bitmap-first-clear", bitmap.getFirstClear() == 2);
+    check("bitmap-first-set", bitmap.getFirstSet() == 0);
+
+    bitmap.clear(0);
+    bitmap.clear(1000);
+    bitmap.clear(100000);
+    check("bitmap-clear", !bitmap.test(0) && !bitmap.test(1000) && !bitmap.test(100000) &&
+                          bitmap.test(1) && bitmap.test(65) && bitmap.getFirstClear() == 0);
+
+    ExtensibleBitmap copy(bitmap);
+    bitmap.clear(65);
+    check("bitmap-copy", copy.test(65) && copy.test(64) && !copy.test(0) && !bitmap.test(65));
+
+    // Every bit of the static word is its own, not just the low half.
+    ExtensibleBitmap word;
+    for (size_t i = 0; i < 40; i++)
+        word.set(word.getFirstClear());
+    bOk = word.test(31) && word.test(32) && word.test(39) && !word.test(40) && word.getFirstClear() == 40;
+    word.clear(35);
+    bOk = bOk && word.test(3) && !word.test(35) && word.getFirstClear() == 35;
+    check("bitmap-static-word", bOk);
+}
+
+static void testRangeList()
+{
+    RangeList<uintptr_t> list(0x1000, 0x10000);
+
+    uintptr_t a = 0, b = 0, c = 0, dummy = 0;
+    bool bOk = list.allocate(0x4000, a) && list.allocate(0x4000, b) && list.allocate(0x8000, c);
+    check("rangelist-allocate", bOk && a == 0x1000 && b == 0x5000 && c == 0x9000 && !list.size());
+    check("rangelist-exhausted", !list.allocate(0x1000, dummy));
+
+    // Freeing out of order merges back into one range.
+    list.free(c, 0x8000);
+    list.free(a, 0x4000);
+    list.free(b, 0x4000);
+    check("rangelist-merge", list.size() == 1 && list.getRange(0).address == 0x1000 &&
+                             list.getRange(0).length == 0x10000);
+
+    bOk = list.allocateSpecific(0x3000, 0x1000);
+    check("rangelist-allocate-specific", bOk && list.size() == 2 && !list.allocateSpecific(0x3000, 0x1000));
+
+    list.free(0x3000, 0x1000);
+    check("rangelist-free-specific", list.size() == 1 && list.getRange(0).length == 0x10000);
+}
+
+void testContainers()
+{
+    testList();
+    testVector();
+    testTree();
+    testRadixTree();
+    testString();
+    testBitmap();
+    testRangeList();
+}
+
+//
+// Benchmarks
+//
+
+static void benchList(size_t nOps)
+{
+    List<void*> list;
+
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        list.pushBack(reinterpret_cast<void*>(i));
+    bench("list-push", nOps, nanoseconds() - start);
+
+    volatile size_t sum = 0;
+    start = nanoseconds();
+    for (List<void*>::Iterator it = list.begin(); it != list.end(); it++)
+        sum += reinterpret_cast<size_t>(*it);
+    bench("list-iterate", nOps, nanoseconds() - start);
+
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        list.popFront();
+    bench("list-pop", nOps, nanoseconds() - start);
+}
+
+static void benchVector(size_t nOps)
+{
+    Vector<size_t> vector;
+
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        vector.pushBack(i);
+    bench("vector-push", nOps, nanoseconds() - start);
+
+    volatile size_t sum = 0;
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        sum += vector[i];
+    bench("vector-index", nOps, nanoseconds() - start);
+
+    start = nanoseconds();
+    for (Vector<size_t>::Iterator it = vector.begin(); it != vector.end(); it++)
+        sum += *it;
+    bench("vector-iterate", nOps, nanoseconds() - start);
+
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        vector.popBack();
+    bench("vector-pop", nOps, nanoseconds() - start);
+}
+
+static void benchTree(size_t nOps)
+{
+    Tree<size_t, size_t> tree;
+
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        tree.insert(scatter(i, nOps), i + 1);
+    bench("tree-insert", nOps, nanoseconds() - start);
+
+    volatile size_t sum = 0;
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        sum += tree.lookup(scatter(i, nOps));
+    bench("tree-lookup", nOps, nanoseconds() - start);
+
+    start = nanoseconds();
+    for (Tree<size_t, size_t>::Iterator it = tree.begin(); it != tree.end(); it++)
+        sum += it.value();
+    bench("tree-iterate", nOps, nanoseconds() - start);
+
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        tree.remove(scatter(i, nOps));
+    bench("tree-remove", nOps, nanoseconds() - start);
+}
+
+static void benchRadixTree(size_t nOps)
+{
+    RadixTree<void*> tree;
+
+    // Path-like keys sharing prefixes, built up front so only the tree is timed.
+    String *pKeys = new String[nOps];
+    for (size_t i = 0; i < nOps; i++)
+        pKeys[i].sprintf("dir%d/file%d", static_cast<int>(i % 97), static_cast<int>(i));
+
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        tree.insert(pKeys[i], reinterpret_cast<void*>(i + 1));
+    bench("radix-insert", nOps, nanoseconds() - start);
+
+    volatile size_t sum = 0;
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        sum += reinterpret_cast<size_t>(tree.lookup(pKeys[i]));
+    bench("radix-lookup", nOps, nanoseconds() - start);
+
+    start = nanoseconds();
+    for (RadixTree<void*>::Iterator it = tree.begin(); it != tree.end(); it++)
+        sum += reinterpret_cast<size_t>(*it);
+    bench("radix-iterate", nOps, nanoseconds() - start);
+
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        tree.remove(pKeys[i]);
+    bench("radix-remove", nOps, nanoseconds() - start);
+
+    delete [] pKeys;
+}
+
+static void benchString(size_t nOps)
+{
+    String s;
+
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        s.sprintf("string %d", static_cast<int>(i));
+    bench("string-sprintf", nOps, nanoseconds() - start);
+
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+    {
+        String copy(s);
+        copy += "/suffix";
+    }
+    bench("string-copy-append", nOps, nanoseconds() - start);
+
+    String other(s);
+    volatile size_t nEqual = 0;
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        nEqual += (s == other);
+    bench("string-compare", nOps, nanoseconds() - start);
+}
+
+static void benchBitmap(size_t nOps)
+{
+    ExtensibleBitmap bitmap;
+
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        bitmap.set(i);
+    bench("bitmap-set", nOps, nanoseconds() - start);
+
+    volatile size_t nSet = 0;
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        nSet += bitmap.test(i);
+    bench("bitmap-test", nOps, nanoseconds() - start);
+
+    // The pattern MemoryPool uses: take the first clear bit, then give it back.
+    size_t nFirstClears = nOps / 100 ? nOps / 100 : 1;
+    start = nanoseconds();
+    for (size_t i = 0; i < nFirstClears; i++)
+    {
+        size_t n = (i * 7919) % nOps;
+        bitmap.clear(n);
+        bitmap.set(bitmap.getFirstClear());
+    }
+    bench("bitmap-first-clear", nFirstClears, nanoseconds() - start);
+
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        bitmap.clear(i);
+    bench("bitmap-clear", nOps, nanoseconds() - start);
+}
+
+static void benchRangeList(size_t nOps)
+{
+    RangeList<uintptr_t> list(0, nOps * 0x1000);
+    uintptr_t *pAddresses = new uintptr_t[nOps];
+
+    uint64_t start = nanoseconds();
+    for (size_t i = 0; i < nOps; i++)
+        list.allocate(0x1000, pAddresses[i]);
+    bench("rangelist-allocate", nOps, nanoseconds() - start);
+
+    // Give every other range back first, so the list fragments before the
+    // rest merge it back together.
+    start = nanoseconds();
+    for (size_t i = 0; i < nOps; i += 2)
+        list.free(pAddresses[i], 0x1000);
+    for (size_t i = 1; i < nOps; i += 2)
+        list.free(pAddresses[i], 0x1000);
+    bench("rangelist-free", nOps, nanoseconds() - start);
+
+    delete [] pAddresses;
+}
+
+void benchContainers()
+{
+    size_t nOps = g_Options.nOps;
+    benchList(nOps);
+    benchVector(nOps);
+    benchTree(nOps);
+    benchRadixTree(nOps);
+    benchString(nOps);
+    benchBitmap(nOps);
+
+    // Fragmenting a range list costs a list walk per free, so it gets
+    // fewer operations to stay in step with the rest.
+    benchRangeList(nOps / 10 ? nOps / 10 : 1);
+}
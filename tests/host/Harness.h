@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef HOST_HARNESS_H
+#define HOST_HARNESS_H
+
+#include <processor/types.h>
+
+/** @addtogroup hosttests
+ * @{ */
+
+/** Operations per benchmark when none are given on the command line. */
+#define HARNESS_DEFAULT_OPS     100000
+/** Most threads the threaded benchmarks go up to by default. */
+#define HARNESS_DEFAULT_THREADS 4
+
+/** How a run of the harness was asked to go, from the command line. */
+struct HarnessOptions
+{
+    /// Operations each benchmark performs.
+    size_t nOps;
+    /// Most threads to run the threaded benchmarks with; they run with
+    /// each power of two up to it.
+    size_t nThreads;
+};
+
+extern HarnessOptions g_Options;
+
+/** Current time from the host's monotonic clock, in nanoseconds. */
+uint64_t nanoseconds();
+
+/** Reports a correctness check as "test <name> ok" or "test <name> FAIL". */
+void check(const char *name, bool bOk);
+
+/** Reports a throughput measurement as
+ *  "bench <name> ops=<n> ns=<total> ns-per-op=<ns> ops-per-sec=<n>". */
+void bench(const char *name, size_t nOps, uint64_t ns);
+
+/** Reports a latency distribution, given a sample in nanoseconds of each
+ *  operation, as "latency <name> samples=<n> min=<ns> p50=<ns> p99=<ns>
+ *  max=<ns>". Sorts the samples. */
+void latency(const char *name, uint64_t *pSamples, size_t nSamples);
+
+/** Reports an amount of memory used as "memory <name> bytes=<n>". */
+void memory(const char *name, size_t nBytes);
+
+/** The suites, in Containers.cc and Allocators.cc. */
+void testContainers();
+void benchContainers();
+void testAllocators();
+void benchAllocators();
+
+/** @} */
+
+#endif
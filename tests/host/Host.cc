@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <Log.h>
+#include <panic.h>
+#include <utilities/assert.h>
+#include <processor/Processor.h>
+#include <processor/VirtualAddressSpace.h>
+#include <processor/PhysicalMemoryManager.h>
+#include <processor/MemoryRegion.h>
+#include <process/Semaphore.h>
+#include <machine/Machine.h>
+
+/** How much address space the kernel heap gets on the host. Pages are only
+ *  backed once the heap grows into them. */
+#define HOST_HEAP_SIZE (1024ULL * 1024 * 1024)
+
+//
+// Log
+//
+
+static bool g_bVerbose = false;
+static volatile size_t g_nErrors = 0;
+
+HostLog::HostLog(Severity severity)
+    : m_Severity(severity), m_Base(Hex), m_Length(0)
+{
+    m_Buffer[0] = 0;
+}
+
+HostLog::~HostLog()
+{
+    static const char *severities[] = {"debug", "notice", "warning", "error", "fatal"};
+
+    if (m_Severity >= Error)
+        __sync_add_and_fetch(&g_nErrors, 1);
+    if (m_Severity >= Warning || g_bVerbose)
+        fprintf(stderr, "%s: %s\n", severities[m_Severity], m_Buffer);
+    if (m_Severity == Fatal)
+        abort();
+}
+
+HostLog &HostLog::operator << (const char *str)
+{
+    append(str ? str : "(null)");
+    return *this;
+}
+
+HostLog &HostLog::operator << (char c)
+{
+    char str[2] = {c, 0};
+    append(str);
+    return *this;
+}
+
+HostLog &HostLog::operator << (bool b)
+{
+    append(b ? "true" : "false");
+    return *this;
+}
+
+HostLog &HostLog::operator << (int n)
+{
+    return *this << static_cast<long long>(n);
+}
+
+HostLog &HostLog::operator << (unsigned int n)
+{
+    return *this << static_cast<unsigned long long>(n);
+}
+
+HostLog &HostLog::operator << (long n)
+{
+    return *this << static_cast<long long>(n);
+}
+
+HostLog &HostLog::operator << (unsigned long n)
+{
+    return *this << static_cast<unsigned long long>(n);
+}
+
+HostLog &HostLog::operator << (long long n)
+{
+    // Only decimal numbers are shown signed, as in the kernel log.
+    if (n < 0 && m_Base == Dec)
+        number(static_cast<unsigned long long>(-n), true);
+    else
+        number(static_cast<unsigned long long>(n), false);
+    return *this;
+}
+
+HostLog &HostLog::operator << (unsigned long long n)
+{
+    number(n, false);
+    return *this;
+}
+
+HostLog &HostLog::operator << (const void *p)
+{
+    char str[24];
+    snprintf(str, sizeof str, "%p", p);
+    append(str);
+    return *this;
+}
+
+HostLog &HostLog::operator << (NumberType type)
+{
+    m_Base = type;
+    return *this;
+}
+
+void HostLog::setVerbose(bool bVerbose)
+{
+    g_bVerbose = bVerbose;
+}
+
+size_t HostLog::errors()
+{
+    return g_nErrors;
+}
+
+void HostLog::append(const char *str)
+{
+    while (*str && m_Length < sizeof m_Buffer - 1)
+        m_Buffer[m_Length++] = *str++;
+    m_Buffer[m_Length] = 0;
+}
+
+void HostLog::number(unsigned long long n, bool bNegative)
+{
+    char str[32];
+    if (m_Base == Dec)
+        snprintf(str, sizeof str, "%s%llu", bNegative ? "-" : "", n);
+    else if (m_Base == Oct)
+        snprintf(str, sizeof str, "0%llo", n);
+    else
+        snprintf(str, sizeof str, "0x%llx", n);
+    append(str);
+}
+
+//
+// Kernel support functions
+//
+
+void panic(const char *msg)
+{
+    fprintf(stderr, "panic: %s\n", msg);
+    abort();
+}
+
+void _assert(bool b, const char *file, int line, const char *func)
+{
+    if (b)
+        return;
+
+    fprintf(stderr, "assertion failed in %s, at %s:%d\n", func, file, line);
+    abort();
+}
+
+//
+// Processor
+//
+
+size_t Processor::m_Initialised = 0;
+ProcessorInformation Processor::m_Information;
+
+static volatile size_t g_nProcessors = 0;
+static __thread size_t t_ProcessorId = ~0UL;
+static __thread bool t_bInterrupts = true;
+
+ProcessorId Processor::id()
+{
+    if (t_ProcessorId == ~0UL)
+    {
+        t_ProcessorId = __sync_fetch_and_add(&g_nProcessors, 1);
+        if (t_ProcessorId >= HOST_MAX_PROCESSORS)
+            FATAL("Processor: more than " << Dec << HOST_MAX_PROCESSORS << " threads have used the kernel code");
+    }
+    return t_ProcessorId;
+}
+
+ProcessorInformation &Processor::information()
+{
+    return m_Information;
+}
+
+bool Processor::getInterrupts()
+{
+    return t_bInterrupts;
+}
+
+void Processor::setInterrupts(bool bEnable)
+{
+    t_bInterrupts = bEnable;
+}
+
+void Processor::breakpoint()
+{
+    abort();
+}
+
+Machine Machine::m_Instance;
+
+//
+// Physical memory
+//
+
+/** The physical memory manager for the host. It's named after the x86 one
+ *  because MemoryRegion lets that class fill in its members.
+ *
+ *  Pages are just numbers, as the heap is already backed by host memory:
+ *  the kernel heap code only needs them to be non-zero. Regions are host
+ *  mappings of their own. */
+class X86CommonPhysicalMemoryManager : public PhysicalMemoryManager
+{
+  public:
+    X86CommonPhysicalMemoryManager()
+        : PhysicalMemoryManager(), m_nNextPage(1)
+    {
+    }
+
+    virtual physical_uintptr_t allocatePage()
+    {
+        return __sync_fetch_and_add(&m_nNextPage, 1) * getPageSize();
+    }
+
+    virtual void freePage(physical_uintptr_t page)
+    {
+    }
+
+    virtual bool allocateRegion(MemoryRegion &Region,
+                                size_t cPages,
+                                size_t pageConstraints,
+                                size_t Flags,
+                                physical_uintptr_t start = -1)
+    {
+        size_t size = cPages * getPageSize();
+        void *pMemory = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pMemory == MAP_FAILED)
+            return false;
+
+        Region.m_VirtualAddress = pMemory;
+        Region.m_PhysicalAddress = 0;
+        Region.m_Size = size;
+        return true;
+    }
+
+  private:
+    virtual void freePageUnlocked(physical_uintptr_t page)
+    {
+    }
+
+    virtual void unmapRegion(MemoryRegion *pRegion)
+    {
+        if (!pRegion->m_VirtualAddress)
+            return;
+
+        munmap(pRegion->m_VirtualAddress, pRegion->m_Size);
+        pRegion->m_VirtualAddress = 0;
+        pRegion->m_Size = 0;
+    }
+
+    volatile physical_uintptr_t m_nNextPage;
+};
+
+PhysicalMemoryManager &PhysicalMemoryManager::instance()
+{
+    static X86CommonPhysicalMemoryManager instance;
+    return instance;
+}
+
+//
+// Virtual memory
+//
+
+/** The kernel address space on the host: one reserved host mapping that the
+ *  kernel heap grows into. Mapping a page is a no-op because the whole
+ *  reservation is already accessible. */
+class HostVirtualAddressSpace : public VirtualAddressSpace
+{
+  public:
+    HostVirtualAddressSpace()
+        : VirtualAddressSpace(reserve()), m_HeapLimit(0)
+    {
+        m_HeapLimit = reinterpret_cast<uintptr_t>(m_Heap) + HOST_HEAP_SIZE;
+    }
+
+    virtual bool isAddressValid(void *virtualAddress)
+    {
+        return true;
+    }
+    virtual bool isMapped(void *virtualAddress)
+    {
+        return memIsInHeap(virtualAddress);
+    }
+
+    virtual bool map(physical_uintptr_t physicalAddress, void *virtualAddress, size_t flags)
+    {
+        return reinterpret_cast<uintptr_t>(virtualAddress) < m_HeapLimit;
+    }
+    virtual void getMapping(void *virtualAddress, physical_uintptr_t &physicalAddress, size_t &flags)
+    {
+        physicalAddress = 0;
+        flags = KernelMode | Write;
+    }
+    virtual void setFlags(void *virtualAddress, size_t newFlags)
+    {
+    }
+    virtual void unmap(void *virtualAddress)
+    {
+    }
+
+    virtual void *allocateStack()
+    {
+        return 0;
+    }
+    virtual void freeStack(void *pStack)
+    {
+    }
+
+    virtual VirtualAddressSpace *clone(bool copyOnWrite = true)
+    {
+        return 0;
+    }
+    virtual void revertToKernelAddressSpace()
+    {
+    }
+
+    virtual bool memIsInHeap(void *pMem)
+    {
+        return pMem >= m_Heap && pMem < m_HeapEnd;
+    }
+    virtual void *getEndOfHeap()
+    {
+        return m_HeapEnd;
+    }
+
+    virtual uintptr_t getKernelStart() const
+    {
+        return 0;
+    }
+    virtual uintptr_t getUserStart() const
+    {
+        return 0;
+    }
+    virtual uintptr_t getUserReservedStart() const
+    {
+        return 0;
+    }
+    virtual uintptr_t getDynamicLinkerAddress() const
+    {
+        return 0;
+    }
+
+  private:
+    static void *reserve()
+    {
+        void *pHeap = mmap(0, HOST_HEAP_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (pHeap == MAP_FAILED)
+            panic("can't reserve address space for the kernel heap");
+        return pHeap;
+    }
+
+    uintptr_t m_HeapLimit;
+};
+
+VirtualAddressSpace &VirtualAddressSpace::getKernelAddressSpace()
+{
+    static HostVirtualAddressSpace instance;
+    return instance;
+}
+
+//
+// Semaphore
+//
+
+Semaphore::Semaphore(size_t nInitialValue, bool bHandoff)
+    : m_Counter(nInitialValue)
+{
+}
+
+Semaphore::~Semaphore()
+{
+}
+
+bool Semaphore::acquire(size_t n, size_t timeoutSecs, size_t timeoutUsecs)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long long timeout = timeoutSecs * 1000000ULL + timeoutUsecs;
+
+    while (!tryAcquire(n))
+    {
+        if (timeout)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            unsigned long long elapsed = (now.tv_sec - start.tv_sec) * 1000000ULL +
+                                         (now.tv_nsec - start.tv_nsec) / 1000;
+            if (elapsed >= timeout)
+                return false;
+        }
+        sched_yield();
+    }
+    return true;
+}
+
+bool Semaphore::tryAcquire(size_t n)
+{
+    ssize_t value = m_Counter;
+    while (value >= static_cast<ssize_t>(n))
+    {
+        if (__sync_bool_compare_and_swap(&m_Counter, value, value - n))
+            return true;
+        value = m_Counter;
+    }
+    return false;
+}
+
+void Semaphore::release(size_t n)
+{
+    __sync_add_and_fetch(&m_Counter, n);
+}
+
+ssize_t Semaphore::getValue()
+{
+    return m_Counter;
+}
@@ -13,5 +13,15 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
-#include <process/RoundRobinCoreAllocator.h>
+#ifndef HOST_BACKTRACE_H
+#define HOST_BACKTRACE_H
 
+/** @addtogroup hosttests
+ * @{ */
+
+// The slab allocator only takes backtraces with VIGILANT_OVERRUN_CHECK, which
+// the harness never builds with.
+
+/** @} */
+
+#endif
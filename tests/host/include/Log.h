@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef HOST_LOG_H
+#define HOST_LOG_H
+
+/** @addtogroup hosttests
+ * @{ */
+
+#include <processor/types.h>
+
+/** Radix for Log's integer output */
+enum NumberType
+{
+  /** Hexadecimal */
+  Hex,
+  /** Decimal */
+  Dec,
+  /** Octal */
+  Oct
+};
+
+/** Stands in for the kernel log on the host. Each entry is built up with
+ *  operator << like a kernel log entry and written to stderr when it goes
+ *  out of scope. Notices are dropped unless verbose output was asked for,
+ *  and a fatal entry aborts the harness. */
+class HostLog
+{
+  public:
+    enum Severity
+    {
+      Debug,
+      Notice,
+      Warning,
+      Error,
+      Fatal
+    };
+
+    HostLog(Severity severity);
+    ~HostLog();
+
+    HostLog &operator << (const char *str);
+    HostLog &operator << (char c);
+    HostLog &operator << (bool b);
+    HostLog &operator << (int n);
+    HostLog &operator << (unsigned int n);
+    HostLog &operator << (long n);
+    HostLog &operator << (unsigned long n);
+    HostLog &operator << (long long n);
+    HostLog &operator << (unsigned long long n);
+    HostLog &operator << (const void *p);
+    HostLog &operator << (NumberType type);
+
+    /** Print notices as well as warnings and errors? */
+    static void setVerbose(bool bVerbose);
+    /** Number of errors logged so far. Code under test logs an error when
+     *  it finds its own data structures corrupted, so any at all is a
+     *  failure. */
+    static size_t errors();
+
+  private:
+    HostLog(const HostLog &);
+    HostLog &operator = (const HostLog &);
+
+    void append(const char *str);
+    void number(unsigned long long n, bool bNegative);
+
+    Severity m_Severity;
+    NumberType m_Base;
+    char m_Buffer[256];
+    size_t m_Length;
+};
+
+#define LOG_ENTRY(severity, text) \
+  do \
+  { \
+    HostLog _host_log(severity); \
+    _host_log << text; \
+  } \
+  while (0)
+
+#define DEBUG_LOG(text)
+#define DEBUG_LOG_NOLOCK(text)
+
+#define NOTICE(text) LOG_ENTRY(HostLog::Notice, text)
+#define NOTICE_NOLOCK(text) LOG_ENTRY(HostLog::Notice, text)
+#define WARNING(text) LOG_ENTRY(HostLog::Warning, text)
+#define WARNING_NOLOCK(text) LOG_ENTRY(HostLog::Warning, text)
+#define ERROR(text) LOG_ENTRY(HostLog::Error, text)
+#define ERROR_NOLOCK(text) LOG_ENTRY(HostLog::Error, text)
+#define FATAL(text) LOG_ENTRY(HostLog::Fatal, text)
+#define FATAL_NOLOCK(text) LOG_ENTRY(HostLog::Fatal, text)
+
+/** @} */
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef HOST_MACHINE_H
+#define HOST_MACHINE_H
+
+/** @addtogroup hosttests
+ * @{ */
+
+/** Stands in for the kernel's Machine on the host. Only whether it's been
+ *  initialised is ever asked for; on the host there's no machine to set up. */
+class Machine
+{
+  public:
+    static Machine &instance()
+    {
+      return m_Instance;
+    }
+
+    bool isInitialised()
+    {
+      return false;
+    }
+
+  private:
+    static Machine m_Instance;
+};
+
+/** @} */
+
+#endif
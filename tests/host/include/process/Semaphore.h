@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef HOST_SEMAPHORE_H
+#define HOST_SEMAPHORE_H
+
+#include <processor/types.h>
+#include <Spinlock.h>
+
+/** @addtogroup hosttests
+ * @{ */
+
+/** Stands in for the kernel's Semaphore on the host, with the same
+ *  interface. There's no scheduler to sleep on, so waiting threads yield
+ *  until the count is high enough. */
+class Semaphore
+{
+  public:
+    Semaphore(size_t nInitialValue, bool bHandoff = false);
+    ~Semaphore();
+
+    /** Attempts to acquire n items, waiting at most the given time (or
+     *  forever if it's zero). */
+    bool acquire(size_t n = 1, size_t timeoutSecs = 0, size_t timeoutUsecs = 0);
+
+    /** Attempts to acquire n items without waiting. */
+    bool tryAcquire(size_t n = 1);
+
+    /** Releases n items. */
+    void release(size_t n = 1);
+
+    /** Gets the current count. */
+    ssize_t getValue();
+
+  private:
+    Semaphore(const Semaphore &);
+    Semaphore &operator = (const Semaphore &);
+
+    volatile ssize_t m_Counter;
+};
+
+/** @} */
+
+#endif
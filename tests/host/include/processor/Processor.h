@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#ifndef HOST_PROCESSOR_H
+#define HOST_PROCESSOR_H
+
+#include <processor/types.h>
+#include <processor/VirtualAddressSpace.h>
+
+/** @addtogroup hosttests
+ * @{ */
+
+/** The most host threads that can stand in for processors, which is the
+ *  most processors the slab allocator keeps per-CPU state for. */
+#define HOST_MAX_PROCESSORS 255
+
+typedef size_t ProcessorId;
+
+/** Per-processor information; on the host every thread sees the one kernel
+ *  address space. */
+class ProcessorInformation
+{
+  public:
+    inline VirtualAddressSpace &getVirtualAddressSpace()
+    {
+      return VirtualAddressSpace::getKernelAddressSpace();
+    }
+};
+
+/** Stands in for the kernel's Processor on the host. Every host thread is a
+ *  processor of its own: it gets the next free processor ID the first time it
+ *  asks, and has its own interrupt flag. A thread with "interrupts disabled"
+ *  can't be preempted by code running on the same processor, as no other
+ *  thread ever has its ID, so per-CPU data is as safe as in the kernel. */
+class Processor
+{
+  public:
+    /** Set to 2 once the kernel is fully up; the harness leaves it at 0 so
+     *  that the debugging paths that backtrace stay off. */
+    static size_t m_Initialised;
+
+    /** The calling thread's processor ID. */
+    static ProcessorId id();
+
+    static ProcessorInformation &information();
+
+    static bool getInterrupts();
+    static void setInterrupts(bool bEnable);
+
+    static void breakpoint();
+
+  private:
+    static ProcessorInformation m_Information;
+};
+
+/** @} */
+
+#endif
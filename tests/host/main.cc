@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2008 James Molloy, Jörg Pfähler, Matthew Iselin
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+// kernel-tests: checks and times the kernel's containers and allocators on
+// the build host.
+//
+//   kernel-tests [-v] [-n operations] [-t threads] [test|bench|all]
+//
+// The kernel sources are compiled unchanged, against the small host versions
+// of Log, Processor, Semaphore and the memory managers in include/ and
+// Host.cc. Every result is printed as one line starting with "test", "bench",
+// "latency" or "memory" and made of name=value pairs, so that runs before and after a
+// change can be compared by a script. The last line sums up the checks; the
+// exit status is non-zero if any failed or the code under test logged an
+// error.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <Log.h>
+#include "Harness.h"
+
+HarnessOptions g_Options = {HARNESS_DEFAULT_OPS, HARNESS_DEFAULT_THREADS};
+
+static size_t g_nChecks = 0;
+static size_t g_nFailed = 0;
+
+uint64_t nanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+void check(const char *name, bool bOk)
+{
+    g_nChecks++;
+    if (!bOk)
+        g_nFailed++;
+    printf("test %s %s\n", name, bOk ? "ok" : "FAIL");
+}
+
+void bench(const char *name, size_t nOps, uint64_t ns)
+{
+    if (!ns)
+        ns = 1;
+    printf("bench %s ops=%lu ns=%llu ns-per-op=%.1f ops-per-sec=%llu\n",
+           name, static_cast<unsigned long>(nOps), static_cast<unsigned long long>(ns),
+           static_cast<double>(ns) / (nOps ? nOps : 1),
+           static_cast<unsigned long long>(nOps * 1000000000ULL / ns));
+}
+
+static int compareSamples(const void *a, const void *b)
+{
+    uint64_t x = *static_cast<const uint64_t*>(a);
+    uint64_t y = *static_cast<const uint64_t*>(b);
+    return (x > y) - (x < y);
+}
+
+void latency(const char *name, uint64_t *pSamples, size_t nSamples)
+{
+    if (!nSamples)
+        return;
+
+    qsort(pSamples, nSamples, sizeof(uint64_t), compareSamples);
+    printf("latency %s samples=%lu min=%llu p50=%llu p99=%llu max=%llu\n",
+           name, static_cast<unsigned long>(nSamples),
+           static_cast<unsigned long long>(pSamples[0]),
+           static_cast<unsigned long long>(pSamples[nSamples / 2]),
+           static_cast<unsigned long long>(pSamples[(nSamples * 99) / 100]),
+           static_cast<unsigned long long>(pSamples[nSamples - 1]));
+}
+
+void memory(const char *name, size_t nBytes)
+{
+    printf("memory %s bytes=%lu\n", name, static_cast<unsigned long>(nBytes));
+}
+
+static int usage(const char *name)
+{
+    printf("usage: %s [-v] [-n operations] [-t threads] [test|bench|all]\n", name);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    bool bTest = true, bBench = true;
+
+    // A line at a time, so results aren't lost if a check aborts.
+    setvbuf(stdout, 0, _IOLBF, 0);
+
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "-v"))
+            HostLog::setVerbose(true);
+        else if ((!strcmp(arg, "-n") || !strcmp(arg, "-t")) && i + 1 < argc)
+        {
+            long n = atol(argv[++i]);
+            if (n <= 0)
+                return usage(argv[0]);
+            if (arg[1] == 'n')
+                g_Options.nOps = n;
+            else
+                g_Options.nThreads = n;
+        }
+        else if (!strcmp(arg, "test"))
+            bBench = false;
+        else if (!strcmp(arg, "bench"))
+            bTest = false;
+        else if (strcmp(arg, "all"))
+            return usage(argv[0]);
+    }
+
+    if (bTest)
+    {
+        testContainers();
+        testAllocators();
+    }
+    if (bBench)
+    {
+        benchContainers();
+        benchAllocators();
+    }
+
+    size_t nErrors = HostLog::errors();
+    printf("summary checks=%lu failed=%lu errors=%lu\n", static_cast<unsigned long>(g_nChecks),
+           static_cast<unsigned long>(g_nFailed), static_cast<unsigned long>(nErrors));
+    return (g_nFailed || nErrors) ? 1 : 0;
+}